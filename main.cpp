@@ -2,10 +2,48 @@
 #define SDL_MAIN_HANDLED
 #include "Engine.h"
 
-int main()
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+
+int main(int argc, char* argv[])
 {
 	UEngine Engine;
 
+	if (argc > 1 && strcmp(argv[1], "--cook") == 0)
+	{
+		Engine.Cook();
+
+		return 0;
+	}
+
+	//--headless [frames] renders offscreen, for benchmarks on machines without a display
+	if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+	{
+		Engine.headless = true;
+
+		if (argc > 2)
+		{
+			//parsed signed so a leading minus is rejected instead of wrapping
+			char* end = nullptr;
+
+			errno = 0;
+
+			long long frames = strtoll(argv[2], &end, 10);
+
+			if (end == argv[2] || *end != '\0' || errno == ERANGE || !UEngine::IsValidHeadlessFrameCount(frames))
+			{
+				std::cout << "Usage: " << argv[0] << " --headless [frames], frames must be between 1 and " << UINT32_MAX << std::endl;
+
+				return 1;
+			}
+
+			Engine.headlessFrames = static_cast<uint32_t>(frames);
+		}
+	}
+
 	Engine.Run();
 
 	return 0;
@@ -5,7 +5,7 @@ layout(location = 0) out vec4 outColor;
 
 #define NUM_CASCADES 3
 
-layout(binding = 0) uniform sampler2D texSampler[NUM_CASCADES];
+layout(binding = 0) uniform sampler2DArray texSampler;
 
 layout(push_constant) uniform PushConstants {
     int textureIndex;
@@ -14,6 +14,6 @@ layout(push_constant) uniform PushConstants {
 void main() {
     // Example: Render UVs as a gradient color
     //outColor = vec4(fragUV, 0.0, 1.0);
-    float depthValue = texture(texSampler[pc.textureIndex], fragUV).r;
+    float depthValue = texture(texSampler, vec3(fragUV, pc.textureIndex)).r;
     outColor = vec4(vec3(depthValue), 1.0);
 }
\ No newline at end of file
@@ -1,25 +1,34 @@
 #version 450
 
+#extension GL_EXT_nonuniform_qualifier : require
+
 layout(location = 0) in vec3 fragColor;
 layout (location = 1) in vec2 inUV;
 layout (location = 2) flat in int inDiffuseTextureID;
 layout (location = 3) in vec3 inNormal;
 layout (location = 4) in vec3 inFragPos;
 layout (location = 5) in vec3 inLightPos;
-layout (location = 6) in mat4 inView;
+layout (location = 6) in float inViewDepth;
 
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 1) uniform sampler2D texSampler[256];
+//false for opaque materials, a shader without discard keeps early depth testing
+layout(constant_id = 0) const bool ALPHA_TEST = true;
+
+//bindless heap, sized at descriptor set allocation
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
 #define NUM_CASCADES 3
 
-layout(binding = 5) uniform sampler2DShadow shadowMap[NUM_CASCADES];
+//one layer per cascade
+layout(binding = 5) uniform sampler2DArrayShadow shadowMap;
 
 struct Cascade
 {
     mat4 viewProjMatrix;
     float splitDepth;
+    //fraction of the layer's side the cascade was drawn into
+    float uvScale;
 };
 
 layout(binding = 6) uniform CascadeDataUniformBuffer{
@@ -30,11 +39,9 @@ float ShadowCalculation(vec3 fragPosWorldSpace)
 {
     // select cascade layer
 
-    vec4 fragPosViewSpace = inView * vec4(fragPosWorldSpace, 1.0);
-
     uint cascadeIndex = 0;
 	for(uint i = 0; i < NUM_CASCADES - 1; ++i) {
-		if(fragPosViewSpace.z < cascades[i].splitDepth) {	
+		if(inViewDepth < cascades[i].splitDepth) {	
 			cascadeIndex = i + 1;
 		}
 	}
@@ -51,7 +58,12 @@ float ShadowCalculation(vec3 fragPosWorldSpace)
         return 1;
     }
 
-    float shadow = texture(shadowMap[cascadeIndex], vec3(shadowMapCoord, projCoords.z));
+    //the filter footprint stays inside the drawn part of the layer
+    float halfTexel = 0.5 / textureSize(shadowMap, 0).x;
+
+    shadowMapCoord = min(shadowMapCoord * cascades[cascadeIndex].uvScale, vec2(cascades[cascadeIndex].uvScale - halfTexel));
+
+    float shadow = texture(shadowMap, vec4(shadowMapCoord, cascadeIndex, projCoords.z));
         
     return shadow;
 }
@@ -68,13 +80,14 @@ void main() {
 
     if(inDiffuseTextureID != -1)
     {
-        vec3 result = (shadow * diffuse + ambient) * texture(texSampler[inDiffuseTextureID], inUV).rgb;
-        if(texture(texSampler[inDiffuseTextureID], inUV).a < 0.2)
+        vec4 texel = texture(textures[nonuniformEXT(inDiffuseTextureID)], inUV);
+        vec3 result = (shadow * diffuse + ambient) * texel.rgb;
+        if(ALPHA_TEST && texel.a < 0.2)
         {
             discard;
         }
 
-        outColor = vec4(result, texture(texSampler[inDiffuseTextureID], inUV).a);
+        outColor = vec4(result, texel.a);
     }
     else
     {
@@ -6,7 +6,11 @@ layout (location = 2) flat out int outDiffuseTextureID;
 layout (location = 3) out vec3 outNormal;
 layout (location = 4) out vec3 fragPos;
 layout (location = 5) out vec3 lightPos;
-layout (location = 6) out mat4 outView;
+//view space depth for the cascade selection
+layout (location = 6) out float outViewDepth;
+
+//the depth prepass and the opaque pass must produce identical depth for the equal test
+invariant gl_Position;
 
 struct Vertex {
     vec3 position;
@@ -20,12 +24,20 @@ struct Vertex {
     mat4 globalTransform;
 };
 
+//rows of an affine model matrix and the inverse transpose of its 3x3 part as snorm16 pairs
 struct EntityInstance
 {
-	mat4 model;
+    vec4 modelRows[3];
+    uint normalMatrix[5];
     int boneTransformBufferIndex;
+    uint flags;
+    uint padding;
 };
 
+//bone influences read per vertex, set per pipeline variant, 0 for meshes drawn without skinning
+//the renderer picks the smallest variant covering every filled slot of the mesh, unused slots have weight 0
+layout(constant_id = 1) const uint BONE_INFLUENCES = 4;
+
 struct BoneTransformData
 {
     mat4 boneTransforms[200];
@@ -55,28 +67,42 @@ layout(binding = 2) uniform SceneDataUniformBuffer{
 	 SceneData sceneData;
 };
 
+vec3 TransformPosition(EntityInstance instance, vec4 position)
+{
+    return vec3(dot(instance.modelRows[0], position), dot(instance.modelRows[1], position), dot(instance.modelRows[2], position));
+}
+
+mat3 NormalMatrix(EntityInstance instance)
+{
+    vec2 p0 = unpackSnorm2x16(instance.normalMatrix[0]);
+    vec2 p1 = unpackSnorm2x16(instance.normalMatrix[1]);
+    vec2 p2 = unpackSnorm2x16(instance.normalMatrix[2]);
+    vec2 p3 = unpackSnorm2x16(instance.normalMatrix[3]);
+    vec2 p4 = unpackSnorm2x16(instance.normalMatrix[4]);
+
+    return mat3(p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, p3.x, p3.y, p4.x);
+}
+
 void main() {
 
     Vertex v = vertices[gl_VertexIndex];
 
+    EntityInstance instance = entityInstances[gl_InstanceIndex];
+
     vec4 totalPosition = vec4(0,0,0,0);
     vec3 skinnedNormal = vec3(0.0);
 
-    if(entityInstances[gl_InstanceIndex].boneTransformBufferIndex == -1)
+    if(BONE_INFLUENCES == 0u)
 	{
 		totalPosition = vec4(v.position, 1.0f);
         skinnedNormal = v.normal;
 	}
     else
     {
-        for(int i = 0 ; i < 4 ; i++)
+        //constant trip count, unrolled once specialized, an unused slot reads bone 0 with weight 0
+        for(uint i = 0u ; i < BONE_INFLUENCES ; i++)
         {
-            if(v.boneIndices[i] == -1 || v.boneWeights[i] == 0.0f)
-            {
-                continue;
-            }
-
-            mat4 boneTransform = boneTransforms[entityInstances[gl_InstanceIndex].boneTransformBufferIndex].boneTransforms[v.boneIndices[i]];
+            mat4 boneTransform = boneTransforms[instance.boneTransformBufferIndex].boneTransforms[max(v.boneIndices[i], 0)];
            
             vec4 localPosition = boneTransform * vec4(v.position, 1.0f);
             totalPosition += localPosition * v.boneWeights[i];
@@ -91,7 +117,11 @@ void main() {
         totalPosition.w = 1.0;
     }
 
-    gl_Position = sceneData.projection * sceneData.view * entityInstances[gl_InstanceIndex].model * totalPosition;
+    vec4 worldPosition = vec4(TransformPosition(instance, totalPosition), totalPosition.w);
+
+    vec4 viewPosition = sceneData.view * worldPosition;
+
+    gl_Position = sceneData.projection * viewPosition;
 
     outUV.x = v.uv_x;
 
@@ -101,12 +131,12 @@ void main() {
 
     outDiffuseTextureID = v.diffuseTextureID;
 
-    outNormal = transpose(inverse(mat3(entityInstances[gl_InstanceIndex].model))) * skinnedNormal;
+    outNormal = NormalMatrix(instance) * skinnedNormal;
 
-    fragPos = vec3(entityInstances[gl_InstanceIndex].model * totalPosition);
+    fragPos = worldPosition.xyz;
 
     lightPos = vec3(sceneData.lightPos);
 
-    outView = sceneData.view;
+    outViewDepth = viewPosition.z;
 
 } 
\ No newline at end of file
@@ -1,5 +1,9 @@
 #version 450
 
+#extension GL_EXT_multiview : require
+
+#define NUM_CASCADES 3
+
 struct Vertex {
     vec3 position;
     float uv_x;
@@ -12,12 +16,20 @@ struct Vertex {
     mat4 globalTransform;
 };
 
+//rows of an affine model matrix, the normal matrix is unused here
 struct EntityInstance
 {
-	mat4 model;
+    vec4 modelRows[3];
+    uint normalMatrix[5];
     int boneTransformBufferIndex;
+    uint flags;
+    uint padding;
 };
 
+//bone influences read per vertex, set per pipeline variant, 0 for meshes drawn without skinning
+//the renderer picks the smallest variant covering every filled slot of the mesh, unused slots have weight 0
+layout(constant_id = 1) const uint BONE_INFLUENCES = 4;
+
 struct BoneTransformData
 {
     mat4 boneTransforms[200];
@@ -25,7 +37,7 @@ struct BoneTransformData
 
 struct ShadowData
 {
-    mat4 model;
+    mat4 lightSpaceMatrices[NUM_CASCADES];
 };
 
 layout(binding = 0, std430) readonly buffer VertexBuffer{ 
@@ -44,29 +56,35 @@ layout(binding = 3, std430) readonly buffer BoneTransformBuffer{
      BoneTransformData boneTransforms[];
 };
 
+//bit i set when cascade layer i is drawn in this pass
 layout(push_constant) uniform PushConstant{
-    mat4 lightSpaceMatrix;
+    uint viewMask;
 } pc;
 
 void main() {
+    //each view is one cascade layer, layers outside the mask keep their depth
+    if((pc.viewMask & (1u << gl_ViewIndex)) == 0u)
+    {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
     Vertex v = vertices[gl_VertexIndex];
 
+    EntityInstance instance = entityInstances[gl_InstanceIndex];
+
     vec4 totalPosition = vec4(0,0,0,0);
 
-    if(entityInstances[gl_InstanceIndex].boneTransformBufferIndex == -1)
+    if(BONE_INFLUENCES == 0u)
 	{
 		totalPosition = vec4(v.position, 1.0f);
 	}
     else
     {
-        for(int i = 0 ; i < 4 ; i++)
+        //constant trip count, unrolled once specialized, an unused slot reads bone 0 with weight 0
+        for(uint i = 0u ; i < BONE_INFLUENCES ; i++)
         {
-            if(v.boneIndices[i] == -1 || v.boneWeights[i] == 0.0f)
-            {
-                continue;
-            }
-
-            mat4 boneTransform = boneTransforms[entityInstances[gl_InstanceIndex].boneTransformBufferIndex].boneTransforms[v.boneIndices[i]];
+            mat4 boneTransform = boneTransforms[instance.boneTransformBufferIndex].boneTransforms[max(v.boneIndices[i], 0)];
            
             vec4 localPosition = boneTransform * vec4(v.position, 1.0f);
             totalPosition += localPosition * v.boneWeights[i];
@@ -77,6 +95,10 @@ void main() {
         totalPosition.w = 1.0;
     }
 
-    gl_Position = pc.lightSpaceMatrix * entityInstances[gl_InstanceIndex].model * v.globalTransform * totalPosition;
+    vec4 localPosition = v.globalTransform * totalPosition;
+
+    vec4 worldPosition = vec4(dot(instance.modelRows[0], localPosition), dot(instance.modelRows[1], localPosition), dot(instance.modelRows[2], localPosition), localPosition.w);
+
+    gl_Position = shadowData.lightSpaceMatrices[gl_ViewIndex] * worldPosition;
 }
 
@@ -2,7 +2,13 @@
 
 #include "SceneTypes.h"
 
+#include "Trace.h"
+
+#include "MeshOptimizer.h"
+
 #include <iostream>
+#include <algorithm>
+#include <cfloat>
 
 #include "json.hpp"
 
@@ -11,6 +17,8 @@ using json = nlohmann::json;
 
 void AssetImporter::LoadModelFromFile(const char* path, Model& model, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<std::string>& texturePaths)
 {
+	UTRACE_FUNCTION();
+
 	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenSmoothNormals);
 
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
@@ -21,6 +29,32 @@ void AssetImporter::LoadModelFromFile(const char* path, Model& model, std::vecto
 
 	ProcessNode(scene->mRootNode, scene, model, &(model.sceneRoot), vertices, indices, texturePaths);
 
+	//bind pose bounds of the full detail meshes, instances pick their LOD from the projected sphere
+	glm::vec3 minBounds = glm::vec3(FLT_MAX);
+	glm::vec3 maxBounds = glm::vec3(-FLT_MAX);
+
+	model.lodCount = 1;
+
+	for (const Mesh& mesh : model.meshes)
+	{
+		for (uint32_t i = 0; i < mesh.lods[0].indexCount; i++)
+		{
+			minBounds = glm::min(minBounds, vertices[indices[mesh.lods[0].startIndex + i]].position);
+			maxBounds = glm::max(maxBounds, vertices[indices[mesh.lods[0].startIndex + i]].position);
+		}
+
+		model.lodCount = std::max(model.lodCount, mesh.lodCount);
+	}
+
+	if (minBounds.x <= maxBounds.x)
+	{
+		model.boundsCenter = (minBounds + maxBounds) * 0.5f;
+		model.boundsRadius = glm::length(maxBounds - minBounds) * 0.5f;
+
+		model.boundsMin = minBounds;
+		model.boundsMax = maxBounds;
+	}
+
 	LoadAnimation(scene, model, "");
 }
 
@@ -149,8 +183,8 @@ void AssetImporter::ProcessMesh(Mesh& mesh, aiMesh* assimpMesh, const aiScene* s
 
 	uint32_t indexCount = static_cast<uint32_t>(indices.size()) - startIndex;
 
-	mesh.startIndex = startIndex;
-	mesh.indexCount = indexCount;
+	mesh.lods[0].startIndex = startIndex;
+	mesh.lods[0].indexCount = indexCount;
 
 	aiMaterial* material = scene->mMaterials[assimpMesh->mMaterialIndex];
 	aiColor3D color(0.f, 0.f, 0.f);
@@ -219,6 +253,8 @@ void AssetImporter::ProcessMesh(Mesh& mesh, aiMesh* assimpMesh, const aiScene* s
 		}
 	}
 
+	mesh.diffuseTextureID = diffuseTextureID;
+
 	std::vector<Vertex> meshVertices;
 
 	meshVertices.resize(assimpMesh->mNumVertices);
@@ -255,7 +291,24 @@ void AssetImporter::ProcessMesh(Mesh& mesh, aiMesh* assimpMesh, const aiScene* s
 
 	ExtractBoneWeights(meshVertices, assimpMesh, model);
 
+	//slots are filled in order, so the last used slot of any vertex is the count the skinned variant has to read
+	for (const Vertex& vertex : meshVertices)
+	{
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			if (vertex.boneIndices[i] >= 0)
+			{
+				mesh.boneInfluences = std::max(mesh.boneInfluences, i + 1);
+			}
+		}
+	}
+
+	uint32_t firstVertex = static_cast<uint32_t>(vertices.size());
+
 	vertices.insert(vertices.end(), meshVertices.begin(), meshVertices.end());
+
+	//welds the face split vertices, builds the LODs and reorders for the vertex cache, overdraw and fetch
+	MeshOptimizer::Get().Optimize(mesh, vertices, indices, firstVertex);
 }
 
 void AssetImporter::ExtractBoneWeights(std::vector<Vertex>& meshVertices, aiMesh* assimpMesh, Model& model)
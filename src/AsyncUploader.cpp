@@ -0,0 +1,516 @@
+#include "AsyncUploader.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+const VkDeviceSize STAGING_ALIGNMENT = 16;
+
+//submissions that can be timed at once, later ones go untimed until a slot frees up
+const uint32_t TIMESTAMP_QUERY_SLOTS = 32;
+
+void UAsyncUploader::Init(VkDevice device, VmaAllocator allocator, VkQueue transferQueue, uint32_t transferQueueFamily, uint32_t graphicsQueueFamily, VkDeviceSize stagingSize)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->transferQueue = transferQueue;
+    this->transferQueueFamily = transferQueueFamily;
+    this->graphicsQueueFamily = graphicsQueueFamily;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = transferQueueFamily;
+
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create upload command pool!");
+    }
+
+    VkSemaphoreTypeCreateInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &timelineInfo;
+
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timelineSemaphore) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create upload timeline semaphore!");
+    }
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = stagingSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocationInfo;
+
+    if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &ring.buffer, &ring.allocation, &allocationInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create upload staging ring!");
+    }
+
+    ringData = (uint8_t*)allocationInfo.pMappedData;
+    ringSize = stagingSize;
+}
+
+void UAsyncUploader::Cleanup()
+{
+    WaitIdle();
+
+    vmaDestroyBuffer(allocator, ring.buffer, ring.allocation);
+
+    if (timestampQueryPool != VK_NULL_HANDLE)
+    {
+        vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+    }
+
+    vkDestroySemaphore(device, timelineSemaphore, nullptr);
+
+    vkDestroyCommandPool(device, commandPool, nullptr);
+}
+
+UploadHandle UAsyncUploader::UploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size,
+    VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, std::function<void()> onComplete)
+{
+    BeginRecording();
+
+    VkBuffer stagingBuffer;
+    VkDeviceSize stagingOffset;
+    WriteStaging(data, size, stagingBuffer, stagingOffset);
+
+    VkCommandBuffer cmd = recording.commandBuffer;
+
+    VkBufferCopy copy{};
+    copy.srcOffset = stagingOffset;
+    copy.dstOffset = offset;
+    copy.size = size;
+
+    vkCmdCopyBuffer(cmd, stagingBuffer, buffer, 1, &copy);
+
+    //the semaphore wait on the graphics queue makes the copy visible, only a queue family change needs barriers
+    if (UsesDedicatedQueue())
+    {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = transferQueueFamily;
+        barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+        barrier.buffer = buffer;
+        barrier.offset = offset;
+        barrier.size = size;
+
+        //release
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+            0, nullptr, 1, &barrier, 0, nullptr);
+
+        //acquire, recorded later on the graphics queue
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = dstAccess;
+
+        recording.bufferAcquires.push_back(barrier);
+        recording.acquireStages |= dstStage;
+    }
+
+    if (onComplete)
+        recording.callbacks.push_back(std::move(onComplete));
+
+    return recording.timelineValue;
+}
+
+UploadHandle UAsyncUploader::UploadImage(VkImage image, uint32_t mipLevels, const std::vector<VkBufferImageCopy>& regions, const void* data, VkDeviceSize size,
+    std::function<void()> onComplete)
+{
+    BeginRecording();
+
+    VkBuffer stagingBuffer;
+    VkDeviceSize stagingOffset;
+    WriteStaging(data, size, stagingBuffer, stagingOffset);
+
+    VkCommandBuffer cmd = recording.commandBuffer;
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+
+    std::vector<VkBufferImageCopy> stagingRegions = regions;
+
+    for (VkBufferImageCopy& region : stagingRegions)
+    {
+        region.bufferOffset += stagingOffset;
+    }
+
+    vkCmdCopyBufferToImage(cmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(stagingRegions.size()), stagingRegions.data());
+
+    //the layout change happens here, on a family change the graphics queue repeats it in its acquire
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+
+    if (UsesDedicatedQueue())
+    {
+        barrier.srcQueueFamilyIndex = transferQueueFamily;
+        barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+    }
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+
+    if (UsesDedicatedQueue())
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        recording.imageAcquires.push_back(barrier);
+        recording.acquireStages |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+
+    if (onComplete)
+        recording.callbacks.push_back(std::move(onComplete));
+
+    return recording.timelineValue;
+}
+
+void UAsyncUploader::EnableTimestamps(float timestampPeriod, uint32_t timestampValidBits)
+{
+    //transfer queues are not required to support timestamps
+    if (timestampValidBits == 0)
+        return;
+
+    this->timestampPeriod = timestampPeriod;
+    timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = TIMESTAMP_QUERY_SLOTS * 2;
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampQueryPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create upload timestamp query pool!");
+    }
+
+    for (uint32_t i = 0; i < TIMESTAMP_QUERY_SLOTS; i++)
+    {
+        freeQuerySlots.push_back(i);
+    }
+}
+
+double UAsyncUploader::ConsumeGpuMilliseconds()
+{
+    double milliseconds = gpuMilliseconds;
+
+    gpuMilliseconds = 0.0;
+
+    return milliseconds;
+}
+
+void UAsyncUploader::Flush()
+{
+    if (!bRecording)
+        return;
+
+    if (recording.querySlot != UINT32_MAX)
+    {
+        vkCmdWriteTimestamp(recording.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, recording.querySlot * 2 + 1);
+    }
+
+    vkEndCommandBuffer(recording.commandBuffer);
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &recording.timelineValue;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &recording.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &timelineSemaphore;
+
+    if (vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit upload command buffer!");
+    }
+
+    inFlight.push_back(std::move(recording));
+
+    recording = Submission{};
+
+    bRecording = false;
+
+    nextTimelineValue++;
+}
+
+void UAsyncUploader::WaitIdle()
+{
+    Flush();
+
+    if (!inFlight.empty())
+    {
+        uint64_t value = inFlight.back().timelineValue;
+
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timelineSemaphore;
+        waitInfo.pValues = &value;
+
+        vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+    }
+
+    Retire(false);
+}
+
+void UAsyncUploader::AcquireCompleted(VkCommandBuffer cmd)
+{
+    Retire(false);
+
+    if (completed.empty())
+        return;
+
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    VkPipelineStageFlags dstStages = 0;
+
+    for (Submission& submission : completed)
+    {
+        bufferBarriers.insert(bufferBarriers.end(), submission.bufferAcquires.begin(), submission.bufferAcquires.end());
+        imageBarriers.insert(imageBarriers.end(), submission.imageAcquires.begin(), submission.imageAcquires.end());
+        dstStages |= submission.acquireStages;
+
+        acquiredValue = std::max(acquiredValue, submission.timelineValue);
+    }
+
+    if (!bufferBarriers.empty() || !imageBarriers.empty())
+    {
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, dstStages, 0,
+            0, nullptr,
+            static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+            static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+
+    for (Submission& submission : completed)
+    {
+        for (std::function<void()>& callback : submission.callbacks)
+        {
+            callback();
+        }
+    }
+
+    completed.clear();
+}
+
+void UAsyncUploader::BeginRecording()
+{
+    if (bRecording)
+        return;
+
+    VkCommandBuffer commandBuffer;
+
+    if (!freeCommandBuffers.empty())
+    {
+        commandBuffer = freeCommandBuffers.back();
+        freeCommandBuffers.pop_back();
+
+        vkResetCommandBuffer(commandBuffer, 0);
+    }
+    else
+    {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate upload command buffer!");
+        }
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    recording.commandBuffer = commandBuffer;
+    recording.timelineValue = nextTimelineValue;
+    recording.ringEnd = ringHead;
+
+    //transfer only queues can not reset queries in a command buffer, so the slot is reset on the host
+    if (!freeQuerySlots.empty())
+    {
+        recording.querySlot = freeQuerySlots.back();
+        freeQuerySlots.pop_back();
+
+        vkResetQueryPool(device, timestampQueryPool, recording.querySlot * 2, 2);
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, recording.querySlot * 2);
+    }
+
+    bRecording = true;
+}
+
+void UAsyncUploader::WriteStaging(const void* data, VkDeviceSize size, VkBuffer& stagingBuffer, VkDeviceSize& stagingOffset)
+{
+    if (size > ringSize)
+    {
+        StagingBuffer dedicated;
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+        allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        VmaAllocationInfo allocationInfo;
+
+        if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &dedicated.buffer, &dedicated.allocation, &allocationInfo) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upload staging buffer!");
+        }
+
+        memcpy(allocationInfo.pMappedData, data, static_cast<size_t>(size));
+
+        recording.dedicatedStaging.push_back(dedicated);
+
+        stagingBuffer = dedicated.buffer;
+        stagingOffset = 0;
+        return;
+    }
+
+    VkDeviceSize position;
+
+    while (!AllocateRing(size, position))
+    {
+        if (!inFlight.empty())
+        {
+            Retire(true);
+        }
+        else
+        {
+            //the ring is full of this batch, submit it so it can be retired
+            Flush();
+            BeginRecording();
+        }
+    }
+
+    recording.ringEnd = ringHead;
+
+    memcpy(ringData + position % ringSize, data, static_cast<size_t>(size));
+
+    stagingBuffer = ring.buffer;
+    stagingOffset = position % ringSize;
+}
+
+bool UAsyncUploader::AllocateRing(VkDeviceSize size, VkDeviceSize& position)
+{
+    //restart at the beginning of the ring when nothing is in use
+    if (ringHead == ringTail)
+    {
+        ringHead = (ringHead + ringSize - 1) / ringSize * ringSize;
+        ringTail = ringHead;
+    }
+
+    VkDeviceSize start = (ringHead + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+    //allocations never wrap, skip the remainder of the ring instead
+    VkDeviceSize offset = start % ringSize;
+
+    if (offset + size > ringSize)
+    {
+        start += ringSize - offset;
+    }
+
+    if (start + size - ringTail > ringSize)
+    {
+        return false;
+    }
+
+    position = start;
+    ringHead = start + size;
+
+    return true;
+}
+
+void UAsyncUploader::Retire(bool bWaitOldest)
+{
+    if (inFlight.empty())
+        return;
+
+    if (bWaitOldest)
+    {
+        uint64_t value = inFlight.front().timelineValue;
+
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timelineSemaphore;
+        waitInfo.pValues = &value;
+
+        vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+    }
+
+    uint64_t completedValue = 0;
+    vkGetSemaphoreCounterValue(device, timelineSemaphore, &completedValue);
+
+    while (!inFlight.empty() && inFlight.front().timelineValue <= completedValue)
+    {
+        Submission& submission = inFlight.front();
+
+        ringTail = std::max(ringTail, submission.ringEnd);
+
+        for (StagingBuffer& staging : submission.dedicatedStaging)
+        {
+            vmaDestroyBuffer(allocator, staging.buffer, staging.allocation);
+        }
+
+        submission.dedicatedStaging.clear();
+
+        //the timeline value was reached, so the timestamps are written
+        if (submission.querySlot != UINT32_MAX)
+        {
+            uint64_t timestamps[2] = {};
+
+            if (vkGetQueryPoolResults(device, timestampQueryPool, submission.querySlot * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+            {
+                gpuMilliseconds += ((timestamps[1] - timestamps[0]) & timestampMask) * timestampPeriod / 1000000.0;
+            }
+
+            freeQuerySlots.push_back(submission.querySlot);
+            submission.querySlot = UINT32_MAX;
+        }
+
+        freeCommandBuffers.push_back(submission.commandBuffer);
+
+        completed.push_back(std::move(submission));
+
+        inFlight.pop_front();
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+
+#include "vulkan/vulkan.h"
+
+#include "vk_mem_alloc.h"
+
+//timeline value of the submission that carries an upload
+typedef uint64_t UploadHandle;
+
+//streams buffer and image data to the GPU on a transfer queue without blocking the frame
+//uploads are copied into a persistently mapped staging ring and batched into one submit per Flush,
+//the graphics queue takes ownership of finished uploads in AcquireCompleted
+//not thread safe, requests are expected from the main thread
+class UAsyncUploader
+{
+public:
+    void Init(VkDevice device, VmaAllocator allocator, VkQueue transferQueue, uint32_t transferQueueFamily, uint32_t graphicsQueueFamily, VkDeviceSize stagingSize);
+
+    void Cleanup();
+
+    //dstStage and dstAccess describe how the graphics queue will use the buffer
+    UploadHandle UploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size,
+        VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, std::function<void()> onComplete = nullptr);
+
+    //region buffer offsets are relative to data, the image ends in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    UploadHandle UploadImage(VkImage image, uint32_t mipLevels, const std::vector<VkBufferImageCopy>& regions, const void* data, VkDeviceSize size,
+        std::function<void()> onComplete = nullptr);
+
+    //submits everything requested since the last flush
+    void Flush();
+
+    //true once the upload finished and was acquired by the graphics queue
+    bool IsReady(UploadHandle handle) const { return handle <= acquiredValue; }
+
+    void WaitIdle();
+
+    //records ownership acquires for finished uploads into a graphics command buffer and runs their callbacks
+    void AcquireCompleted(VkCommandBuffer cmd);
+
+    VkSemaphore GetTimelineSemaphore() const { return timelineSemaphore; }
+
+    //value the next graphics submit has to wait on before using acquired resources
+    uint64_t GetGraphicsWaitValue() const { return acquiredValue; }
+
+    bool UsesDedicatedQueue() const { return transferQueueFamily != graphicsQueueFamily; }
+
+    //brackets every submission with timestamps, needs host query reset
+    void EnableTimestamps(float timestampPeriod, uint32_t timestampValidBits);
+
+    //GPU time of the submissions retired since the last call
+    double ConsumeGpuMilliseconds();
+
+private:
+    struct StagingBuffer
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+    };
+
+    struct Submission
+    {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        uint64_t timelineValue = 0;
+        //ring position after the last allocation of this submission
+        VkDeviceSize ringEnd = 0;
+
+        //uploads that did not fit in the ring get their own staging buffer
+        std::vector<StagingBuffer> dedicatedStaging;
+
+        std::vector<VkBufferMemoryBarrier> bufferAcquires;
+        std::vector<VkImageMemoryBarrier> imageAcquires;
+        VkPipelineStageFlags acquireStages = 0;
+
+        std::vector<std::function<void()>> callbacks;
+
+        //pair of timestamps in the query pool, UINT32_MAX when not timed
+        uint32_t querySlot = UINT32_MAX;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+
+    VmaAllocator allocator = VK_NULL_HANDLE;
+
+    VkQueue transferQueue = VK_NULL_HANDLE;
+
+    uint32_t transferQueueFamily = 0;
+
+    uint32_t graphicsQueueFamily = 0;
+
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+
+    std::vector<VkCommandBuffer> freeCommandBuffers;
+
+    VkSemaphore timelineSemaphore = VK_NULL_HANDLE;
+
+    StagingBuffer ring;
+
+    uint8_t* ringData = nullptr;
+
+    VkDeviceSize ringSize = 0;
+
+    //monotonic positions, the physical offset is position % ringSize
+    VkDeviceSize ringHead = 0;
+
+    VkDeviceSize ringTail = 0;
+
+    //submission being recorded, its timeline value is the handle returned to callers
+    Submission recording;
+
+    bool bRecording = false;
+
+    std::deque<Submission> inFlight;
+
+    //finished on the transfer queue but not yet acquired by the graphics queue
+    std::vector<Submission> completed;
+
+    uint64_t nextTimelineValue = 1;
+
+    uint64_t acquiredValue = 0;
+
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+
+    std::vector<uint32_t> freeQuerySlots;
+
+    float timestampPeriod = 1.0f;
+
+    uint64_t timestampMask = ~0ull;
+
+    double gpuMilliseconds = 0.0;
+
+    void BeginRecording();
+
+    //returns the staging buffer and offset the data was written to
+    void WriteStaging(const void* data, VkDeviceSize size, VkBuffer& stagingBuffer, VkDeviceSize& stagingOffset);
+
+    bool AllocateRing(VkDeviceSize size, VkDeviceSize& position);
+
+    void Retire(bool bWaitOldest);
+};
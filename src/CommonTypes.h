@@ -31,10 +31,50 @@ static std::string ReadFileStr(const std::string& filename)
     return stream.str();
 }
 
-struct Mesh
+const uint32_t MAX_MESH_LODS = 4;
+
+//texels below this alpha are discarded by shader.frag (0.2), textures containing any go through the alpha tested pipeline
+const uint8_t ALPHA_TEST_CUTOFF = 51;
+
+//index range of one detail level of a mesh
+struct MeshLOD
 {
 	uint32_t startIndex = 0;
 	uint32_t indexCount = 0;
+
+	//clusters covering the index range, counted from the start of Model::meshlets, ClusterDraw carries the arena offset
+	uint32_t firstMeshlet = 0;
+	uint32_t meshletCount = 0;
+};
+
+struct Mesh
+{
+	int diffuseTextureID = -1;
+
+	//most bone slots a vertex of the mesh fills, picks the skinning pipeline variant, 0 without bones
+	uint32_t boneInfluences = 0;
+
+	//LOD 0 is the imported geometry, every further level has roughly half the triangles of the previous one
+	uint32_t lodCount = 1;
+	MeshLOD lods[MAX_MESH_LODS];
+};
+
+//cluster of a mesh, its triangles are a contiguous part of the mesh index range
+//bounds are in mesh space, laid out for std430 as read by clusterCull.comp
+struct Meshlet
+{
+	glm::vec3 center;
+	float radius;
+
+	//the cluster faces away from every viewer with dot(normalize(coneApex - viewer), coneAxis) >= coneCutoff
+	glm::vec3 coneAxis;
+	float coneCutoff;
+
+	glm::vec3 coneApex;
+	uint32_t firstIndex;
+
+	uint32_t indexCount;
+	uint32_t padding[3];
 };
 
 struct Vertex {
@@ -0,0 +1,64 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+//fraction of the target the controller aims for once it decides to change the scale, the band keeps it from reacting to noise
+const double DYNAMIC_RESOLUTION_AIM = 0.9;
+const double DYNAMIC_RESOLUTION_LOW = 0.8;
+
+//largest steps of one change, drops are faster than raises so a single slow frame does not start an oscillation
+const float DYNAMIC_RESOLUTION_MAX_DROP = 0.15f;
+const float DYNAMIC_RESOLUTION_MAX_RAISE = 0.05f;
+
+//changes smaller than this are not worth a visible change in sharpness
+const float DYNAMIC_RESOLUTION_MIN_STEP = 0.01f;
+
+void UDynamicResolution::Reset()
+{
+    //clamping needs ordered bounds
+    minScale = std::min(minScale, maxScale);
+
+    scale = maxScale;
+    filteredMilliseconds = 0.0;
+    framesSinceChange = 0;
+}
+
+float UDynamicResolution::Update(double gpuMilliseconds)
+{
+    scale = std::clamp(scale, minScale, maxScale);
+
+    if (gpuMilliseconds <= 0.0 || targetMilliseconds <= 0.0)
+    {
+        return scale;
+    }
+
+    //the resolved frame was still recorded at an older scale
+    if (++framesSinceChange <= settleFrames)
+    {
+        return scale;
+    }
+
+    filteredMilliseconds = filteredMilliseconds == 0.0 ? gpuMilliseconds : filteredMilliseconds + (gpuMilliseconds - filteredMilliseconds) * 0.25;
+
+    if (filteredMilliseconds <= targetMilliseconds && filteredMilliseconds >= targetMilliseconds * DYNAMIC_RESOLUTION_LOW)
+    {
+        return scale;
+    }
+
+    //time is taken as proportional to the pixel count, the part that is not, like shadows and culling, is corrected by later steps
+    float desired = scale * static_cast<float>(std::sqrt(targetMilliseconds * DYNAMIC_RESOLUTION_AIM / filteredMilliseconds));
+
+    desired = std::clamp(desired, scale - DYNAMIC_RESOLUTION_MAX_DROP, scale + DYNAMIC_RESOLUTION_MAX_RAISE);
+
+    desired = std::clamp(desired, minScale, maxScale);
+
+    if (std::abs(desired - scale) >= DYNAMIC_RESOLUTION_MIN_STEP)
+    {
+        scale = desired;
+        filteredMilliseconds = 0.0;
+        framesSinceChange = 0;
+    }
+
+    return scale;
+}
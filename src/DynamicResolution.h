@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+//picks the fraction of the output resolution the scene is rendered at so the GPU frame time stays near a target
+//timings arrive frames after the scale they were measured at was set, so samples are ignored until a change has settled
+class UDynamicResolution
+{
+public:
+    //GPU time a frame should take
+    double targetMilliseconds = 16.0;
+
+    //bounds of the per axis scale, the render targets are allocated at the maximum
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+
+    //frames the measured time needs to reflect a new scale, the frames in flight plus the one being recorded
+    uint32_t settleFrames = 3;
+
+    //starts again at the maximum scale
+    void Reset();
+
+    //feeds the GPU time of the latest resolved frame, 0 when nothing was measured, and returns the scale to render at
+    float Update(double gpuMilliseconds);
+
+    float GetScale() const { return scale; }
+
+private:
+    float scale = 1.0f;
+
+    //smoothed GPU time, 0 until the first sample after a change
+    double filteredMilliseconds = 0.0;
+
+    uint32_t framesSinceChange = 0;
+};
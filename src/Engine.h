@@ -10,8 +10,22 @@
 
 #include "SceneManager.h"
 
+#include "TextureCooker.h"
+
+#include "ModelCooker.h"
+
+#include "Trace.h"
+
 #include <iostream>
 
+#include <chrono>
+
+#include <algorithm>
+
+#include <stdexcept>
+
+#include <string>
+
 #include "json.hpp"
 
 using json = nlohmann::json;
@@ -19,7 +33,7 @@ using json = nlohmann::json;
 class UEngine
 {
 	VkExtent2D windowExtent{ 1920 , 1080 };
-	SDL_Window* window;
+	SDL_Window* window = nullptr;
 
 	URenderer renderer;
 
@@ -28,7 +42,21 @@ class UEngine
 	float deltaTime = 0.0f;
 	float lastFrame = 0.0f;
 
+	//frame times of a headless run in milliseconds
+	std::vector<double> frameTimes;
+
 public:
+	//render offscreen without a window for a fixed number of frames, then exit
+	bool headless = false;
+
+	uint32_t headlessFrames = 0;
+
+	//shared by the command line and the config, 0 is left for "not set"
+	static bool IsValidHeadlessFrameCount(long long frames)
+	{
+		return frames >= 1 && frames <= UINT32_MAX;
+	}
+
 	void Run()
 	{
 		std::ifstream f("config/Config.json");
@@ -37,6 +65,76 @@ public:
 		windowExtent.width = data["resolution"][0];
 		windowExtent.height = data["resolution"][1];
 
+		if (data.contains("shadowCaching"))
+			renderer.shadowCaching = data["shadowCaching"];
+
+		if (data.contains("depthPrepass"))
+			renderer.depthPrepass = data["depthPrepass"];
+
+		if (data.contains("clusterCulling"))
+			renderer.clusterCulling = data["clusterCulling"];
+
+		if (data.contains("occlusionCulling"))
+			renderer.occlusionCulling = data["occlusionCulling"];
+
+		if (data.contains("softwareOcclusionCulling"))
+			renderer.softwareOcclusionCulling = data["softwareOcclusionCulling"];
+
+		if (data.contains("dynamicResolution"))
+			renderer.dynamicResolution = data["dynamicResolution"];
+
+		if (data.contains("dynamicResolutionTargetMs"))
+			renderer.GetDynamicResolution().targetMilliseconds = data["dynamicResolutionTargetMs"];
+
+		if (data.contains("dynamicResolutionMinScale"))
+			renderer.GetDynamicResolution().minScale = data["dynamicResolutionMinScale"];
+
+		if (data.contains("dynamicResolutionMaxScale"))
+			renderer.GetDynamicResolution().maxScale = data["dynamicResolutionMaxScale"];
+
+		if (data.contains("scalabilityGovernor"))
+			renderer.scalabilityGovernor = data["scalabilityGovernor"];
+
+		if (data.contains("frameBudgetMs"))
+			renderer.GetScalabilityGovernor().budgetMilliseconds = data["frameBudgetMs"];
+
+		if (data.contains("geometryArenaVertexMB"))
+			renderer.geometryArenaVertexMB = data["geometryArenaVertexMB"];
+
+		if (data.contains("geometryArenaIndexMB"))
+			renderer.geometryArenaIndexMB = data["geometryArenaIndexMB"];
+
+		if (data.contains("gpuProfilerLogInterval"))
+			renderer.GetGpuProfiler().logInterval = data["gpuProfilerLogInterval"];
+
+		if (data.contains("gpuProfilerCsv"))
+			renderer.GetGpuProfiler().csvPath = data["gpuProfilerCsv"];
+
+		if (data.contains("traceDumpFrame"))
+			Trace::Get().dumpAfterFrames = data["traceDumpFrame"];
+
+		if (data.contains("tracePath"))
+			Trace::Get().outputPath = data["tracePath"];
+
+		//the command line takes precedence over the config
+		if (data.contains("headless") && !headless)
+			headless = data["headless"];
+
+		if (data.contains("headlessFrames") && headlessFrames == 0)
+		{
+			//read signed so a negative value is rejected instead of wrapping
+			if (!data["headlessFrames"].is_number_integer() || !IsValidHeadlessFrameCount(data["headlessFrames"].get<long long>()))
+				throw std::runtime_error("headlessFrames in config/Config.json must be between 1 and " + std::to_string(UINT32_MAX));
+
+			headlessFrames = static_cast<uint32_t>(data["headlessFrames"].get<long long>());
+		}
+
+		if (headless)
+		{
+			RunHeadless();
+			return;
+		}
+
 		InitWindow();
 
 		renderer.SetWindow(window);
@@ -50,6 +148,8 @@ public:
 		while (!bQuit)
 		{
 			MainLoop();
+
+			UTRACE_END_FRAME(InputManager::Get().dumpTrace);
 		}
 
 		renderer.Cleanup();
@@ -57,6 +157,52 @@ public:
 		SDL_DestroyWindow(window);
 	}
 
+	void RunHeadless()
+	{
+		if (headlessFrames == 0)
+			headlessFrames = 300;
+
+		renderer.SetHeadless(windowExtent);
+
+		LoadAssets();
+
+		renderer.Init();
+
+		//fixed time step so every run simulates the same frames
+		deltaTime = 1.0f / 60.0f;
+
+		frameTimes.reserve(headlessFrames);
+
+		for (uint32_t i = 0; i < headlessFrames; i++)
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			UpdateFrame();
+
+			auto end = std::chrono::steady_clock::now();
+
+			frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+			UTRACE_END_FRAME(false);
+		}
+
+		renderer.Cleanup();
+
+		ReportFrameTimes();
+	}
+
+	//encodes the scene's textures and converts its models into cooked/ so loading skips decoding and importing
+	void Cook()
+	{
+		ModelCooker::Get().CookScene("scenes/Scene1.json");
+
+		std::vector<std::string> texturePaths = TextureCooker::Get().CollectSceneTextures("scenes/Scene1.json");
+
+		texturePaths.push_back("assets/image.jpg");
+
+		TextureCooker::Get().CookTextures(texturePaths);
+	}
+
 private:
 	void InitWindow()
 	{
@@ -77,6 +223,8 @@ private:
 
 	void MainLoop()
 	{
+		UTRACE_FUNCTION();
+
 		float currentFrame = static_cast<float>(SDL_GetTicks64()) / 1000.0f;
 		deltaTime = currentFrame - lastFrame;
 
@@ -98,13 +246,42 @@ private:
 		if (renderer.debugQuadTextureIndex >= NUM_CASCADES)
 			renderer.debugQuadTextureIndex = 0;
 
+		UpdateFrame();
+	}
+
+	void UpdateFrame()
+	{
+		UTRACE_FUNCTION();
+
 		UPhysics::Get().Update(deltaTime);
 
 		renderer.Draw(deltaTime);
 	}
 
+	void ReportFrameTimes()
+	{
+		if (frameTimes.empty())
+			return;
+
+		std::vector<double> sorted = frameTimes;
+		std::sort(sorted.begin(), sorted.end());
+
+		double total = 0.0;
+
+		for (double frameTime : sorted)
+			total += frameTime;
+
+		auto percentile = [&](double p) { return sorted[static_cast<size_t>(p * (sorted.size() - 1))]; };
+
+		std::cout << "Headless run: " << sorted.size() << " frames at " << windowExtent.width << "x" << windowExtent.height << std::endl;
+		std::cout << "  average " << total / sorted.size() << " ms, min " << sorted.front() << " ms, median " << percentile(0.5)
+			<< " ms, p95 " << percentile(0.95) << " ms, p99 " << percentile(0.99) << " ms, max " << sorted.back() << " ms" << std::endl;
+	}
+
 	void LoadAssets()
 	{
+		UTRACE_FUNCTION();
+
 		SceneManager::Get().LoadScene("scenes/Scene1.json");
 
 		SceneManager::Get().texturePaths.push_back("assets/image.jpg");
@@ -0,0 +1,237 @@
+#include "GeometryArena.h"
+
+#include <algorithm>
+#include <iterator>
+
+void UFreeListAllocator::Init(uint32_t newCapacity)
+{
+    capacity = newCapacity;
+
+    freeCount = newCapacity;
+
+    freeBlocks.clear();
+
+    if (newCapacity > 0)
+    {
+        freeBlocks[0] = newCapacity;
+    }
+}
+
+bool UFreeListAllocator::AllocateBelow(uint32_t count, uint32_t limit, uint32_t& offset)
+{
+    for (auto it = freeBlocks.begin(); it != freeBlocks.end() && it->first + count <= limit; ++it)
+    {
+        if (it->second < count)
+        {
+            continue;
+        }
+
+        offset = it->first;
+
+        uint32_t remaining = it->second - count;
+
+        freeBlocks.erase(it);
+
+        if (remaining > 0)
+        {
+            freeBlocks[offset + count] = remaining;
+        }
+
+        freeCount -= count;
+
+        return true;
+    }
+
+    return false;
+}
+
+void UFreeListAllocator::Free(uint32_t offset, uint32_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    freeCount += count;
+
+    auto next = freeBlocks.lower_bound(offset);
+
+    //merge with the block right after
+    if (next != freeBlocks.end() && offset + count == next->first)
+    {
+        count += next->second;
+
+        next = freeBlocks.erase(next);
+    }
+
+    //and with the block right before
+    if (next != freeBlocks.begin())
+    {
+        auto previous = std::prev(next);
+
+        if (previous->first + previous->second == offset)
+        {
+            previous->second += count;
+            return;
+        }
+    }
+
+    freeBlocks[offset] = count;
+}
+
+void UGeometryArena::Init(const std::array<uint32_t, GEOMETRY_STREAM_COUNT>& capacities)
+{
+    for (uint32_t stream = 0; stream < GEOMETRY_STREAM_COUNT; stream++)
+    {
+        streams[stream].Init(capacities[stream]);
+    }
+
+    allocations.clear();
+
+    freeHandles.clear();
+
+    retiredRanges.clear();
+}
+
+GeometryHandle UGeometryArena::Allocate(const std::array<uint32_t, GEOMETRY_STREAM_COUNT>& counts)
+{
+    Allocation allocation;
+
+    for (uint32_t stream = 0; stream < GEOMETRY_STREAM_COUNT; stream++)
+    {
+        allocation.ranges[stream].count = counts[stream];
+
+        if (counts[stream] > 0 && !streams[stream].Allocate(counts[stream], allocation.ranges[stream].offset))
+        {
+            //undo the streams that fit
+            for (uint32_t i = 0; i < stream; i++)
+            {
+                streams[i].Free(allocation.ranges[i].offset, allocation.ranges[i].count);
+            }
+
+            return INVALID_GEOMETRY_HANDLE;
+        }
+    }
+
+    allocation.bLive = true;
+
+    GeometryHandle handle;
+
+    if (!freeHandles.empty())
+    {
+        handle = freeHandles.back();
+
+        freeHandles.pop_back();
+
+        allocations[handle] = allocation;
+    }
+    else
+    {
+        handle = static_cast<GeometryHandle>(allocations.size());
+
+        allocations.push_back(allocation);
+    }
+
+    return handle;
+}
+
+void UGeometryArena::Free(GeometryHandle handle, uint64_t frameNumber)
+{
+    if (handle >= allocations.size() || !allocations[handle].bLive)
+    {
+        return;
+    }
+
+    //the upload still writes the ranges and its callback still names the handle
+    if (!allocations[handle].bResident)
+    {
+        allocations[handle].bFreed = true;
+        return;
+    }
+
+    Retire(handle, frameNumber);
+}
+
+void UGeometryArena::SetResident(GeometryHandle handle, uint64_t frameNumber)
+{
+    Allocation& allocation = allocations[handle];
+
+    if (allocation.bFreed)
+    {
+        Retire(handle, frameNumber);
+        return;
+    }
+
+    allocation.bResident = true;
+}
+
+void UGeometryArena::Retire(GeometryHandle handle, uint64_t frameNumber)
+{
+    Allocation& allocation = allocations[handle];
+
+    for (uint32_t stream = 0; stream < GEOMETRY_STREAM_COUNT; stream++)
+    {
+        retiredRanges.push_back({ stream, allocation.ranges[stream], frameNumber });
+    }
+
+    allocation = Allocation();
+
+    freeHandles.push_back(handle);
+}
+
+void UGeometryArena::ReleaseRetired(uint64_t frameNumber, uint32_t framesInFlight)
+{
+    while (!retiredRanges.empty() && retiredRanges.front().frameNumber + framesInFlight <= frameNumber)
+    {
+        const RetiredRange& retired = retiredRanges.front();
+
+        streams[retired.stream].Free(retired.range.offset, retired.range.count);
+
+        retiredRanges.pop_front();
+    }
+}
+
+void UGeometryArena::Defragment(uint64_t frameNumber, const std::array<uint32_t, GEOMETRY_STREAM_COUNT>& maxCounts, std::vector<GeometryMove>& moves)
+{
+    std::vector<GeometryHandle> candidates;
+
+    for (uint32_t stream = 0; stream < GEOMETRY_STREAM_COUNT; stream++)
+    {
+        candidates.clear();
+
+        for (GeometryHandle handle = 0; handle < allocations.size(); handle++)
+        {
+            const GeometryRange& range = allocations[handle].ranges[stream];
+
+            if (allocations[handle].bResident && range.count > 0 && range.count <= maxCounts[stream])
+            {
+                candidates.push_back(handle);
+            }
+        }
+
+        //highest first, every move lowers the end of the used part of the buffer or opens a hole for a higher allocation
+        std::sort(candidates.begin(), candidates.end(), [&](GeometryHandle a, GeometryHandle b) {
+            return allocations[a].ranges[stream].offset > allocations[b].ranges[stream].offset;
+            });
+
+        for (GeometryHandle handle : candidates)
+        {
+            GeometryRange& range = allocations[handle].ranges[stream];
+
+            uint32_t newOffset;
+
+            if (!streams[stream].AllocateBelow(range.count, range.offset, newOffset))
+            {
+                continue;
+            }
+
+            moves.push_back({ stream, range.offset, newOffset, range.count });
+
+            retiredRanges.push_back({ stream, range, frameNumber });
+
+            range.offset = newOffset;
+
+            break;
+        }
+    }
+}
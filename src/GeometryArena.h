@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <deque>
+#include <map>
+
+//buffers of the geometry arena, ranges are counted in elements of each
+const uint32_t GEOMETRY_STREAM_VERTICES = 0;
+
+const uint32_t GEOMETRY_STREAM_INDICES = 1;
+
+const uint32_t GEOMETRY_STREAM_MESHLETS = 2;
+
+const uint32_t GEOMETRY_STREAM_COUNT = 3;
+
+typedef uint32_t GeometryHandle;
+
+const GeometryHandle INVALID_GEOMETRY_HANDLE = ~0u;
+
+struct GeometryRange
+{
+    uint32_t offset = 0;
+    uint32_t count = 0;
+};
+
+//copy of a range into a free block lower in the same buffer, the two never overlap
+struct GeometryMove
+{
+    uint32_t stream;
+    uint32_t srcOffset;
+    uint32_t dstOffset;
+    uint32_t count;
+};
+
+//first fit over [0, capacity), freed blocks merge with their free neighbours
+class UFreeListAllocator
+{
+public:
+    void Init(uint32_t capacity);
+
+    bool Allocate(uint32_t count, uint32_t& offset) { return AllocateBelow(count, capacity, offset); }
+
+    //lowest block holding count elements that ends at or before limit
+    bool AllocateBelow(uint32_t count, uint32_t limit, uint32_t& offset);
+
+    void Free(uint32_t offset, uint32_t count);
+
+    uint32_t GetCapacity() const { return capacity; }
+
+    uint32_t GetFreeCount() const { return freeCount; }
+
+private:
+    //offset to size of every free block
+    std::map<uint32_t, uint32_t> freeBlocks;
+
+    uint32_t capacity = 0;
+
+    uint32_t freeCount = 0;
+};
+
+//sub-allocates the vertex, index and meshlet buffers between models so they can be loaded and unloaded without recreating them
+//freed ranges are only reused once the frames in flight that may still read them are done
+//Defragment moves allocations down a step at a time, the renderer copies the data and draws from the new ranges in the same frame
+class UGeometryArena
+{
+public:
+    void Init(const std::array<uint32_t, GEOMETRY_STREAM_COUNT>& capacities);
+
+    //INVALID_GEOMETRY_HANDLE when a stream has no block large enough
+    GeometryHandle Allocate(const std::array<uint32_t, GEOMETRY_STREAM_COUNT>& counts);
+
+    //an allocation whose upload is still running is released once SetResident reports it done
+    void Free(GeometryHandle handle, uint64_t frameNumber);
+
+    //the upload finished, the allocation can be drawn and moved
+    void SetResident(GeometryHandle handle, uint64_t frameNumber);
+
+    bool IsResident(GeometryHandle handle) const { return handle < allocations.size() && allocations[handle].bResident; }
+
+    GeometryRange GetRange(GeometryHandle handle, uint32_t stream) const { return allocations[handle].ranges[stream]; }
+
+    //returns ranges retired at least framesInFlight frames ago to the free lists
+    void ReleaseRetired(uint64_t frameNumber, uint32_t framesInFlight);
+
+    //moves at most one resident allocation per stream, the highest that fits a free block below it and has at most maxCounts elements
+    //the ranges point at the new place right away, the old ones are retired
+    void Defragment(uint64_t frameNumber, const std::array<uint32_t, GEOMETRY_STREAM_COUNT>& maxCounts, std::vector<GeometryMove>& moves);
+
+    uint32_t GetCapacity(uint32_t stream) const { return streams[stream].GetCapacity(); }
+
+    uint32_t GetFreeCount(uint32_t stream) const { return streams[stream].GetFreeCount(); }
+
+private:
+    struct Allocation
+    {
+        std::array<GeometryRange, GEOMETRY_STREAM_COUNT> ranges;
+
+        bool bLive = false;
+
+        bool bResident = false;
+
+        //freed before its upload finished
+        bool bFreed = false;
+    };
+
+    struct RetiredRange
+    {
+        uint32_t stream;
+        GeometryRange range;
+        uint64_t frameNumber;
+    };
+
+    std::array<UFreeListAllocator, GEOMETRY_STREAM_COUNT> streams;
+
+    std::vector<Allocation> allocations;
+
+    std::vector<GeometryHandle> freeHandles;
+
+    std::deque<RetiredRange> retiredRanges;
+
+    void Retire(GeometryHandle handle, uint64_t frameNumber);
+};
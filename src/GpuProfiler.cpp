@@ -0,0 +1,279 @@
+#include "GpuProfiler.h"
+
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+void UGpuProfiler::Init(VkDevice device, float timestampPeriod, uint32_t timestampValidBits, bool bPipelineStatistics, uint32_t framesInFlight)
+{
+    this->device = device;
+    this->timestampPeriod = timestampPeriod;
+
+    frames.resize(framesInFlight);
+
+    //the queue can not write timestamps, scopes become no-ops
+    if (timestampValidBits == 0)
+    {
+        std::cout << "GPU timestamps not supported, the GPU profiler is disabled" << std::endl;
+        return;
+    }
+
+    timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = framesInFlight * MAX_GPU_PROFILER_SCOPES * 2;
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampQueryPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create timestamp query pool!");
+    }
+
+    vkResetQueryPool(device, timestampQueryPool, 0, queryPoolInfo.queryCount);
+
+    if (bPipelineStatistics)
+    {
+        pipelineStatisticFlags = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+        queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        queryPoolInfo.queryCount = framesInFlight * MAX_GPU_PROFILER_SCOPES;
+        queryPoolInfo.pipelineStatistics = pipelineStatisticFlags;
+
+        if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &statisticsQueryPool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create pipeline statistics query pool!");
+        }
+
+        vkResetQueryPool(device, statisticsQueryPool, 0, queryPoolInfo.queryCount);
+    }
+
+    if (!csvPath.empty())
+    {
+        csvFile.open(csvPath, std::ios::out | std::ios::trunc);
+
+        if (!csvFile.is_open())
+        {
+            throw std::runtime_error("Failed to open GPU profiler CSV file: " + csvPath);
+        }
+
+        csvFile << "frame,scope,milliseconds,vertexInvocations,fragmentInvocations" << std::endl;
+    }
+}
+
+void UGpuProfiler::Cleanup()
+{
+    if (csvFile.is_open())
+    {
+        csvFile.close();
+    }
+
+    if (statisticsQueryPool != VK_NULL_HANDLE)
+    {
+        vkDestroyQueryPool(device, statisticsQueryPool, nullptr);
+    }
+
+    if (timestampQueryPool != VK_NULL_HANDLE)
+    {
+        vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+    }
+}
+
+void UGpuProfiler::BeginFrame(uint32_t frameIndex)
+{
+    currentFrame = frameIndex;
+
+    if (!IsEnabled())
+        return;
+
+    FrameQueries& frame = frames[frameIndex];
+
+    uint32_t scopeCount = static_cast<uint32_t>(frame.scopeNames.size());
+
+    if (scopeCount > 0)
+    {
+        uint32_t firstTimestamp = frameIndex * MAX_GPU_PROFILER_SCOPES * 2;
+        uint32_t firstStatistics = frameIndex * MAX_GPU_PROFILER_SCOPES;
+
+        //value and availability per query, nothing is waited for
+        std::vector<uint64_t> timestamps(scopeCount * 2 * 2);
+
+        VkResult result = vkGetQueryPoolResults(device, timestampQueryPool, firstTimestamp, scopeCount * 2,
+            timestamps.size() * sizeof(uint64_t), timestamps.data(), 2 * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+        //statistics values in flag bit order followed by availability
+        std::vector<uint64_t> statistics(scopeCount * 3);
+
+        if (result == VK_SUCCESS && statisticsQueryPool != VK_NULL_HANDLE)
+        {
+            result = vkGetQueryPoolResults(device, statisticsQueryPool, firstStatistics, scopeCount,
+                statistics.size() * sizeof(uint64_t), statistics.data(), 3 * sizeof(uint64_t),
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        }
+
+        bool bAvailable = result == VK_SUCCESS;
+
+        for (uint32_t i = 0; i < scopeCount * 2 && bAvailable; i++)
+        {
+            bAvailable = timestamps[i * 2 + 1] != 0;
+        }
+
+        if (bAvailable)
+        {
+            results.clear();
+
+            for (uint32_t i = 0; i < scopeCount; i++)
+            {
+                uint64_t begin = timestamps[i * 4] & timestampMask;
+                uint64_t end = timestamps[i * 4 + 2] & timestampMask;
+
+                GpuScopeResult scope;
+                scope.name = frame.scopeNames[i];
+                scope.milliseconds = ((end - begin) & timestampMask) * timestampPeriod / 1000000.0;
+
+                if (statisticsQueryPool != VK_NULL_HANDLE)
+                {
+                    scope.vertexInvocations = statistics[i * 3];
+                    scope.fragmentInvocations = statistics[i * 3 + 1];
+                }
+
+                results.push_back(scope);
+            }
+
+            uint64_t frameBegin = timestamps[0] & timestampMask;
+            uint64_t frameEnd = timestamps[(scopeCount * 2 - 1) * 2] & timestampMask;
+
+            frameMilliseconds = ((frameEnd - frameBegin) & timestampMask) * timestampPeriod / 1000000.0;
+
+            results.insert(results.end(), externalResults.begin(), externalResults.end());
+            externalResults.clear();
+
+            resolvedFrameCount++;
+
+            Report();
+        }
+
+        //the fence of this frame was waited on, so the queries are no longer in use
+        vkResetQueryPool(device, timestampQueryPool, firstTimestamp, scopeCount * 2);
+
+        if (statisticsQueryPool != VK_NULL_HANDLE)
+        {
+            vkResetQueryPool(device, statisticsQueryPool, firstStatistics, scopeCount);
+        }
+
+        frame.scopeNames.clear();
+    }
+}
+
+void UGpuProfiler::BeginScope(VkCommandBuffer cmd, const char* name)
+{
+    if (!IsEnabled())
+        return;
+
+    if (bScopeOpen)
+    {
+        throw std::runtime_error("GPU profiler scopes can not nest!");
+    }
+
+    FrameQueries& frame = frames[currentFrame];
+
+    if (frame.scopeNames.size() == MAX_GPU_PROFILER_SCOPES)
+    {
+        throw std::runtime_error("Too many GPU profiler scopes in a frame!");
+    }
+
+    uint32_t scope = static_cast<uint32_t>(frame.scopeNames.size());
+
+    frame.scopeNames.push_back(name);
+
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, (currentFrame * MAX_GPU_PROFILER_SCOPES + scope) * 2);
+
+    if (statisticsQueryPool != VK_NULL_HANDLE)
+    {
+        vkCmdBeginQuery(cmd, statisticsQueryPool, currentFrame * MAX_GPU_PROFILER_SCOPES + scope, 0);
+    }
+
+    bScopeOpen = true;
+}
+
+void UGpuProfiler::EndScope(VkCommandBuffer cmd)
+{
+    if (!IsEnabled())
+        return;
+
+    uint32_t scope = static_cast<uint32_t>(frames[currentFrame].scopeNames.size()) - 1;
+
+    if (statisticsQueryPool != VK_NULL_HANDLE)
+    {
+        vkCmdEndQuery(cmd, statisticsQueryPool, currentFrame * MAX_GPU_PROFILER_SCOPES + scope);
+    }
+
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, (currentFrame * MAX_GPU_PROFILER_SCOPES + scope) * 2 + 1);
+
+    bScopeOpen = false;
+}
+
+void UGpuProfiler::AddExternalScope(const char* name, double milliseconds)
+{
+    for (GpuScopeResult& scope : externalResults)
+    {
+        if (scope.name == name)
+        {
+            scope.milliseconds += milliseconds;
+            return;
+        }
+    }
+
+    GpuScopeResult scope;
+    scope.name = name;
+    scope.milliseconds = milliseconds;
+
+    externalResults.push_back(scope);
+}
+
+const GpuScopeResult* UGpuProfiler::FindResult(const std::string& name) const
+{
+    for (const GpuScopeResult& scope : results)
+    {
+        if (scope.name == name)
+        {
+            return &scope;
+        }
+    }
+
+    return nullptr;
+}
+
+void UGpuProfiler::Report()
+{
+    if (csvFile.is_open())
+    {
+        for (const GpuScopeResult& scope : results)
+        {
+            csvFile << resolvedFrameCount << "," << scope.name << "," << scope.milliseconds << ","
+                << scope.vertexInvocations << "," << scope.fragmentInvocations << "\n";
+        }
+    }
+
+    if (logInterval == 0 || resolvedFrameCount % logInterval != 0)
+        return;
+
+    //formatted locally so the precision does not stick to std::cout
+    std::ostringstream report;
+
+    report << "GPU frame " << std::fixed << std::setprecision(3) << frameMilliseconds << " ms\n";
+
+    for (const GpuScopeResult& scope : results)
+    {
+        report << "  " << scope.name << ": " << scope.milliseconds << " ms";
+
+        if (statisticsQueryPool != VK_NULL_HANDLE && (scope.vertexInvocations > 0 || scope.fragmentInvocations > 0))
+        {
+            report << ", " << scope.vertexInvocations << " vertex / " << scope.fragmentInvocations << " fragment invocations";
+        }
+
+        report << "\n";
+    }
+
+    std::cout << report.str() << std::flush;
+}
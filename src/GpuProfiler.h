@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include "vulkan/vulkan.h"
+
+//timestamp queries per frame, every scope uses two
+const uint32_t MAX_GPU_PROFILER_SCOPES = 16;
+
+struct GpuScopeResult
+{
+    std::string name;
+    double milliseconds = 0.0;
+    //zero when pipeline statistics are not supported
+    uint64_t vertexInvocations = 0;
+    uint64_t fragmentInvocations = 0;
+};
+
+//brackets passes of a frame with timestamp and pipeline statistics queries
+//results of a frame slot are read when the slot is reused, after its fence was waited on, so reading never stalls
+//scopes can not nest since only one pipeline statistics query may be active in a command buffer
+class UGpuProfiler
+{
+public:
+    //frames between console logs, 0 disables logging
+    uint32_t logInterval = 0;
+
+    //every resolved frame is appended to this file when set
+    std::string csvPath;
+
+    void Init(VkDevice device, float timestampPeriod, uint32_t timestampValidBits, bool bPipelineStatistics, uint32_t framesInFlight);
+
+    void Cleanup();
+
+    //resolves the queries recorded the last time frameIndex was used and resets them
+    void BeginFrame(uint32_t frameIndex);
+
+    void BeginScope(VkCommandBuffer cmd, const char* name);
+
+    void EndScope(VkCommandBuffer cmd);
+
+    //time measured outside the frame's command buffer, reported with the next resolved frame
+    void AddExternalScope(const char* name, double milliseconds);
+
+    //latest resolved frame
+    const std::vector<GpuScopeResult>& GetResults() const { return results; }
+
+    //null when the scope was not recorded in the latest resolved frame
+    const GpuScopeResult* FindResult(const std::string& name) const;
+
+    //first scope begin to last scope end of the latest resolved frame
+    double GetFrameMilliseconds() const { return frameMilliseconds; }
+
+    //statistics secondary command buffers have to inherit while a scope is open
+    VkQueryPipelineStatisticFlags GetPipelineStatisticFlags() const { return pipelineStatisticFlags; }
+
+    bool IsEnabled() const { return timestampQueryPool != VK_NULL_HANDLE; }
+
+private:
+    struct FrameQueries
+    {
+        std::vector<std::string> scopeNames;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+
+    VkQueryPool statisticsQueryPool = VK_NULL_HANDLE;
+
+    VkQueryPipelineStatisticFlags pipelineStatisticFlags = 0;
+
+    float timestampPeriod = 1.0f;
+
+    uint64_t timestampMask = ~0ull;
+
+    std::vector<FrameQueries> frames;
+
+    uint32_t currentFrame = 0;
+
+    bool bScopeOpen = false;
+
+    std::vector<GpuScopeResult> results;
+
+    std::vector<GpuScopeResult> externalResults;
+
+    double frameMilliseconds = 0.0;
+
+    uint64_t resolvedFrameCount = 0;
+
+    std::ofstream csvFile;
+
+    void Report();
+};
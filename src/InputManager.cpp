@@ -1,12 +1,17 @@
 #include "InputManager.h"
 
+#include "Trace.h"
+
 #include <iostream>
 
 void InputManager::Update()
 {
+	UTRACE_FUNCTION();
+
 	bQuit = false;
 	increaseRenderDebugQuad = false;
 	increaseCameraIndex = false;
+	dumpTrace = false;
 	attack = false;
 
 
@@ -40,6 +45,10 @@ void InputManager::Update()
 			{
 				increaseRenderDebugQuad = true;
 			}
+			else if (e.key.keysym.sym == SDLK_F9)
+			{
+				dumpTrace = true;
+			}
 		}
 
 		if (e.type == SDL_MOUSEBUTTONDOWN)
@@ -19,6 +19,9 @@ public:
 	bool increaseRenderDebugQuad = false;
 	bool increaseCameraIndex = false;
 
+	//write the CPU trace after this frame
+	bool dumpTrace = false;
+
 	static InputManager& Get()
 	{
 		static InputManager instance;
@@ -0,0 +1,131 @@
+#include "JobSystem.h"
+
+#include <exception>
+#include <algorithm>
+
+static thread_local uint32_t currentThreadIndex = 0;
+
+JobSystem::JobSystem()
+{
+	uint32_t threadCount = std::thread::hardware_concurrency();
+
+	//the calling thread also works during ParallelFor
+	if (threadCount > 1)
+		threadCount--;
+
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		workers.emplace_back(&JobSystem::WorkerLoop, this, i + 1);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+		bShutdown = true;
+	}
+
+	jobsCondition.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+uint32_t JobSystem::GetThreadIndex()
+{
+	return currentThreadIndex;
+}
+
+void JobSystem::WorkerLoop(uint32_t threadIndex)
+{
+	currentThreadIndex = threadIndex;
+
+	while (true)
+	{
+		std::function<void()> job;
+
+		{
+			std::unique_lock<std::mutex> lock(jobsMutex);
+
+			jobsCondition.wait(lock, [this]() { return bShutdown || !jobs.empty(); });
+
+			if (bShutdown && jobs.empty())
+				return;
+
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		job();
+	}
+}
+
+void JobSystem::ParallelFor(uint32_t count, const std::function<void(uint32_t index)>& function)
+{
+	if (count == 0)
+		return;
+
+	std::atomic<uint32_t> nextIndex = 0;
+
+	std::mutex doneMutex;
+	std::condition_variable doneCondition;
+	uint32_t exitedCount = 0;
+
+	std::exception_ptr exception = nullptr;
+
+	uint32_t helperCount = std::min(static_cast<uint32_t>(workers.size()), count - 1);
+
+	//every participant pulls indices until the range is exhausted, so uneven jobs balance themselves
+	//the locals captured here live on this stack frame, so we wait for every participant to exit
+	auto work = [&]() {
+		while (true)
+		{
+			uint32_t index = nextIndex.fetch_add(1);
+
+			if (index >= count)
+				break;
+
+			try
+			{
+				function(index);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(doneMutex);
+
+				if (!exception)
+					exception = std::current_exception();
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(doneMutex);
+		exitedCount++;
+
+		if (exitedCount == helperCount + 1)
+			doneCondition.notify_all();
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+
+		for (uint32_t i = 0; i < helperCount; i++)
+		{
+			jobs.push_back(work);
+		}
+	}
+
+	jobsCondition.notify_all();
+
+	work();
+
+	{
+		std::unique_lock<std::mutex> lock(doneMutex);
+		doneCondition.wait(lock, [&]() { return exitedCount == helperCount + 1; });
+	}
+
+	if (exception)
+		std::rethrow_exception(exception);
+}
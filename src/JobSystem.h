@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+//fixed size worker pool for CPU heavy work like texture decode
+class JobSystem
+{
+public:
+	static JobSystem& Get()
+	{
+		static JobSystem instance;
+		return instance;
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	uint32_t GetThreadCount() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+	//0 for the main thread, 1..GetThreadCount()-1 for workers, used to index per-thread resources
+	static uint32_t GetThreadIndex();
+
+	//runs function for every index in [0, count) on the workers and the calling thread, returns when all are done
+	//the first exception thrown by a job is rethrown on the calling thread
+	void ParallelFor(uint32_t count, const std::function<void(uint32_t index)>& function);
+
+private:
+	JobSystem();
+	~JobSystem();
+
+	void WorkerLoop(uint32_t threadIndex);
+
+	std::vector<std::thread> workers;
+
+	std::deque<std::function<void()>> jobs;
+
+	std::mutex jobsMutex;
+	std::condition_variable jobsCondition;
+
+	bool bShutdown = false;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+//read only memory mapping of a whole file, pages are read in by the OS as they are touched
+class MappedFile
+{
+public:
+	MappedFile() = default;
+
+	MappedFile(const MappedFile&) = delete;
+
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile();
+
+	//returns false if the file can not be opened or is empty
+	bool Open(const std::string& path);
+
+	void Close();
+
+	const uint8_t* GetData() const { return data; }
+
+	size_t GetSize() const { return size; }
+
+private:
+	const uint8_t* data = nullptr;
+
+	size_t size = 0;
+
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+
+	void* mappingHandle = nullptr;
+#endif
+};
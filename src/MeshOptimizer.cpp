@@ -0,0 +1,475 @@
+#include "MeshOptimizer.h"
+
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+
+void MeshOptimizer::Optimize(Mesh& mesh, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t firstVertex)
+{
+	MeshLOD& base = mesh.lods[0];
+
+	uint32_t importedVertexCount = static_cast<uint32_t>(vertices.size()) - firstVertex;
+
+	if (base.indexCount == 0)
+	{
+		MeshSimplifier::Get().GenerateLODs(mesh, vertices, indices);
+		return;
+	}
+
+	float importedACMR = ComputeACMR(&indices[base.startIndex], base.indexCount, MESH_ACMR_CACHE_SIZE);
+
+	WeldVertices(vertices, &indices[base.startIndex], base.indexCount, firstVertex);
+
+	float weldedACMR = ComputeACMR(&indices[base.startIndex], base.indexCount, MESH_ACMR_CACHE_SIZE);
+
+	MeshSimplifier::Get().GenerateLODs(mesh, vertices, indices);
+
+	for (uint32_t lod = 0; lod < mesh.lodCount; lod++)
+	{
+		MeshLOD& meshLOD = mesh.lods[lod];
+
+		OptimizeVertexCache(&indices[meshLOD.startIndex], meshLOD.indexCount, firstVertex, importedVertexCount);
+
+		OptimizeOverdraw(vertices, &indices[meshLOD.startIndex], meshLOD.indexCount);
+	}
+
+	OptimizeVertexFetch(mesh, vertices, indices, firstVertex);
+
+	float optimizedACMR = ComputeACMR(&indices[base.startIndex], base.indexCount, MESH_ACMR_CACHE_SIZE);
+
+	std::cout << "Mesh ACMR: " << importedACMR << " imported, " << weldedACMR << " welded, " << optimizedACMR << " optimized ("
+		<< importedVertexCount << " -> " << vertices.size() - firstVertex << " vertices)" << std::endl;
+}
+
+float MeshOptimizer::ComputeACMR(const uint32_t* indices, uint32_t indexCount, uint32_t cacheSize)
+{
+	if (indexCount < 3)
+	{
+		return 0.0f;
+	}
+
+	uint32_t maxVertex = *std::max_element(indices, indices + indexCount);
+
+	//a vertex is cached while fewer than cacheSize misses happened since its own
+	std::vector<uint32_t> missTimestamps(maxVertex + 1, 0);
+
+	uint32_t misses = 0;
+
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		uint32_t& timestamp = missTimestamps[indices[i]];
+
+		if (timestamp == 0 || misses - timestamp >= cacheSize)
+		{
+			misses++;
+			timestamp = misses;
+		}
+	}
+
+	return static_cast<float>(misses) / (indexCount / 3);
+}
+
+void MeshOptimizer::WeldVertices(const std::vector<Vertex>& vertices, uint32_t* indices, uint32_t indexCount, uint32_t firstVertex)
+{
+	uint32_t vertexCount = static_cast<uint32_t>(vertices.size()) - firstVertex;
+
+	//sorting by contents puts identical vertices next to each other, ties keep the lowest index first
+	std::vector<uint32_t> order(vertexCount);
+	std::iota(order.begin(), order.end(), firstVertex);
+
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		int comparison = std::memcmp(&vertices[a], &vertices[b], sizeof(Vertex));
+
+		return comparison != 0 ? comparison < 0 : a < b;
+		});
+
+	std::vector<uint32_t> remap(vertexCount);
+
+	for (uint32_t i = 0; i < vertexCount; i++)
+	{
+		uint32_t vertex = order[i];
+
+		bool bDuplicate = i > 0 && std::memcmp(&vertices[order[i - 1]], &vertices[vertex], sizeof(Vertex)) == 0;
+
+		remap[vertex - firstVertex] = bDuplicate ? remap[order[i - 1] - firstVertex] : vertex;
+	}
+
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		indices[i] = remap[indices[i] - firstVertex];
+	}
+}
+
+//Forsyth's scoring, vertices near the front of the cache and with few triangles left are preferred
+static float VertexCacheScore(int cachePosition, uint32_t remainingTriangles)
+{
+	if (remainingTriangles == 0)
+	{
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+
+	if (cachePosition >= 0)
+	{
+		//the last triangle's vertices score the same so the order does not depend on its winding
+		if (cachePosition < 3)
+		{
+			score = 0.75f;
+		}
+		else
+		{
+			float scale = 1.0f / (MESH_OPTIMIZER_CACHE_SIZE - 3);
+
+			score = std::pow(1.0f - (cachePosition - 3) * scale, 1.5f);
+		}
+	}
+
+	return score + 2.0f / std::sqrt(static_cast<float>(remainingTriangles));
+}
+
+void MeshOptimizer::OptimizeVertexCache(uint32_t* indices, uint32_t indexCount, uint32_t firstVertex, uint32_t vertexCount)
+{
+	uint32_t triangleCount = indexCount / 3;
+
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	//vertex to triangles
+	std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		triangleOffsets[indices[i] - firstVertex + 1]++;
+	}
+
+	for (uint32_t i = 1; i <= vertexCount; i++)
+	{
+		triangleOffsets[i] += triangleOffsets[i - 1];
+	}
+
+	std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+
+	std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		vertexTriangles[fill[indices[i] - firstVertex]++] = i / 3;
+	}
+
+	std::vector<uint32_t> remainingTriangles(vertexCount);
+
+	std::vector<float> vertexScores(vertexCount);
+
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		remainingTriangles[v] = triangleOffsets[v + 1] - triangleOffsets[v];
+
+		vertexScores[v] = VertexCacheScore(-1, remainingTriangles[v]);
+	}
+
+	std::vector<bool> emitted(triangleCount, false);
+
+	std::vector<uint32_t> orderedIndices;
+	orderedIndices.reserve(triangleCount * 3);
+
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> newCache;
+
+	uint32_t bestTriangle = ~0u;
+
+	//fallback when nothing in the cache has triangles left, continues in input order
+	uint32_t nextUnemitted = 0;
+
+	for (uint32_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		if (bestTriangle == ~0u)
+		{
+			while (emitted[nextUnemitted])
+			{
+				nextUnemitted++;
+			}
+
+			bestTriangle = nextUnemitted;
+		}
+
+		emitted[bestTriangle] = true;
+
+		newCache.clear();
+
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			uint32_t vertex = indices[bestTriangle * 3 + corner] - firstVertex;
+
+			orderedIndices.push_back(vertex + firstVertex);
+
+			remainingTriangles[vertex]--;
+
+			newCache.push_back(vertex);
+		}
+
+		for (uint32_t vertex : cache)
+		{
+			if (std::find(newCache.begin(), newCache.begin() + 3, vertex) == newCache.begin() + 3)
+			{
+				newCache.push_back(vertex);
+			}
+		}
+
+		//vertices pushed out of the cache lose their position score
+		for (size_t i = MESH_OPTIMIZER_CACHE_SIZE; i < newCache.size(); i++)
+		{
+			vertexScores[newCache[i]] = VertexCacheScore(-1, remainingTriangles[newCache[i]]);
+		}
+
+		newCache.resize(std::min<size_t>(newCache.size(), MESH_OPTIMIZER_CACHE_SIZE));
+
+		std::swap(cache, newCache);
+
+		for (size_t i = 0; i < cache.size(); i++)
+		{
+			vertexScores[cache[i]] = VertexCacheScore(static_cast<int>(i), remainingTriangles[cache[i]]);
+		}
+
+		//only triangles touching the cache changed score, the best of them is drawn next
+		bestTriangle = ~0u;
+
+		float bestScore = -1.0f;
+
+		for (uint32_t vertex : cache)
+		{
+			for (uint32_t i = triangleOffsets[vertex]; i < triangleOffsets[vertex + 1]; i++)
+			{
+				uint32_t t = vertexTriangles[i];
+
+				if (emitted[t])
+				{
+					continue;
+				}
+
+				float score = vertexScores[indices[t * 3] - firstVertex] + vertexScores[indices[t * 3 + 1] - firstVertex] + vertexScores[indices[t * 3 + 2] - firstVertex];
+
+				if (score > bestScore)
+				{
+					bestScore = score;
+					bestTriangle = t;
+				}
+			}
+		}
+	}
+
+	std::copy(orderedIndices.begin(), orderedIndices.end(), indices);
+}
+
+void MeshOptimizer::OptimizeOverdraw(const std::vector<Vertex>& vertices, uint32_t* indices, uint32_t indexCount)
+{
+	uint32_t triangleCount = indexCount / 3;
+
+	if (triangleCount < 2)
+	{
+		return;
+	}
+
+	uint32_t maxVertex = *std::max_element(indices, indices + triangleCount * 3);
+
+	std::vector<uint32_t> missTimestamps(maxVertex + 1, 0);
+
+	uint32_t misses = 0;
+
+	//cache misses of every triangle with the FIFO cache
+	std::vector<uint32_t> triangleMisses(triangleCount, 0);
+
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		uint32_t& timestamp = missTimestamps[indices[i]];
+
+		if (timestamp == 0 || misses - timestamp >= MESH_ACMR_CACHE_SIZE)
+		{
+			misses++;
+			timestamp = misses;
+
+			triangleMisses[i / 3]++;
+		}
+	}
+
+	//hard boundaries are where the cache order starts over, a triangle missing all of its vertices
+	std::vector<uint32_t> clusterStarts;
+
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		if (t == 0 || triangleMisses[t] == 3)
+		{
+			clusterStarts.push_back(t);
+		}
+	}
+
+	clusterStarts.push_back(triangleCount);
+
+	//soft boundaries split a hard cluster once its prefix is already about as cache friendly as the whole cluster
+	//every soft cluster is measured from a cold cache, since after reordering it may follow any other cluster
+	std::vector<uint32_t> softStarts;
+
+	std::fill(missTimestamps.begin(), missTimestamps.end(), 0);
+
+	misses = 0;
+
+	for (size_t cluster = 0; cluster + 1 < clusterStarts.size(); cluster++)
+	{
+		uint32_t start = clusterStarts[cluster];
+		uint32_t end = clusterStarts[cluster + 1];
+
+		uint32_t clusterMisses = 0;
+
+		for (uint32_t t = start; t < end; t++)
+		{
+			clusterMisses += triangleMisses[t];
+		}
+
+		float clusterACMR = static_cast<float>(clusterMisses) / (end - start);
+
+		softStarts.push_back(start);
+
+		uint32_t prefixStart = start;
+		uint32_t prefixMisses = 0;
+
+		//vertices missed before the prefix started count as uncached
+		uint32_t prefixBase = misses;
+
+		for (uint32_t t = start; t < end; t++)
+		{
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				uint32_t& timestamp = missTimestamps[indices[t * 3 + corner]];
+
+				if (timestamp <= prefixBase || misses - timestamp >= MESH_ACMR_CACHE_SIZE)
+				{
+					misses++;
+					timestamp = misses;
+
+					prefixMisses++;
+				}
+			}
+
+			float prefixACMR = static_cast<float>(prefixMisses) / (t - prefixStart + 1);
+
+			if (t + 1 < end && prefixACMR <= clusterACMR * MESH_OVERDRAW_THRESHOLD)
+			{
+				softStarts.push_back(t + 1);
+
+				prefixStart = t + 1;
+				prefixMisses = 0;
+				prefixBase = misses;
+			}
+		}
+	}
+
+	softStarts.push_back(triangleCount);
+
+	uint32_t clusterCount = static_cast<uint32_t>(softStarts.size()) - 1;
+
+	std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+
+	glm::vec3 meshCentroid = glm::vec3(0.0f);
+
+	float meshArea = 0.0f;
+
+	for (uint32_t cluster = 0; cluster < clusterCount; cluster++)
+	{
+		float clusterArea = 0.0f;
+
+		for (uint32_t t = softStarts[cluster]; t < softStarts[cluster + 1]; t++)
+		{
+			const glm::vec3& p0 = vertices[indices[t * 3]].position;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+
+			float area = glm::length(normal);
+
+			clusterCentroids[cluster] += (p0 + p1 + p2) * (area / 3.0f);
+			clusterNormals[cluster] += normal;
+
+			clusterArea += area;
+		}
+
+		meshCentroid += clusterCentroids[cluster];
+		meshArea += clusterArea;
+
+		clusterCentroids[cluster] = clusterArea > 0.0f ? clusterCentroids[cluster] / clusterArea : vertices[indices[softStarts[cluster] * 3]].position;
+	}
+
+	meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : glm::vec3(0.0f);
+
+	//clusters facing away from the mesh centre occlude the rest, drawing them first lets early depth reject more
+	std::vector<float> occlusionPotentials(clusterCount);
+
+	for (uint32_t cluster = 0; cluster < clusterCount; cluster++)
+	{
+		float length = glm::length(clusterNormals[cluster]);
+
+		occlusionPotentials[cluster] = length > 0.0f ? glm::dot(clusterCentroids[cluster] - meshCentroid, clusterNormals[cluster] / length) : 0.0f;
+	}
+
+	std::vector<uint32_t> clusterOrder(clusterCount);
+	std::iota(clusterOrder.begin(), clusterOrder.end(), 0);
+
+	std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](uint32_t a, uint32_t b) { return occlusionPotentials[a] > occlusionPotentials[b]; });
+
+	std::vector<uint32_t> orderedIndices;
+	orderedIndices.reserve(triangleCount * 3);
+
+	for (uint32_t cluster : clusterOrder)
+	{
+		orderedIndices.insert(orderedIndices.end(), indices + softStarts[cluster] * 3, indices + softStarts[cluster + 1] * 3);
+	}
+
+	std::copy(orderedIndices.begin(), orderedIndices.end(), indices);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(Mesh& mesh, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t firstVertex)
+{
+	uint32_t vertexCount = static_cast<uint32_t>(vertices.size()) - firstVertex;
+
+	std::vector<uint32_t> remap(vertexCount, ~0u);
+
+	uint32_t nextVertex = 0;
+
+	for (uint32_t lod = 0; lod < mesh.lodCount; lod++)
+	{
+		const MeshLOD& meshLOD = mesh.lods[lod];
+
+		for (uint32_t i = meshLOD.startIndex; i < meshLOD.startIndex + meshLOD.indexCount; i++)
+		{
+			uint32_t& newVertex = remap[indices[i] - firstVertex];
+
+			if (newVertex == ~0u)
+			{
+				newVertex = nextVertex++;
+			}
+
+			indices[i] = firstVertex + newVertex;
+		}
+	}
+
+	std::vector<Vertex> orderedVertices(nextVertex);
+
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		if (remap[v] != ~0u)
+		{
+			orderedVertices[remap[v]] = vertices[firstVertex + v];
+		}
+	}
+
+	vertices.resize(firstVertex);
+
+	vertices.insert(vertices.end(), orderedVertices.begin(), orderedVertices.end());
+}
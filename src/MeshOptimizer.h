@@ -0,0 +1,46 @@
+#pragma once
+
+#include "CommonTypes.h"
+
+#include <vector>
+
+//cache modelled by the Forsyth triangle order, larger than the hardware so the order stays good on any of it
+const uint32_t MESH_OPTIMIZER_CACHE_SIZE = 32;
+
+//FIFO cache the reported ACMR is measured with
+const uint32_t MESH_ACMR_CACHE_SIZE = 16;
+
+//overdraw clusters may be this much worse than their cache optimal ACMR
+const float MESH_OVERDRAW_THRESHOLD = 1.05f;
+
+//import time optimisation of the vertices and index ranges of a mesh
+class MeshOptimizer
+{
+public:
+	static MeshOptimizer& Get()
+	{
+		static MeshOptimizer instance;
+		return instance;
+	}
+
+	//welds identical vertices, builds the LOD chain on the welded mesh, then reorders every level for the
+	//post transform cache and overdraw and the mesh vertices for fetch locality
+	//the vertices of the mesh must be the tail of vertices starting at firstVertex, the tail is compacted
+	void Optimize(Mesh& mesh, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t firstVertex);
+
+	//average cache misses per triangle with a FIFO cache, 3 when nothing is shared and 0.5 at best on a regular grid
+	static float ComputeACMR(const uint32_t* indices, uint32_t indexCount, uint32_t cacheSize);
+
+private:
+	//points every index at the first vertex with identical contents
+	void WeldVertices(const std::vector<Vertex>& vertices, uint32_t* indices, uint32_t indexCount, uint32_t firstVertex);
+
+	//Forsyth's linear speed vertex cache optimisation
+	void OptimizeVertexCache(uint32_t* indices, uint32_t indexCount, uint32_t firstVertex, uint32_t vertexCount);
+
+	//splits the cache optimised order into clusters and draws the outward facing ones first
+	void OptimizeOverdraw(const std::vector<Vertex>& vertices, uint32_t* indices, uint32_t indexCount);
+
+	//renumbers the vertices in first use order over all LODs and drops the welded ones
+	void OptimizeVertexFetch(Mesh& mesh, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t firstVertex);
+};
@@ -0,0 +1,502 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <queue>
+#include <unordered_map>
+
+//symmetric 4x4 matrix summing squared distances to a set of planes
+struct Quadric
+{
+	double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+	double a11 = 0, a12 = 0, a13 = 0;
+	double a22 = 0, a23 = 0;
+	double a33 = 0;
+
+	void AddPlane(const glm::dvec3& normal, double distance)
+	{
+		a00 += normal.x * normal.x; a01 += normal.x * normal.y; a02 += normal.x * normal.z; a03 += normal.x * distance;
+		a11 += normal.y * normal.y; a12 += normal.y * normal.z; a13 += normal.y * distance;
+		a22 += normal.z * normal.z; a23 += normal.z * distance;
+		a33 += distance * distance;
+	}
+
+	void Add(const Quadric& other)
+	{
+		a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+		a11 += other.a11; a12 += other.a12; a13 += other.a13;
+		a22 += other.a22; a23 += other.a23;
+		a33 += other.a33;
+	}
+
+	double Evaluate(const glm::dvec3& p) const
+	{
+		return a00 * p.x * p.x + 2.0 * a01 * p.x * p.y + 2.0 * a02 * p.x * p.z + 2.0 * a03 * p.x
+			+ a11 * p.y * p.y + 2.0 * a12 * p.y * p.z + 2.0 * a13 * p.y
+			+ a22 * p.z * p.z + 2.0 * a23 * p.z
+			+ a33;
+	}
+};
+
+//moves from onto to, entries are stale once either vertex changed after they were queued
+struct Collapse
+{
+	double cost;
+	uint32_t from;
+	uint32_t to;
+	uint32_t fromVersion;
+	uint32_t toVersion;
+
+	bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+static bool SamePosition(const Vertex& a, const Vertex& b)
+{
+	return a.position == b.position;
+}
+
+static bool PositionLess(const Vertex& a, const Vertex& b)
+{
+	if (a.position.x != b.position.x) return a.position.x < b.position.x;
+	if (a.position.y != b.position.y) return a.position.y < b.position.y;
+	return a.position.z < b.position.z;
+}
+
+static bool SameAttributes(const Vertex& a, const Vertex& b)
+{
+	return a.uv_x == b.uv_x && a.uv_y == b.uv_y && a.normal == b.normal && a.boneIndices == b.boneIndices && a.boneWeights == b.boneWeights;
+}
+
+//sum of the weight differences per bone, 0 for identical skinning and 2 for disjoint bones
+static float SkinDistance(const Vertex& a, const Vertex& b)
+{
+	float distance = 0.0f;
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (a.boneIndices[i] == -1)
+			continue;
+
+		float weight = 0.0f;
+
+		for (int j = 0; j < 4; j++)
+		{
+			if (b.boneIndices[j] == a.boneIndices[i])
+				weight = b.boneWeights[j];
+		}
+
+		distance += std::abs(a.boneWeights[i] - weight);
+	}
+
+	for (int j = 0; j < 4; j++)
+	{
+		if (b.boneIndices[j] == -1)
+			continue;
+
+		bool bShared = false;
+
+		for (int i = 0; i < 4; i++)
+		{
+			bShared |= a.boneIndices[i] == b.boneIndices[j];
+		}
+
+		if (!bShared)
+			distance += b.boneWeights[j];
+	}
+
+	return distance;
+}
+
+void MeshSimplifier::GenerateLODs(Mesh& mesh, const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	mesh.lodCount = 1;
+
+	const MeshLOD base = mesh.lods[0];
+
+	if (base.indexCount / 3 < MESH_LOD_MIN_TRIANGLES)
+	{
+		return;
+	}
+
+	glm::vec3 minBounds = glm::vec3(FLT_MAX);
+	glm::vec3 maxBounds = glm::vec3(-FLT_MAX);
+
+	for (uint32_t i = 0; i < base.indexCount; i++)
+	{
+		minBounds = glm::min(minBounds, vertices[indices[base.startIndex + i]].position);
+		maxBounds = glm::max(maxBounds, vertices[indices[base.startIndex + i]].position);
+	}
+
+	float radius = glm::length(maxBounds - minBounds) * 0.5f;
+
+	std::vector<uint32_t> baseIndices(indices.begin() + base.startIndex, indices.begin() + base.startIndex + base.indexCount);
+
+	uint32_t previousIndexCount = base.indexCount;
+
+	for (uint32_t lod = 1; lod < MAX_MESH_LODS; lod++)
+	{
+		//every level starts over from the imported triangles, simplifying a simplified level would compound the error
+		std::vector<uint32_t> lodIndices = baseIndices;
+
+		uint32_t targetIndexCount = (base.indexCount >> lod) / 3 * 3;
+
+		//levels are picked at half the screen size of the previous one, so they may be twice as wrong
+		float maxError = MESH_LOD_MAX_ERROR * radius * static_cast<float>(1u << (lod - 1));
+
+		Simplify(vertices, lodIndices, targetIndexCount, maxError);
+
+		if (lodIndices.empty() || lodIndices.size() > previousIndexCount * MESH_LOD_MIN_REDUCTION)
+		{
+			break;
+		}
+
+		MeshLOD& meshLOD = mesh.lods[lod];
+		meshLOD.startIndex = static_cast<uint32_t>(indices.size());
+		meshLOD.indexCount = static_cast<uint32_t>(lodIndices.size());
+
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+
+		previousIndexCount = meshLOD.indexCount;
+
+		mesh.lodCount = lod + 1;
+	}
+
+	std::cout << "Mesh LODs:";
+
+	for (uint32_t lod = 0; lod < mesh.lodCount; lod++)
+	{
+		std::cout << " " << mesh.lods[lod].indexCount / 3;
+	}
+
+	std::cout << " triangles" << std::endl;
+}
+
+void MeshSimplifier::Simplify(const std::vector<Vertex>& vertices, std::vector<uint32_t>& triangleIndices, uint32_t targetIndexCount, float maxError)
+{
+	//copies that only differ in attributes the simplifier ignores are welded so the triangles stay connected
+	std::vector<uint32_t> used(triangleIndices);
+
+	std::sort(used.begin(), used.end());
+	used.erase(std::unique(used.begin(), used.end()), used.end());
+
+	std::sort(used.begin(), used.end(), [&](uint32_t a, uint32_t b) {
+		if (!SamePosition(vertices[a], vertices[b]))
+			return PositionLess(vertices[a], vertices[b]);
+
+		return a < b;
+		});
+
+	//welded vertex ids, each one names the first buffer vertex that was welded into it
+	std::unordered_map<uint32_t, uint32_t> localIDs;
+	std::vector<uint32_t> globalIDs;
+	std::vector<bool> locked;
+
+	for (size_t runStart = 0; runStart < used.size();)
+	{
+		size_t runEnd = runStart + 1;
+
+		while (runEnd < used.size() && SamePosition(vertices[used[runStart]], vertices[used[runEnd]]))
+		{
+			runEnd++;
+		}
+
+		uint32_t firstLocal = static_cast<uint32_t>(globalIDs.size());
+
+		for (size_t i = runStart; i < runEnd; i++)
+		{
+			uint32_t local = firstLocal;
+
+			while (local < globalIDs.size() && !SameAttributes(vertices[globalIDs[local]], vertices[used[i]]))
+			{
+				local++;
+			}
+
+			if (local == globalIDs.size())
+			{
+				globalIDs.push_back(used[i]);
+			}
+
+			localIDs[used[i]] = local;
+		}
+
+		//one position with several attribute sets is a UV, normal or skin seam, moving it would tear the seam open
+		bool bSeam = globalIDs.size() - firstLocal > 1;
+
+		locked.resize(globalIDs.size(), bSeam);
+
+		runStart = runEnd;
+	}
+
+	uint32_t vertexCount = static_cast<uint32_t>(globalIDs.size());
+
+	std::vector<glm::dvec3> positions(vertexCount);
+
+	for (uint32_t i = 0; i < vertexCount; i++)
+	{
+		positions[i] = glm::dvec3(vertices[globalIDs[i]].position);
+	}
+
+	std::vector<uint32_t> triangles;
+	triangles.reserve(triangleIndices.size());
+
+	for (size_t i = 0; i + 2 < triangleIndices.size(); i += 3)
+	{
+		uint32_t a = localIDs[triangleIndices[i]];
+		uint32_t b = localIDs[triangleIndices[i + 1]];
+		uint32_t c = localIDs[triangleIndices[i + 2]];
+
+		if (a != b && b != c && a != c)
+		{
+			triangles.insert(triangles.end(), { a, b, c });
+		}
+	}
+
+	uint32_t triangleCount = static_cast<uint32_t>(triangles.size() / 3);
+
+	//edges used by one triangle are open borders and edges used by more are non manifold, both keep their vertices
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+
+	auto edgeKey = [](uint32_t a, uint32_t b) {
+		return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+		};
+
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		edgeUses[edgeKey(triangles[i], triangles[i / 3 * 3 + (i + 1) % 3])]++;
+	}
+
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		uint32_t a = triangles[i];
+		uint32_t b = triangles[i / 3 * 3 + (i + 1) % 3];
+
+		if (edgeUses[edgeKey(a, b)] != 2)
+		{
+			locked[a] = true;
+			locked[b] = true;
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertexCount);
+
+	std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		const uint32_t* corners = &triangles[t * 3];
+
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			vertexTriangles[corners[corner]].push_back(t);
+		}
+
+		glm::dvec3 normal = glm::cross(positions[corners[1]] - positions[corners[0]], positions[corners[2]] - positions[corners[0]]);
+
+		double length = glm::length(normal);
+
+		if (length == 0.0)
+		{
+			continue;
+		}
+
+		normal /= length;
+
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			quadrics[corners[corner]].AddPlane(normal, -glm::dot(normal, positions[corners[0]]));
+		}
+	}
+
+	std::vector<bool> triangleAlive(triangleCount, true);
+
+	std::vector<bool> removed(vertexCount, false);
+
+	std::vector<uint32_t> versions(vertexCount, 0);
+
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+
+	auto pushCollapse = [&](uint32_t from, uint32_t to) {
+		//moving a vertex onto one skinned to other bones would drag its skin along with the wrong bones
+		if (locked[from] || SkinDistance(vertices[globalIDs[from]], vertices[globalIDs[to]]) > MESH_LOD_MAX_SKIN_DISTANCE)
+		{
+			return;
+		}
+
+		Quadric quadric = quadrics[from];
+		quadric.Add(quadrics[to]);
+
+		queue.push({ quadric.Evaluate(positions[to]), from, to, versions[from], versions[to] });
+		};
+
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		uint32_t a = triangles[i];
+		uint32_t b = triangles[i / 3 * 3 + (i + 1) % 3];
+
+		pushCollapse(a, b);
+		pushCollapse(b, a);
+	}
+
+	auto gatherNeighbours = [&](uint32_t vertex, std::vector<uint32_t>& neighbours) {
+		neighbours.clear();
+
+		for (uint32_t t : vertexTriangles[vertex])
+		{
+			if (!triangleAlive[t])
+				continue;
+
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				if (triangles[t * 3 + corner] != vertex)
+					neighbours.push_back(triangles[t * 3 + corner]);
+			}
+		}
+
+		std::sort(neighbours.begin(), neighbours.end());
+		neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		};
+
+	auto triangleNormal = [&](uint32_t t, uint32_t from, uint32_t to) {
+		glm::dvec3 p[3];
+
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			uint32_t vertex = triangles[t * 3 + corner];
+
+			p[corner] = positions[vertex == from ? to : vertex];
+		}
+
+		return glm::cross(p[1] - p[0], p[2] - p[0]);
+		};
+
+	double maxCost = static_cast<double>(maxError) * maxError;
+
+	uint32_t liveTriangles = triangleCount;
+
+	std::vector<uint32_t> fromNeighbours;
+	std::vector<uint32_t> toNeighbours;
+
+	while (liveTriangles * 3 > targetIndexCount && !queue.empty())
+	{
+		Collapse collapse = queue.top();
+		queue.pop();
+
+		if (removed[collapse.from] || removed[collapse.to] || versions[collapse.from] != collapse.fromVersion || versions[collapse.to] != collapse.toVersion)
+		{
+			continue;
+		}
+
+		if (collapse.cost > maxCost)
+		{
+			break;
+		}
+
+		//an edge whose ends share more than the two opposite vertices would pinch the surface into a non manifold fold
+		gatherNeighbours(collapse.from, fromNeighbours);
+		gatherNeighbours(collapse.to, toNeighbours);
+
+		uint32_t sharedNeighbours = 0;
+
+		for (size_t i = 0, j = 0; i < fromNeighbours.size() && j < toNeighbours.size();)
+		{
+			if (fromNeighbours[i] < toNeighbours[j]) i++;
+			else if (fromNeighbours[i] > toNeighbours[j]) j++;
+			else { sharedNeighbours++; i++; j++; }
+		}
+
+		if (sharedNeighbours > 2)
+		{
+			continue;
+		}
+
+		//triangles that keep existing must not flip or shrink to nothing
+		bool bFlips = false;
+
+		for (uint32_t t : vertexTriangles[collapse.from])
+		{
+			const uint32_t* corners = &triangles[t * 3];
+
+			if (!triangleAlive[t] || corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+			{
+				continue;
+			}
+
+			if (glm::dot(triangleNormal(t, ~0u, ~0u), triangleNormal(t, collapse.from, collapse.to)) <= 0.0)
+			{
+				bFlips = true;
+				break;
+			}
+		}
+
+		if (bFlips)
+		{
+			continue;
+		}
+
+		for (uint32_t t : vertexTriangles[collapse.from])
+		{
+			uint32_t* corners = &triangles[t * 3];
+
+			if (!triangleAlive[t])
+			{
+				continue;
+			}
+
+			if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+			{
+				triangleAlive[t] = false;
+				liveTriangles--;
+				continue;
+			}
+
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				if (corners[corner] == collapse.from)
+					corners[corner] = collapse.to;
+			}
+
+			vertexTriangles[collapse.to].push_back(t);
+		}
+
+		vertexTriangles[collapse.from].clear();
+
+		quadrics[collapse.to].Add(quadrics[collapse.from]);
+
+		removed[collapse.from] = true;
+
+		versions[collapse.to]++;
+
+		std::vector<uint32_t>& toTriangles = vertexTriangles[collapse.to];
+
+		toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(), [&](uint32_t t) { return !triangleAlive[t]; }), toTriangles.end());
+
+		for (uint32_t t : toTriangles)
+		{
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				uint32_t vertex = triangles[t * 3 + corner];
+
+				if (vertex != collapse.to)
+				{
+					pushCollapse(collapse.to, vertex);
+					pushCollapse(vertex, collapse.to);
+				}
+			}
+		}
+	}
+
+	triangleIndices.clear();
+
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		if (!triangleAlive[t])
+			continue;
+
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			triangleIndices.push_back(globalIDs[triangles[t * 3 + corner]]);
+		}
+	}
+}
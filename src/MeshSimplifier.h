@@ -0,0 +1,37 @@
+#pragma once
+
+#include "CommonTypes.h"
+
+#include <vector>
+
+//meshes below this are drawn at full detail only
+const uint32_t MESH_LOD_MIN_TRIANGLES = 256;
+
+//largest collapse error allowed for LOD 1, relative to the mesh bounding radius, doubled for every further level
+const float MESH_LOD_MAX_ERROR = 0.02f;
+
+//vertices whose bone weights differ by more than this are never collapsed onto each other
+const float MESH_LOD_MAX_SKIN_DISTANCE = 0.5f;
+
+//a level that keeps more of the previous one than this is not worth its index range and ends the chain
+const float MESH_LOD_MIN_REDUCTION = 0.8f;
+
+//quadric edge collapse, builds the LOD chain of a mesh at import time
+class MeshSimplifier
+{
+public:
+	static MeshSimplifier& Get()
+	{
+		static MeshSimplifier instance;
+		return instance;
+	}
+
+	//appends simplified copies of LOD 0 to indices, each aiming at half the triangles of the previous level
+	//collapses only move vertices onto existing neighbours, so the vertex buffer and the skinning data are untouched
+	void GenerateLODs(Mesh& mesh, const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+private:
+	//removes triangles from the list until targetIndexCount is reached or the next collapse costs more than maxError
+	//UV, normal and skin seams and open borders are locked in place
+	void Simplify(const std::vector<Vertex>& vertices, std::vector<uint32_t>& triangleIndices, uint32_t targetIndexCount, float maxError);
+};
@@ -0,0 +1,285 @@
+#include "MeshletBuilder.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+void MeshletBuilder::Build(MeshLOD& lod, const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<Meshlet>& meshlets)
+{
+	lod.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+
+	uint32_t triangleCount = lod.indexCount / 3;
+
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	std::vector<bool> emitted(triangleCount, false);
+
+	//triangle order after clustering, written back over the LOD range
+	std::vector<uint32_t> clusteredIndices;
+	clusteredIndices.reserve(lod.indexCount);
+
+	//vertex to triangles, so a meshlet grows through its neighbours before falling back to index order
+	std::vector<uint32_t> adjacencyOffsets;
+	std::vector<uint32_t> adjacency;
+
+	uint32_t minVertex = ~0u;
+	uint32_t maxVertex = 0;
+
+	for (uint32_t i = 0; i < lod.indexCount; i++)
+	{
+		minVertex = std::min(minVertex, indices[lod.startIndex + i]);
+		maxVertex = std::max(maxVertex, indices[lod.startIndex + i]);
+	}
+
+	adjacencyOffsets.assign(maxVertex - minVertex + 2, 0);
+
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		adjacencyOffsets[indices[lod.startIndex + i] - minVertex + 1]++;
+	}
+
+	for (size_t i = 1; i < adjacencyOffsets.size(); i++)
+	{
+		adjacencyOffsets[i] += adjacencyOffsets[i - 1];
+	}
+
+	adjacency.resize(triangleCount * 3);
+
+	std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		adjacency[fill[indices[lod.startIndex + i] - minVertex]++] = i / 3;
+	}
+
+	uint32_t nextSeed = 0;
+
+	while (true)
+	{
+		while (nextSeed < triangleCount && emitted[nextSeed])
+		{
+			nextSeed++;
+		}
+
+		if (nextSeed == triangleCount)
+		{
+			break;
+		}
+
+		Meshlet meshlet{};
+		meshlet.firstIndex = lod.startIndex + static_cast<uint32_t>(clusteredIndices.size());
+
+		uint32_t meshletVertices[MESHLET_MAX_VERTICES];
+		uint32_t vertexCount = 0;
+		uint32_t meshletTriangles = 0;
+
+		//candidate triangles sharing a vertex with the meshlet, seeded with the first unused one
+		std::vector<uint32_t> candidates = { nextSeed };
+
+		auto countNewVertices = [&](uint32_t triangle) {
+			const uint32_t* triangleIndices = &indices[lod.startIndex + triangle * 3];
+
+			uint32_t newVertices = 0;
+
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				if (std::find(meshletVertices, meshletVertices + vertexCount, triangleIndices[corner]) == meshletVertices + vertexCount)
+				{
+					newVertices++;
+				}
+			}
+
+			return newVertices;
+			};
+
+		while (!candidates.empty() && meshletTriangles < MESHLET_MAX_TRIANGLES)
+		{
+			//the candidate adding the fewest vertices keeps the meshlet compact
+			size_t best = 0;
+			uint32_t bestNewVertices = 4;
+
+			for (size_t i = 0; i < candidates.size() && bestNewVertices > 0; i++)
+			{
+				uint32_t newVertices = emitted[candidates[i]] ? 4 : countNewVertices(candidates[i]);
+
+				if (newVertices < bestNewVertices)
+				{
+					best = i;
+					bestNewVertices = newVertices;
+				}
+			}
+
+			uint32_t triangle = candidates[best];
+
+			candidates[best] = candidates.back();
+			candidates.pop_back();
+
+			if (emitted[triangle] || vertexCount + bestNewVertices > MESHLET_MAX_VERTICES)
+			{
+				//every remaining candidate is either used or would overflow the vertex limit
+				if (!emitted[triangle])
+				{
+					break;
+				}
+
+				continue;
+			}
+
+			const uint32_t* triangleIndices = &indices[lod.startIndex + triangle * 3];
+
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				uint32_t vertex = triangleIndices[corner];
+
+				if (std::find(meshletVertices, meshletVertices + vertexCount, vertex) == meshletVertices + vertexCount)
+				{
+					meshletVertices[vertexCount++] = vertex;
+				}
+
+				clusteredIndices.push_back(vertex);
+
+				for (uint32_t j = adjacencyOffsets[vertex - minVertex]; j < adjacencyOffsets[vertex - minVertex + 1]; j++)
+				{
+					if (!emitted[adjacency[j]])
+					{
+						candidates.push_back(adjacency[j]);
+					}
+				}
+			}
+
+			emitted[triangle] = true;
+
+			meshletTriangles++;
+
+			//disconnected pieces continue from index order
+			if (candidates.empty() && meshletTriangles < MESHLET_MAX_TRIANGLES)
+			{
+				while (nextSeed < triangleCount && emitted[nextSeed])
+				{
+					nextSeed++;
+				}
+
+				if (nextSeed < triangleCount)
+				{
+					candidates.push_back(nextSeed);
+				}
+			}
+		}
+
+		meshlet.indexCount = meshletTriangles * 3;
+
+		meshlets.push_back(meshlet);
+	}
+
+	std::copy(clusteredIndices.begin(), clusteredIndices.end(), indices.begin() + lod.startIndex);
+
+	lod.meshletCount = static_cast<uint32_t>(meshlets.size()) - lod.firstMeshlet;
+
+	for (uint32_t i = lod.firstMeshlet; i < meshlets.size(); i++)
+	{
+		ComputeBounds(meshlets[i], vertices, indices);
+	}
+}
+
+void MeshletBuilder::ComputeBounds(Meshlet& meshlet, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	glm::vec3 minPosition = glm::vec3(FLT_MAX);
+	glm::vec3 maxPosition = glm::vec3(-FLT_MAX);
+
+	for (uint32_t i = 0; i < meshlet.indexCount; i++)
+	{
+		const glm::vec3& position = vertices[indices[meshlet.firstIndex + i]].position;
+
+		minPosition = glm::min(minPosition, position);
+		maxPosition = glm::max(maxPosition, position);
+	}
+
+	meshlet.center = (minPosition + maxPosition) * 0.5f;
+	meshlet.radius = 0.0f;
+
+	for (uint32_t i = 0; i < meshlet.indexCount; i++)
+	{
+		meshlet.radius = std::max(meshlet.radius, glm::length(vertices[indices[meshlet.firstIndex + i]].position - meshlet.center));
+	}
+
+	//normal cone from the face normals, a cutoff above 1 never culls
+	std::vector<glm::vec3> normals;
+
+	glm::vec3 axis = glm::vec3(0.0f);
+
+	for (uint32_t i = 0; i < meshlet.indexCount; i += 3)
+	{
+		const glm::vec3& p0 = vertices[indices[meshlet.firstIndex + i]].position;
+		const glm::vec3& p1 = vertices[indices[meshlet.firstIndex + i + 1]].position;
+		const glm::vec3& p2 = vertices[indices[meshlet.firstIndex + i + 2]].position;
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+
+		float area = glm::length(normal);
+
+		//degenerate triangles have no facing
+		if (area <= 1e-12f)
+		{
+			normals.push_back(glm::vec3(0.0f));
+			continue;
+		}
+
+		normals.push_back(normal / area);
+
+		axis += normal / area;
+	}
+
+	meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.coneApex = meshlet.center;
+	meshlet.coneCutoff = 2.0f;
+
+	float axisLength = glm::length(axis);
+
+	if (axisLength <= 1e-6f)
+	{
+		return;
+	}
+
+	axis /= axisLength;
+
+	float minDot = 1.0f;
+
+	for (const glm::vec3& normal : normals)
+	{
+		if (normal != glm::vec3(0.0f))
+		{
+			minDot = std::min(minDot, glm::dot(normal, axis));
+		}
+	}
+
+	//cones of 90 degrees or wider can be seen from the front from anywhere
+	if (minDot <= 0.1f)
+	{
+		return;
+	}
+
+	//move the apex back until every triangle plane is in front of it
+	float maxT = 0.0f;
+
+	for (uint32_t i = 0, triangle = 0; i < meshlet.indexCount; i += 3, triangle++)
+	{
+		if (normals[triangle] == glm::vec3(0.0f))
+		{
+			continue;
+		}
+
+		const glm::vec3& p0 = vertices[indices[meshlet.firstIndex + i]].position;
+
+		float dc = glm::dot(meshlet.center - p0, normals[triangle]);
+		float dn = glm::dot(axis, normals[triangle]);
+
+		maxT = std::max(maxT, dc / dn);
+	}
+
+	meshlet.coneAxis = axis;
+	meshlet.coneApex = meshlet.center - axis * maxT;
+	meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "CommonTypes.h"
+
+#include <vector>
+
+//cluster limits, small enough for tight bounds and normal cones
+const uint32_t MESHLET_MAX_VERTICES = 64;
+
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+//splits mesh index ranges into meshlets at import time
+class MeshletBuilder
+{
+public:
+	static MeshletBuilder& Get()
+	{
+		static MeshletBuilder instance;
+		return instance;
+	}
+
+	//reorders the triangles of the LOD range so every meshlet is contiguous and appends the meshlets
+	void Build(MeshLOD& lod, const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<Meshlet>& meshlets);
+
+private:
+	void ComputeBounds(Meshlet& meshlet, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+};
@@ -0,0 +1,685 @@
+#include "ModelCooker.h"
+
+#include "AssetImporter.h"
+
+#include "MeshletBuilder.h"
+
+#include "MappedFile.h"
+
+#include "SceneTypes.h"
+
+#include "Trace.h"
+
+#include "json.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+
+using json = nlohmann::json;
+
+namespace
+{
+	const char COOKED_MODEL_MAGIC[4] = { 'U', 'M', 'D', 'L' };
+
+	const uint32_t COOKED_ROOT_NODE = ~0u;
+
+	uint64_t AlignSection(uint64_t offset)
+	{
+		return (offset + 15) & ~uint64_t(15);
+	}
+
+	//collects the sections of a cooked model before they are written out
+	struct CookedModelWriter
+	{
+		std::vector<uint8_t> sections[COOKED_MODEL_SECTION_COUNT];
+
+		//returns the byte offset of the records in the section
+		template<typename T>
+		uint64_t Append(uint32_t section, const T* records, size_t count)
+		{
+			std::vector<uint8_t>& data = sections[section];
+
+			uint64_t offset = data.size();
+
+			data.insert(data.end(), reinterpret_cast<const uint8_t*>(records), reinterpret_cast<const uint8_t*>(records + count));
+
+			return offset;
+		}
+
+		CookedString AddString(const std::string& value)
+		{
+			CookedString string{ static_cast<uint32_t>(sections[COOKED_MODEL_STRINGS].size()), static_cast<uint32_t>(value.size()) };
+
+			Append(COOKED_MODEL_STRINGS, value.data(), value.size());
+
+			return string;
+		}
+
+		void AddNodes(const SceneNode* node, uint32_t parent)
+		{
+			CookedNode cooked{};
+			cooked.name = AddString(node->name);
+			cooked.parent = parent;
+			cooked.localTransform = node->localTransform;
+			cooked.globalTransform = node->globalTransform;
+
+			uint32_t index = static_cast<uint32_t>(sections[COOKED_MODEL_NODES].size() / sizeof(CookedNode));
+
+			Append(COOKED_MODEL_NODES, &cooked, 1);
+
+			for (const SceneNode* child : node->children)
+			{
+				AddNodes(child, index);
+			}
+		}
+	};
+
+	//views the sections of a mapped cooked model, a range outside of the file clears bValid
+	struct CookedModelReader
+	{
+		std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+
+		CookedModelHeader header{};
+
+		bool bValid = true;
+
+		template<typename T>
+		const T* GetRecords(uint32_t section, uint32_t& count)
+		{
+			const CookedSection& range = header.sections[section];
+
+			count = 0;
+
+			if (range.offset % 16 != 0 || range.offset > file->GetSize() || range.size > file->GetSize() - range.offset || range.size % sizeof(T) != 0)
+			{
+				bValid = false;
+				return nullptr;
+			}
+
+			count = static_cast<uint32_t>(range.size / sizeof(T));
+
+			return reinterpret_cast<const T*>(file->GetData() + range.offset);
+		}
+
+		std::string GetString(CookedString string)
+		{
+			uint32_t size;
+			const char* strings = GetRecords<char>(COOKED_MODEL_STRINGS, size);
+
+			if (static_cast<uint64_t>(string.offset) + string.length > size)
+			{
+				bValid = false;
+				return std::string();
+			}
+
+			return std::string(strings + string.offset, string.length);
+		}
+
+		//keys are copied out, the animation system keeps them after the file is unmapped
+		template<typename T>
+		void GetKeys(uint64_t offset, uint32_t count, std::vector<T>& keys)
+		{
+			uint32_t size;
+			const uint8_t* data = GetRecords<uint8_t>(COOKED_MODEL_KEYS, size);
+
+			if (offset > size || static_cast<uint64_t>(count) * sizeof(T) > size - offset)
+			{
+				bValid = false;
+				return;
+			}
+
+			keys.resize(count);
+
+			memcpy(keys.data(), data + offset, count * sizeof(T));
+		}
+
+		void GetAnimations(std::unordered_map<std::string, Animation>& animations, const std::string& name)
+		{
+			uint32_t animationCount, channelCount;
+			const CookedAnimation* cookedAnimations = GetRecords<CookedAnimation>(COOKED_MODEL_ANIMATIONS, animationCount);
+			const CookedChannel* cookedChannels = GetRecords<CookedChannel>(COOKED_MODEL_CHANNELS, channelCount);
+
+			for (uint32_t i = 0; i < animationCount && bValid; i++)
+			{
+				const CookedAnimation& cooked = cookedAnimations[i];
+
+				if (static_cast<uint64_t>(cooked.firstChannel) + cooked.channelCount > channelCount)
+				{
+					bValid = false;
+					return;
+				}
+
+				Animation animation;
+				animation.name = GetString(cooked.name);
+				animation.duration = cooked.duration;
+				animation.ticksPerSecond = cooked.ticksPerSecond;
+
+				for (uint32_t j = 0; j < cooked.channelCount; j++)
+				{
+					const CookedChannel& cookedChannel = cookedChannels[cooked.firstChannel + j];
+
+					AnimationChannel channel;
+					channel.nodeName = GetString(cookedChannel.nodeName);
+
+					GetKeys(cookedChannel.positionKeys, cookedChannel.positionKeyCount, channel.positionKeys);
+					GetKeys(cookedChannel.rotationKeys, cookedChannel.rotationKeyCount, channel.rotationKeys);
+					GetKeys(cookedChannel.scalingKeys, cookedChannel.scalingKeyCount, channel.scalingKeys);
+
+					animation.channels[channel.nodeName] = std::move(channel);
+				}
+
+				//like the importer, a given name is used for every animation of the file
+				std::string animationName = name.empty() ? animation.name : name;
+
+				animations[animationName] = std::move(animation);
+			}
+		}
+	};
+
+	bool IsNewer(const std::string& path, const std::string& cookedPath)
+	{
+		std::error_code error;
+
+		return std::filesystem::exists(path, error) && std::filesystem::last_write_time(path, error) > std::filesystem::last_write_time(cookedPath, error);
+	}
+
+	//maps the cooked file of sourcePath and checks its header, false without logging if there is none
+	bool OpenCookedModel(const std::string& sourcePath, CookedModelReader& reader)
+	{
+		std::string cookedPath = ModelCooker::GetCookedPath(sourcePath);
+
+		std::error_code error;
+
+		if (!std::filesystem::exists(cookedPath, error))
+		{
+			return false;
+		}
+
+		if (IsNewer(sourcePath, cookedPath))
+		{
+			std::cout << "Cooked model is out of date, loading source: " << sourcePath << std::endl;
+			return false;
+		}
+
+		if (!reader.file->Open(cookedPath) || reader.file->GetSize() < sizeof(CookedModelHeader))
+		{
+			std::cout << "Invalid cooked model: " << cookedPath << std::endl;
+			return false;
+		}
+
+		memcpy(&reader.header, reader.file->GetData(), sizeof(CookedModelHeader));
+
+		if (memcmp(reader.header.magic, COOKED_MODEL_MAGIC, 4) != 0 || reader.header.version != COOKED_MODEL_VERSION
+			|| reader.header.meshSize != sizeof(Mesh) || reader.header.vertexSize != sizeof(Vertex) || reader.header.meshletSize != sizeof(Meshlet))
+		{
+			std::cout << "Invalid cooked model: " << cookedPath << std::endl;
+			return false;
+		}
+
+		for (uint32_t section = 0; section < COOKED_MODEL_SECTION_COUNT; section++)
+		{
+			uint32_t size;
+			reader.GetRecords<uint8_t>(section, size);
+		}
+
+		if (!reader.bValid)
+		{
+			std::cout << "Truncated cooked model: " << cookedPath << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	void DestroyNodes(SceneNode* node)
+	{
+		if (node == nullptr)
+		{
+			return;
+		}
+
+		for (SceneNode* child : node->children)
+		{
+			DestroyNodes(child);
+		}
+
+		delete node;
+	}
+}
+
+std::string ModelCooker::GetCookedPath(const std::string& modelPath)
+{
+	return "cooked/" + std::filesystem::path(modelPath).replace_extension(".umdl").generic_string();
+}
+
+void ModelCooker::CookScene(const std::string& scenePath)
+{
+	std::ifstream file(scenePath);
+	json scene = json::parse(file);
+
+	//SceneManager::LoadScene imports the models in the same order into an empty texture list
+	std::vector<std::string> texturePaths;
+
+	std::vector<std::string> cookedPaths;
+
+	int cooked = 0;
+
+	for (auto& modelData : scene["assets"]["models"])
+	{
+		Model model;
+		model.name = modelData["name"];
+		model.customMaterialTextures = modelData.contains("customMaterialTextures");
+
+		std::string path = modelData["file"];
+
+		AssetImporter::Get().LoadModelFromFile(path.c_str(), model, model.vertices, model.indices, texturePaths);
+
+		for (Mesh& mesh : model.meshes)
+		{
+			for (uint32_t lod = 0; lod < mesh.lodCount; lod++)
+			{
+				MeshletBuilder::Get().Build(mesh.lods[lod], model.vertices, model.indices, model.meshlets);
+			}
+		}
+
+		if (CookModel(path, model, texturePaths))
+		{
+			cooked++;
+		}
+
+		cookedPaths.push_back(path);
+
+		DestroyNodes(model.sceneRoot);
+	}
+
+	for (auto& animationData : scene["assets"]["animations"])
+	{
+		std::string path = animationData["file"];
+
+		//a model file already carries its animations, an animation only file must not replace it
+		if (std::find(cookedPaths.begin(), cookedPaths.end(), path) != cookedPaths.end())
+		{
+			continue;
+		}
+
+		Model model;
+
+		AssetImporter::Get().LoadAnimatonToModel(path.c_str(), model, "");
+
+		if (CookModel(path, model, texturePaths))
+		{
+			cooked++;
+		}
+
+		cookedPaths.push_back(path);
+	}
+
+	std::cout << "Cooked " << cooked << "/" << cookedPaths.size() << " models and animations" << std::endl;
+}
+
+bool ModelCooker::CookModel(const std::string& modelPath, const Model& model, const std::vector<std::string>& texturePaths)
+{
+	CookedModelWriter writer;
+
+	writer.Append(COOKED_MODEL_MESHES, model.meshes.data(), model.meshes.size());
+
+	//textures in the order the meshes first use them, the order a load appends the missing ones in
+	std::vector<int32_t> textureIDs;
+
+	for (const Mesh& mesh : model.meshes)
+	{
+		if (mesh.diffuseTextureID < 0 || std::find(textureIDs.begin(), textureIDs.end(), mesh.diffuseTextureID) != textureIDs.end())
+		{
+			continue;
+		}
+
+		textureIDs.push_back(mesh.diffuseTextureID);
+
+		CookedMaterial material{};
+		material.textureID = mesh.diffuseTextureID;
+		material.texturePath = writer.AddString(texturePaths[mesh.diffuseTextureID]);
+
+		writer.Append(COOKED_MODEL_MATERIALS, &material, 1);
+	}
+
+	if (model.sceneRoot != nullptr)
+	{
+		writer.AddNodes(model.sceneRoot, COOKED_ROOT_NODE);
+	}
+
+	std::vector<const Bone*> bones;
+
+	for (auto& [boneName, bone] : model.boneMap)
+	{
+		bones.push_back(&bone);
+	}
+
+	std::sort(bones.begin(), bones.end(), [](const Bone* a, const Bone* b) { return a->boneIndex < b->boneIndex; });
+
+	for (const Bone* bone : bones)
+	{
+		CookedBone cooked{};
+		cooked.name = writer.AddString(bone->name);
+		cooked.boneIndex = bone->boneIndex;
+		cooked.offsetMatrix = bone->offsetMatrix;
+
+		writer.Append(COOKED_MODEL_BONES, &cooked, 1);
+	}
+
+	uint32_t channelCount = 0;
+
+	for (auto& [animationName, animation] : model.animations)
+	{
+		CookedAnimation cooked{};
+		cooked.name = writer.AddString(animationName);
+		cooked.firstChannel = channelCount;
+		cooked.channelCount = static_cast<uint32_t>(animation.channels.size());
+		cooked.duration = animation.duration;
+		cooked.ticksPerSecond = animation.ticksPerSecond;
+
+		writer.Append(COOKED_MODEL_ANIMATIONS, &cooked, 1);
+
+		for (auto& [nodeName, channel] : animation.channels)
+		{
+			CookedChannel cookedChannel{};
+			cookedChannel.nodeName = writer.AddString(nodeName);
+			cookedChannel.positionKeyCount = static_cast<uint32_t>(channel.positionKeys.size());
+			cookedChannel.rotationKeyCount = static_cast<uint32_t>(channel.rotationKeys.size());
+			cookedChannel.scalingKeyCount = static_cast<uint32_t>(channel.scalingKeys.size());
+			cookedChannel.positionKeys = writer.Append(COOKED_MODEL_KEYS, channel.positionKeys.data(), channel.positionKeys.size());
+			cookedChannel.rotationKeys = writer.Append(COOKED_MODEL_KEYS, channel.rotationKeys.data(), channel.rotationKeys.size());
+			cookedChannel.scalingKeys = writer.Append(COOKED_MODEL_KEYS, channel.scalingKeys.data(), channel.scalingKeys.size());
+
+			writer.Append(COOKED_MODEL_CHANNELS, &cookedChannel, 1);
+		}
+
+		channelCount += cooked.channelCount;
+	}
+
+	writer.Append(COOKED_MODEL_VERTICES, model.vertices.data(), model.vertices.size());
+	writer.Append(COOKED_MODEL_INDICES, model.indices.data(), model.indices.size());
+	writer.Append(COOKED_MODEL_MESHLETS, model.meshlets.data(), model.meshlets.size());
+
+	CookedModelHeader header{};
+	memcpy(header.magic, COOKED_MODEL_MAGIC, 4);
+	header.version = COOKED_MODEL_VERSION;
+	header.customMaterialTextures = model.customMaterialTextures ? 1 : 0;
+	header.lodCount = model.lodCount;
+	header.meshSize = sizeof(Mesh);
+	header.vertexSize = sizeof(Vertex);
+	header.meshletSize = sizeof(Meshlet);
+	header.boundsCenter = model.boundsCenter;
+	header.boundsRadius = model.boundsRadius;
+	header.boundsMin = glm::vec4(model.boundsMin, 0.0f);
+	header.boundsMax = glm::vec4(model.boundsMax, 0.0f);
+
+	uint64_t offset = AlignSection(sizeof(CookedModelHeader));
+
+	for (uint32_t section = 0; section < COOKED_MODEL_SECTION_COUNT; section++)
+	{
+		header.sections[section].offset = offset;
+		header.sections[section].size = writer.sections[section].size();
+
+		offset = AlignSection(offset + header.sections[section].size);
+	}
+
+	std::string cookedPath = GetCookedPath(modelPath);
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(cookedPath).parent_path(), error);
+
+	std::ofstream file(cookedPath, std::ios::out | std::ios::binary | std::ios::trunc);
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	const char zeros[16] = {};
+
+	uint64_t written = sizeof(header);
+
+	for (uint32_t section = 0; section < COOKED_MODEL_SECTION_COUNT; section++)
+	{
+		file.write(zeros, header.sections[section].offset - written);
+		file.write(reinterpret_cast<const char*>(writer.sections[section].data()), writer.sections[section].size());
+
+		written = header.sections[section].offset + header.sections[section].size;
+	}
+
+	if (!file)
+	{
+		std::cout << "Failed to write cooked model: " << cookedPath << std::endl;
+		return false;
+	}
+
+	std::cout << "Cooked " << modelPath << " -> " << cookedPath << " (" << model.meshes.size() << " meshes, " << model.vertices.size() << " vertices, "
+		<< model.indices.size() / 3 << " triangles, " << model.animations.size() << " animations, " << written / 1024 << " KB)" << std::endl;
+
+	return true;
+}
+
+bool ModelCooker::LoadCookedModel(const std::string& modelPath, Model& model, std::vector<std::string>& texturePaths)
+{
+	UTRACE_FUNCTION();
+
+	CookedModelReader reader;
+
+	if (!OpenCookedModel(modelPath, reader))
+	{
+		return false;
+	}
+
+	std::string cookedPath = GetCookedPath(modelPath);
+
+	//material texture references come from the config instead of the file
+	if (model.customMaterialTextures && IsNewer("config/CustomMaterialTextures.json", cookedPath))
+	{
+		std::cout << "Cooked model is out of date, loading source: " << modelPath << std::endl;
+		return false;
+	}
+
+	if ((reader.header.customMaterialTextures != 0) != model.customMaterialTextures)
+	{
+		std::cout << "Cooked model was cooked with other material textures, loading source: " << modelPath << std::endl;
+		return false;
+	}
+
+	uint32_t meshCount, materialCount, nodeCount, boneCount;
+	const Mesh* meshes = reader.GetRecords<Mesh>(COOKED_MODEL_MESHES, meshCount);
+	const CookedMaterial* materials = reader.GetRecords<CookedMaterial>(COOKED_MODEL_MATERIALS, materialCount);
+	const CookedNode* nodes = reader.GetRecords<CookedNode>(COOKED_MODEL_NODES, nodeCount);
+	const CookedBone* bones = reader.GetRecords<CookedBone>(COOKED_MODEL_BONES, boneCount);
+
+	GeometrySource geometry;
+	geometry.vertices = reader.GetRecords<Vertex>(COOKED_MODEL_VERTICES, geometry.vertexCount);
+	geometry.indices = reader.GetRecords<uint32_t>(COOKED_MODEL_INDICES, geometry.indexCount);
+	geometry.meshlets = reader.GetRecords<Meshlet>(COOKED_MODEL_MESHLETS, geometry.meshletCount);
+
+	//the renderer trusts the ranges, a damaged file is rejected here
+	for (uint32_t i = 0; i < meshCount && reader.bValid; i++)
+	{
+		reader.bValid = meshes[i].lodCount >= 1 && meshes[i].lodCount <= MAX_MESH_LODS;
+
+		for (uint32_t lod = 0; lod < meshes[i].lodCount && reader.bValid; lod++)
+		{
+			const MeshLOD& range = meshes[i].lods[lod];
+
+			reader.bValid = static_cast<uint64_t>(range.startIndex) + range.indexCount <= geometry.indexCount
+				&& static_cast<uint64_t>(range.firstMeshlet) + range.meshletCount <= geometry.meshletCount;
+		}
+	}
+
+	for (uint32_t i = 0; i < geometry.meshletCount && reader.bValid; i++)
+	{
+		reader.bValid = static_cast<uint64_t>(geometry.meshlets[i].firstIndex) + geometry.meshlets[i].indexCount <= geometry.indexCount;
+	}
+
+	//touches every index page of the mapping, the upload reads them right after so they stay in the page cache
+	for (uint32_t i = 0; i < geometry.indexCount && reader.bValid; i++)
+	{
+		reader.bValid = geometry.indices[i] < geometry.vertexCount;
+	}
+
+	std::vector<SceneNode*> sceneNodes(nodeCount);
+
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		sceneNodes[i] = new SceneNode();
+		sceneNodes[i]->name = reader.GetString(nodes[i].name);
+		sceneNodes[i]->localTransform = nodes[i].localTransform;
+		sceneNodes[i]->globalTransform = nodes[i].globalTransform;
+
+		//parents come first, anything else is a damaged file
+		if ((i == 0) != (nodes[i].parent == COOKED_ROOT_NODE) || (i > 0 && nodes[i].parent >= i))
+		{
+			reader.bValid = false;
+		}
+		else if (i > 0)
+		{
+			sceneNodes[nodes[i].parent]->children.push_back(sceneNodes[i]);
+		}
+	}
+
+	std::unordered_map<std::string, Bone> boneMap;
+
+	for (uint32_t i = 0; i < boneCount; i++)
+	{
+		Bone bone;
+		bone.name = reader.GetString(bones[i].name);
+		bone.boneIndex = bones[i].boneIndex;
+		bone.offsetMatrix = bones[i].offsetMatrix;
+
+		boneMap[bone.name] = bone;
+	}
+
+	std::unordered_map<std::string, Animation> animations;
+
+	reader.GetAnimations(animations, "");
+
+	std::vector<std::string> materialPaths(materialCount);
+
+	for (uint32_t i = 0; i < materialCount; i++)
+	{
+		materialPaths[i] = reader.GetString(materials[i].texturePath);
+	}
+
+	if (!reader.bValid)
+	{
+		for (SceneNode* node : sceneNodes)
+		{
+			delete node;
+		}
+
+		std::cout << "Truncated cooked model: " << cookedPath << std::endl;
+		return false;
+	}
+
+	//the IDs baked into the vertices hold when the scene loads in the order it was cooked in, otherwise the vertices are copied and remapped
+	std::unordered_map<int32_t, int32_t> textureRemap;
+
+	bool bRemapVertices = false;
+
+	for (uint32_t i = 0; i < materialCount; i++)
+	{
+		auto it = std::find(texturePaths.begin(), texturePaths.end(), materialPaths[i]);
+
+		int32_t textureID = static_cast<int32_t>(std::distance(texturePaths.begin(), it));
+
+		if (it == texturePaths.end())
+		{
+			texturePaths.push_back(materialPaths[i]);
+		}
+
+		textureRemap[materials[i].textureID] = textureID;
+
+		bRemapVertices |= textureID != materials[i].textureID;
+	}
+
+	model.meshes.assign(meshes, meshes + meshCount);
+
+	for (Mesh& mesh : model.meshes)
+	{
+		if (mesh.diffuseTextureID >= 0)
+		{
+			mesh.diffuseTextureID = textureRemap[mesh.diffuseTextureID];
+		}
+	}
+
+	if (bRemapVertices)
+	{
+		std::cout << "Cooked model texture IDs differ from the scene, remapping vertices: " << modelPath << std::endl;
+
+		model.vertices.assign(geometry.vertices, geometry.vertices + geometry.vertexCount);
+		model.indices.assign(geometry.indices, geometry.indices + geometry.indexCount);
+		model.meshlets.assign(geometry.meshlets, geometry.meshlets + geometry.meshletCount);
+
+		for (Vertex& vertex : model.vertices)
+		{
+			auto it = textureRemap.find(vertex.diffuseTextureID);
+
+			if (it != textureRemap.end())
+			{
+				vertex.diffuseTextureID = it->second;
+			}
+		}
+	}
+	else
+	{
+		model.mappedFile = reader.file;
+		model.mappedGeometry = geometry;
+	}
+
+	model.sceneRoot = nodeCount > 0 ? sceneNodes[0] : nullptr;
+
+	for (SceneNode* node : sceneNodes)
+	{
+		model.nodeMap[node->name] = node;
+	}
+
+	for (auto& [boneName, bone] : boneMap)
+	{
+		model.boneMap[boneName] = bone;
+	}
+
+	for (auto& [animationName, animation] : animations)
+	{
+		model.animations[animationName] = std::move(animation);
+	}
+
+	model.lodCount = reader.header.lodCount;
+	model.boundsCenter = reader.header.boundsCenter;
+	model.boundsRadius = reader.header.boundsRadius;
+	model.boundsMin = glm::vec3(reader.header.boundsMin);
+	model.boundsMax = glm::vec3(reader.header.boundsMax);
+
+	return true;
+}
+
+bool ModelCooker::LoadCookedAnimations(const std::string& animationPath, Model& model, const std::string& name)
+{
+	CookedModelReader reader;
+
+	if (!OpenCookedModel(animationPath, reader))
+	{
+		return false;
+	}
+
+	std::unordered_map<std::string, Animation> animations;
+
+	reader.GetAnimations(animations, name);
+
+	if (!reader.bValid)
+	{
+		std::cout << "Truncated cooked model: " << GetCookedPath(animationPath) << std::endl;
+		return false;
+	}
+
+	for (auto& [animationName, animation] : animations)
+	{
+		model.animations[animationName] = std::move(animation);
+	}
+
+	return true;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "CommonTypes.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct Model;
+
+const uint32_t COOKED_MODEL_VERSION = 2;
+
+//parts of a cooked model, each one is an array of records starting at a 16 byte aligned offset
+enum CookedModelSection : uint32_t
+{
+	COOKED_MODEL_MESHES = 0,
+	COOKED_MODEL_MATERIALS,
+	COOKED_MODEL_NODES,
+	COOKED_MODEL_BONES,
+	COOKED_MODEL_ANIMATIONS,
+	COOKED_MODEL_CHANNELS,
+	//position, rotation and scaling keys of every channel
+	COOKED_MODEL_KEYS,
+	COOKED_MODEL_STRINGS,
+	COOKED_MODEL_VERTICES,
+	COOKED_MODEL_INDICES,
+	COOKED_MODEL_MESHLETS,
+	COOKED_MODEL_SECTION_COUNT
+};
+
+struct CookedSection
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct CookedModelHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t customMaterialTextures;
+	uint32_t lodCount;
+
+	glm::vec3 boundsCenter;
+	float boundsRadius;
+
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+
+	CookedSection sections[COOKED_MODEL_SECTION_COUNT];
+
+	//meshes, vertices and meshlets are stored as the engine's structs, a file cooked with other sizes is rejected
+	uint32_t meshSize;
+	uint32_t vertexSize;
+	uint32_t meshletSize;
+	uint32_t padding;
+};
+
+//range of the string table, not null terminated
+struct CookedString
+{
+	uint32_t offset;
+	uint32_t length;
+};
+
+//texture a diffuseTextureID of the meshes and vertices stood for when the model was cooked
+struct CookedMaterial
+{
+	int32_t textureID;
+	CookedString texturePath;
+};
+
+//nodes are stored depth first, parents before their children
+struct CookedNode
+{
+	CookedString name;
+	//~0u for the root
+	uint32_t parent;
+	uint32_t padding;
+	glm::mat4 localTransform;
+	glm::mat4 globalTransform;
+};
+
+struct CookedBone
+{
+	CookedString name;
+	int32_t boneIndex;
+	uint32_t padding;
+	glm::mat4 offsetMatrix;
+};
+
+struct CookedAnimation
+{
+	CookedString name;
+	uint32_t firstChannel;
+	uint32_t channelCount;
+	double duration;
+	double ticksPerSecond;
+};
+
+//key arrays are byte offsets into the keys section
+struct CookedChannel
+{
+	CookedString nodeName;
+	uint32_t positionKeyCount;
+	uint32_t rotationKeyCount;
+	uint32_t scalingKeyCount;
+	uint32_t padding;
+	uint64_t positionKeys;
+	uint64_t rotationKeys;
+	uint64_t scalingKeys;
+};
+
+//offline converter of the scene's models and animations into binary files under cooked/
+//the files are memory mapped at load time, vertices, indices and meshlets go from the mapping to the staging buffer without Assimp or the mesh optimizer
+class ModelCooker
+{
+public:
+	static ModelCooker& Get()
+	{
+		static ModelCooker instance;
+		return instance;
+	}
+
+	static std::string GetCookedPath(const std::string& modelPath);
+
+	//imports the models in scene order, texture IDs baked into the vertices are the ones a scene load hands out
+	void CookScene(const std::string& scenePath);
+
+	bool CookModel(const std::string& modelPath, const Model& model, const std::vector<std::string>& texturePaths);
+
+	//fills the meshes, node tree, bones, animations and bounds of the model, the geometry stays in the mapping until the renderer copied it
+	//returns false if there is no up to date cooked file for the source model
+	bool LoadCookedModel(const std::string& modelPath, Model& model, std::vector<std::string>& texturePaths);
+
+	//adds the animations of a cooked file to the model, under name unless it is empty
+	bool LoadCookedAnimations(const std::string& animationPath, Model& model, const std::string& name);
+};
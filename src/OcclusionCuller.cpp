@@ -0,0 +1,341 @@
+#include "OcclusionCuller.h"
+
+#include "Trace.h"
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+
+static const uint32_t TILES_X = OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_SIZE;
+static const uint32_t TILES_Y = OCCLUSION_BUFFER_HEIGHT / OCCLUSION_TILE_SIZE;
+
+static const uint32_t TILE_PIXELS = OCCLUSION_TILE_SIZE * OCCLUSION_TILE_SIZE;
+
+//rows of a tile are contiguous, so four pixels starting at a multiple of four are one SSE load
+static size_t PixelIndex(uint32_t x, uint32_t y)
+{
+	uint32_t tile = (y / OCCLUSION_TILE_SIZE) * TILES_X + x / OCCLUSION_TILE_SIZE;
+
+	return static_cast<size_t>(tile) * TILE_PIXELS + (y % OCCLUSION_TILE_SIZE) * OCCLUSION_TILE_SIZE + x % OCCLUSION_TILE_SIZE;
+}
+
+static void LoadColumns(const glm::mat4& matrix, __m128 columns[4])
+{
+	for (int i = 0; i < 4; i++)
+	{
+		columns[i] = _mm_loadu_ps(glm::value_ptr(matrix[i]));
+	}
+}
+
+static __m128 TransformPoint(const __m128 columns[4], const glm::vec3& point)
+{
+	__m128 result = _mm_mul_ps(columns[0], _mm_set1_ps(point.x));
+	result = _mm_add_ps(result, _mm_mul_ps(columns[1], _mm_set1_ps(point.y)));
+	result = _mm_add_ps(result, _mm_mul_ps(columns[2], _mm_set1_ps(point.z)));
+
+	return _mm_add_ps(result, columns[3]);
+}
+
+void OcclusionCuller::BuildOccluder(Model& model, const Vertex* vertices, const uint32_t* indices)
+{
+	model.occluderPositions.clear();
+	model.occluderIndices.clear();
+
+	std::unordered_map<uint32_t, uint32_t> remap;
+
+	for (const Mesh& mesh : model.meshes)
+	{
+		//collapses only move vertices onto their neighbours, so the coarsest level stays on the surface
+		const MeshLOD& lod = mesh.lods[mesh.lodCount - 1];
+
+		for (uint32_t i = 0; i < lod.indexCount; i++)
+		{
+			uint32_t vertex = indices[lod.startIndex + i];
+
+			auto it = remap.try_emplace(vertex, static_cast<uint32_t>(model.occluderPositions.size())).first;
+
+			if (it->second == model.occluderPositions.size())
+			{
+				model.occluderPositions.push_back(vertices[vertex].position);
+			}
+
+			model.occluderIndices.push_back(it->second);
+		}
+	}
+
+	std::cout << "Occluder " << model.name << ": " << model.occluderIndices.size() / 3 << " triangles" << std::endl;
+}
+
+void OcclusionCuller::BeginFrame(const glm::mat4& viewProjection)
+{
+	UTRACE_FUNCTION();
+
+	this->viewProjection = viewProjection;
+
+	depthBuffer.assign(OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT, 1.0f);
+
+	tileDepths.assign(TILES_X * TILES_Y, 1.0f);
+
+	bTileDepthsDirty = false;
+
+	culledCount = 0;
+}
+
+void OcclusionCuller::RenderOccluder(const Model& model, const glm::mat4& modelMatrix)
+{
+	UTRACE_FUNCTION();
+
+	__m128 columns[4];
+	LoadColumns(viewProjection * modelMatrix, columns);
+
+	//NDC to pixels, y already points down after the projection flip
+	const __m128 viewportScale = _mm_setr_ps(0.5f * OCCLUSION_BUFFER_WIDTH, 0.5f * OCCLUSION_BUFFER_HEIGHT, 1.0f, 0.0f);
+	const __m128 viewportOffset = _mm_setr_ps(0.5f * OCCLUSION_BUFFER_WIDTH, 0.5f * OCCLUSION_BUFFER_HEIGHT, 0.0f, 1.0f);
+
+	screenVertices.resize(model.occluderPositions.size());
+
+	for (size_t i = 0; i < model.occluderPositions.size(); i++)
+	{
+		__m128 clip = TransformPoint(columns, model.occluderPositions[i]);
+
+		float clipZ = _mm_cvtss_f32(_mm_shuffle_ps(clip, clip, _MM_SHUFFLE(2, 2, 2, 2)));
+		float clipW = _mm_cvtss_f32(_mm_shuffle_ps(clip, clip, _MM_SHUFFLE(3, 3, 3, 3)));
+
+		//zero to one depth, negative z is in front of the near plane or behind the camera
+		if (clipZ < 0.0f)
+		{
+			screenVertices[i] = glm::vec4(0.0f);
+			continue;
+		}
+
+		__m128 screen = _mm_add_ps(_mm_mul_ps(_mm_div_ps(clip, _mm_set1_ps(clipW)), viewportScale), viewportOffset);
+
+		_mm_storeu_ps(glm::value_ptr(screenVertices[i]), screen);
+	}
+
+	for (size_t i = 0; i + 2 < model.occluderIndices.size(); i += 3)
+	{
+		const glm::vec4& v0 = screenVertices[model.occluderIndices[i]];
+		const glm::vec4& v1 = screenVertices[model.occluderIndices[i + 1]];
+		const glm::vec4& v2 = screenVertices[model.occluderIndices[i + 2]];
+
+		if (v0.w == 0.0f || v1.w == 0.0f || v2.w == 0.0f)
+		{
+			continue;
+		}
+
+		RasterizeTriangle(glm::vec3(v0), glm::vec3(v1), glm::vec3(v2));
+	}
+
+	bTileDepthsDirty = true;
+}
+
+void OcclusionCuller::RasterizeTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2)
+{
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+
+	//degenerate, or NaN from a vertex on the camera plane
+	if (!(area != 0.0f))
+	{
+		return;
+	}
+
+	//both windings are drawn, occluders do not need to be closed
+	if (area < 0.0f)
+	{
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	float minX = std::max(std::floor(std::min(v0.x, std::min(v1.x, v2.x))), 0.0f);
+	float maxX = std::min(std::ceil(std::max(v0.x, std::max(v1.x, v2.x))), float(OCCLUSION_BUFFER_WIDTH - 1));
+	float minY = std::max(std::floor(std::min(v0.y, std::min(v1.y, v2.y))), 0.0f);
+	float maxY = std::min(std::ceil(std::max(v0.y, std::max(v1.y, v2.y))), float(OCCLUSION_BUFFER_HEIGHT - 1));
+
+	if (minX > maxX || minY > maxY)
+	{
+		return;
+	}
+
+	//edge i is opposite vertex i, a * x + b * y + c is positive inside
+	float a0 = v1.y - v2.y, b0 = v2.x - v1.x, c0 = -(a0 * v1.x + b0 * v1.y);
+	float a1 = v2.y - v0.y, b1 = v0.x - v2.x, c1 = -(a1 * v2.x + b1 * v2.y);
+	float a2 = v0.y - v1.y, b2 = v1.x - v0.x, c2 = -(a2 * v0.x + b2 * v0.y);
+
+	//depth is linear in screen space, the edge functions divided by the area are the barycentrics
+	float inverseArea = 1.0f / area;
+	float za = (a0 * v0.z + a1 * v1.z + a2 * v2.z) * inverseArea;
+	float zb = (b0 * v0.z + b1 * v1.z + b2 * v2.z) * inverseArea;
+	float zc = (c0 * v0.z + c1 * v1.z + c2 * v2.z) * inverseArea;
+
+	const __m128 laneCenters = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	const __m128 edgeA0 = _mm_set1_ps(a0), edgeA1 = _mm_set1_ps(a1), edgeA2 = _mm_set1_ps(a2);
+	const __m128 depthA = _mm_set1_ps(za);
+
+	//the buffer width is a multiple of four, so a group starting at a multiple of four never leaves the row
+	uint32_t firstX = static_cast<uint32_t>(minX) & ~3u;
+	uint32_t lastX = static_cast<uint32_t>(maxX);
+
+	for (uint32_t y = static_cast<uint32_t>(minY); y <= static_cast<uint32_t>(maxY); y++)
+	{
+		float centerY = y + 0.5f;
+
+		const __m128 rowE0 = _mm_set1_ps(b0 * centerY + c0);
+		const __m128 rowE1 = _mm_set1_ps(b1 * centerY + c1);
+		const __m128 rowE2 = _mm_set1_ps(b2 * centerY + c2);
+		const __m128 rowDepth = _mm_set1_ps(zb * centerY + zc);
+
+		for (uint32_t x = firstX; x <= lastX; x += 4)
+		{
+			__m128 centerX = _mm_add_ps(_mm_set1_ps(float(x)), laneCenters);
+
+			__m128 e0 = _mm_add_ps(_mm_mul_ps(edgeA0, centerX), rowE0);
+			__m128 e1 = _mm_add_ps(_mm_mul_ps(edgeA1, centerX), rowE1);
+			__m128 e2 = _mm_add_ps(_mm_mul_ps(edgeA2, centerX), rowE2);
+
+			//inclusive on every edge, pixel centers on a shared edge are covered by both triangles
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+
+			if (_mm_movemask_ps(inside) == 0)
+			{
+				continue;
+			}
+
+			__m128 depth = _mm_add_ps(_mm_mul_ps(depthA, centerX), rowDepth);
+
+			float* pixels = &depthBuffer[PixelIndex(x, y)];
+
+			__m128 previous = _mm_loadu_ps(pixels);
+
+			__m128 nearest = _mm_min_ps(previous, depth);
+
+			_mm_storeu_ps(pixels, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, previous)));
+		}
+	}
+}
+
+void OcclusionCuller::UpdateTileDepths()
+{
+	UTRACE_FUNCTION();
+
+	for (uint32_t tile = 0; tile < TILES_X * TILES_Y; tile++)
+	{
+		const float* pixels = &depthBuffer[static_cast<size_t>(tile) * TILE_PIXELS];
+
+		__m128 farthest = _mm_loadu_ps(pixels);
+
+		for (uint32_t i = 4; i < TILE_PIXELS; i += 4)
+		{
+			farthest = _mm_max_ps(farthest, _mm_loadu_ps(pixels + i));
+		}
+
+		farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+		farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		tileDepths[tile] = _mm_cvtss_f32(farthest);
+	}
+}
+
+bool OcclusionCuller::IsVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& modelMatrix)
+{
+	if (bTileDepthsDirty)
+	{
+		UpdateTileDepths();
+
+		bTileDepthsDirty = false;
+	}
+
+	__m128 columns[4];
+	LoadColumns(viewProjection * modelMatrix, columns);
+
+	__m128 minNDC = _mm_set1_ps(FLT_MAX);
+	__m128 maxNDC = _mm_set1_ps(-FLT_MAX);
+
+	for (uint32_t corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 point(corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y, corner & 4 ? boundsMax.z : boundsMin.z);
+
+		__m128 clip = TransformPoint(columns, point);
+
+		//the box reaches past the near plane, its projection is unbounded
+		if (_mm_cvtss_f32(_mm_shuffle_ps(clip, clip, _MM_SHUFFLE(2, 2, 2, 2))) < 0.0f)
+		{
+			return true;
+		}
+
+		__m128 ndc = _mm_div_ps(clip, _mm_shuffle_ps(clip, clip, _MM_SHUFFLE(3, 3, 3, 3)));
+
+		minNDC = _mm_min_ps(minNDC, ndc);
+		maxNDC = _mm_max_ps(maxNDC, ndc);
+	}
+
+	glm::vec4 low, high;
+	_mm_storeu_ps(glm::value_ptr(low), minNDC);
+	_mm_storeu_ps(glm::value_ptr(high), maxNDC);
+
+	//off screen boxes are left to frustum culling
+	if (low.x > 1.0f || high.x < -1.0f || low.y > 1.0f || high.y < -1.0f)
+	{
+		return true;
+	}
+
+	//pixels the rectangle touches, the clamp keeps huge projections in range before the conversion
+	auto toPixel = [](float ndc, uint32_t size) {
+		return static_cast<uint32_t>(std::clamp((ndc * 0.5f + 0.5f) * size, 0.0f, float(size - 1)));
+		};
+
+	uint32_t x0 = toPixel(low.x, OCCLUSION_BUFFER_WIDTH), x1 = toPixel(high.x, OCCLUSION_BUFFER_WIDTH);
+	uint32_t y0 = toPixel(low.y, OCCLUSION_BUFFER_HEIGHT), y1 = toPixel(high.y, OCCLUSION_BUFFER_HEIGHT);
+
+	//nearest point of the box, hidden only where every occluder depth is in front of it
+	float boxDepth = low.z;
+
+	const __m128 boxDepths = _mm_set1_ps(boxDepth);
+	const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+	for (uint32_t tileY = y0 / OCCLUSION_TILE_SIZE; tileY <= y1 / OCCLUSION_TILE_SIZE; tileY++)
+	{
+		for (uint32_t tileX = x0 / OCCLUSION_TILE_SIZE; tileX <= x1 / OCCLUSION_TILE_SIZE; tileX++)
+		{
+			//the whole tile is in front of the box
+			if (tileDepths[tileY * TILES_X + tileX] < boxDepth)
+			{
+				continue;
+			}
+
+			uint32_t firstX = std::max(x0, tileX * OCCLUSION_TILE_SIZE);
+			uint32_t lastX = std::min(x1, tileX * OCCLUSION_TILE_SIZE + OCCLUSION_TILE_SIZE - 1);
+			uint32_t firstY = std::max(y0, tileY * OCCLUSION_TILE_SIZE);
+			uint32_t lastY = std::min(y1, tileY * OCCLUSION_TILE_SIZE + OCCLUSION_TILE_SIZE - 1);
+
+			const __m128 minLane = _mm_set1_ps(float(firstX));
+			const __m128 maxLane = _mm_set1_ps(float(lastX));
+
+			for (uint32_t y = firstY; y <= lastY; y++)
+			{
+				for (uint32_t x = firstX & ~3u; x <= lastX; x += 4)
+				{
+					__m128 laneX = _mm_add_ps(_mm_set1_ps(float(x)), laneOffsets);
+
+					__m128 covered = _mm_and_ps(_mm_cmpge_ps(laneX, minLane), _mm_cmple_ps(laneX, maxLane));
+
+					__m128 behind = _mm_cmpge_ps(_mm_loadu_ps(&depthBuffer[PixelIndex(x, y)]), boxDepths);
+
+					if (_mm_movemask_ps(_mm_and_ps(covered, behind)) != 0)
+					{
+						return true;
+					}
+				}
+			}
+		}
+	}
+
+	culledCount++;
+
+	return false;
+}
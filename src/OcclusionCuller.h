@@ -0,0 +1,59 @@
+#pragma once
+
+#include "SceneTypes.h"
+
+#include <vector>
+
+//resolution of the software depth buffer, multiples of the tile size
+const uint32_t OCCLUSION_BUFFER_WIDTH = 320;
+const uint32_t OCCLUSION_BUFFER_HEIGHT = 192;
+
+//pixels per side of a depth tile, tiles are contiguous in memory and keep their farthest depth
+const uint32_t OCCLUSION_TILE_SIZE = 8;
+
+//CPU occlusion culling, designated occluders are rasterised with SSE into a small depth buffer and instance boxes tested against it
+class OcclusionCuller
+{
+public:
+	static OcclusionCuller& Get()
+	{
+		static OcclusionCuller instance;
+		return instance;
+	}
+
+	//collects the coarsest LOD of every mesh of the model as its position only occluder mesh
+	void BuildOccluder(Model& model, const Vertex* vertices, const uint32_t* indices);
+
+	//clears the depth buffer, the occluders and tests until the next call are projected with viewProjection
+	void BeginFrame(const glm::mat4& viewProjection);
+
+	//triangles touching the near plane are skipped, an occluder never hides more than it covers
+	void RenderOccluder(const Model& model, const glm::mat4& modelMatrix);
+
+	//false when the box is behind the occluders at every pixel it covers, boxes crossing the near plane are always visible
+	bool IsVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& modelMatrix);
+
+	//instances IsVisible rejected since BeginFrame
+	uint32_t GetCulledCount() const { return culledCount; }
+
+private:
+	//vertices in pixels with depth in z
+	void RasterizeTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2);
+
+	void UpdateTileDepths();
+
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+
+	//tile by tile, nearest occluder depth of every pixel
+	std::vector<float> depthBuffer;
+
+	//farthest depth of every tile, rebuilt before the first test after occluders were drawn
+	std::vector<float> tileDepths;
+
+	bool bTileDepthsDirty = false;
+
+	//occluder vertices of the mesh being drawn, w is 0 for vertices in front of the near plane
+	std::vector<glm::vec4> screenVertices;
+
+	uint32_t culledCount = 0;
+};
@@ -2,6 +2,8 @@
 
 #include "physx/PxPhysicsAPI.h"
 
+#include "Trace.h"
+
 using namespace physx;
 
 class UPhysics
@@ -33,6 +35,8 @@ public:
 
 	void Update(float deltaTime)
 	{
+		UTRACE_FUNCTION();
+
 		gScene->simulate(deltaTime);
 		gScene->fetchResults(true);
 	}
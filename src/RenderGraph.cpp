@@ -0,0 +1,818 @@
+#include "RenderGraph.h"
+
+#include "GpuProfiler.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+    struct UsageInfo
+    {
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        VkImageLayout colorLayout;
+        VkImageLayout depthLayout;
+    };
+
+    const VkAccessFlags WRITE_ACCESS_MASK = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    UsageInfo GetUsageInfo(RGUsage usage)
+    {
+        switch (usage)
+        {
+        case RGUsage::TransferRead:
+            return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL };
+        case RGUsage::TransferWrite:
+            return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL };
+        case RGUsage::VertexShaderRead:
+            return { VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+        case RGUsage::FragmentShaderSample:
+            return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+        case RGUsage::ComputeRead:
+            return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+        case RGUsage::ComputeWrite:
+            return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL };
+        case RGUsage::IndirectRead:
+            return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED };
+        case RGUsage::IndexRead:
+            return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED };
+        case RGUsage::ColorAttachment:
+            return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+        case RGUsage::DepthAttachment:
+            return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+        }
+
+        throw std::runtime_error("Unknown render graph usage!");
+    }
+}
+
+URenderGraph::PassBuilder& URenderGraph::PassBuilder::Read(RGResource resource, RGUsage usage)
+{
+    graph.passes[pass].accesses.push_back({ resource, usage, false, false });
+    return *this;
+}
+
+URenderGraph::PassBuilder& URenderGraph::PassBuilder::Write(RGResource resource, RGUsage usage, bool bDiscard)
+{
+    graph.passes[pass].accesses.push_back({ resource, usage, true, bDiscard });
+    return *this;
+}
+
+URenderGraph::PassBuilder& URenderGraph::PassBuilder::SetEnabled(bool bEnabled)
+{
+    graph.passes[pass].bEnabled = bEnabled;
+    return *this;
+}
+
+void URenderGraph::Init(VkDevice device, VmaAllocator allocator, uint32_t framesInFlight)
+{
+    this->device = device;
+    this->allocator = allocator;
+
+    retired.resize(framesInFlight);
+}
+
+void URenderGraph::Cleanup()
+{
+    for (std::vector<std::function<void()>>& functions : retired)
+    {
+        for (std::function<void()>& function : functions)
+        {
+            function();
+        }
+
+        functions.clear();
+    }
+
+    ReleaseFramebuffers();
+
+    for (PhysicalImage& physicalImage : physicalImages)
+    {
+        vkDestroyImageView(device, physicalImage.view, nullptr);
+        vkDestroyImage(device, physicalImage.image, nullptr);
+    }
+
+    physicalImages.clear();
+
+    for (MemorySlot& slot : slots)
+    {
+        if (slot.allocation != VK_NULL_HANDLE)
+        {
+            vmaFreeMemory(allocator, slot.allocation);
+        }
+    }
+
+    slots.clear();
+}
+
+void URenderGraph::BeginFrame(uint32_t frameIndex)
+{
+    currentFrame = frameIndex;
+
+    for (std::function<void()>& function : retired[frameIndex])
+    {
+        function();
+    }
+
+    retired[frameIndex].clear();
+
+    passes.clear();
+    resources.clear();
+}
+
+RGResource URenderGraph::ImportImage(const char* name, VkImage image, VkImageView view, VkImageAspectFlags aspect, uint32_t layers, RGResourceState& state)
+{
+    Resource resource;
+    resource.name = name;
+    resource.bImage = true;
+    resource.bImported = true;
+    resource.image = image;
+    resource.view = view;
+    resource.aspect = aspect;
+    resource.layers = layers;
+    resource.state = state;
+    resource.importedState = &state;
+
+    resources.push_back(resource);
+
+    return static_cast<RGResource>(resources.size() - 1);
+}
+
+RGResource URenderGraph::ImportBuffer(const char* name, VkBuffer buffer, RGResourceState& state)
+{
+    Resource resource;
+    resource.name = name;
+    resource.bImported = true;
+    resource.buffer = buffer;
+    resource.state = state;
+    resource.importedState = &state;
+
+    resources.push_back(resource);
+
+    return static_cast<RGResource>(resources.size() - 1);
+}
+
+RGResource URenderGraph::CreateImage(const char* name, const RGImageDesc& desc)
+{
+    Resource resource;
+    resource.name = name;
+    resource.bImage = true;
+    resource.aspect = desc.aspect;
+    resource.layers = desc.layers;
+    resource.desc = desc;
+
+    resources.push_back(resource);
+
+    return static_cast<RGResource>(resources.size() - 1);
+}
+
+void URenderGraph::Export(RGResource resource, VkImageLayout layout)
+{
+    resources[resource].exportLayout = layout;
+}
+
+URenderGraph::PassBuilder URenderGraph::AddPass(const char* name, std::function<void(VkCommandBuffer cmd)>&& execute)
+{
+    Pass pass;
+    pass.name = name;
+    pass.execute = std::move(execute);
+
+    passes.push_back(std::move(pass));
+
+    return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+}
+
+void URenderGraph::Compile()
+{
+    //walk backwards from resources that outlive the frame, a pass is live if something later needs what it writes
+    std::vector<bool> needed(resources.size());
+
+    for (size_t i = 0; i < resources.size(); i++)
+    {
+        needed[i] = resources[i].bImported || resources[i].exportLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+
+    for (size_t i = passes.size(); i-- > 0;)
+    {
+        Pass& pass = passes[i];
+
+        pass.bLive = false;
+
+        if (!pass.bEnabled)
+            continue;
+
+        for (const Access& access : pass.accesses)
+        {
+            pass.bLive |= access.bWrite && needed[access.resource];
+        }
+
+        if (!pass.bLive)
+            continue;
+
+        for (const Access& access : pass.accesses)
+        {
+            const Resource& resource = resources[access.resource];
+
+            //a discarding write ends the previous contents of a transient, earlier writers are not needed for it
+            if (access.bWrite && access.bDiscard && !resource.bImported && resource.exportLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+            {
+                needed[access.resource] = false;
+            }
+            else
+            {
+                needed[access.resource] = true;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < passes.size(); i++)
+    {
+        if (!passes[i].bLive)
+            continue;
+
+        for (const Access& access : passes[i].accesses)
+        {
+            Resource& resource = resources[access.resource];
+
+            resource.firstPass = std::min(resource.firstPass, i);
+            resource.lastPass = std::max(resource.lastPass, i);
+        }
+    }
+
+    PlaceTransients();
+}
+
+void URenderGraph::PlaceTransients()
+{
+    //images unused for a while are released, the rest wait to be claimed again
+    for (size_t i = physicalImages.size(); i-- > 0;)
+    {
+        if (physicalImages[i].unusedFrames > RENDER_GRAPH_TRANSIENT_LIFETIME)
+        {
+            RetirePhysicalImage(physicalImages[i]);
+            physicalImages.erase(physicalImages.begin() + i);
+        }
+    }
+
+    for (PhysicalImage& physicalImage : physicalImages)
+    {
+        physicalImage.bClaimed = false;
+    }
+
+    std::vector<RGResource> transients;
+
+    for (RGResource i = 0; i < resources.size(); i++)
+    {
+        Resource& resource = resources[i];
+
+        if (resource.bImported || resource.firstPass == ~0u)
+            continue;
+
+        //an image with the same description keeps its memory from frame to frame
+        for (uint32_t j = 0; j < physicalImages.size() && resource.physicalImage == ~0u; j++)
+        {
+            if (!physicalImages[j].bClaimed && physicalImages[j].desc == resource.desc)
+            {
+                resource.physicalImage = j;
+            }
+        }
+
+        if (resource.physicalImage == ~0u)
+        {
+            PhysicalImage physicalImage;
+            physicalImage.desc = resource.desc;
+
+            CreatePhysicalImage(physicalImage);
+
+            physicalImages.push_back(physicalImage);
+
+            resource.physicalImage = static_cast<uint32_t>(physicalImages.size() - 1);
+        }
+
+        physicalImages[resource.physicalImage].bClaimed = true;
+
+        transients.push_back(i);
+    }
+
+    for (PhysicalImage& physicalImage : physicalImages)
+    {
+        physicalImage.unusedFrames = physicalImage.bClaimed ? 0 : physicalImage.unusedFrames + 1;
+    }
+
+    //largest first, each image goes into the first slot whose images are all dead before it starts or born after it ends
+    std::sort(transients.begin(), transients.end(), [&](RGResource a, RGResource b) {
+        return physicalImages[resources[a].physicalImage].requirements.size > physicalImages[resources[b].physicalImage].requirements.size;
+        });
+
+    struct PlannedSlot
+    {
+        VkDeviceSize size = 0;
+        VkDeviceSize alignment = 1;
+        uint32_t memoryTypeBits = ~0u;
+        std::vector<RGResource> residents;
+    };
+
+    std::vector<PlannedSlot> plannedSlots;
+
+    std::vector<uint32_t> assignedSlots(resources.size(), ~0u);
+
+    for (RGResource transient : transients)
+    {
+        const Resource& resource = resources[transient];
+        const VkMemoryRequirements& requirements = physicalImages[resource.physicalImage].requirements;
+
+        uint32_t slotIndex = ~0u;
+
+        for (uint32_t i = 0; i < plannedSlots.size() && slotIndex == ~0u; i++)
+        {
+            if ((plannedSlots[i].memoryTypeBits & requirements.memoryTypeBits) == 0)
+                continue;
+
+            bool bOverlaps = false;
+
+            for (RGResource resident : plannedSlots[i].residents)
+            {
+                bOverlaps |= resource.firstPass <= resources[resident].lastPass && resources[resident].firstPass <= resource.lastPass;
+            }
+
+            if (!bOverlaps)
+            {
+                slotIndex = i;
+            }
+        }
+
+        if (slotIndex == ~0u)
+        {
+            plannedSlots.emplace_back();
+            slotIndex = static_cast<uint32_t>(plannedSlots.size() - 1);
+        }
+
+        PlannedSlot& plannedSlot = plannedSlots[slotIndex];
+        plannedSlot.size = std::max(plannedSlot.size, requirements.size);
+        plannedSlot.alignment = std::max(plannedSlot.alignment, requirements.alignment);
+        plannedSlot.memoryTypeBits &= requirements.memoryTypeBits;
+        plannedSlot.residents.push_back(transient);
+
+        assignedSlots[transient] = slotIndex;
+    }
+
+    if (slots.size() < plannedSlots.size())
+    {
+        slots.resize(plannedSlots.size());
+    }
+
+    for (uint32_t i = 0; i < slots.size(); i++)
+    {
+        MemorySlot& slot = slots[i];
+
+        bool bCompatible = false;
+
+        //memory not planned this frame stays while images waiting to be claimed again are bound to it
+        if (slot.allocation != VK_NULL_HANDLE && i >= plannedSlots.size())
+        {
+            for (const PhysicalImage& physicalImage : physicalImages)
+            {
+                bCompatible |= physicalImage.slot == i;
+            }
+        }
+
+        if (slot.allocation != VK_NULL_HANDLE && i < plannedSlots.size())
+        {
+            VmaAllocationInfo allocationInfo;
+            vmaGetAllocationInfo(allocator, slot.allocation, &allocationInfo);
+
+            bCompatible = slot.size >= plannedSlots[i].size && allocationInfo.offset % plannedSlots[i].alignment == 0 &&
+                (plannedSlots[i].memoryTypeBits & (1u << allocationInfo.memoryType)) != 0;
+        }
+
+        if (bCompatible)
+            continue;
+
+        //the memory grows or is no longer planned, images bound to it are recreated when placed again
+        if (slot.allocation != VK_NULL_HANDLE)
+        {
+            for (PhysicalImage& physicalImage : physicalImages)
+            {
+                if (physicalImage.slot == i)
+                {
+                    RetirePhysicalImage(physicalImage);
+                    CreatePhysicalImage(physicalImage);
+                }
+            }
+
+            VmaAllocation allocation = slot.allocation;
+
+            retired[currentFrame].push_back([=]() {
+                vmaFreeMemory(allocator, allocation);
+                });
+
+            slot = MemorySlot();
+        }
+
+        if (i >= plannedSlots.size())
+            continue;
+
+        VkMemoryRequirements requirements{};
+        requirements.size = plannedSlots[i].size;
+        requirements.alignment = plannedSlots[i].alignment;
+        requirements.memoryTypeBits = plannedSlots[i].memoryTypeBits;
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        if (vmaAllocateMemory(allocator, &requirements, &allocInfo, &slot.allocation, nullptr) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate render graph memory!");
+        }
+
+        slot.size = requirements.size;
+        slot.alignment = requirements.alignment;
+        slot.memoryTypeBits = requirements.memoryTypeBits;
+    }
+
+    while (!slots.empty() && slots.back().allocation == VK_NULL_HANDLE)
+    {
+        slots.pop_back();
+    }
+
+    for (RGResource transient : transients)
+    {
+        Resource& resource = resources[transient];
+        PhysicalImage& physicalImage = physicalImages[resource.physicalImage];
+
+        uint32_t slotIndex = assignedSlots[transient];
+
+        //images can not be rebound, one moving to another slot is recreated
+        if (physicalImage.slot != slotIndex)
+        {
+            if (physicalImage.slot != ~0u)
+            {
+                RetirePhysicalImage(physicalImage);
+                CreatePhysicalImage(physicalImage);
+            }
+
+            if (vmaBindImageMemory(allocator, slots[slotIndex].allocation, physicalImage.image) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to bind render graph image memory!");
+            }
+
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = physicalImage.image;
+            viewInfo.viewType = physicalImage.desc.layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = physicalImage.desc.format;
+            viewInfo.subresourceRange.aspectMask = physicalImage.desc.aspect;
+            viewInfo.subresourceRange.baseMipLevel = 0;
+            viewInfo.subresourceRange.levelCount = 1;
+            viewInfo.subresourceRange.baseArrayLayer = 0;
+            viewInfo.subresourceRange.layerCount = physicalImage.desc.layers;
+
+            if (vkCreateImageView(device, &viewInfo, nullptr, &physicalImage.view) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create render graph image view!");
+            }
+
+            physicalImage.slot = slotIndex;
+        }
+
+        resource.image = physicalImage.image;
+        resource.view = physicalImage.view;
+    }
+}
+
+void URenderGraph::CreatePhysicalImage(PhysicalImage& physicalImage)
+{
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = physicalImage.desc.width;
+    imageInfo.extent.height = physicalImage.desc.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = physicalImage.desc.layers;
+    imageInfo.format = physicalImage.desc.format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = physicalImage.desc.usage;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    if (vkCreateImage(device, &imageInfo, nullptr, &physicalImage.image) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create render graph image!");
+    }
+
+    vkGetImageMemoryRequirements(device, physicalImage.image, &physicalImage.requirements);
+
+    physicalImage.view = VK_NULL_HANDLE;
+    physicalImage.slot = ~0u;
+}
+
+void URenderGraph::RetirePhysicalImage(PhysicalImage& physicalImage)
+{
+    VkImage image = physicalImage.image;
+    VkImageView view = physicalImage.view;
+
+    if (view != VK_NULL_HANDLE)
+    {
+        RetireFramebuffers(view);
+    }
+
+    retired[currentFrame].push_back([=]() {
+        vkDestroyImageView(device, view, nullptr);
+        vkDestroyImage(device, image, nullptr);
+        });
+
+    physicalImage.image = VK_NULL_HANDLE;
+    physicalImage.view = VK_NULL_HANDLE;
+    physicalImage.slot = ~0u;
+}
+
+void URenderGraph::RetireFramebuffers(VkImageView view)
+{
+    for (size_t i = framebuffers.size(); i-- > 0;)
+    {
+        if (std::find(framebuffers[i].views.begin(), framebuffers[i].views.end(), view) == framebuffers[i].views.end())
+            continue;
+
+        VkFramebuffer framebuffer = framebuffers[i].framebuffer;
+
+        retired[currentFrame].push_back([=]() {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+            });
+
+        framebuffers.erase(framebuffers.begin() + i);
+    }
+}
+
+bool URenderGraph::IsPassLive(const PassBuilder& pass) const
+{
+    return passes[pass.pass].bLive;
+}
+
+VkImage URenderGraph::GetImage(RGResource resource) const
+{
+    return resources[resource].image;
+}
+
+VkImageView URenderGraph::GetImageView(RGResource resource) const
+{
+    return resources[resource].view;
+}
+
+VkFramebuffer URenderGraph::GetFramebuffer(VkRenderPass renderPass, std::initializer_list<RGResource> attachments, uint32_t width, uint32_t height)
+{
+    std::vector<VkImageView> views;
+
+    for (RGResource attachment : attachments)
+    {
+        views.push_back(resources[attachment].view);
+    }
+
+    for (const CachedFramebuffer& cached : framebuffers)
+    {
+        if (cached.renderPass == renderPass && cached.views == views && cached.width == width && cached.height == height)
+        {
+            return cached.framebuffer;
+        }
+    }
+
+    VkFramebufferCreateInfo framebufferInfo{};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+    framebufferInfo.pAttachments = views.data();
+    framebufferInfo.width = width;
+    framebufferInfo.height = height;
+    framebufferInfo.layers = 1;
+
+    VkFramebuffer framebuffer;
+
+    if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create render graph framebuffer!");
+    }
+
+    framebuffers.push_back({ renderPass, views, width, height, framebuffer });
+
+    return framebuffer;
+}
+
+void URenderGraph::ReleaseFramebuffers()
+{
+    for (const CachedFramebuffer& cached : framebuffers)
+    {
+        vkDestroyFramebuffer(device, cached.framebuffer, nullptr);
+    }
+
+    framebuffers.clear();
+}
+
+void URenderGraph::AddBarrier(Resource& resource, RGUsage usage, bool bWrite, bool bDiscard, VkPipelineStageFlags& srcStages, VkPipelineStageFlags& dstStages,
+    VkMemoryBarrier& memoryBarrier, std::vector<VkImageMemoryBarrier>& imageBarriers)
+{
+    UsageInfo info = GetUsageInfo(usage);
+
+    RGResourceState& state = resource.state;
+
+    VkImageLayout layout = (resource.aspect & VK_IMAGE_ASPECT_DEPTH_BIT) ? info.depthLayout : info.colorLayout;
+
+    VkAccessFlags writeAccess = bWrite ? info.access & WRITE_ACCESS_MASK : 0;
+
+    if (resource.bImage && layout != state.layout)
+    {
+        //the transition waits for every earlier use and makes the last write available
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = bDiscard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+        barrier.newLayout = layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = resource.image;
+        barrier.subresourceRange.aspectMask = resource.aspect;
+        barrier.subresourceRange.baseMipLevel = 0;
+        //imported images may have a mip chain, every level shares the tracked state
+        barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = resource.layers;
+        barrier.srcAccessMask = state.writeAccess;
+        barrier.dstAccessMask = info.access;
+
+        imageBarriers.push_back(barrier);
+
+        srcStages |= state.writeStages | state.readStages;
+        dstStages |= info.stages;
+
+        state.layout = layout;
+        state.writeStages = info.stages;
+        state.writeAccess = writeAccess;
+        state.readStages = bWrite ? 0 : info.stages;
+        state.visibleStages = bWrite ? 0 : info.stages;
+        state.visibleAccess = bWrite ? 0 : info.access;
+
+        return;
+    }
+
+    if (bWrite)
+    {
+        //write after read only needs the readers to finish, write after write also needs the earlier write available
+        VkPipelineStageFlags waitStages = state.writeStages | state.readStages;
+
+        if (waitStages != 0)
+        {
+            srcStages |= waitStages;
+            dstStages |= info.stages;
+
+            if (state.writeAccess != 0)
+            {
+                memoryBarrier.srcAccessMask |= state.writeAccess;
+                memoryBarrier.dstAccessMask |= info.access;
+            }
+        }
+
+        state.writeStages = info.stages;
+        state.writeAccess = writeAccess;
+        state.readStages = 0;
+        state.visibleStages = 0;
+        state.visibleAccess = 0;
+
+        return;
+    }
+
+    //reads that the last write was already made visible to need nothing
+    if (state.writeStages != 0 && ((state.visibleStages & info.stages) != info.stages || (state.visibleAccess & info.access) != info.access))
+    {
+        srcStages |= state.writeStages;
+        dstStages |= info.stages;
+
+        if (state.writeAccess != 0)
+        {
+            memoryBarrier.srcAccessMask |= state.writeAccess;
+            memoryBarrier.dstAccessMask |= info.access;
+        }
+
+        state.visibleStages |= info.stages;
+        state.visibleAccess |= info.access;
+    }
+
+    state.readStages |= info.stages;
+}
+
+void URenderGraph::Execute(VkCommandBuffer cmd, UGpuProfiler* profiler)
+{
+    for (uint32_t i = 0; i < passes.size(); i++)
+    {
+        Pass& pass = passes[i];
+
+        if (!pass.bLive)
+            continue;
+
+        if (profiler)
+        {
+            profiler->BeginScope(cmd, pass.name);
+        }
+
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+
+        VkMemoryBarrier memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+        std::vector<VkImageMemoryBarrier> imageBarriers;
+
+        for (const Access& access : pass.accesses)
+        {
+            Resource& resource = resources[access.resource];
+
+            if (resource.bImported)
+            {
+                AddBarrier(resource, access.usage, access.bWrite, access.bDiscard, srcStages, dstStages, memoryBarrier, imageBarriers);
+                continue;
+            }
+
+            MemorySlot& slot = slots[physicalImages[resource.physicalImage].slot];
+
+            //a transient starts undefined, after whatever used its memory last
+            if (i == resource.firstPass)
+            {
+                resource.state = RGResourceState();
+                resource.state.writeStages = slot.stages;
+                resource.state.writeAccess = slot.writeAccess;
+            }
+
+            AddBarrier(resource, access.usage, access.bWrite, access.bDiscard, srcStages, dstStages, memoryBarrier, imageBarriers);
+
+            slot.stages = resource.state.writeStages | resource.state.readStages;
+            slot.writeAccess = resource.state.writeAccess;
+        }
+
+        if (srcStages != 0 || !imageBarriers.empty())
+        {
+            bool bMemoryBarrier = memoryBarrier.srcAccessMask != 0 || memoryBarrier.dstAccessMask != 0;
+
+            vkCmdPipelineBarrier(cmd, srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStages, 0,
+                bMemoryBarrier ? 1 : 0, &memoryBarrier, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+        }
+
+        pass.execute(cmd);
+
+        if (profiler)
+        {
+            profiler->EndScope(cmd);
+        }
+    }
+
+    //exported images are moved to the layout their consumer outside the graph expects
+    std::vector<VkImageMemoryBarrier> exportBarriers;
+
+    VkPipelineStageFlags exportStages = 0;
+
+    for (Resource& resource : resources)
+    {
+        if (resource.exportLayout == VK_IMAGE_LAYOUT_UNDEFINED || resource.state.layout == resource.exportLayout)
+            continue;
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = resource.state.layout;
+        barrier.newLayout = resource.exportLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = resource.image;
+        barrier.subresourceRange.aspectMask = resource.aspect;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = resource.layers;
+        barrier.srcAccessMask = resource.state.writeAccess;
+        barrier.dstAccessMask = 0;
+
+        exportBarriers.push_back(barrier);
+
+        exportStages |= resource.state.writeStages | resource.state.readStages;
+
+        resource.state.layout = resource.exportLayout;
+        resource.state.writeStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        resource.state.writeAccess = 0;
+        resource.state.readStages = 0;
+        resource.state.visibleStages = 0;
+        resource.state.visibleAccess = 0;
+    }
+
+    if (!exportBarriers.empty())
+    {
+        vkCmdPipelineBarrier(cmd, exportStages != 0 ? exportStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+            0, nullptr, 0, nullptr, static_cast<uint32_t>(exportBarriers.size()), exportBarriers.data());
+    }
+
+    for (Resource& resource : resources)
+    {
+        if (resource.importedState)
+        {
+            *resource.importedState = resource.state;
+        }
+    }
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <initializer_list>
+
+#include "vulkan/vulkan.h"
+
+#include "vk_mem_alloc.h"
+
+class UGpuProfiler;
+
+//frames a transient image may go unused before its memory is released
+const uint32_t RENDER_GRAPH_TRANSIENT_LIFETIME = 120;
+
+using RGResource = uint32_t;
+
+//how a pass touches a resource, stages, access and image layout are derived from it
+enum class RGUsage
+{
+    TransferRead,
+    TransferWrite,
+    VertexShaderRead,
+    FragmentShaderSample,
+    ComputeRead,
+    ComputeWrite,
+    IndirectRead,
+    IndexRead,
+    ColorAttachment,
+    DepthAttachment
+};
+
+//synchronization state of a resource, imported resources keep theirs across frames
+struct RGResourceState
+{
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    //last write, a layout transition counts as a write without access
+    VkPipelineStageFlags writeStages = 0;
+    VkAccessFlags writeAccess = 0;
+
+    //stages that read since the last write
+    VkPipelineStageFlags readStages = 0;
+
+    //where the last write is already visible
+    VkPipelineStageFlags visibleStages = 0;
+    VkAccessFlags visibleAccess = 0;
+};
+
+struct RGImageDesc
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkImageUsageFlags usage = 0;
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    uint32_t layers = 1;
+
+    bool operator==(const RGImageDesc& other) const
+    {
+        return width == other.width && height == other.height && format == other.format && usage == other.usage && aspect == other.aspect && layers == other.layers;
+    }
+};
+
+//frame graph, rebuilt every frame
+//passes declare the resources they read and write, the graph culls passes nothing depends on,
+//inserts one batched barrier per pass from the tracked state and places transient images with disjoint lifetimes in the same memory
+//render passes used by graph passes keep their attachments in the subpass layout and declare no external dependencies
+class URenderGraph
+{
+public:
+    class PassBuilder
+    {
+    public:
+        PassBuilder(URenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+        PassBuilder& Read(RGResource resource, RGUsage usage);
+
+        //bDiscard drops the previous contents, for attachments that are cleared or fully overwritten
+        PassBuilder& Write(RGResource resource, RGUsage usage, bool bDiscard = false);
+
+        //disabled passes are culled along with everything only they depend on
+        PassBuilder& SetEnabled(bool bEnabled);
+
+    private:
+        friend class URenderGraph;
+
+        URenderGraph& graph;
+        uint32_t pass;
+    };
+
+    void Init(VkDevice device, VmaAllocator allocator, uint32_t framesInFlight);
+
+    void Cleanup();
+
+    //clears the previous graph and destroys what this frame slot retired, its fence must have been waited on
+    void BeginFrame(uint32_t frameIndex);
+
+    //external images and buffers, their written contents outlive the frame so passes writing them are never culled
+    RGResource ImportImage(const char* name, VkImage image, VkImageView view, VkImageAspectFlags aspect, uint32_t layers, RGResourceState& state);
+
+    RGResource ImportBuffer(const char* name, VkBuffer buffer, RGResourceState& state);
+
+    //image owned by the graph for this frame, its memory may be shared with other transients
+    RGResource CreateImage(const char* name, const RGImageDesc& desc);
+
+    //the image is left in layout once the graph has executed
+    void Export(RGResource resource, VkImageLayout layout);
+
+    PassBuilder AddPass(const char* name, std::function<void(VkCommandBuffer cmd)>&& execute);
+
+    //culls passes and places transient images, handles are valid afterwards
+    void Compile();
+
+    bool IsPassLive(const PassBuilder& pass) const;
+
+    VkImage GetImage(RGResource resource) const;
+
+    VkImageView GetImageView(RGResource resource) const;
+
+    //cached until one of the views is destroyed, attachments in render pass order
+    VkFramebuffer GetFramebuffer(VkRenderPass renderPass, std::initializer_list<RGResource> attachments, uint32_t width, uint32_t height);
+
+    //records the live passes, each inside a profiler scope named after the pass when a profiler is given
+    void Execute(VkCommandBuffer cmd, UGpuProfiler* profiler);
+
+    //the swapchain views were recreated, the device must be idle
+    void ReleaseFramebuffers();
+
+private:
+    struct Access
+    {
+        RGResource resource;
+        RGUsage usage;
+        bool bWrite;
+        bool bDiscard;
+    };
+
+    struct Pass
+    {
+        const char* name;
+        std::function<void(VkCommandBuffer cmd)> execute;
+        std::vector<Access> accesses;
+        bool bEnabled = true;
+        bool bLive = false;
+    };
+
+    struct Resource
+    {
+        const char* name;
+        bool bImage = false;
+        bool bImported = false;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkImageAspectFlags aspect = 0;
+        uint32_t layers = 1;
+        RGResourceState state;
+        //imported resources write their final state back here
+        RGResourceState* importedState = nullptr;
+        VkImageLayout exportLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        RGImageDesc desc;
+        //index into physicalImages for transients
+        uint32_t physicalImage = ~0u;
+        uint32_t firstPass = ~0u;
+        uint32_t lastPass = 0;
+    };
+
+    //memory shared by transients whose lifetimes do not overlap
+    struct MemorySlot
+    {
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkDeviceSize alignment = 0;
+        uint32_t memoryTypeBits = 0;
+        //last use of the memory by any image, the next image placed here waits for it
+        VkPipelineStageFlags stages = 0;
+        VkAccessFlags writeAccess = 0;
+    };
+
+    struct PhysicalImage
+    {
+        RGImageDesc desc;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkMemoryRequirements requirements{};
+        uint32_t slot = ~0u;
+        bool bClaimed = false;
+        uint32_t unusedFrames = 0;
+    };
+
+    struct CachedFramebuffer
+    {
+        VkRenderPass renderPass;
+        std::vector<VkImageView> views;
+        uint32_t width;
+        uint32_t height;
+        VkFramebuffer framebuffer;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+
+    VmaAllocator allocator = VK_NULL_HANDLE;
+
+    uint32_t currentFrame = 0;
+
+    std::vector<Pass> passes;
+
+    std::vector<Resource> resources;
+
+    std::vector<MemorySlot> slots;
+
+    std::vector<PhysicalImage> physicalImages;
+
+    std::vector<CachedFramebuffer> framebuffers;
+
+    //destroyed once the frame slot that retired them comes around again
+    std::vector<std::vector<std::function<void()>>> retired;
+
+    void PlaceTransients();
+
+    void CreatePhysicalImage(PhysicalImage& physicalImage);
+
+    void RetirePhysicalImage(PhysicalImage& physicalImage);
+
+    void RetireFramebuffers(VkImageView view);
+
+    //appends the barrier needed before resource is used as usage and updates its state
+    void AddBarrier(Resource& resource, RGUsage usage, bool bWrite, bool bDiscard, VkPipelineStageFlags& srcStages, VkPipelineStageFlags& dstStages,
+        VkMemoryBarrier& memoryBarrier, std::vector<VkImageMemoryBarrier>& imageBarriers);
+};
@@ -4,6 +4,8 @@
 
 #include "CommonTypes.h"
 
+#include <glm/gtc/matrix_access.hpp>
+
 #include "FreeCamera.h"
 
 #include <iostream>
@@ -17,8 +19,30 @@
 
 #include "SceneManager.h"
 
+#include "TextureCooker.h"
+
+#include "JobSystem.h"
+
+#include "Trace.h"
+
 #include <chrono>
 #include <cctype>
+#include <algorithm>
+#include <limits>
+#include <cassert>
+
+//smallest skinning variant reading every bone influence of a mesh
+static uint32_t GetSkinningVariant(uint32_t boneInfluences)
+{
+    uint32_t variant = 1;
+
+    while (variant + 1 < SKINNING_VARIANT_COUNT && SKINNING_VARIANT_INFLUENCES[variant] < boneInfluences)
+    {
+        variant++;
+    }
+
+    return boneInfluences == 0 ? 0 : variant;
+}
 
 void URenderer::Init() {
     InitVulkan();
@@ -33,34 +57,74 @@ void URenderer::Init() {
 
     CreateCommandPool();
 
-    LoadAssets();
+    CreateTextureSampler();
 
-    CreateDepthResources();
+    CreateTextureHeap();
 
-    CreateTextureSampler();
+    LoadAssets();
 
     CreateDescriptorSetLayout();
     CreateShadowDescriptorSetLayout();
     CreateDebugQuadDescriptorSetLayout();
+    CreateClusterCullDescriptorSetLayout();
+    CreateHiZBuildDescriptorSetLayout();
 
     CreateDescriptorPool();
 
 	CreateShadowSampler();
 
-    for (int i = 0; i < NUM_CASCADES; i++)
-    {
-		CreateShadowFrameBuffer(shadowFramebuffers[i], shadowImages[i], shadowImageViews[i]);
-    }
+    CreateShadowFrameBuffer();
+
+    CreateStaticShadowFrameBuffer();
 
     CreateDescriptorSets();
     CreateShadowDescriptorSets();
     CreateDebugQuadDescriptorSets();
+    CreateClusterCullDescriptorSets();
+
+    CreateHiZ();
 
     auto start = std::chrono::high_resolution_clock::now();
 
-    CreateGraphicsPipeline();
+    //the static variant always exists, skinned variants only for what the meshes of the loaded scene's skinned entities read
+    uint32_t variantMask = 1u;
+
+    const SceneManager& scene = SceneManager::Get();
+
+    for (size_t category = 0; category < scene.renderBatches.size(); category++)
+    {
+        if (!IsSkinnedRenderBatch(static_cast<RenderBatchCategory>(category)))
+        {
+            continue;
+        }
+
+        const std::vector<RenderBatch>& skinnedBatches = scene.renderBatches[category];
+
+        for (uint32_t modelID = 0; modelID < skinnedBatches.size(); modelID++)
+        {
+            if (skinnedBatches[modelID].entities.empty())
+            {
+                continue;
+            }
+
+            for (const Mesh& mesh : scene.modelTable[modelID]->meshes)
+            {
+                variantMask |= 1u << GetSkinningVariant(mesh.boneInfluences);
+            }
+        }
+    }
+
+    for (uint32_t variant = 0; variant < SKINNING_VARIANT_COUNT; variant++)
+    {
+        if (variantMask & (1u << variant))
+        {
+            CreatePipelineVariant(variant);
+        }
+    }
+
     CreateDebugQuadPipeline();
-    CreateShadowPipeline();
+    CreateClusterCullPipeline();
+    CreateHiZBuildPipeline();
 
     auto end = std::chrono::high_resolution_clock::now();
 
@@ -70,15 +134,18 @@ void URenderer::Init() {
 
     glslang::FinalizeProcess();
 
-    CreateFrameBuffers();
-
     CreateCommandBuffer();
 
+    CreateThreadCommandPools();
+
     CreateSyncPrimitives();
 
 	//create default camera
 
 	defaultCamera = new FreeCamera();
+
+	//instance LODs are picked before the frame's camera is known
+	camera = defaultCamera;
 }
 
 void URenderer::SetWindow(SDL_Window* window)
@@ -86,48 +153,95 @@ void URenderer::SetWindow(SDL_Window* window)
     _window = window;
 }
 
+void URenderer::SetHeadless(VkExtent2D extent)
+{
+    headless = true;
+    swapChainExtent = extent;
+    colorFinalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+}
+
 void URenderer::Draw(float deltaTime)
 {
+    UTRACE_FUNCTION();
+
 	this->deltaTime = deltaTime;
     //wait for previous frame
-    vkWaitForFences(vkb_device, 1, &frames[currentFrame].renderFence, VK_TRUE, UINT64_MAX);
+    {
+        UTRACE_SCOPE("Wait for frame fence");
+        vkWaitForFences(vkb_device, 1, &frames[currentFrame].renderFence, VK_TRUE, UINT64_MAX);
+    }
 
-    uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(vkb_device, vkb_swapchain, UINT64_MAX, frames[currentFrame].imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    //offscreen images are owned by a frame slot, the fence above already guards their reuse
+    uint32_t imageIndex = currentFrame;
+    VkResult result = VK_SUCCESS;
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        RecreateSwapChain();
-        return;
-    }
-    else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-        throw std::runtime_error("Failed to acquire swap chain image!");
+    if (!headless)
+    {
+        result = vkAcquireNextImageKHR(vkb_device, vkb_swapchain, UINT64_MAX, frames[currentFrame].imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            RecreateSwapChain();
+            return;
+        }
+        else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            throw std::runtime_error("Failed to acquire swap chain image!");
+        }
     }
 
+    //waiting for the fence and the image is not work the governor can scale away
+    auto cpuFrameStart = std::chrono::steady_clock::now();
+
     vkResetFences(vkb_device, 1, &frames[currentFrame].renderFence);
 
     vkResetCommandBuffer(frames[currentFrame].commandBuffer, 0);
 
+    //submit streaming requests made since the last frame
+    uploader.Flush();
+
     RecordCommandBuffer(frames[currentFrame].commandBuffer, imageIndex);
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = { frames[currentFrame].imageAvailableSemaphore };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
+    //uploads acquired in this command buffer were finished when recorded, so the timeline wait never stalls
+    VkSemaphore waitSemaphores[] = { frames[currentFrame].imageAvailableSemaphore, uploader.GetTimelineSemaphore() };
+    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+    uint64_t waitValues[] = { 0, uploader.GetGraphicsWaitValue() };
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    //headless frames skip the acquire semaphore and signal nothing for presentation
+    uint32_t firstWait = headless ? 1 : 0;
+
+    timelineInfo.waitSemaphoreValueCount = 2 - firstWait;
+    timelineInfo.pWaitSemaphoreValues = waitValues + firstWait;
+
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = 2 - firstWait;
+    submitInfo.pWaitSemaphores = waitSemaphores + firstWait;
+    submitInfo.pWaitDstStageMask = waitStages + firstWait;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &frames[currentFrame].commandBuffer;
 
     VkSemaphore signalSemaphores[] = { frames[currentFrame].renderFinishedSemaphore };
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = headless ? 0 : 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
     if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frames[currentFrame].renderFence) != VK_SUCCESS) {
         throw std::runtime_error("Failed to submit draw command buffer!");
     }
 
+    cpuFrameMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpuFrameStart).count();
+
+    if (headless)
+    {
+        currentFrame = (currentFrame + 1) % MAX_FRAMES;
+
+        frameNumber++;
+
+        return;
+    }
+
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
@@ -150,20 +264,24 @@ void URenderer::Draw(float deltaTime)
     }
 
     currentFrame = (currentFrame + 1) % MAX_FRAMES;
+
+    frameNumber++;
 }
 
 void URenderer::Cleanup() {
     vkDeviceWaitIdle(vkb_device);
 
-    for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
-        vkDestroyFramebuffer(vkb_device, swapChainFramebuffers[i], nullptr);
-    }
+    renderGraph.ReleaseFramebuffers();
 
-    for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-        vkDestroyImageView(vkb_device, swapChainImageViews[i], nullptr);
-    }
+    //offscreen images and views are in the deletion queue
+    if (!headless)
+    {
+        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+            vkDestroyImageView(vkb_device, swapChainImageViews[i], nullptr);
+        }
 
-    vkb::destroy_swapchain(vkb_swapchain);
+        vkb::destroy_swapchain(vkb_swapchain);
+    }
 
     deletionQueue.flush();
 }
@@ -172,8 +290,10 @@ void URenderer::InitVulkan() {
 
     vkb::InstanceBuilder instance_builder;
     auto instance_builder_return = instance_builder
+        .require_api_version(1, 2, 0)
         .request_validation_layers()
         .use_default_debug_messenger()
+        .set_headless(headless)
         .build();
     if (!instance_builder_return) {
         throw std::runtime_error("Failed to create instance!");
@@ -184,23 +304,65 @@ void URenderer::InitVulkan() {
         vkb::destroy_instance(vkb_instance);
         });
 
-    if (SDL_Vulkan_CreateSurface(_window, vkb_instance.instance, &surface) != SDL_TRUE)
+    if (!headless)
     {
-        throw std::runtime_error("Failed to create surface!");
-    }
+        if (SDL_Vulkan_CreateSurface(_window, vkb_instance.instance, &surface) != SDL_TRUE)
+        {
+            throw std::runtime_error("Failed to create surface!");
+        }
 
-    deletionQueue.push_function([&]() {
-        vkb::destroy_surface(vkb_instance, surface);
-        });
+        deletionQueue.push_function([&]() {
+            vkb::destroy_surface(vkb_instance, surface);
+            });
+    }
 
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+    //culled clusters are drawn with one indirect draw per cluster, each naming its instance
+    deviceFeatures.multiDrawIndirect = VK_TRUE;
+    deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+
+    //multiview renders all shadow cascades in one pass
+    VkPhysicalDeviceVulkan11Features features11{};
+    features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    features11.multiview = VK_TRUE;
+
+    //timeline semaphores track async uploads
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.timelineSemaphore = VK_TRUE;
+
+    //profiler queries are reset on the host, transfer queues can not reset them in a command buffer
+    features12.hostQueryReset = VK_TRUE;
+
+    //bindless texture heap, a runtime sized array that is partially bound and written while in use
+    features12.descriptorIndexing = VK_TRUE;
+    features12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    features12.runtimeDescriptorArray = VK_TRUE;
+    features12.descriptorBindingPartiallyBound = VK_TRUE;
+    features12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+    features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    features12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+
+    //the cluster culling pass writes the draw counts
+    features12.drawIndirectCount = VK_TRUE;
+
+    //a headless instance drops the present requirement, software implementations such as lavapipe are accepted
     vkb::PhysicalDeviceSelector phys_device_selector(vkb_instance);
-    auto physical_device_selector_return = phys_device_selector
+    phys_device_selector
+        .set_minimum_version(1, 2)
         .set_required_features(deviceFeatures)
-        .set_surface(surface)
-        .select();
+        .set_required_features_11(features11)
+        .set_required_features_12(features12)
+        .allow_any_gpu_device_type();
+
+    if (!headless)
+    {
+        phys_device_selector.set_surface(surface);
+    }
+
+    auto physical_device_selector_return = phys_device_selector.select();
     if (!physical_device_selector_return) {
         throw std::runtime_error("Failed to select physical device!");
     }
@@ -208,6 +370,28 @@ void URenderer::InitVulkan() {
 
     std::cout << "Selected physical device: " << phys_device.name << std::endl;
 
+    VkPhysicalDeviceFeatures compressionFeatures{};
+    compressionFeatures.textureCompressionBC = VK_TRUE;
+
+    textureCompressionBC = phys_device.enable_features_if_present(compressionFeatures);
+
+    if (!textureCompressionBC)
+    {
+        std::cout << "BC texture compression not supported, cooked textures will be ignored" << std::endl;
+    }
+
+    //secondary command buffers run inside the profiler's statistics queries
+    VkPhysicalDeviceFeatures statisticsFeatures{};
+    statisticsFeatures.pipelineStatisticsQuery = VK_TRUE;
+    statisticsFeatures.inheritedQueries = VK_TRUE;
+
+    pipelineStatistics = phys_device.enable_features_if_present(statisticsFeatures);
+
+    if (!pipelineStatistics)
+    {
+        std::cout << "Pipeline statistics queries not supported, the GPU profiler only records timestamps" << std::endl;
+    }
+
     vkb::DeviceBuilder device_builder{ phys_device };
     auto dev_ret = device_builder.build();
     if (!dev_ret) {
@@ -225,11 +409,18 @@ void URenderer::InitVulkan() {
     }
     graphicsQueue = queue_ret.value();
 
-    queue_ret = vkb_device.get_queue(vkb::QueueType::present);
-    if (!queue_ret) {
-        throw std::runtime_error("Failed to get present queue!");
+    if (headless)
+    {
+        presentQueue = graphicsQueue;
+    }
+    else
+    {
+        queue_ret = vkb_device.get_queue(vkb::QueueType::present);
+        if (!queue_ret) {
+            throw std::runtime_error("Failed to get present queue!");
+        }
+        presentQueue = queue_ret.value();
     }
-    presentQueue = queue_ret.value();
 
     VmaAllocatorCreateInfo allocatorInfo = {};
     allocatorInfo.physicalDevice = phys_device;
@@ -241,6 +432,67 @@ void URenderer::InitVulkan() {
     deletionQueue.push_function([&]() {
         vmaDestroyAllocator(allocator);
         });
+
+    uint32_t graphicsQueueFamily = vkb_device.get_queue_index(vkb::QueueType::graphics).value();
+
+    //prefer a transfer only queue, then any queue outside the graphics family, then the graphics queue itself
+    VkQueue transferQueue = graphicsQueue;
+    uint32_t transferQueueFamily = graphicsQueueFamily;
+
+    auto transfer_queue_ret = vkb_device.get_dedicated_queue(vkb::QueueType::transfer);
+    auto transfer_index_ret = vkb_device.get_dedicated_queue_index(vkb::QueueType::transfer);
+
+    if (!transfer_queue_ret)
+    {
+        transfer_queue_ret = vkb_device.get_queue(vkb::QueueType::transfer);
+        transfer_index_ret = vkb_device.get_queue_index(vkb::QueueType::transfer);
+    }
+
+    if (transfer_queue_ret && transfer_index_ret)
+    {
+        transferQueue = transfer_queue_ret.value();
+        transferQueueFamily = transfer_index_ret.value();
+    }
+
+    uploader.Init(vkb_device, allocator, transferQueue, transferQueueFamily, graphicsQueueFamily, UPLOAD_STAGING_SIZE);
+
+    std::cout << "Async uploads use " << (uploader.UsesDedicatedQueue() ? "a dedicated transfer queue" : "the graphics queue") << std::endl;
+
+    std::vector<VkQueueFamilyProperties> queueFamilies = phys_device.get_queue_families();
+
+    float timestampPeriod = phys_device.properties.limits.timestampPeriod;
+
+    uploader.EnableTimestamps(timestampPeriod, queueFamilies[transferQueueFamily].timestampValidBits);
+
+    gpuProfiler.Init(vkb_device, timestampPeriod, queueFamilies[graphicsQueueFamily].timestampValidBits, pipelineStatistics, MAX_FRAMES);
+
+    renderGraph.Init(vkb_device, allocator, MAX_FRAMES);
+
+    //the upscale is a linear filtered blit between images of the swapchain format
+    VkFormatProperties blitFormatProperties;
+    vkGetPhysicalDeviceFormatProperties(phys_device, VK_FORMAT_B8G8R8A8_SRGB, &blitFormatProperties);
+
+    VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    if (dynamicResolution && (blitFormatProperties.optimalTilingFeatures & blitFeatures) != blitFeatures)
+    {
+        std::cout << "Linear blits not supported, dynamic resolution is disabled" << std::endl;
+
+        dynamicResolution = false;
+    }
+
+    //a timing reflects a new scale once the frames in flight recorded at the old one are resolved
+    resolutionController.settleFrames = MAX_FRAMES + 1;
+
+    governor.settleFrames = MAX_FRAMES + 1;
+
+    resolutionController.Reset();
+
+    deletionQueue.push_function([&]() {
+        uploader.Cleanup();
+        gpuProfiler.Cleanup();
+        renderGraph.Cleanup();
+        });
 }
 
 void URenderer::OneTimeSubmit(std::function<void(VkCommandBuffer cmd)>&& function)
@@ -277,15 +529,28 @@ void URenderer::OneTimeSubmit(std::function<void(VkCommandBuffer cmd)>&& functio
 
 void URenderer::LoadAssets()
 {
+    UTRACE_FUNCTION();
+
     entityInstanceBufferSize = MAX_ENTITIES * sizeof(EntityInstance);
     entityInstanceBuffer = CreateBuffer(entityInstanceBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 
     boneTransformBufferSize = MAX_ANIMATED_ENTITIES * sizeof(BoneTransformData);
     boneTransformBuffer = CreateBuffer(boneTransformBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 
-    entityInstanceStaging = CreateBuffer(entityInstanceBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    frames.resize(MAX_FRAMES);
+
+    for (FrameData& frame : frames)
+    {
+        frame.entityInstanceStaging = CreateBuffer(entityInstanceBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        frame.entityInstanceStagingSize = entityInstanceBufferSize;
+
+        frame.boneTransformStaging = CreateBuffer(boneTransformBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        frame.boneTransformStagingSize = boneTransformBufferSize;
 
-	boneTransformStaging = CreateBuffer(boneTransformBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        frame.clusterDraws = CreateBuffer(MAX_CLUSTER_DRAWS * sizeof(ClusterDraw), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+        frame.clusterCullUniform = CreateBuffer(sizeof(ClusterCullData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    }
 
     deletionQueue.push_function([&]() {
         vmaDestroyBuffer(allocator, entityInstanceBuffer.buffer, entityInstanceBuffer.allocation);
@@ -296,31 +561,92 @@ void URenderer::LoadAssets()
         });
 
     deletionQueue.push_function([&]() {
-        vmaDestroyBuffer(allocator, entityInstanceStaging.buffer, entityInstanceStaging.allocation);
+        for (FrameData& frame : frames)
+        {
+            for (std::function<void()>& release : frame.retiredBuffers)
+            {
+                release();
+            }
+
+            vmaDestroyBuffer(allocator, frame.entityInstanceStaging.buffer, frame.entityInstanceStaging.allocation);
+            vmaDestroyBuffer(allocator, frame.boneTransformStaging.buffer, frame.boneTransformStaging.allocation);
+            vmaDestroyBuffer(allocator, frame.clusterDraws.buffer, frame.clusterDraws.allocation);
+            vmaDestroyBuffer(allocator, frame.clusterCullUniform.buffer, frame.clusterCullUniform.allocation);
+        }
         });
 
-	deletionQueue.push_function([&]() {
-		vmaDestroyBuffer(allocator, boneTransformStaging.buffer, boneTransformStaging.allocation);
-		});
+    //the arena buffers are created once, models loaded later are sub-allocated from them
+    std::array<uint32_t, GEOMETRY_STREAM_COUNT> sceneCounts = {};
+
+    for (auto& [modelName, model] : SceneManager::Get().models)
+    {
+        GeometrySource geometry = model.GetPendingGeometry();
+
+        sceneCounts[GEOMETRY_STREAM_VERTICES] += geometry.vertexCount;
+        sceneCounts[GEOMETRY_STREAM_INDICES] += geometry.indexCount;
+        sceneCounts[GEOMETRY_STREAM_MESHLETS] += geometry.meshletCount;
+    }
 
-    //create vertex and index buffer
-    const size_t vertexBufferSize = SceneManager::Get().vertices.size() * sizeof(Vertex);
-    const size_t indexBufferSize = SceneManager::Get().indices.size() * sizeof(uint32_t);
+    std::array<uint32_t, GEOMETRY_STREAM_COUNT> arenaCapacities;
+    arenaCapacities[GEOMETRY_STREAM_VERTICES] = static_cast<uint32_t>(geometryArenaVertexMB * 1024ull * 1024ull / sizeof(Vertex));
+    arenaCapacities[GEOMETRY_STREAM_INDICES] = static_cast<uint32_t>(geometryArenaIndexMB * 1024ull * 1024ull / sizeof(uint32_t));
+    //meshlets hold up to 124 triangles, most are close to full
+    arenaCapacities[GEOMETRY_STREAM_MESHLETS] = arenaCapacities[GEOMETRY_STREAM_INDICES] / 32;
 
-    if (vertexBufferSize + indexBufferSize > 0)
+    for (uint32_t stream = 0; stream < GEOMETRY_STREAM_COUNT; stream++)
     {
-        vertexBuffer = CreateBuffer(vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-            VMA_MEMORY_USAGE_GPU_ONLY);
+        if (arenaCapacities[stream] < sceneCounts[stream])
+        {
+            std::cout << "Geometry arena stream " << stream << " raised from " << arenaCapacities[stream] << " to " << sceneCounts[stream]
+                << " elements to fit the scene" << std::endl;
 
-        indexBuffer = CreateBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-            VMA_MEMORY_USAGE_GPU_ONLY);
+            arenaCapacities[stream] = sceneCounts[stream];
+        }
 
-        deletionQueue.push_function([&]() {
-            vmaDestroyBuffer(allocator, vertexBuffer.buffer, vertexBuffer.allocation);
-            vmaDestroyBuffer(allocator, indexBuffer.buffer, indexBuffer.allocation);
-            });
+        //an empty scene still gets buffers so the descriptors stay valid
+        arenaCapacities[stream] = std::max(arenaCapacities[stream], 1u);
     }
 
+    geometryArena.Init(arenaCapacities);
+
+    //transfer source for the defragmentation copies
+    const VkBufferUsageFlags arenaUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    meshletBuffer = CreateBuffer(static_cast<size_t>(arenaCapacities[GEOMETRY_STREAM_MESHLETS]) * sizeof(Meshlet),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | arenaUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    vertexBuffer = CreateBuffer(static_cast<size_t>(arenaCapacities[GEOMETRY_STREAM_VERTICES]) * sizeof(Vertex),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | arenaUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    indexBuffer = CreateBuffer(static_cast<size_t>(arenaCapacities[GEOMETRY_STREAM_INDICES]) * sizeof(uint32_t),
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | arenaUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    const VkPhysicalDeviceLimits& limits = phys_device.properties.limits;
+
+    maxComputeWorkGroupsX = limits.maxComputeWorkGroupCount[0];
+
+    //the culling set binds all lists as one range, the late phase dispatches one group per 64 of its clusters in x
+    clusterListMaxCapacity = static_cast<uint32_t>(std::min<uint64_t>({ CLUSTER_LIST_MAX_CAPACITY,
+        limits.maxStorageBufferRange / (CLUSTER_LIST_COUNT * sizeof(VkDrawIndexedIndirectCommand)),
+        limits.maxStorageBufferRange / sizeof(glm::uvec4) - 1,
+        static_cast<uint64_t>(maxComputeWorkGroupsX) * 64 }));
+
+    clusterListCapacity = std::min(CLUSTER_LIST_INITIAL_CAPACITY, clusterListMaxCapacity);
+
+    CreateClusterListBuffers();
+
+    clusterCountBuffer = CreateBuffer(CLUSTER_LIST_COUNT * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    deletionQueue.push_function([&]() {
+        vmaDestroyBuffer(allocator, meshletBuffer.buffer, meshletBuffer.allocation);
+        vmaDestroyBuffer(allocator, vertexBuffer.buffer, vertexBuffer.allocation);
+        vmaDestroyBuffer(allocator, indexBuffer.buffer, indexBuffer.allocation);
+        vmaDestroyBuffer(allocator, clusterCommandBuffer.buffer, clusterCommandBuffer.allocation);
+        vmaDestroyBuffer(allocator, clusterCountBuffer.buffer, clusterCountBuffer.allocation);
+        vmaDestroyBuffer(allocator, clusterLateBuffer.buffer, clusterLateBuffer.allocation);
+        });
+
     shadowUniformBuffer = CreateBuffer(sizeof(ShadowData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
     deletionQueue.push_function([&]() {
@@ -340,150 +666,576 @@ void URenderer::LoadAssets()
 		});
 
 
-    //copy vertex and index data to GPU
-    if (vertexBufferSize + indexBufferSize > 0)
-    {
-        AllocatedBuffer staging = CreateBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-        void* data = staging.allocation->GetMappedData();
+    std::cout << sceneCounts[GEOMETRY_STREAM_VERTICES] << " vertices" << std::endl;
 
-		std::cout << SceneManager::Get().vertices.size() << " vertices" << std::endl;
-        // copy vertex buffer
-        memcpy(data, SceneManager::Get().vertices.data(), vertexBufferSize);
-        // copy index buffer
-        memcpy((char*)data + vertexBufferSize, SceneManager::Get().indices.data(), indexBufferSize);
+    //the scene goes through the same path as models loaded later
+    StreamModelGeometry();
 
+    //the startup batch is waited on so the first frame acquires all of it, the first frames would draw without the scene otherwise
+    uploader.WaitIdle();
 
-        // copy staging buffer to vertex and index buffer
-        OneTimeSubmit([&](VkCommandBuffer cmd) {
-            VkBufferCopy vertexCopy{ 0 };
-            vertexCopy.dstOffset = 0;
-            vertexCopy.srcOffset = 0;
-            vertexCopy.size = vertexBufferSize;
+    std::cout << "Texture upload size: " << textureUploadSize / (1024 * 1024) << " MB" << std::endl;
+}
 
-            vkCmdCopyBuffer(cmd, staging.buffer, vertexBuffer.buffer, 1, &vertexCopy);
+void URenderer::LoadTextures()
+{
+    UTRACE_FUNCTION();
 
-            VkBufferCopy indexCopy{ 0 };
-            indexCopy.dstOffset = 0;
-            indexCopy.srcOffset = vertexBufferSize;
-            indexCopy.size = indexBufferSize;
+    const std::vector<std::string>& texturePaths = SceneManager::Get().texturePaths;
 
-            vkCmdCopyBuffer(cmd, staging.buffer, indexBuffer.buffer, 1, &indexCopy);
-            });
+    //texture ids are indices into the scene's paths, every path before firstTexture is loaded already
+    const uint32_t firstTexture = static_cast<uint32_t>(textureAlphaTested.size());
 
-        vmaDestroyBuffer(allocator, staging.buffer, staging.allocation);
+    //checked before anything is created, the slots are only allocated in the upload callbacks while the frame is recorded
+    if (texturePaths.size() > textureHeap.GetCapacity())
+    {
+        throw std::runtime_error("Scene has " + std::to_string(texturePaths.size()) + " textures, the texture heap holds " + std::to_string(textureHeap.GetCapacity()) + "!");
     }
 
-    for (std::string texturePath : SceneManager::Get().texturePaths)
+    std::vector<TextureUpload> uploads(texturePaths.size() - firstTexture);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    //decode is independent per texture, only the upload below touches the device
+    JobSystem::Get().ParallelFor(static_cast<uint32_t>(uploads.size()), [&](uint32_t index) {
+        DecodeTexture(texturePaths[firstTexture + index], uploads[index]);
+        });
+
+    auto decoded = std::chrono::high_resolution_clock::now();
+
+    textureAlphaTested.resize(texturePaths.size());
+
+    for (size_t i = 0; i < uploads.size(); i++)
     {
-        CreateTextureImage(texturePath);
+        textureAlphaTested[firstTexture + i] = uploads[i].bAlphaTested;
     }
 
-}
-
-void URenderer::CreateDepthResources()
-{
-    CreateImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImage);
+    UploadTextures(uploads, firstTexture);
 
-    depthImageView = CreateImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+    auto end = std::chrono::high_resolution_clock::now();
 
-    TransitionImageLayout(depthImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    std::cout << "Decoded " << uploads.size() << " textures on " << JobSystem::Get().GetThreadCount() << " threads in "
+        << std::chrono::duration<float, std::milli>(decoded - start).count() << " ms, uploaded in "
+        << std::chrono::duration<float, std::milli>(end - decoded).count() << " ms" << std::endl;
 }
 
-void URenderer::CreateTextureImage(std::string texturePath)
+void URenderer::ReserveInstanceBuffers(FrameData& frame, uint32_t instanceCount, uint32_t animatedCount)
 {
-    std::string extension = texturePath.substr(texturePath.find_last_of(".") + 1);
-
-    for (char& c : extension) {
-        c = std::tolower(static_cast<unsigned char>(c));
+    //this frame slot's fence was waited on, nothing recorded into it the last time is still running
+    for (std::function<void()>& release : frame.retiredBuffers)
+    {
+        release();
     }
 
-    if (extension == "png" || extension == "jpg" || extension == "jpeg" || extension == "tga")
+    frame.retiredBuffers.clear();
+
+    const size_t instanceSize = static_cast<size_t>(instanceCount) * sizeof(EntityInstance);
+    const size_t boneTransformSize = static_cast<size_t>(animatedCount) * sizeof(BoneTransformData);
+
+    //the other frame in flight may still read the old buffers, they are destroyed once this slot comes around again
+    //by then both frames that could use them are finished
+    if (instanceSize > entityInstanceBufferSize)
     {
-        int texWidth, texHeight, texChannels;
-        stbi_uc* pixels = stbi_load(texturePath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-        VkDeviceSize imageSize = texWidth * texHeight * 4;
+        AllocatedBuffer retired = entityInstanceBuffer;
 
-        if (!pixels) {
-            throw std::runtime_error("Failed to load texture image!");
-        }
+        frame.retiredBuffers.push_back([this, retired]() {
+            vmaDestroyBuffer(allocator, retired.buffer, retired.allocation);
+            });
 
-        AllocatedBuffer stagingBuffer = CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        entityInstanceBufferSize = std::max(instanceSize, entityInstanceBufferSize * 2);
 
-        void* data = stagingBuffer.allocation->GetMappedData();
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
+        entityInstanceBuffer = CreateBuffer(entityInstanceBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 
-        stbi_image_free(pixels);
+        instanceBuffersVersion++;
 
-        VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+        std::cout << "Entity instance buffer grown to " << entityInstanceBufferSize / sizeof(EntityInstance) << " instances" << std::endl;
+    }
 
-        VkImage textureImage;
-        CreateImage(texWidth, texHeight, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, textureImage);
+    if (boneTransformSize > boneTransformBufferSize)
+    {
+        AllocatedBuffer retired = boneTransformBuffer;
+
+        frame.retiredBuffers.push_back([this, retired]() {
+            vmaDestroyBuffer(allocator, retired.buffer, retired.allocation);
+            });
 
-        TransitionImageLayout(textureImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        boneTransformBufferSize = std::max(boneTransformSize, boneTransformBufferSize * 2);
 
-        CopyBufferToImage(stagingBuffer.buffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+        boneTransformBuffer = CreateBuffer(boneTransformBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 
-        TransitionImageLayout(textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        instanceBuffersVersion++;
 
-        vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+        std::cout << "Bone transform buffer grown to " << boneTransformBufferSize / sizeof(BoneTransformData) << " animated entities" << std::endl;
+    }
 
-        VkImageView textureImageView = CreateImageView(textureImage, format, VK_IMAGE_ASPECT_COLOR_BIT);
+    //staging of this frame is idle, it follows the device buffers right away
+    if (frame.entityInstanceStagingSize < entityInstanceBufferSize)
+    {
+        vmaDestroyBuffer(allocator, frame.entityInstanceStaging.buffer, frame.entityInstanceStaging.allocation);
 
-        images.push_back(textureImageView);
+        frame.entityInstanceStaging = CreateBuffer(entityInstanceBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        frame.entityInstanceStagingSize = entityInstanceBufferSize;
     }
-    else
+
+    if (frame.boneTransformStagingSize < boneTransformBufferSize)
     {
-        throw std::runtime_error("Unsupported texture format!");
+        vmaDestroyBuffer(allocator, frame.boneTransformStaging.buffer, frame.boneTransformStaging.allocation);
+
+        frame.boneTransformStaging = CreateBuffer(boneTransformBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        frame.boneTransformStagingSize = boneTransformBufferSize;
+    }
+
+    //descriptor sets of the other frame may be in use, each frame updates its own when it is recorded next
+    if (frame.instanceBuffersVersion != instanceBuffersVersion)
+    {
+        WriteInstanceBufferDescriptors(currentFrame);
+
+        frame.instanceBuffersVersion = instanceBuffersVersion;
     }
 
+    entityInstanceCount = instanceCount;
+
+    animatedEntityCount = animatedCount;
 }
 
-void URenderer::CreateTextureSampler()
+void URenderer::WriteInstanceBufferDescriptors(uint32_t frameIndex)
 {
-    VkSamplerCreateInfo samplerInfo{};
-    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
+    VkDescriptorBufferInfo entityInstanceBufferInfo{ entityInstanceBuffer.buffer, 0, entityInstanceBufferSize };
 
-    VkPhysicalDeviceProperties properties{};
-    vkGetPhysicalDeviceProperties(phys_device, &properties);
-    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+    VkDescriptorBufferInfo boneTransformBufferInfo{ boneTransformBuffer.buffer, 0, boneTransformBufferSize };
 
-    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable = VK_FALSE;
-    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    samplerInfo.mipLodBias = 0.0f;
-    samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    //binding of the instances and the bone transforms in the main, shadow and cluster culling sets, the cull shader has no bones
+    struct InstanceBindings
+    {
+        VkDescriptorSet set;
+        uint32_t entityInstanceBinding;
+        uint32_t boneTransformBinding;
+    };
 
-    if (vkCreateSampler(vkb_device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create texture sampler!");
+    const InstanceBindings sets[] = {
+        { descriptorSets[frameIndex], 3, 4 },
+        { shadowDescriptorSets[frameIndex], 2, 3 },
+        { clusterCullDescriptorSets[frameIndex], 1, ~0u },
+    };
+
+    std::vector<VkWriteDescriptorSet> descriptorWrites;
+
+    for (const InstanceBindings& bindings : sets)
+    {
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = bindings.set;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.descriptorCount = 1;
+
+        descriptorWrite.dstBinding = bindings.entityInstanceBinding;
+        descriptorWrite.pBufferInfo = &entityInstanceBufferInfo;
+        descriptorWrites.push_back(descriptorWrite);
+
+        if (bindings.boneTransformBinding != ~0u)
+        {
+            descriptorWrite.dstBinding = bindings.boneTransformBinding;
+            descriptorWrite.pBufferInfo = &boneTransformBufferInfo;
+            descriptorWrites.push_back(descriptorWrite);
+        }
     }
 
-    deletionQueue.push_function([&]() {
-        vkDestroySampler(vkb_device, textureSampler, nullptr);
-        });
+    vkUpdateDescriptorSets(vkb_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
-VkImageView URenderer::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+void URenderer::CreateClusterListBuffers()
+{
+    clusterCommandBuffer = CreateBuffer(static_cast<size_t>(CLUSTER_LIST_COUNT) * clusterListCapacity * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    //a uvec4 header then up to clusterListCapacity meshlet, instance, list and draw entries
+    clusterLateBuffer = CreateBuffer((1 + static_cast<size_t>(clusterListCapacity)) * sizeof(glm::uvec4),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    //the new buffers start without pending writes
+    clusterCommandBufferState = RGResourceState();
+    clusterLateBufferState = RGResourceState();
+}
+
+bool URenderer::ReserveClusterLists(FrameData& frame, uint32_t workCount)
+{
+    if (workCount > clusterListMaxCapacity)
+    {
+        if (!bClusterListOverflowLogged)
+        {
+            std::cout << "Cluster culling work of " << workCount << " clusters exceeds the list limit of " << clusterListMaxCapacity
+                << ", drawing without cluster culling" << std::endl;
+
+            bClusterListOverflowLogged = true;
+        }
+
+        return false;
+    }
+
+    bClusterListOverflowLogged = false;
+
+    //retired like the instance buffers, the other frame in flight may still draw from the old lists
+    if (workCount > clusterListCapacity)
+    {
+        AllocatedBuffer retiredCommands = clusterCommandBuffer;
+        AllocatedBuffer retiredLate = clusterLateBuffer;
+
+        frame.retiredBuffers.push_back([this, retiredCommands, retiredLate]() {
+            vmaDestroyBuffer(allocator, retiredCommands.buffer, retiredCommands.allocation);
+            vmaDestroyBuffer(allocator, retiredLate.buffer, retiredLate.allocation);
+            });
+
+        clusterListCapacity = std::min(std::max(workCount, clusterListCapacity * 2), clusterListMaxCapacity);
+
+        CreateClusterListBuffers();
+
+        clusterListsVersion++;
+
+        std::cout << "Cluster lists grown to " << clusterListCapacity << " commands" << std::endl;
+    }
+
+    if (frame.clusterListsVersion != clusterListsVersion)
+    {
+        WriteClusterListDescriptors(currentFrame);
+
+        frame.clusterListsVersion = clusterListsVersion;
+    }
+
+    return true;
+}
+
+void URenderer::WriteClusterListDescriptors(uint32_t frameIndex)
+{
+    VkDescriptorBufferInfo commandBufferInfo{ clusterCommandBuffer.buffer, 0, VK_WHOLE_SIZE };
+
+    VkDescriptorBufferInfo lateBufferInfo{ clusterLateBuffer.buffer, 0, VK_WHOLE_SIZE };
+
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+
+    for (VkWriteDescriptorSet& descriptorWrite : descriptorWrites)
+    {
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = clusterCullDescriptorSets[frameIndex];
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.descriptorCount = 1;
+    }
+
+    descriptorWrites[0].dstBinding = 4;
+    descriptorWrites[0].pBufferInfo = &commandBufferInfo;
+
+    descriptorWrites[1].dstBinding = 7;
+    descriptorWrites[1].pBufferInfo = &lateBufferInfo;
+
+    vkUpdateDescriptorSets(vkb_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+void URenderer::StreamModelGeometry()
+{
+    UTRACE_FUNCTION();
+
+    SceneManager& scene = SceneManager::Get();
+
+    geometryArena.ReleaseRetired(frameNumber, MAX_FRAMES);
+
+    for (GeometryHandle handle : scene.releasedGeometry)
+    {
+        geometryArena.Free(handle, frameNumber);
+    }
+
+    scene.releasedGeometry.clear();
+
+    if (scene.texturePaths.size() > textureAlphaTested.size())
+    {
+        LoadTextures();
+    }
+
+    for (auto& [modelName, model] : scene.models)
+    {
+        if (model.geometry != INVALID_GEOMETRY_HANDLE)
+        {
+            continue;
+        }
+
+        //vectors of an imported model or the mapping of a cooked one
+        GeometrySource geometry = model.GetPendingGeometry();
+
+        if (geometry.vertexCount == 0)
+        {
+            continue;
+        }
+
+        std::array<uint32_t, GEOMETRY_STREAM_COUNT> counts;
+        counts[GEOMETRY_STREAM_VERTICES] = geometry.vertexCount;
+        counts[GEOMETRY_STREAM_INDICES] = geometry.indexCount;
+        counts[GEOMETRY_STREAM_MESHLETS] = geometry.meshletCount;
+
+        GeometryHandle handle = geometryArena.Allocate(counts);
+
+        if (handle == INVALID_GEOMETRY_HANDLE)
+        {
+            for (uint32_t stream = 0; stream < GEOMETRY_STREAM_COUNT; stream++)
+            {
+                if (counts[stream] > geometryArena.GetFreeCount(stream))
+                {
+                    throw std::runtime_error("Geometry arena is full!");
+                }
+            }
+
+            //enough space in holes or in ranges still retiring, tried again once defragmentation or the release made room
+            continue;
+        }
+
+        model.geometry = handle;
+
+        GeometryRange vertexRange = geometryArena.GetRange(handle, GEOMETRY_STREAM_VERTICES);
+        GeometryRange indexRange = geometryArena.GetRange(handle, GEOMETRY_STREAM_INDICES);
+        GeometryRange meshletRange = geometryArena.GetRange(handle, GEOMETRY_STREAM_MESHLETS);
+
+        uploader.UploadBuffer(vertexBuffer.buffer, vertexRange.offset * sizeof(Vertex), geometry.vertices, geometry.vertexCount * sizeof(Vertex),
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+        if (geometry.meshletCount > 0)
+        {
+            uploader.UploadBuffer(meshletBuffer.buffer, meshletRange.offset * sizeof(Meshlet), geometry.meshlets, geometry.meshletCount * sizeof(Meshlet),
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        }
+
+        //uploads of a flush complete together, the last one's callback makes the model drawable
+        uploader.UploadBuffer(indexBuffer.buffer, indexRange.offset * sizeof(uint32_t), geometry.indices, geometry.indexCount * sizeof(uint32_t),
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, [this, handle]() {
+                geometryArena.SetResident(handle, frameNumber);
+
+                //the static shadow cache is redrawn with the new model
+                SceneManager::Get().staticBatchVersion++;
+            });
+
+        //the uploader copied it into staging, the GPU copy is the only one from now on
+        std::vector<Vertex>().swap(model.vertices);
+        std::vector<uint32_t>().swap(model.indices);
+        std::vector<Meshlet>().swap(model.meshlets);
+
+        model.mappedFile.reset();
+        model.mappedGeometry = GeometrySource();
+    }
+
+    geometryMoves.clear();
+
+    std::array<uint32_t, GEOMETRY_STREAM_COUNT> moveBudget;
+    moveBudget[GEOMETRY_STREAM_VERTICES] = GEOMETRY_DEFRAG_BYTES_PER_FRAME / sizeof(Vertex);
+    moveBudget[GEOMETRY_STREAM_INDICES] = GEOMETRY_DEFRAG_BYTES_PER_FRAME / sizeof(uint32_t);
+    moveBudget[GEOMETRY_STREAM_MESHLETS] = GEOMETRY_DEFRAG_BYTES_PER_FRAME / sizeof(Meshlet);
+
+    geometryArena.Defragment(frameNumber, moveBudget, geometryMoves);
+}
+
+//planes of the clip volume of viewProj with zero to one depth, normalized with xyz pointing inside
+static void ExtractFrustumPlanes(const glm::mat4& viewProj, glm::vec4* planes)
+{
+    glm::vec4 row0 = glm::row(viewProj, 0);
+    glm::vec4 row1 = glm::row(viewProj, 1);
+    glm::vec4 row2 = glm::row(viewProj, 2);
+    glm::vec4 row3 = glm::row(viewProj, 3);
+
+    planes[0] = row3 + row0;
+    planes[1] = row3 - row0;
+    planes[2] = row3 + row1;
+    planes[3] = row3 - row1;
+    planes[4] = row2;
+    planes[5] = row3 - row2;
+
+    for (int i = 0; i < 6; i++)
+    {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+static VkFormat GetCookedTextureFormat(CookedTextureFormat format)
+{
+    switch (format)
+    {
+    case CookedTextureFormat::BC1_SRGB:
+        return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+    case CookedTextureFormat::BC3_SRGB:
+        return VK_FORMAT_BC3_SRGB_BLOCK;
+    case CookedTextureFormat::BC5_UNORM:
+        return VK_FORMAT_BC5_UNORM_BLOCK;
+    case CookedTextureFormat::BC7_SRGB:
+        return VK_FORMAT_BC7_SRGB_BLOCK;
+    default:
+        throw std::runtime_error("Unsupported cooked texture format!");
+    }
+}
+
+//runs on job system threads, must not touch vulkan or shared renderer state
+void URenderer::DecodeTexture(const std::string& texturePath, TextureUpload& upload)
+{
+    UTRACE_FUNCTION();
+
+    CookedTexture cookedTexture;
+
+    if (textureCompressionBC && TextureCooker::Get().LoadCookedTexture(texturePath, cookedTexture))
+    {
+        upload.format = GetCookedTextureFormat(cookedTexture.format);
+        upload.width = cookedTexture.width;
+        upload.height = cookedTexture.height;
+
+        for (uint32_t i = 0; i < cookedTexture.mips.size(); i++)
+        {
+            const CookedMipLevel& mip = cookedTexture.mips[i];
+
+            VkBufferImageCopy region{};
+            region.bufferOffset = mip.offset;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = i;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = { 0, 0, 0 };
+            region.imageExtent = { mip.width, mip.height, 1 };
+
+            upload.regions.push_back(region);
+        }
+
+        upload.data = std::move(cookedTexture.data);
+
+        //same test as the raw path below, the alpha formats are also used for soft alpha that is never discarded
+        upload.bAlphaTested = cookedTexture.bAlphaTested;
+        return;
+    }
+
+    std::string extension = texturePath.substr(texturePath.find_last_of(".") + 1);
+
+    for (char& c : extension) {
+        c = std::tolower(static_cast<unsigned char>(c));
+    }
+
+    if (extension == "png" || extension == "jpg" || extension == "jpeg" || extension == "tga")
+    {
+        int texWidth, texHeight, texChannels;
+        stbi_uc* pixels = stbi_load(texturePath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+
+        if (!pixels) {
+            throw std::runtime_error("Failed to load texture image: " + texturePath);
+        }
+
+        size_t imageSize = static_cast<size_t>(texWidth) * texHeight * 4;
+
+        upload.format = VK_FORMAT_R8G8B8A8_SRGB;
+        upload.width = static_cast<uint32_t>(texWidth);
+        upload.height = static_cast<uint32_t>(texHeight);
+        upload.data.assign(pixels, pixels + imageSize);
+
+        for (size_t i = 3; i < imageSize && !upload.bAlphaTested; i += 4)
+        {
+            upload.bAlphaTested = pixels[i] < ALPHA_TEST_CUTOFF;
+        }
+
+        stbi_image_free(pixels);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { upload.width, upload.height, 1 };
+
+        upload.regions.push_back(region);
+    }
+    else
+    {
+        throw std::runtime_error("Unsupported texture format!");
+    }
+}
+
+void URenderer::UploadTextures(const std::vector<TextureUpload>& uploads, uint32_t firstTexture)
+{
+    UTRACE_FUNCTION();
+
+    //the uploader batches every texture into as few transfer submits as the staging ring allows
+    for (size_t i = 0; i < uploads.size(); i++)
+    {
+        const TextureUpload& upload = uploads[i];
+
+        uint32_t mipLevels = static_cast<uint32_t>(upload.regions.size());
+
+        VkImage textureImage;
+        CreateImage(upload.width, upload.height, upload.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, textureImage, mipLevels);
+
+        VkImageView textureImageView = CreateImageView(textureImage, upload.format, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+
+        uint32_t textureID = firstTexture + static_cast<uint32_t>(i);
+
+        //the slot is written once the graphics queue acquired the image, callbacks run in upload order so slots are still handed out in order
+        //geometry using the texture is uploaded after it and only drawn once its own upload was acquired
+        uploader.UploadImage(textureImage, mipLevels, upload.regions, upload.data.data(), upload.data.size(), [this, textureImageView, textureID]() {
+            //vertices store the scene texture index, textures are only ever appended and LoadTextures checked the capacity, so the two match
+            uint32_t slot = textureHeap.Allocate(textureImageView);
+
+            assert(slot == textureID);
+            (void)slot;
+            });
+
+        textureUploadSize += upload.data.size();
+    }
+}
+
+void URenderer::CreateTextureSampler()
+{
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.anisotropyEnable = VK_TRUE;
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(phys_device, &properties);
+    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    if (vkCreateSampler(vkb_device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create texture sampler!");
+    }
+
+    deletionQueue.push_function([&]() {
+        vkDestroySampler(vkb_device, textureSampler, nullptr);
+        });
+}
+
+void URenderer::CreateTextureHeap()
+{
+    textureHeap.Init(vkb_device, phys_device, textureSampler, MAX_FRAMES);
+
+    deletionQueue.push_function([&]() {
+        textureHeap.Cleanup();
+        });
+}
+
+VkImageView URenderer::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t layerCount)
 {
     VkImageViewCreateInfo viewInfo{};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     viewInfo.image = image;
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.viewType = layerCount > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = aspectFlags;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
+    viewInfo.subresourceRange.layerCount = layerCount;
 
     VkImageView imageView;
     if (vkCreateImageView(vkb_device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
@@ -497,7 +1249,7 @@ VkImageView URenderer::CreateImageView(VkImage image, VkFormat format, VkImageAs
     return imageView;
 }
 
-void URenderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImage& image)
+void URenderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImage& image, uint32_t mipLevels, uint32_t arrayLayers)
 {
 
     VkImageCreateInfo imageInfo{};
@@ -506,8 +1258,8 @@ void URenderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, Vk
     imageInfo.extent.width = static_cast<uint32_t>(width);
     imageInfo.extent.height = static_cast<uint32_t>(height);
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = arrayLayers;
     imageInfo.format = format;
     imageInfo.tiling = tiling;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -533,78 +1285,6 @@ void URenderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, Vk
         });
 }
 
-void URenderer::TransitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
-{
-    OneTimeSubmit([&](VkCommandBuffer cmd) {
-        VkImageMemoryBarrier barrier{};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.oldLayout = oldLayout;
-        barrier.newLayout = newLayout;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image = image;
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = 1;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
-        barrier.srcAccessMask = 0; // TODO
-        barrier.dstAccessMask = 0; // TODO
-
-        if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-        {
-            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-        }
-        else
-        {
-            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        }
-
-        VkPipelineStageFlags sourceStage;
-        VkPipelineStageFlags destinationStage;
-
-        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-        {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        }
-        else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-        {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        }
-        else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-        {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        }
-        else
-        {
-            throw std::invalid_argument("Unsupported layout transition!");
-        }
-
-
-        vkCmdPipelineBarrier(
-            cmd,
-            sourceStage, destinationStage,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &barrier
-        );
-
-        });
-}
-
 void URenderer::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
     OneTimeSubmit([&](VkCommandBuffer cmd) {
         VkBufferImageCopy region{};
@@ -659,6 +1339,25 @@ URenderer::AllocatedBuffer URenderer::CreateBuffer(size_t allocSize, VkBufferUsa
 
 void URenderer::CreateSwapChain()
 {
+    swapChainSurfaceFormat.format = VK_FORMAT_B8G8R8A8_SRGB;
+    swapChainSurfaceFormat.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+
+    if (headless)
+    {
+        //one color target per frame in flight, transfer src so frames can be read back and transfer dst for the upscale
+        swapChainImages.resize(MAX_FRAMES);
+        swapChainImageViews.resize(MAX_FRAMES);
+
+        for (uint32_t i = 0; i < MAX_FRAMES; i++)
+        {
+            CreateImage(swapChainExtent.width, swapChainExtent.height, swapChainSurfaceFormat.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, swapChainImages[i]);
+
+            swapChainImageViews[i] = CreateImageView(swapChainImages[i], swapChainSurfaceFormat.format, VK_IMAGE_ASPECT_COLOR_BIT);
+        }
+
+        return;
+    }
+
     int width, height;
 
     SDL_GetWindowSize(_window, &width, &height);
@@ -671,14 +1370,12 @@ void URenderer::CreateSwapChain()
     swapChainExtent.height = static_cast<uint32_t>(height);
     swapChainExtent.width = static_cast<uint32_t>(width);
 
-    swapChainSurfaceFormat.format = VK_FORMAT_B8G8R8A8_SRGB;
-    swapChainSurfaceFormat.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
-
     vkb::SwapchainBuilder swapchain_builder{ vkb_device };
     auto swap_ret = swapchain_builder
         .set_desired_extent(swapChainExtent.width, swapChainExtent.height)
         .set_desired_format(swapChainSurfaceFormat)
         .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+        .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
         .build();
     if (!swap_ret) {
         throw std::runtime_error("Failed to create swapchain!");
@@ -698,7 +1395,7 @@ void URenderer::CreateRenderPass()
     depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference depthAttachmentRef{};
@@ -712,8 +1409,8 @@ void URenderer::CreateRenderPass()
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     //subpass
     VkAttachmentReference colorAttachmentRef{};
@@ -726,16 +1423,7 @@ void URenderer::CreateRenderPass()
     subpass.pColorAttachments = &colorAttachmentRef;
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    //subpass dependency
-    VkSubpassDependency dependency{};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-    //render pass
+    //render pass, layouts and dependencies are handled by the render graph
     VkRenderPassCreateInfo renderPassInfo{};
     std::vector<VkAttachmentDescription> attachments = { colorAttachment, depthAttachment };
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -743,76 +1431,97 @@ void URenderer::CreateRenderPass()
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
 
     if (vkCreateRenderPass(vkb_device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create render pass!");
     }
 
+    //overlay pass, draws on top of the main pass result without touching depth
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+
+    if (vkCreateRenderPass(vkb_device, &renderPassInfo, nullptr, &overlayRenderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+
+    //occlusion culling splits the main pass, the depth pyramid is built from the first half's depth
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+    if (vkCreateRenderPass(vkb_device, &renderPassInfo, nullptr, &occlusionEarlyRenderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+    if (vkCreateRenderPass(vkb_device, &renderPassInfo, nullptr, &occlusionLateRenderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+
     deletionQueue.push_function([&]() {
         vkDestroyRenderPass(vkb_device, renderPass, nullptr);
+        vkDestroyRenderPass(vkb_device, overlayRenderPass, nullptr);
+        vkDestroyRenderPass(vkb_device, occlusionEarlyRenderPass, nullptr);
+        vkDestroyRenderPass(vkb_device, occlusionLateRenderPass, nullptr);
         });
 
 }
 
 void URenderer::CreateShadowRenderPass()
 {
+    //the render graph transitions the shadow arrays, attachments stay in the subpass layout and need no external dependencies
     VkAttachmentDescription attachmentDescription{};
     attachmentDescription.format = shadowDepthFormat;
     attachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
-    attachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;							// Clear depth at beginning of the render pass
-    attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;						// We will read from depth, so it's important to store the depth attachment results
+    attachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;					// We don't care about initial layout of the attachment
-    attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;// Attachment will be transitioned to shader read at render pass end
-    // Attachment will be transitioned to shader read at render pass end
+    attachmentDescription.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference depthReference = {};
     depthReference.attachment = 0;
-    depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;			// Attachment will be used as depth/stencil during render pass
-    // Attachment will be used as depth/stencil during render pass
+    depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkSubpassDescription subpass = {};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 0;													// No color attachments
-    subpass.pDepthStencilAttachment = &depthReference;									// Reference to our depth attachment
-
-    // Use subpass dependencies for layout transitions
-    std::array<VkSubpassDependency, 2> dependencies;
-
-    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependencies[0].dstSubpass = 0;
-    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-    dependencies[1].srcSubpass = 0;
-    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    subpass.colorAttachmentCount = 0;
+    subpass.pDepthStencilAttachment = &depthReference;
 
-    VkRenderPassCreateInfo renderPassInfo{};
+    //each view renders one cascade layer of the shadow array
+    uint32_t viewMask = ALL_CASCADES_MASK;
+
+    VkRenderPassMultiviewCreateInfo multiviewInfo{};
+    multiviewInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO;
+    multiviewInfo.subpassCount = 1;
+    multiviewInfo.pViewMasks = &viewMask;
+
+    VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.pNext = &multiviewInfo;
     renderPassInfo.attachmentCount = 1;
     renderPassInfo.pAttachments = &attachmentDescription;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
-    renderPassInfo.pDependencies = dependencies.data();
 
     if (vkCreateRenderPass(vkb_device, &renderPassInfo, nullptr, &shadowRenderPass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create render pass!");
     }
 
+    //a clear would wipe every view, so with caching refreshed layers are cleared or copied with transfers beforehand and every layer is loaded
+    attachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+
+    if (vkCreateRenderPass(vkb_device, &renderPassInfo, nullptr, &shadowLoadRenderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+
     deletionQueue.push_function([&]() {
         vkDestroyRenderPass(vkb_device, shadowRenderPass, nullptr);
+        vkDestroyRenderPass(vkb_device, shadowLoadRenderPass, nullptr);
         });
 }
 
@@ -827,13 +1536,7 @@ void URenderer::CreateDescriptorSetLayout()
     vertexBufferLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 	bindings.push_back(vertexBufferLayoutBinding);
 
-    VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-    samplerLayoutBinding.binding = 1;
-    samplerLayoutBinding.descriptorCount = MAX_TEXTURE_COUNT;
-    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.pImmutableSamplers = nullptr;
-    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	bindings.push_back(samplerLayoutBinding);
+    //binding 1 was the fixed texture array, textures now live in the heap bound as set 1
 
     VkDescriptorSetLayoutBinding sceneDataLayoutBinding{};
     sceneDataLayoutBinding.binding = 2;
@@ -858,7 +1561,7 @@ void URenderer::CreateDescriptorSetLayout()
 
 	VkDescriptorSetLayoutBinding shadowMapLayoutBinding{};
 	shadowMapLayoutBinding.binding = 5;
-	shadowMapLayoutBinding.descriptorCount = NUM_CASCADES;
+	shadowMapLayoutBinding.descriptorCount = 1;
 	shadowMapLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	shadowMapLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	bindings.push_back(shadowMapLayoutBinding);
@@ -932,7 +1635,7 @@ void URenderer::CreateDebugQuadDescriptorSetLayout()
 {
     VkDescriptorSetLayoutBinding samplerLayoutBinding{};
     samplerLayoutBinding.binding = 0;
-    samplerLayoutBinding.descriptorCount = NUM_CASCADES;
+    samplerLayoutBinding.descriptorCount = 1;
     samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     samplerLayoutBinding.pImmutableSamplers = nullptr;
     samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -951,7 +1654,77 @@ void URenderer::CreateDebugQuadDescriptorSetLayout()
         });
 }
 
-void URenderer::CreateGraphicsPipeline()
+void URenderer::CreateClusterCullDescriptorSetLayout()
+{
+    //meshlets, entity instances, cluster draws, cull data, indirect commands, draw counts, depth pyramid, late clusters
+    std::vector<VkDescriptorSetLayoutBinding> bindings(8);
+
+    for (uint32_t i = 0; i < bindings.size(); i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = i == 3 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    bindings[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(vkb_device, &layoutInfo, nullptr, &clusterCullDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout!");
+    }
+
+    deletionQueue.push_function([&]() {
+        vkDestroyDescriptorSetLayout(vkb_device, clusterCullDescriptorSetLayout, nullptr);
+        });
+}
+
+void URenderer::CreateHiZBuildDescriptorSetLayout()
+{
+    //the level above, or the depth image for the first level, and the level written
+    std::vector<VkDescriptorSetLayoutBinding> bindings(2);
+
+    for (uint32_t i = 0; i < bindings.size(); i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(vkb_device, &layoutInfo, nullptr, &hiZBuildDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout!");
+    }
+
+    deletionQueue.push_function([&]() {
+        vkDestroyDescriptorSetLayout(vkb_device, hiZBuildDescriptorSetLayout, nullptr);
+        });
+}
+
+void URenderer::CreatePipelineVariant(uint32_t variant)
+{
+    if (graphicsPipelines[variant] != VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    CreateGraphicsPipeline(variant);
+
+    CreateShadowPipeline(variant);
+
+    std::cout << "Created pipeline variant for " << SKINNING_VARIANT_INFLUENCES[variant] << " bone influences" << std::endl;
+}
+
+void URenderer::CreateGraphicsPipeline(uint32_t variant)
 {
 
     //auto vertShaderCode = ReadFile("shaders/shader.vert");
@@ -960,15 +1733,23 @@ void URenderer::CreateGraphicsPipeline()
     //VkShaderModule vertShaderModule = CreateShaderModule(vertShaderCode, shaderc_glsl_vertex_shader);
     //VkShaderModule fragShaderModule = CreateShaderModule(fragShaderCode, shaderc_glsl_fragment_shader);
 
+    //the first variant compiles the shaders and creates the layout, the modules are kept so later variants are only specialized
+    bool bFirstVariant = mainVertShaderModule == VK_NULL_HANDLE;
+
+    if (bFirstVariant)
+    {
+        auto vertShaderCode = ReadFileStr("shaders/shader.vert");
+        auto fragShaderCode = ReadFileStr("shaders/shader.frag");
 
-    auto vertShaderCode = ReadFileStr("shaders/shader.vert");
-    auto fragShaderCode = ReadFileStr("shaders/shader.frag");
+        std::vector<uint32_t> spirvCode = CompileGLSLtoSPV(vertShaderCode, EShLangVertex);
+        mainVertShaderModule = CreateShaderModule(spirvCode);
 
-    std::vector<uint32_t> spirvCode = CompileGLSLtoSPV(vertShaderCode, EShLangVertex);
-    VkShaderModule vertShaderModule = CreateShaderModule(spirvCode);
+        spirvCode = CompileGLSLtoSPV(fragShaderCode, EShLangFragment);
+        mainFragShaderModule = CreateShaderModule(spirvCode);
+    }
 
-    spirvCode = CompileGLSLtoSPV(fragShaderCode, EShLangFragment);
-    VkShaderModule fragShaderModule = CreateShaderModule(spirvCode);
+    VkShaderModule vertShaderModule = mainVertShaderModule;
+    VkShaderModule fragShaderModule = mainFragShaderModule;
 
 
     //vertex shader
@@ -978,6 +1759,22 @@ void URenderer::CreateGraphicsPipeline()
     vertShaderStageInfo.module = vertShaderModule;
     vertShaderStageInfo.pName = "main";
 
+    //bone influences the skinning loop is unrolled for, 0 leaves it out
+    VkSpecializationMapEntry influenceEntry{};
+    influenceEntry.constantID = 1;
+    influenceEntry.offset = 0;
+    influenceEntry.size = sizeof(uint32_t);
+
+    uint32_t boneInfluences = SKINNING_VARIANT_INFLUENCES[variant];
+
+    VkSpecializationInfo vertSpecializationInfo{};
+    vertSpecializationInfo.mapEntryCount = 1;
+    vertSpecializationInfo.pMapEntries = &influenceEntry;
+    vertSpecializationInfo.dataSize = sizeof(uint32_t);
+    vertSpecializationInfo.pData = &boneInfluences;
+
+    vertShaderStageInfo.pSpecializationInfo = &vertSpecializationInfo;
+
     //fragment shader
     VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
     fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -1105,18 +1902,37 @@ void URenderer::CreateGraphicsPipeline()
     //pipeline layout
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+    //set 0 changes per frame, set 1 is the texture heap
+    std::array<VkDescriptorSetLayout, 2> setLayouts = { descriptorSetLayout, textureHeap.GetLayout() };
+
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = setLayouts.data();
     //pipelineLayoutInfo.pushConstantRangeCount = 1; // Optional
     //pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange; // Optional
 
-    if (vkCreatePipelineLayout(vkb_device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create pipeline layout!");
-    }
+    if (bFirstVariant)
+    {
+        if (vkCreatePipelineLayout(vkb_device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create pipeline layout!");
+        }
 
-    deletionQueue.push_function([&]() {
-        vkDestroyPipelineLayout(vkb_device, pipelineLayout, nullptr);
-        });
+        deletionQueue.push_function([&]() {
+            vkDestroyPipelineLayout(vkb_device, pipelineLayout, nullptr);
+            });
+
+        //variants created later are destroyed here too
+        deletionQueue.push_function([&]() {
+            for (uint32_t i = 0; i < SKINNING_VARIANT_COUNT; i++)
+            {
+                vkDestroyPipeline(vkb_device, graphicsPipelines[i], nullptr);
+                vkDestroyPipeline(vkb_device, alphaTestPipelines[i], nullptr);
+                vkDestroyPipeline(vkb_device, depthPrepassPipelines[i], nullptr);
+            }
+
+            vkDestroyShaderModule(vkb_device, mainFragShaderModule, nullptr);
+            vkDestroyShaderModule(vkb_device, mainVertShaderModule, nullptr);
+            });
+    }
 
 
     //pipeline
@@ -1138,16 +1954,55 @@ void URenderer::CreateGraphicsPipeline()
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    if (vkCreateGraphicsPipelines(vkb_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+    //alpha tested materials keep the discard
+    VkSpecializationMapEntry specializationEntry{};
+    specializationEntry.constantID = 0;
+    specializationEntry.offset = 0;
+    specializationEntry.size = sizeof(VkBool32);
+
+    VkBool32 alphaTest = VK_TRUE;
+
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = 1;
+    specializationInfo.pMapEntries = &specializationEntry;
+    specializationInfo.dataSize = sizeof(VkBool32);
+    specializationInfo.pData = &alphaTest;
+
+    shaderStages[1].pSpecializationInfo = &specializationInfo;
+
+    if (vkCreateGraphicsPipelines(vkb_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &alphaTestPipelines[variant]) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create graphics pipeline!");
     }
 
-    deletionQueue.push_function([&]() {
-        vkDestroyPipeline(vkb_device, graphicsPipeline, nullptr);
-        });
+    //opaque materials, without a discard the fragment shader no longer disables early depth testing
+    alphaTest = VK_FALSE;
 
-    vkDestroyShaderModule(vkb_device, fragShaderModule, nullptr);
-    vkDestroyShaderModule(vkb_device, vertShaderModule, nullptr);
+    if (depthPrepass)
+    {
+        //depth is already final, the lighting shader only runs for the visible fragment
+        depthStencil.depthWriteEnable = VK_FALSE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    }
+
+    if (vkCreateGraphicsPipelines(vkb_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipelines[variant]) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create graphics pipeline!");
+    }
+
+    //depth prepass, vertex shader only and no color writes
+    VkPipelineColorBlendAttachmentState depthOnlyBlendAttachment{};
+    depthOnlyBlendAttachment.colorWriteMask = 0;
+    depthOnlyBlendAttachment.blendEnable = VK_FALSE;
+
+    colorBlending.pAttachments = &depthOnlyBlendAttachment;
+
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+    pipelineInfo.stageCount = 1;
+
+    if (vkCreateGraphicsPipelines(vkb_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &depthPrepassPipelines[variant]) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create graphics pipeline!");
+    }
 }
 
 void URenderer::CreateDebugQuadPipeline()
@@ -1346,12 +2201,18 @@ void URenderer::CreateDebugQuadPipeline()
     vkDestroyShaderModule(vkb_device, vertShaderModule, nullptr);
 }
 
-void URenderer::CreateShadowPipeline()
+void URenderer::CreateShadowPipeline(uint32_t variant)
 {
+    bool bFirstVariant = shadowVertShaderModule == VK_NULL_HANDLE;
 
-    auto vertShaderCode = ReadFileStr("shaders/shadow.vert");
-    std::vector<uint32_t> spirvCode = CompileGLSLtoSPV(vertShaderCode, EShLangVertex);
-    VkShaderModule vertShaderModule = CreateShaderModule(spirvCode);
+    if (bFirstVariant)
+    {
+        auto vertShaderCode = ReadFileStr("shaders/shadow.vert");
+        std::vector<uint32_t> spirvCode = CompileGLSLtoSPV(vertShaderCode, EShLangVertex);
+        shadowVertShaderModule = CreateShaderModule(spirvCode);
+    }
+
+    VkShaderModule vertShaderModule = shadowVertShaderModule;
 
     //vertex shader
     VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
@@ -1360,6 +2221,22 @@ void URenderer::CreateShadowPipeline()
     vertShaderStageInfo.module = vertShaderModule;
     vertShaderStageInfo.pName = "main";
 
+    //same constant as the main vertex shader
+    VkSpecializationMapEntry influenceEntry{};
+    influenceEntry.constantID = 1;
+    influenceEntry.offset = 0;
+    influenceEntry.size = sizeof(uint32_t);
+
+    uint32_t boneInfluences = SKINNING_VARIANT_INFLUENCES[variant];
+
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = 1;
+    specializationInfo.pMapEntries = &influenceEntry;
+    specializationInfo.dataSize = sizeof(uint32_t);
+    specializationInfo.pData = &boneInfluences;
+
+    vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
     //shader stages
     VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo };
 
@@ -1484,13 +2361,25 @@ void URenderer::CreateShadowPipeline()
     pipelineLayoutInfo.pushConstantRangeCount = 1;
     pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-    if (vkCreatePipelineLayout(vkb_device, &pipelineLayoutInfo, nullptr, &shadowPipelineLayout) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create pipeline layout!");
-    }
+    if (bFirstVariant)
+    {
+        if (vkCreatePipelineLayout(vkb_device, &pipelineLayoutInfo, nullptr, &shadowPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create pipeline layout!");
+        }
 
-    deletionQueue.push_function([&]() {
-        vkDestroyPipelineLayout(vkb_device, shadowPipelineLayout, nullptr);
-        });
+        deletionQueue.push_function([&]() {
+            vkDestroyPipelineLayout(vkb_device, shadowPipelineLayout, nullptr);
+            });
+
+        deletionQueue.push_function([&]() {
+            for (VkPipeline pipeline : shadowPipelines)
+            {
+                vkDestroyPipeline(vkb_device, pipeline, nullptr);
+            }
+
+            vkDestroyShaderModule(vkb_device, shadowVertShaderModule, nullptr);
+            });
+    }
 
 
     //pipeline
@@ -1512,51 +2401,112 @@ void URenderer::CreateShadowPipeline()
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    if (vkCreateGraphicsPipelines(vkb_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &shadowPipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(vkb_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &shadowPipelines[variant]) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create graphics pipeline!");
     }
+}
+
+void URenderer::CreateClusterCullPipeline()
+{
+    auto compShaderCode = ReadFileStr("shaders/clusterCull.comp");
+
+    std::vector<uint32_t> spirvCode = CompileGLSLtoSPV(compShaderCode, EShLangCompute);
+    VkShaderModule compShaderModule = CreateShaderModule(spirvCode);
+
+    //the culling phase, 0 tests against last frame's depth pyramid and 1 re-tests its late clusters against this frame's
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(uint32_t);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &clusterCullDescriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(vkb_device, &pipelineLayoutInfo, nullptr, &clusterCullPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline layout!");
+    }
 
     deletionQueue.push_function([&]() {
-        vkDestroyPipeline(vkb_device, shadowPipeline, nullptr);
+        vkDestroyPipelineLayout(vkb_device, clusterCullPipelineLayout, nullptr);
         });
 
-    // vkDestroyShaderModule(vkb_device, fragShaderModule, nullptr);
-    vkDestroyShaderModule(vkb_device, vertShaderModule, nullptr);
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = compShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = clusterCullPipelineLayout;
+
+    if (vkCreateComputePipelines(vkb_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &clusterCullPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute pipeline!");
+    }
+
+    deletionQueue.push_function([&]() {
+        vkDestroyPipeline(vkb_device, clusterCullPipeline, nullptr);
+        });
+
+    vkDestroyShaderModule(vkb_device, compShaderModule, nullptr);
 }
 
-void URenderer::CreateFrameBuffers()
+void URenderer::CreateHiZBuildPipeline()
 {
-    swapChainFramebuffers.resize(swapChainImageViews.size());
+    auto compShaderCode = ReadFileStr("shaders/hzbBuild.comp");
 
-    for (size_t i = 0; i < swapChainImageViews.size(); i++)
-    {
-        std::vector<VkImageView> attachments
-        {
-            swapChainImageViews[i],
-            depthImageView
-        };
+    std::vector<uint32_t> spirvCode = CompileGLSLtoSPV(compShaderCode, EShLangCompute);
+    VkShaderModule compShaderModule = CreateShaderModule(spirvCode);
 
-        VkFramebufferCreateInfo framebufferInfo{};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = renderPass;
-        framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-        framebufferInfo.pAttachments = attachments.data();
-        framebufferInfo.width = swapChainExtent.width;
-        framebufferInfo.height = swapChainExtent.height;
-        framebufferInfo.layers = 1;
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &hiZBuildDescriptorSetLayout;
 
-        if (vkCreateFramebuffer(vkb_device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to create framebuffer!");
-        }
+    //the part of the source level that holds depth, smaller than the depth image with dynamic resolution
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(VkExtent2D);
+
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(vkb_device, &pipelineLayoutInfo, nullptr, &hiZBuildPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline layout!");
     }
+
+    deletionQueue.push_function([&]() {
+        vkDestroyPipelineLayout(vkb_device, hiZBuildPipelineLayout, nullptr);
+        });
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = compShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = hiZBuildPipelineLayout;
+
+    if (vkCreateComputePipelines(vkb_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &hiZBuildPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute pipeline!");
+    }
+
+    deletionQueue.push_function([&]() {
+        vkDestroyPipeline(vkb_device, hiZBuildPipeline, nullptr);
+        });
+
+    vkDestroyShaderModule(vkb_device, compShaderModule, nullptr);
 }
 
-void URenderer::CreateShadowFrameBuffer(VkFramebuffer& shadowFramebuffer, VkImage& shadowImage, VkImageView& shadowImageView)
+void URenderer::CreateShadowFrameBuffer()
 {
-    CreateImage(shadowMapResolution, shadowMapResolution, shadowDepthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, shadowImage);
+    CreateImage(shadowMapResolution, shadowMapResolution, shadowDepthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, shadowImage, 1, NUM_CASCADES);
 
-    shadowImageView = CreateImageView(shadowImage, shadowDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+    //the array view is both the multiview attachment and the sampled shadow map
+    shadowImageView = CreateImageView(shadowImage, shadowDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1, NUM_CASCADES);
 
     VkFramebufferCreateInfo framebufferInfo{};
     framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -1578,6 +2528,31 @@ void URenderer::CreateShadowFrameBuffer(VkFramebuffer& shadowFramebuffer, VkImag
 
 }
 
+void URenderer::CreateStaticShadowFrameBuffer()
+{
+    CreateImage(shadowMapResolution, shadowMapResolution, shadowDepthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, staticShadowImage, 1, NUM_CASCADES);
+
+    staticShadowImageView = CreateImageView(staticShadowImage, shadowDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1, NUM_CASCADES);
+
+    VkFramebufferCreateInfo framebufferInfo{};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = shadowLoadRenderPass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &staticShadowImageView;
+    framebufferInfo.width = shadowMapResolution;
+    framebufferInfo.height = shadowMapResolution;
+    framebufferInfo.layers = 1;
+
+    if (vkCreateFramebuffer(vkb_device, &framebufferInfo, nullptr, &staticShadowFramebuffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create framebuffer!");
+    }
+
+    deletionQueue.push_function([&]() {
+        vkDestroyFramebuffer(vkb_device, staticShadowFramebuffer, nullptr);
+        });
+}
+
 void URenderer::CreateShadowSampler()
 {
     VkFilter shadowmap_filter = VK_FILTER_LINEAR;
@@ -1613,9 +2588,8 @@ void URenderer::RecreateSwapChain()
 
     std::cout << "Recreate Swapchain!" << std::endl;
 
-    for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
-        vkDestroyFramebuffer(vkb_device, swapChainFramebuffers[i], nullptr);
-    }
+    //the graph creates framebuffers for the new views and a depth image of the new size on the next frame
+    renderGraph.ReleaseFramebuffers();
 
     for (size_t i = 0; i < swapChainImageViews.size(); i++) {
         vkDestroyImageView(vkb_device, swapChainImageViews[i], nullptr);
@@ -1624,7 +2598,15 @@ void URenderer::RecreateSwapChain()
     vkb::destroy_swapchain(vkb_swapchain);
 
     CreateSwapChain();
-    CreateFrameBuffers();
+
+    //the pyramid follows the swapchain size, last frame's contents no longer match the new depth
+    DestroyHiZImage();
+
+    CreateHiZImage();
+
+    WriteHiZDescriptors();
+
+    hiZValid = false;
 }
 
 void URenderer::CreateCommandPool()
@@ -1645,19 +2627,21 @@ void URenderer::CreateCommandPool()
 
 void URenderer::CreateDescriptorPool()
 {
-    std::vector<VkDescriptorPoolSize> poolSizes(3);
+    std::vector<VkDescriptorPoolSize> poolSizes(4);
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES * 6);
+    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES * (6 + 6));
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES * (MAX_TEXTURE_COUNT + NUM_CASCADES * 2));
+    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES * (3 + HI_Z_MAX_MIPS));
     poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES * (10 + NUM_CASCADES));
+    poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES * (11 + NUM_CASCADES));
+    poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[3].descriptorCount = static_cast<uint32_t>(MAX_FRAMES * HI_Z_MAX_MIPS);
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES * (2 + NUM_CASCADES));
+    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES * (3 + NUM_CASCADES + HI_Z_MAX_MIPS));
 
     if (vkCreateDescriptorPool(vkb_device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create descriptor pool!");
@@ -1684,34 +2668,10 @@ void URenderer::CreateDescriptorSets()
         throw std::runtime_error("Failed to allocate descriptor sets!");
     }
 
-    std::vector<VkDescriptorImageInfo> imageInfos;
-
-    int i = 0;
-    for (auto& imageView : images)
-    {
-        VkDescriptorImageInfo imageInfo{};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = imageView;
-        imageInfo.sampler = textureSampler;
-
-        imageInfos.push_back(imageInfo);
-        i++;
-    }
-
-    for (i; i < 256; i++)
-    {
-        VkDescriptorImageInfo imageInfo{};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = images[0];
-        imageInfo.sampler = textureSampler;
-
-        imageInfos.push_back(imageInfo);
-    }
-
     VkDescriptorBufferInfo vertexBufferInfo{};
     vertexBufferInfo.buffer = vertexBuffer.buffer;
     vertexBufferInfo.offset = 0;
-    vertexBufferInfo.range = SceneManager::Get().vertices.size() * sizeof(Vertex);
+    vertexBufferInfo.range = VK_WHOLE_SIZE;
 
     VkDescriptorBufferInfo sceneBufferInfo{};
     sceneBufferInfo.buffer = sceneDataUniformBuffer.buffer;
@@ -1728,16 +2688,11 @@ void URenderer::CreateDescriptorSets()
     boneTransformBufferInfo.offset = 0;
     boneTransformBufferInfo.range = boneTransformBufferSize;
 
-    std::vector<VkDescriptorImageInfo> shadowImageInfos{};
-    
-    for (i = 0; i < NUM_CASCADES; i++)
-    {
-		VkDescriptorImageInfo shadowImageInfo{};
-		shadowImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-		shadowImageInfo.imageView = shadowImageViews[i];
-		shadowImageInfo.sampler = shadowSampler;
-		shadowImageInfos.push_back(shadowImageInfo);
-    }
+    //one array view holds every cascade
+    VkDescriptorImageInfo shadowImageInfo{};
+    shadowImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    shadowImageInfo.imageView = shadowImageView;
+    shadowImageInfo.sampler = shadowSampler;
 
 	VkDescriptorBufferInfo cascadeDataBufferInfo{};
 	cascadeDataBufferInfo.buffer = cascadeDataBuffer.buffer;
@@ -1746,7 +2701,7 @@ void URenderer::CreateDescriptorSets()
 
     for (size_t i = 0; i < MAX_FRAMES; i++)
     {
-        std::vector<VkWriteDescriptorSet> descriptorWrites(7);
+        std::vector<VkWriteDescriptorSet> descriptorWrites(6);
 
         descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[0].dstSet = descriptorSets[i];
@@ -1758,51 +2713,43 @@ void URenderer::CreateDescriptorSets()
 
         descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[1].dstSet = descriptorSets[i];
-        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].dstBinding = 2;
         descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = MAX_TEXTURE_COUNT;
-        descriptorWrites[1].pImageInfo = imageInfos.data();
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[1].descriptorCount = 1;
+        descriptorWrites[1].pBufferInfo = &sceneBufferInfo;
 
         descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[2].dstSet = descriptorSets[i];
-        descriptorWrites[2].dstBinding = 2;
+        descriptorWrites[2].dstBinding = 3;
         descriptorWrites[2].dstArrayElement = 0;
-        descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         descriptorWrites[2].descriptorCount = 1;
-        descriptorWrites[2].pBufferInfo = &sceneBufferInfo;
+        descriptorWrites[2].pBufferInfo = &entityInstanceBufferInfo;
 
         descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[3].dstSet = descriptorSets[i];
-        descriptorWrites[3].dstBinding = 3;
+        descriptorWrites[3].dstBinding = 4;
         descriptorWrites[3].dstArrayElement = 0;
         descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         descriptorWrites[3].descriptorCount = 1;
-        descriptorWrites[3].pBufferInfo = &entityInstanceBufferInfo;
+        descriptorWrites[3].pBufferInfo = &boneTransformBufferInfo;
 
         descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[4].dstSet = descriptorSets[i];
-        descriptorWrites[4].dstBinding = 4;
+        descriptorWrites[4].dstBinding = 5;
         descriptorWrites[4].dstArrayElement = 0;
-        descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         descriptorWrites[4].descriptorCount = 1;
-        descriptorWrites[4].pBufferInfo = &boneTransformBufferInfo;
-
-        descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[5].dstSet = descriptorSets[i];
-        descriptorWrites[5].dstBinding = 5;
-        descriptorWrites[5].dstArrayElement = 0;
-        descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[5].descriptorCount = shadowImageInfos.size();
-        descriptorWrites[5].pImageInfo = shadowImageInfos.data();
-
-		descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[6].dstSet = descriptorSets[i];
-		descriptorWrites[6].dstBinding = 6;
-		descriptorWrites[6].dstArrayElement = 0;
-		descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[6].descriptorCount = 1;
-		descriptorWrites[6].pBufferInfo = &cascadeDataBufferInfo;
+        descriptorWrites[4].pImageInfo = &shadowImageInfo;
+
+		descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[5].dstSet = descriptorSets[i];
+		descriptorWrites[5].dstBinding = 6;
+		descriptorWrites[5].dstArrayElement = 0;
+		descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[5].descriptorCount = 1;
+		descriptorWrites[5].pBufferInfo = &cascadeDataBufferInfo;
 
         vkUpdateDescriptorSets(vkb_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
     }
@@ -1825,7 +2772,7 @@ void URenderer::CreateShadowDescriptorSets()
     VkDescriptorBufferInfo vertexBufferInfo{};
     vertexBufferInfo.buffer = vertexBuffer.buffer;
     vertexBufferInfo.offset = 0;
-    vertexBufferInfo.range = SceneManager::Get().vertices.size() * sizeof(Vertex);
+    vertexBufferInfo.range = VK_WHOLE_SIZE;
 
     VkDescriptorBufferInfo shadowBufferInfo{};
     shadowBufferInfo.buffer = shadowUniformBuffer.buffer;
@@ -1870,323 +2817,1400 @@ void URenderer::CreateShadowDescriptorSets()
         descriptorWrites[2].descriptorCount = 1;
         descriptorWrites[2].pBufferInfo = &entityInstanceBufferInfo;
 
-        descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[3].dstSet = shadowDescriptorSets[i];
-        descriptorWrites[3].dstBinding = 3;
-        descriptorWrites[3].dstArrayElement = 0;
-        descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        descriptorWrites[3].descriptorCount = 1;
-        descriptorWrites[3].pBufferInfo = &boneTransformBufferInfo;
+        descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[3].dstSet = shadowDescriptorSets[i];
+        descriptorWrites[3].dstBinding = 3;
+        descriptorWrites[3].dstArrayElement = 0;
+        descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[3].descriptorCount = 1;
+        descriptorWrites[3].pBufferInfo = &boneTransformBufferInfo;
+
+        vkUpdateDescriptorSets(vkb_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+    }
+
+}
+
+void URenderer::CreateDebugQuadDescriptorSets()
+{
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES, debugQuadDescriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES);
+    allocInfo.pSetLayouts = layouts.data();
+
+    if (vkAllocateDescriptorSets(vkb_device, &allocInfo, debugQuadDescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate descriptor sets!");
+    }
+
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	imageInfo.imageView = shadowImageView;
+	imageInfo.sampler = shadowSampler;
+
+    for (size_t i = 0; i < MAX_FRAMES; i++)
+    {
+        std::vector<VkWriteDescriptorSet> descriptorWrites(1);
+
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = debugQuadDescriptorSets[i];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pImageInfo = &imageInfo;
+
+        vkUpdateDescriptorSets(vkb_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+}
+
+void URenderer::CreateClusterCullDescriptorSets()
+{
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES, clusterCullDescriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES);
+    allocInfo.pSetLayouts = layouts.data();
+
+    if (vkAllocateDescriptorSets(vkb_device, &allocInfo, clusterCullDescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate descriptor sets!");
+    }
+
+    for (size_t i = 0; i < MAX_FRAMES; i++)
+    {
+        //the draws and cull data are written per frame, the rest is shared, the depth pyramid is written by WriteHiZDescriptors
+        std::array<VkDescriptorBufferInfo, 8> bufferInfos{};
+        bufferInfos[0] = { meshletBuffer.buffer, 0, VK_WHOLE_SIZE };
+        bufferInfos[1] = { entityInstanceBuffer.buffer, 0, entityInstanceBufferSize };
+        bufferInfos[2] = { frames[i].clusterDraws.buffer, 0, VK_WHOLE_SIZE };
+        bufferInfos[3] = { frames[i].clusterCullUniform.buffer, 0, sizeof(ClusterCullData) };
+        bufferInfos[4] = { clusterCommandBuffer.buffer, 0, VK_WHOLE_SIZE };
+        bufferInfos[5] = { clusterCountBuffer.buffer, 0, VK_WHOLE_SIZE };
+        bufferInfos[7] = { clusterLateBuffer.buffer, 0, VK_WHOLE_SIZE };
+
+        std::vector<VkWriteDescriptorSet> descriptorWrites;
+
+        for (uint32_t binding = 0; binding < bufferInfos.size(); binding++)
+        {
+            if (binding == 6)
+            {
+                continue;
+            }
+
+            VkWriteDescriptorSet descriptorWrite{};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = clusterCullDescriptorSets[i];
+            descriptorWrite.dstBinding = binding;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = binding == 3 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = &bufferInfos[binding];
+
+            descriptorWrites.push_back(descriptorWrite);
+        }
+
+        vkUpdateDescriptorSets(vkb_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+}
+
+void URenderer::CreateHiZ()
+{
+    //levels are read with texelFetch, the sampler only has to exist
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    if (vkCreateSampler(vkb_device, &samplerInfo, nullptr, &hiZSampler) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create depth pyramid sampler!");
+    }
+
+    for (size_t i = 0; i < MAX_FRAMES; i++)
+    {
+        std::vector<VkDescriptorSetLayout> layouts(HI_Z_MAX_MIPS, hiZBuildDescriptorSetLayout);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = HI_Z_MAX_MIPS;
+        allocInfo.pSetLayouts = layouts.data();
+
+        if (vkAllocateDescriptorSets(vkb_device, &allocInfo, hiZBuildDescriptorSets[i].data()) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate descriptor sets!");
+        }
+    }
+
+    CreateHiZImage();
+
+    WriteHiZDescriptors();
+
+    deletionQueue.push_function([&]() {
+        DestroyHiZImage();
+        vkDestroySampler(vkb_device, hiZSampler, nullptr);
+        });
+}
+
+void URenderer::CreateHiZImage()
+{
+    hiZExtent.width = std::max(1u, (swapChainExtent.width + 1) / 2);
+    hiZExtent.height = std::max(1u, (swapChainExtent.height + 1) / 2);
+
+    hiZMipCount = 1;
+
+    while (hiZMipCount < HI_Z_MAX_MIPS && std::max(hiZExtent.width, hiZExtent.height) >> hiZMipCount > 0)
+    {
+        hiZMipCount++;
+    }
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = { hiZExtent.width, hiZExtent.height, 1 };
+    imageInfo.mipLevels = hiZMipCount;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = VK_FORMAT_R32_SFLOAT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    if (vmaCreateImage(allocator, &imageInfo, &allocInfo, &hiZImage, &hiZAllocation, nullptr) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create depth pyramid!");
+    }
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = hiZImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R32_SFLOAT;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, hiZMipCount, 0, 1 };
+
+    if (vkCreateImageView(vkb_device, &viewInfo, nullptr, &hiZImageView) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create depth pyramid view!");
+    }
+
+    for (uint32_t mip = 0; mip < hiZMipCount; mip++)
+    {
+        viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 1, 0, 1 };
+
+        if (vkCreateImageView(vkb_device, &viewInfo, nullptr, &hiZMipViews[mip]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create depth pyramid view!");
+        }
+    }
+
+    //the new image starts undefined
+    hiZImageState = RGResourceState{};
+}
+
+void URenderer::DestroyHiZImage()
+{
+    for (uint32_t mip = 0; mip < hiZMipCount; mip++)
+    {
+        vkDestroyImageView(vkb_device, hiZMipViews[mip], nullptr);
+    }
+
+    vkDestroyImageView(vkb_device, hiZImageView, nullptr);
+
+    vmaDestroyImage(allocator, hiZImage, hiZAllocation);
+
+    hiZImage = VK_NULL_HANDLE;
+}
+
+void URenderer::WriteHiZDescriptors()
+{
+    //the culling pass samples the pyramid in the layout the render graph gives compute reads
+    VkDescriptorImageInfo pyramidInfo{ hiZSampler, hiZImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+    std::vector<VkDescriptorImageInfo> imageInfos(MAX_FRAMES * hiZMipCount * 2);
+
+    std::vector<VkWriteDescriptorSet> descriptorWrites;
+
+    for (size_t i = 0; i < MAX_FRAMES; i++)
+    {
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = clusterCullDescriptorSets[i];
+        descriptorWrite.dstBinding = 6;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &pyramidInfo;
+
+        descriptorWrites.push_back(descriptorWrite);
+
+        //the whole pyramid is in the general layout while it is built, the first level's source is written every frame
+        for (uint32_t mip = 0; mip < hiZMipCount; mip++)
+        {
+            VkDescriptorImageInfo* mipInfos = &imageInfos[(i * hiZMipCount + mip) * 2];
+
+            mipInfos[0] = { hiZSampler, mip > 0 ? hiZMipViews[mip - 1] : VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL };
+            mipInfos[1] = { VK_NULL_HANDLE, hiZMipViews[mip], VK_IMAGE_LAYOUT_GENERAL };
+
+            for (uint32_t binding = mip > 0 ? 0 : 1; binding < 2; binding++)
+            {
+                descriptorWrite.dstSet = hiZBuildDescriptorSets[i][mip];
+                descriptorWrite.dstBinding = binding;
+                descriptorWrite.descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                descriptorWrite.pImageInfo = &mipInfos[binding];
+
+                descriptorWrites.push_back(descriptorWrite);
+            }
+        }
+    }
+
+    vkUpdateDescriptorSets(vkb_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+void URenderer::CreateCommandBuffer()
+{
+    frames.resize(MAX_FRAMES);
+
+    //temp array to hold command buffers
+    std::vector<VkCommandBuffer> commandBuffers(frames.size());
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+
+    if (vkAllocateCommandBuffers(vkb_device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate command buffers!");
+    }
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        frames[i].commandBuffer = commandBuffers[i];
+    }
+}
+
+void URenderer::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    UTRACE_FUNCTION();
+
+    FrameData& frame = frames[currentFrame];
+
+    //this frame's fence was waited on, so its queries from MAX_FRAMES ago are resolved without stalling
+    gpuProfiler.BeginFrame(currentFrame);
+
+    gpuProfiler.AddExternalScope("Upload copies", uploader.ConsumeGpuMilliseconds());
+
+    //the targets keep the size of the maximum scale, only the drawn area follows the controller
+    if (dynamicResolution)
+    {
+        float maxScale = resolutionController.maxScale;
+
+        float scale = resolutionController.Update(gpuProfiler.IsEnabled() ? gpuProfiler.GetFrameMilliseconds() : 0.0);
+
+        renderTargetExtent.width = std::max(1u, static_cast<uint32_t>(std::ceil(swapChainExtent.width * maxScale)));
+        renderTargetExtent.height = std::max(1u, static_cast<uint32_t>(std::ceil(swapChainExtent.height * maxScale)));
+
+        renderExtent.width = std::clamp(static_cast<uint32_t>(std::round(swapChainExtent.width * scale)), 1u, renderTargetExtent.width);
+        renderExtent.height = std::clamp(static_cast<uint32_t>(std::round(swapChainExtent.height * scale)), 1u, renderTargetExtent.height);
+    }
+    else
+    {
+        renderTargetExtent = swapChainExtent;
+
+        renderExtent = swapChainExtent;
+    }
+
+    renderGraph.BeginFrame(currentFrame);
+
+    textureHeap.BeginFrame(currentFrame);
+
+    //ranges move before the draw lists read them, the moves pass copies the data ahead of every draw
+    StreamModelGeometry();
+
+    //last frame's CPU time and the GPU time of the latest resolved frame
+    if (scalabilityGovernor && governor.Update(cpuFrameMilliseconds, gpuProfiler.IsEnabled() ? gpuProfiler.GetFrameMilliseconds() : 0.0, deltaTime))
+    {
+        ApplyScalabilitySettings(governor.GetSettings());
+    }
+
+    UpdateFragmentStatistics();
+
+    SceneManager::Get().UpdatePhysicsActors(deltaTime);
+
+    //cameras only follow entity transforms, so they are updated before the instances are culled against them and the animation LOD
+    std::vector<Camera*> cameras;
+
+	SceneManager::Get().UpdateCameraSystem(deltaTime, cameras);
+
+    camera = defaultCamera;
+
+    defaultCamera->Update(deltaTime);
+
+    if (cameras.size() > 0)
+    {
+        if (cameraIndex >= cameras.size())
+        {
+            cameraIndex = 0;
+        }
+
+        camera = cameras[cameraIndex];
+    }
+
+    //entities spawned since last frame may not fit anymore, the staging pointers are taken after the buffers grew
+    ReserveInstanceBuffers(frame, SceneManager::Get().GetInstanceCount(), SceneManager::Get().GetAnimatedEntityCount());
+
+    EntityInstance* entityInstance = (EntityInstance*)frame.entityInstanceStaging.allocation->GetMappedData();
+
+    BoneTransformData* boneTransformData = (BoneTransformData*)frame.boneTransformStaging.allocation->GetMappedData();
+
+	SceneManager::Get().UpdateAnimationSystem(boneTransformData, static_cast<uint32_t>(boneTransformBufferSize / sizeof(BoneTransformData)), deltaTime, camera->Position);
+
+    float farPlane = camera->farPlane * drawDistanceScale;
+
+    glm::mat4 projection = glm::perspective(glm::radians(camera->Zoom), (float)swapChainExtent.width / (float)swapChainExtent.height, camera->nearPlane, farPlane);
+
+    projection[1][1] *= -1;
+
+    glm::mat4 viewProjection = projection * camera->GetViewMatrix();
+
+    LODView lodView{ camera->Position, 1.0f / glm::tan(glm::radians(camera->Zoom) * 0.5f), farPlane };
+
+	SceneManager::Get().UpdateEntityInstances(entityInstance, static_cast<uint32_t>(entityInstanceBufferSize / sizeof(EntityInstance)), lodView,
+        softwareOcclusionCulling ? &viewProjection : nullptr);
+
+	UpdateCascades();
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0; // Optional
+    beginInfo.pInheritanceInfo = nullptr; // Optional
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording command buffer!");
+    }
+
+    //flatten the render batches so worker threads never touch the scene, static instances come first in the buffer
+    //the lists are members so their storage is reused from frame to frame
+    for (uint32_t variant = 0; variant < SKINNING_VARIANT_COUNT; variant++)
+    {
+        staticDrawCommands[variant].clear();
+
+        dynamicDrawCommands[variant].clear();
+
+        opaqueDrawCommands[variant].clear();
+
+        alphaTestedDrawCommands[variant].clear();
+    }
+
+    const SceneManager& scene = SceneManager::Get();
+
+    //every mesh draw is also handed to the cluster culling pass, which expands it to meshlets per instance
+    ClusterDraw* clusterDraws = (ClusterDraw*)frame.clusterDraws.allocation->GetMappedData();
+
+    uint32_t clusterDrawCount = 0;
+
+    uint32_t clusterWorkCount = 0;
+
+    for (size_t category = 0; category < scene.renderBatches.size(); category++)
+    {
+        std::array<std::vector<DrawCommand>, SKINNING_VARIANT_COUNT>& drawLists = category == static_cast<size_t>(RenderBatchCategory::Static) ? staticDrawCommands : dynamicDrawCommands;
+
+        bool bSkinned = IsSkinnedRenderBatch(static_cast<RenderBatchCategory>(category));
+
+        for (uint32_t modelID = 0; modelID < scene.renderBatches[category].size(); modelID++)
+        {
+            const RenderBatch& batch = scene.renderBatches[category][modelID];
+
+            uint32_t instanceCount = static_cast<uint32_t>(batch.entities.size());
+
+            const Model& model = *scene.modelTable[modelID];
+
+            //models still streaming in or unloaded draw nothing
+            if (instanceCount == 0 || !geometryArena.IsResident(model.geometry))
+            {
+                continue;
+            }
+
+            GeometryRange vertexRange = geometryArena.GetRange(model.geometry, GEOMETRY_STREAM_VERTICES);
+            GeometryRange indexRange = geometryArena.GetRange(model.geometry, GEOMETRY_STREAM_INDICES);
+            GeometryRange meshletRange = geometryArena.GetRange(model.geometry, GEOMETRY_STREAM_MESHLETS);
+
+            for (const Mesh& mesh : model.meshes)
+            {
+                bool bAlphaTested = mesh.diffuseTextureID != -1 && textureAlphaTested[mesh.diffuseTextureID];
+
+                //meshes of skinned entities without weights take the static variant like everything else
+                uint32_t variant = bSkinned ? GetSkinningVariant(mesh.boneInfluences) : 0;
+
+                //entities spawned after startup may need a variant the loaded scene did not
+                CreatePipelineVariant(variant);
+
+                //the batch is sorted by LOD, one draw per LOD that has instances
+                //instances hidden by the software occlusion test follow in their own LOD ranges and only cast shadows
+                uint32_t lodFirstInstance = batch.firstInstance;
+
+                for (uint32_t lodRange = 0; lodRange < mesh.lodCount * 2; lodRange++)
+                {
+                    bool bOccluded = lodRange >= mesh.lodCount;
+
+                    uint32_t lod = bOccluded ? lodRange - mesh.lodCount : lodRange;
+
+                    const std::array<uint32_t, MAX_MESH_LODS>& lodInstanceCounts = bOccluded ? batch.occludedLODInstanceCounts : batch.lodInstanceCounts;
+
+                    uint32_t lodInstanceCount = lodInstanceCounts[lod];
+
+                    //instances past the coarsest LOD of this mesh follow it, so they join its draw
+                    if (lod == mesh.lodCount - 1)
+                    {
+                        for (uint32_t coarserLOD = lod + 1; coarserLOD < MAX_MESH_LODS; coarserLOD++)
+                        {
+                            lodInstanceCount += lodInstanceCounts[coarserLOD];
+                        }
+                    }
+
+                    if (lodInstanceCount == 0)
+                    {
+                        continue;
+                    }
+
+                    const MeshLOD& meshLOD = mesh.lods[lod];
+
+                    DrawCommand draw = { meshLOD.indexCount, lodInstanceCount, indexRange.offset + meshLOD.startIndex, static_cast<int32_t>(vertexRange.offset),
+                        lodFirstInstance, meshletRange.offset + meshLOD.firstMeshlet, meshLOD.meshletCount };
+
+                    lodFirstInstance += lodInstanceCount;
+
+                    drawLists[variant].push_back(draw);
+
+                    if (!bOccluded)
+                    {
+                        (bAlphaTested ? alphaTestedDrawCommands : opaqueDrawCommands)[variant].push_back(draw);
+                    }
+
+                    //clusters of skinned meshes have bind pose bounds, their draws are recorded directly
+                    if (!clusterCulling || meshLOD.meshletCount == 0 || variant != 0)
+                    {
+                        continue;
+                    }
+
+                    if (clusterDrawCount == MAX_CLUSTER_DRAWS)
+                    {
+                        throw std::runtime_error("Too many draws for cluster culling!");
+                    }
+
+                    ClusterDraw& clusterDraw = clusterDraws[clusterDrawCount++];
+                    clusterDraw.firstMeshlet = draw.firstMeshlet;
+                    clusterDraw.meshletCount = meshLOD.meshletCount;
+                    clusterDraw.firstInstance = draw.firstInstance;
+                    clusterDraw.instanceCount = lodInstanceCount;
+                    clusterDraw.workOffset = clusterWorkCount;
+                    clusterDraw.mainList = bOccluded ? CLUSTER_LIST_NONE : bAlphaTested ? CLUSTER_LIST_ALPHA_TESTED : CLUSTER_LIST_OPAQUE;
+                    //static casters go to the cache list only while caching, the uncached pass draws everything
+                    clusterDraw.shadowList = shadowCaching && category == static_cast<size_t>(RenderBatchCategory::Static) ? CLUSTER_LIST_SHADOW_STATIC : CLUSTER_LIST_SHADOW_DYNAMIC;
+                    clusterDraw.indexOffset = indexRange.offset;
+                    clusterDraw.vertexOffset = draw.vertexOffset;
+
+                    clusterWorkCount += meshLOD.meshletCount * lodInstanceCount;
+                }
+            }
+        }
+    }
+
+    //past the largest lists clusters would be dropped, every draw is recorded directly instead
+    bool bClusterCulling = clusterCulling && ReserveClusterLists(frame, clusterWorkCount);
+
+    for (uint32_t variant = 0; variant < SKINNING_VARIANT_COUNT; variant++)
+    {
+        allDrawCommands[variant].assign(staticDrawCommands[variant].begin(), staticDrawCommands[variant].end());
+        allDrawCommands[variant].insert(allDrawCommands[variant].end(), dynamicDrawCommands[variant].begin(), dynamicDrawCommands[variant].end());
+    }
+
+    bool bStaticSetChanged = scene.staticBatchVersion != staticBatchVersion;
+
+    staticBatchVersion = scene.staticBatchVersion;
+
+    //every cascade's cache holds the old static set, not just the ones refreshing this frame
+    if (bStaticSetChanged)
+    {
+        for (int i = 0; i < NUM_CASCADES; i++)
+        {
+            staticShadowValid[i] = false;
+        }
+    }
+
+    //cascades drawn this frame and cascades whose static cache is redrawn, one bit per array layer
+    uint32_t refreshMask = 0;
+
+    uint32_t staticRefreshMask = 0;
+
+    for (int i = 0; i < NUM_CASCADES; i++)
+    {
+        //cascades past the active count are not sampled, their cache is redrawn once they are active again
+        if (i >= static_cast<int>(activeCascades))
+        {
+            staticShadowValid[i] = false;
+            continue;
+        }
+
+        if (!shadowCaching)
+        {
+            staticShadowValid[i] = false;
+
+            renderedCascades[i] = cascades[i];
+
+            refreshMask |= 1u << i;
+            continue;
+        }
+
+        //cascades are offset by their index so the reduced rate refreshes do not land on the same frame
+        bool bRefresh = !staticShadowValid[i] || (frameNumber + i) % (cascadeUpdateIntervals[i] * cascadeIntervalScale) == 0;
+
+        if (!bRefresh)
+        {
+            continue;
+        }
+
+        if (!staticShadowValid[i] || staticShadowMatrices[i] != cascades[i].viewProjMatrix)
+        {
+            staticShadowMatrices[i] = cascades[i].viewProjMatrix;
+            staticShadowValid[i] = true;
+
+            staticRefreshMask |= 1u << i;
+        }
+
+        renderedCascades[i] = cascades[i];
+
+        refreshMask |= 1u << i;
+    }
+
+    ShadowData shadowData{};
+
+    for (int i = 0; i < NUM_CASCADES; i++)
+    {
+        shadowData.lightSpaceMatrices[i] = renderedCascades[i].viewProjMatrix;
+    }
+
+    void* data = shadowUniformBuffer.allocation->GetMappedData();
+    memcpy(data, &shadowData, sizeof(ShadowData));
+
+    SceneData sceneData{};
+    sceneData.projection = projection;
+    sceneData.view = camera->GetViewMatrix();
+    sceneData.model = glm::mat4(1.0f);
+    sceneData.lightPos = glm::vec4(sunPos, 0.f);
+
+    CascadeData cascadeData{};
+
+    for (size_t i = 0; i < NUM_CASCADES; i++)
+    {
+        cascadeData.cascades[i] = renderedCascades[i];
+    }
+
+    data = sceneDataUniformBuffer.allocation->GetMappedData();
+    memcpy(data, &sceneData, sizeof(SceneData));
+
+    data = cascadeDataBuffer.allocation->GetMappedData();
+    memcpy(data, &cascadeData, sizeof(CascadeData));
+
+    bool bOcclusionCulling = bClusterCulling && occlusionCulling;
+
+    if (bClusterCulling)
+    {
+        ClusterCullData clusterCullData{};
+
+        ExtractFrustumPlanes(projection * sceneData.view, &clusterCullData.frustumPlanes[0]);
+
+        for (int i = 0; i < NUM_CASCADES; i++)
+        {
+            ExtractFrustumPlanes(renderedCascades[i].viewProjMatrix, &clusterCullData.frustumPlanes[(1 + i) * 6]);
+        }
+
+        clusterCullData.cameraPosition = glm::inverse(sceneData.view)[3];
+        clusterCullData.counts = glm::uvec4(clusterDrawCount, clusterWorkCount, clusterListCapacity, 0);
+        clusterCullData.cascadeMasks = glm::uvec4(staticRefreshMask, refreshMask, 0, 0);
+
+        //P11 without the Vulkan flip, the culling shader works with y up
+        glm::vec4 projectionParams(projection[0][0], -projection[1][1], projection[2][2], projection[3][2]);
+
+        clusterCullData.occlusionViews[0] = hiZView;
+        clusterCullData.occlusionViews[1] = sceneData.view;
+        clusterCullData.occlusionProjections[0] = hiZProjection;
+        clusterCullData.occlusionProjections[1] = projectionParams;
+        clusterCullData.hiZParams = glm::uvec4(hiZExtent.width, hiZExtent.height, hiZMipCount, bOcclusionCulling && hiZValid ? 1 : 0);
+
+        data = frame.clusterCullUniform.allocation->GetMappedData();
+        memcpy(data, &clusterCullData, sizeof(ClusterCullData));
+
+        //the pyramid built this frame is tested against by the next one
+        hiZView = sceneData.view;
+        hiZProjection = projectionParams;
+    }
+
+    hiZValid = bOcclusionCulling;
+
+    //the pools of this frame are free again since its fence was waited on
+    for (ThreadCommandPool& threadCommandPool : frame.threadCommandPools)
+    {
+        vkResetCommandPool(vkb_device, threadCommandPool.pool, 0);
+        threadCommandPool.usedCount = 0;
+    }
+
+    //every refreshed cascade is drawn by one multiview pass, preceded by a cache pass when static casters are redrawn
+    bool bStaticCachePass = staticRefreshMask != 0;
+
+    bool bShadowPass = refreshMask != 0;
+
+    //main pass chunks in draw order: depth prepass, opaque, alpha tested, each by skinning variant
+    struct MainPassChunk
+    {
+        VkPipeline pipeline;
+        const std::vector<DrawCommand>* drawCommands;
+        size_t firstDraw;
+        size_t drawCount;
+        uint32_t clusterList;
+    };
+
+    std::vector<MainPassChunk> mainPassChunks;
+
+    //culled clusters are a single indirect draw per list, the GPU decides the count
+    auto addMainPassChunks = [&](VkPipeline pipeline, const std::vector<DrawCommand>& draws, uint32_t clusterList) {
+        if (bClusterCulling && clusterList != CLUSTER_LIST_NONE)
+        {
+            if (!draws.empty())
+            {
+                mainPassChunks.push_back({ pipeline, &draws, 0, 0, clusterList });
+            }
+
+            return;
+        }
+
+        for (size_t firstDraw = 0; firstDraw < draws.size(); firstDraw += MAIN_PASS_DRAWS_PER_CHUNK)
+        {
+            mainPassChunks.push_back({ pipeline, &draws, firstDraw, std::min<size_t>(MAIN_PASS_DRAWS_PER_CHUNK, draws.size() - firstDraw), CLUSTER_LIST_NONE });
+        }
+        };
+
+    //only the static variant goes through the cluster lists
+    auto addVariantChunks = [&](const std::array<VkPipeline, SKINNING_VARIANT_COUNT>& pipelines, const std::array<std::vector<DrawCommand>, SKINNING_VARIANT_COUNT>& draws, uint32_t clusterList) {
+        for (uint32_t variant = 0; variant < SKINNING_VARIANT_COUNT; variant++)
+        {
+            addMainPassChunks(pipelines[variant], draws[variant], variant == 0 ? clusterList : CLUSTER_LIST_NONE);
+        }
+        };
+
+    if (depthPrepass)
+    {
+        addVariantChunks(depthPrepassPipelines, opaqueDrawCommands, CLUSTER_LIST_OPAQUE);
+    }
+
+    addVariantChunks(graphicsPipelines, opaqueDrawCommands, CLUSTER_LIST_OPAQUE);
+
+    addVariantChunks(alphaTestPipelines, alphaTestedDrawCommands, CLUSTER_LIST_ALPHA_TESTED);
+
+    size_t mainPassChunkCount = mainPassChunks.size();
+
+    //clusters hidden by last frame's depth that turn out visible are drawn again in the same order after the pyramid is rebuilt
+    //skinned draws are not cluster culled, the early pass already drew all of them
+    if (bOcclusionCulling)
+    {
+        if (depthPrepass)
+        {
+            addMainPassChunks(depthPrepassPipelines[0], opaqueDrawCommands[0], CLUSTER_LIST_OPAQUE_LATE);
+        }
+
+        addMainPassChunks(graphicsPipelines[0], opaqueDrawCommands[0], CLUSTER_LIST_OPAQUE_LATE);
+
+        addMainPassChunks(alphaTestPipelines[0], alphaTestedDrawCommands[0], CLUSTER_LIST_ALPHA_TESTED_LATE);
+    }
+
+    size_t latePassChunkCount = mainPassChunks.size() - mainPassChunkCount;
+
+    //frame graph, passes declare what they touch and the graph derives the barriers between them
+    RGResource entityInstances = renderGraph.ImportBuffer("Entity instances", entityInstanceBuffer.buffer, entityInstanceBufferState);
+
+    RGResource boneTransforms = renderGraph.ImportBuffer("Bone transforms", boneTransformBuffer.buffer, boneTransformBufferState);
+
+    RGResource shadowArray = renderGraph.ImportImage("Shadow array", shadowImage, shadowImageView, VK_IMAGE_ASPECT_DEPTH_BIT, NUM_CASCADES, shadowImageState);
+
+    RGResource staticShadowArray = renderGraph.ImportImage("Static shadow array", staticShadowImage, staticShadowImageView, VK_IMAGE_ASPECT_DEPTH_BIT, NUM_CASCADES, staticShadowImageState);
+
+    //the acquired image is undefined and may be written once the acquire semaphore wait at color attachment output is over
+    RGResourceState backBufferState;
+    backBufferState.writeStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+    RGResource clusterCommands = renderGraph.ImportBuffer("Cluster commands", clusterCommandBuffer.buffer, clusterCommandBufferState);
+
+    RGResource clusterCounts = renderGraph.ImportBuffer("Cluster counts", clusterCountBuffer.buffer, clusterCountBufferState);
+
+    RGResource clusterLate = renderGraph.ImportBuffer("Late clusters", clusterLateBuffer.buffer, clusterLateBufferState);
+
+    RGResource vertices = renderGraph.ImportBuffer("Vertex arena", vertexBuffer.buffer, vertexBufferState);
+
+    RGResource indices = renderGraph.ImportBuffer("Index arena", indexBuffer.buffer, indexBufferState);
+
+    RGResource meshlets = renderGraph.ImportBuffer("Meshlet arena", meshletBuffer.buffer, meshletBufferState);
+
+    RGResource hiZ = renderGraph.ImportImage("Depth pyramid", hiZImage, hiZImageView, VK_IMAGE_ASPECT_COLOR_BIT, 1, hiZImageState);
 
-        vkUpdateDescriptorSets(vkb_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    RGResource backBuffer = renderGraph.ImportImage("Back buffer", swapChainImages[imageIndex], swapChainImageViews[imageIndex], VK_IMAGE_ASPECT_COLOR_BIT, 1, backBufferState);
 
-    }
+    renderGraph.Export(backBuffer, colorFinalLayout);
 
-}
+    RGImageDesc depthDesc;
+    depthDesc.width = renderTargetExtent.width;
+    depthDesc.height = renderTargetExtent.height;
+    depthDesc.format = depthFormat;
+    depthDesc.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (bOcclusionCulling ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+    depthDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
 
-void URenderer::CreateDebugQuadDescriptorSets()
-{
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES, debugQuadDescriptorSetLayout);
+    RGResource depth = renderGraph.CreateImage("Depth", depthDesc);
 
-    VkDescriptorSetAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES);
-    allocInfo.pSetLayouts = layouts.data();
+    //with dynamic resolution the scene is drawn into the top left of its own target and upscaled into the back buffer
+    RGResource sceneColor = backBuffer;
 
-    if (vkAllocateDescriptorSets(vkb_device, &allocInfo, debugQuadDescriptorSets.data()) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate descriptor sets!");
+    if (dynamicResolution)
+    {
+        RGImageDesc sceneColorDesc;
+        sceneColorDesc.width = renderTargetExtent.width;
+        sceneColorDesc.height = renderTargetExtent.height;
+        sceneColorDesc.format = swapChainSurfaceFormat.format;
+        sceneColorDesc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        sceneColorDesc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+
+        sceneColor = renderGraph.CreateImage("Scene color", sceneColorDesc);
     }
 
-	std::vector<VkDescriptorImageInfo> imageInfos;
+    //secondary command buffers in task order: shadow passes, main pass chunks, late main pass chunks, debug quad
+    std::vector<VkCommandBuffer> secondaryCommandBuffers;
 
-	for (int i = 0; i < NUM_CASCADES; i++)
-	{
-		VkDescriptorImageInfo imageInfo{};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = shadowImageViews[i];
-		imageInfo.sampler = shadowSampler;
-		imageInfos.push_back(imageInfo);
-	}
+    size_t staticCacheTask = 0;
 
-    for (size_t i = 0; i < MAX_FRAMES; i++)
-    {
-        std::vector<VkWriteDescriptorSet> descriptorWrites(1);
+    size_t shadowTask = 0;
 
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = debugQuadDescriptorSets[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[0].descriptorCount = imageInfos.size();
-        descriptorWrites[0].pImageInfo = imageInfos.data();
+    size_t firstMainPassTask = 0;
 
-        vkUpdateDescriptorSets(vkb_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-    }
-}
+    size_t firstLatePassTask = 0;
 
-void URenderer::CreateCommandBuffer()
-{
-    frames.resize(MAX_FRAMES);
+    size_t debugQuadTask = 0;
 
-    //temp array to hold command buffers
-    std::vector<VkCommandBuffer> commandBuffers(frames.size());
+    auto executeSecondary = [&](VkCommandBuffer cmd, VkRenderPass pass, VkFramebuffer framebuffer, VkExtent2D extent,
+        const std::vector<VkClearValue>& clearValues, size_t firstTask, size_t taskCount) {
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = pass;
+        renderPassInfo.framebuffer = framebuffer;
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = extent;
+        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
 
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+        vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-    if (vkAllocateCommandBuffers(vkb_device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate command buffers!");
-    }
+        if (taskCount > 0)
+        {
+            vkCmdExecuteCommands(cmd, static_cast<uint32_t>(taskCount), &secondaryCommandBuffers[firstTask]);
+        }
 
-    for (size_t i = 0; i < frames.size(); i++) {
-        frames[i].commandBuffer = commandBuffers[i];
-    }
-}
+        vkCmdEndRenderPass(cmd);
+        };
 
-void URenderer::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
-{
-    EntityInstance* entityInstance = (EntityInstance*)entityInstanceStaging.allocation->GetMappedData();
+    VkExtent2D shadowExtent = { shadowResolution, shadowResolution };
 
-    BoneTransformData* boneTransformData = (BoneTransformData*)boneTransformStaging.allocation->GetMappedData();
+    std::vector<VkClearValue> shadowClearValues(1);
+    shadowClearValues[0].depthStencil = { 1.0f, 0 };
 
-    std::map<std::string, std::vector<EntityInstance>> modelInstanceMap;
+    std::vector<VkClearValue> mainClearValues(2);
+    mainClearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+    mainClearValues[1].depthStencil = { 1.0f, 0 };
 
-    SceneManager::Get().UpdatePhysicsActors(deltaTime);
+    VkFramebuffer mainFramebuffer = VK_NULL_HANDLE;
 
-	SceneManager::Get().UpdateAnimationSystem(boneTransformData, deltaTime);
+    renderGraph.AddPass("Instance copies", [&](VkCommandBuffer cmd) {
+        uploader.AcquireCompleted(cmd);
 
-	SceneManager::Get().UpdateEntityInstances(entityInstance, modelInstanceMap);
+        //only the written part, a buffer sized for a crowd would otherwise be copied whole every frame
+        if (entityInstanceCount > 0)
+        {
+            VkBufferCopy copyEntityInstances{};
+            copyEntityInstances.srcOffset = 0;
+            copyEntityInstances.dstOffset = 0;
+            copyEntityInstances.size = entityInstanceCount * sizeof(EntityInstance);
+            vkCmdCopyBuffer(cmd, frame.entityInstanceStaging.buffer, entityInstanceBuffer.buffer, 1, &copyEntityInstances);
+        }
 
-    std::vector<Camera*> cameras;
+        if (animatedEntityCount > 0)
+        {
+            VkBufferCopy copyBoneTransforms{};
+            copyBoneTransforms.srcOffset = 0;
+            copyBoneTransforms.dstOffset = 0;
+            copyBoneTransforms.size = animatedEntityCount * sizeof(BoneTransformData);
+            vkCmdCopyBuffer(cmd, frame.boneTransformStaging.buffer, boneTransformBuffer.buffer, 1, &copyBoneTransforms);
+        }
+        })
+        .Write(entityInstances, RGUsage::TransferWrite)
+        .Write(boneTransforms, RGUsage::TransferWrite);
 
-	SceneManager::Get().UpdateCameraSystem(deltaTime, cameras);
+    //defragmentation copies, the draw lists already use the new ranges and the old ones are retired until the frames in flight are done
+    renderGraph.AddPass("Geometry moves", [&](VkCommandBuffer cmd) {
+        const VkBuffer streamBuffers[GEOMETRY_STREAM_COUNT] = { vertexBuffer.buffer, indexBuffer.buffer, meshletBuffer.buffer };
 
-    OneTimeSubmit([&](VkCommandBuffer cmd) {
-        VkBufferCopy copyEntityInstances{};
-        copyEntityInstances.srcOffset = 0;
-        copyEntityInstances.dstOffset = 0;
-        copyEntityInstances.size = entityInstanceBufferSize;
-        vkCmdCopyBuffer(cmd, entityInstanceStaging.buffer, entityInstanceBuffer.buffer, 1, &copyEntityInstances);
-
-        VkBufferCopy copyBoneTransforms{};
-        copyBoneTransforms.srcOffset = 0;
-        copyBoneTransforms.dstOffset = 0;
-        copyBoneTransforms.size = boneTransformBufferSize;
-        vkCmdCopyBuffer(cmd, boneTransformStaging.buffer, boneTransformBuffer.buffer, 1, &copyBoneTransforms);
-        });
+        const VkDeviceSize streamStrides[GEOMETRY_STREAM_COUNT] = { sizeof(Vertex), sizeof(uint32_t), sizeof(Meshlet) };
 
-    camera = defaultCamera;
+        for (const GeometryMove& move : geometryMoves)
+        {
+            VkBufferCopy copy{};
+            copy.srcOffset = move.srcOffset * streamStrides[move.stream];
+            copy.dstOffset = move.dstOffset * streamStrides[move.stream];
+            copy.size = move.count * streamStrides[move.stream];
 
-    defaultCamera->Update(deltaTime);
+            vkCmdCopyBuffer(cmd, streamBuffers[move.stream], streamBuffers[move.stream], 1, &copy);
+        }
+        })
+        .Read(vertices, RGUsage::TransferRead)
+        .Read(indices, RGUsage::TransferRead)
+        .Read(meshlets, RGUsage::TransferRead)
+        .Write(vertices, RGUsage::TransferWrite)
+        .Write(indices, RGUsage::TransferWrite)
+        .Write(meshlets, RGUsage::TransferWrite)
+        .SetEnabled(!geometryMoves.empty());
+
+    renderGraph.AddPass("Cluster count clear", [&](VkCommandBuffer cmd) {
+        vkCmdFillBuffer(cmd, clusterCountBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+
+        //an empty second phase dispatch
+        const uint32_t lateHeader[4] = { 0, 1, 1, 0 };
+        vkCmdUpdateBuffer(cmd, clusterLateBuffer.buffer, 0, sizeof(lateHeader), lateHeader);
+        })
+        .Write(clusterCounts, RGUsage::TransferWrite)
+        .Write(clusterLate, RGUsage::TransferWrite)
+        .SetEnabled(bClusterCulling);
+
+    auto dispatchClusterCulling = [&](VkCommandBuffer cmd, uint32_t phase) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, clusterCullPipeline);
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, clusterCullPipelineLayout, 0, 1, &clusterCullDescriptorSets[currentFrame], 0, nullptr);
+
+        vkCmdPushConstants(cmd, clusterCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &phase);
+
+        if (phase == 0)
+        {
+            //rows of at most maxComputeWorkGroupsX groups, the shader flattens the invocation index again
+            uint32_t groupCount = (clusterWorkCount + 63) / 64;
 
-    if (cameras.size() > 0)
-    {
-        if (cameraIndex >= cameras.size())
+            uint32_t groupsX = std::min(groupCount, maxComputeWorkGroupsX);
+
+            vkCmdDispatch(cmd, groupsX, (groupCount + groupsX - 1) / groupsX, 1);
+        }
+        else
         {
-            cameraIndex = 0;
+            vkCmdDispatchIndirect(cmd, clusterLateBuffer.buffer, 0);
         }
+        };
 
-        camera = cameras[cameraIndex];
-    }
+    //tests against last frame's pyramid, the pyramid is transitioned even when unused so the descriptor layout holds
+    renderGraph.AddPass("Cluster culling", [&](VkCommandBuffer cmd) {
+        dispatchClusterCulling(cmd, 0);
+        })
+        .Read(meshlets, RGUsage::ComputeRead)
+        .Read(entityInstances, RGUsage::ComputeRead)
+        .Read(hiZ, RGUsage::ComputeRead)
+        .Write(clusterCounts, RGUsage::ComputeWrite)
+        .Write(clusterCommands, RGUsage::ComputeWrite)
+        .Write(clusterLate, RGUsage::ComputeWrite)
+        .SetEnabled(bClusterCulling && clusterWorkCount > 0);
+
+    //passes drawing culled clusters read the lists as indirect arguments, every scene pass reads the arena
+    auto readDrawInputs = [&](URenderGraph::PassBuilder& pass) {
+        pass.Read(vertices, RGUsage::VertexShaderRead).Read(indices, RGUsage::IndexRead);
+
+        if (bClusterCulling)
+        {
+            pass.Read(clusterCommands, RGUsage::IndirectRead).Read(clusterCounts, RGUsage::IndirectRead);
+        }
+        };
 
-	UpdateCascades();
+    //clear only the refreshed layers of the cache, the others keep their static depth
+    renderGraph.AddPass("Shadow cache clear", [&](VkCommandBuffer cmd) {
+        std::vector<VkImageSubresourceRange> clearRanges;
 
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0; // Optional
-    beginInfo.pInheritanceInfo = nullptr; // Optional
+        for (uint32_t i = 0; i < NUM_CASCADES; i++)
+        {
+            if (staticRefreshMask & (1u << i))
+            {
+                clearRanges.push_back({ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, i, 1 });
+            }
+        }
 
-    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to begin recording command buffer!");
-    }
-    
-    {
-        for (int i = 0; i < NUM_CASCADES; i++)
+        VkClearDepthStencilValue clearValue = { 1.0f, 0 };
+
+        vkCmdClearDepthStencilImage(cmd, staticShadowImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearValue,
+            static_cast<uint32_t>(clearRanges.size()), clearRanges.data());
+        })
+        .Write(staticShadowArray, RGUsage::TransferWrite)
+        .SetEnabled(bStaticCachePass);
+
+    URenderGraph::PassBuilder staticCachePass = renderGraph.AddPass("Shadow cache", [&](VkCommandBuffer cmd) {
+        executeSecondary(cmd, shadowLoadRenderPass, staticShadowFramebuffer, shadowExtent, {}, staticCacheTask, 1);
+        })
+        .Read(entityInstances, RGUsage::VertexShaderRead)
+        .Read(boneTransforms, RGUsage::VertexShaderRead)
+        .Write(staticShadowArray, RGUsage::DepthAttachment)
+        .SetEnabled(bStaticCachePass);
+
+    readDrawInputs(staticCachePass);
+
+    //refreshed layers start from the cached static depth, the others keep last frame's depth
+    renderGraph.AddPass("Shadow copy", [&](VkCommandBuffer cmd) {
+        std::vector<VkImageCopy> copyRegions;
+
+        for (uint32_t i = 0; i < NUM_CASCADES; i++)
         {
-            VkRenderPassBeginInfo renderPassInfo{};
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.renderPass = shadowRenderPass;
-            renderPassInfo.framebuffer = shadowFramebuffers[i];
-            renderPassInfo.renderArea.offset = { 0, 0 };
-            renderPassInfo.renderArea.extent.height = shadowMapResolution;
-            renderPassInfo.renderArea.extent.width = shadowMapResolution;
+            if (refreshMask & (1u << i))
+            {
+                VkImageCopy copyRegion{};
+                copyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+                copyRegion.srcSubresource.mipLevel = 0;
+                copyRegion.srcSubresource.baseArrayLayer = i;
+                copyRegion.srcSubresource.layerCount = 1;
+                copyRegion.dstSubresource = copyRegion.srcSubresource;
+                copyRegion.extent = { shadowResolution, shadowResolution, 1 };
+
+                copyRegions.push_back(copyRegion);
+            }
+        }
 
-            std::vector<VkClearValue> clearValues(1);
-            clearValues[0].depthStencil = { 1.0f, 0 };
+        vkCmdCopyImage(cmd, staticShadowImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            shadowImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+        })
+        .Read(staticShadowArray, RGUsage::TransferRead)
+        .Write(shadowArray, RGUsage::TransferWrite)
+        .SetEnabled(bShadowPass && shadowCaching);
 
-            renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-            renderPassInfo.pClearValues = clearValues.data();
+    //without caching every layer is refreshed and cleared by the render pass
+    URenderGraph::PassBuilder shadowPass = renderGraph.AddPass("Shadow cascades", [&](VkCommandBuffer cmd) {
+        if (shadowCaching)
+        {
+            executeSecondary(cmd, shadowLoadRenderPass, shadowFramebuffer, shadowExtent, {}, shadowTask, 1);
+        }
+        else
+        {
+            executeSecondary(cmd, shadowRenderPass, shadowFramebuffer, shadowExtent, shadowClearValues, shadowTask, 1);
+        }
+        })
+        .Read(entityInstances, RGUsage::VertexShaderRead)
+        .Read(boneTransforms, RGUsage::VertexShaderRead)
+        .Write(shadowArray, RGUsage::DepthAttachment, !shadowCaching)
+        .SetEnabled(bShadowPass);
+
+    readDrawInputs(shadowPass);
+
+    URenderGraph::PassBuilder mainPass = renderGraph.AddPass("Main pass", [&](VkCommandBuffer cmd) {
+        executeSecondary(cmd, bOcclusionCulling ? occlusionEarlyRenderPass : renderPass, mainFramebuffer, renderExtent, mainClearValues, firstMainPassTask, mainPassChunkCount);
+        })
+        .Read(entityInstances, RGUsage::VertexShaderRead)
+        .Read(boneTransforms, RGUsage::VertexShaderRead)
+        .Read(shadowArray, RGUsage::FragmentShaderSample)
+        .Write(sceneColor, RGUsage::ColorAttachment, true)
+        .Write(depth, RGUsage::DepthAttachment, true);
+
+    readDrawInputs(mainPass);
+
+    //a single build per frame from the early depth, tested against by the second phase now and the first phase next frame
+    renderGraph.AddPass("Depth pyramid", [&](VkCommandBuffer cmd) {
+        //the pyramid keeps its size and covers the drawn area of the depth, so it stays valid across scale changes
+        VkDescriptorImageInfo depthInfo{ hiZSampler, renderGraph.GetImageView(depth), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = hiZBuildDescriptorSets[currentFrame][0];
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &depthInfo;
+
+        vkUpdateDescriptorSets(vkb_device, 1, &descriptorWrite, 0, nullptr);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, hiZBuildPipeline);
+
+        for (uint32_t mip = 0; mip < hiZMipCount; mip++)
+        {
+            if (mip > 0)
+            {
+                //the level just written is the source of the next
+                VkMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+                vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            }
 
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, hiZBuildPipelineLayout, 0, 1, &hiZBuildDescriptorSets[currentFrame][mip], 0, nullptr);
 
-            VkViewport viewport{};
-            viewport.x = 0.0f;
-            viewport.y = 0.0f;
-            viewport.width = static_cast<float>(shadowMapResolution);
-            viewport.height = static_cast<float>(shadowMapResolution);
-            viewport.minDepth = 0.0f;
-            viewport.maxDepth = 1.0f;
-            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            uint32_t width = std::max(1u, hiZExtent.width >> mip);
+            uint32_t height = std::max(1u, hiZExtent.height >> mip);
 
-            VkRect2D scissor{};
-            scissor.offset = { 0, 0 };
-            scissor.extent.height = shadowMapResolution;
-            scissor.extent.width = shadowMapResolution;
-            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+            VkExtent2D sourceExtent = mip > 0 ? VkExtent2D{ std::max(1u, hiZExtent.width >> (mip - 1)), std::max(1u, hiZExtent.height >> (mip - 1)) } : renderExtent;
 
+            vkCmdPushConstants(cmd, hiZBuildPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(VkExtent2D), &sourceExtent);
 
-            ShadowData shadowData{};
-            shadowData.model = glm::mat4(1.0f);
+            vkCmdDispatch(cmd, (width + 7) / 8, (height + 7) / 8, 1);
+        }
+        })
+        .Read(depth, RGUsage::ComputeRead)
+        .Write(hiZ, RGUsage::ComputeWrite, true)
+        .SetEnabled(bOcclusionCulling);
+
+    renderGraph.AddPass("Cluster occlusion culling", [&](VkCommandBuffer cmd) {
+        dispatchClusterCulling(cmd, 1);
+        })
+        .Read(meshlets, RGUsage::ComputeRead)
+        .Read(entityInstances, RGUsage::ComputeRead)
+        .Read(hiZ, RGUsage::ComputeRead)
+        .Read(clusterLate, RGUsage::IndirectRead)
+        .Read(clusterLate, RGUsage::ComputeRead)
+        .Write(clusterCounts, RGUsage::ComputeWrite)
+        .Write(clusterCommands, RGUsage::ComputeWrite)
+        .SetEnabled(bOcclusionCulling && clusterWorkCount > 0);
+
+    URenderGraph::PassBuilder latePass = renderGraph.AddPass("Main pass late", [&](VkCommandBuffer cmd) {
+        executeSecondary(cmd, occlusionLateRenderPass, mainFramebuffer, renderExtent, {}, firstLatePassTask, latePassChunkCount);
+        })
+        .Read(entityInstances, RGUsage::VertexShaderRead)
+        .Read(boneTransforms, RGUsage::VertexShaderRead)
+        .Read(shadowArray, RGUsage::FragmentShaderSample)
+        .Write(sceneColor, RGUsage::ColorAttachment)
+        .Write(depth, RGUsage::DepthAttachment)
+        .SetEnabled(bOcclusionCulling);
+
+    readDrawInputs(latePass);
+
+    URenderGraph::PassBuilder debugQuadPass = renderGraph.AddPass("Debug quad", [&](VkCommandBuffer cmd) {
+        executeSecondary(cmd, overlayRenderPass, mainFramebuffer, renderExtent, {}, debugQuadTask, 1);
+        })
+        .Read(shadowArray, RGUsage::FragmentShaderSample)
+        .Write(sceneColor, RGUsage::ColorAttachment)
+        .Write(depth, RGUsage::DepthAttachment, true)
+        .SetEnabled(renderDebugQuad);
+
+    //a single bilinear filter, every back buffer pixel is written so its old contents are discarded
+    renderGraph.AddPass("Upscale", [&](VkCommandBuffer cmd) {
+        VkImageBlit blitRegion{};
+        blitRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        blitRegion.srcOffsets[1] = { static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1 };
+        blitRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        blitRegion.dstOffsets[1] = { static_cast<int32_t>(swapChainExtent.width), static_cast<int32_t>(swapChainExtent.height), 1 };
+
+        vkCmdBlitImage(cmd, renderGraph.GetImage(sceneColor), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitRegion, VK_FILTER_LINEAR);
+        })
+        .Read(sceneColor, RGUsage::TransferRead)
+        .Write(backBuffer, RGUsage::TransferWrite, true)
+        .SetEnabled(dynamicResolution);
+
+    renderGraph.Compile();
+
+    //the overlay pass is compatible with the main pass so both use the same framebuffer
+    mainFramebuffer = renderGraph.GetFramebuffer(renderPass, { sceneColor, depth }, renderTargetExtent.width, renderTargetExtent.height);
+
+    bool bStaticCacheLive = renderGraph.IsPassLive(staticCachePass);
+
+    bool bShadowLive = renderGraph.IsPassLive(shadowPass);
+
+    bool bDebugQuadLive = renderGraph.IsPassLive(debugQuadPass);
+
+    shadowTask = bStaticCacheLive ? 1 : 0;
+
+    firstMainPassTask = shadowTask + (bShadowLive ? 1 : 0);
+
+    firstLatePassTask = firstMainPassTask + mainPassChunkCount;
+
+    debugQuadTask = firstLatePassTask + latePassChunkCount;
+
+    size_t taskCount = debugQuadTask + (bDebugQuadLive ? 1 : 0);
+
+    secondaryCommandBuffers.resize(taskCount);
+
+    //secondaries are only recorded for passes the graph kept
+    JobSystem::Get().ParallelFor(static_cast<uint32_t>(taskCount), [&](uint32_t task) {
+        VkCommandBuffer cmd;
+
+        if (bStaticCacheLive && task == staticCacheTask)
+        {
+            cmd = BeginSecondaryCommandBuffer(shadowLoadRenderPass, staticShadowFramebuffer);
 
-            void* data = shadowUniformBuffer.allocation->GetMappedData();
-            memcpy(data, &shadowData, sizeof(ShadowData));
+            RecordShadowPass(cmd, staticRefreshMask, staticDrawCommands, bClusterCulling ? CLUSTER_LIST_SHADOW_STATIC : CLUSTER_LIST_NONE);
+        }
+        else if (task < firstMainPassTask)
+        {
+            cmd = BeginSecondaryCommandBuffer(shadowCaching ? shadowLoadRenderPass : shadowRenderPass, shadowFramebuffer);
 
-			ShadowPushConstants pushConstants{};
-			pushConstants.lightSpaceMatrix = cascades[i].viewProjMatrix;
+            RecordShadowPass(cmd, refreshMask, shadowCaching ? dynamicDrawCommands : allDrawCommands, bClusterCulling ? CLUSTER_LIST_SHADOW_DYNAMIC : CLUSTER_LIST_NONE);
+        }
+        else if (task < debugQuadTask)
+        {
+            const MainPassChunk& chunk = mainPassChunks[task - firstMainPassTask];
 
-			vkCmdPushConstants(commandBuffer, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ShadowPushConstants), &pushConstants);
+            cmd = BeginSecondaryCommandBuffer(renderPass, mainFramebuffer);
 
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelineLayout, 0, 1, &shadowDescriptorSets[currentFrame], 0, nullptr);
+            RecordMainPassChunk(cmd, chunk.pipeline, *chunk.drawCommands, chunk.firstDraw, chunk.drawCount, chunk.clusterList);
+        }
+        else
+        {
+            cmd = BeginSecondaryCommandBuffer(overlayRenderPass, mainFramebuffer);
 
-            vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+            RecordDebugQuad(cmd);
+        }
 
-            uint32_t instanceIndex = 0;
+        vkEndCommandBuffer(cmd);
 
-            for (const auto& pair : modelInstanceMap)
-            {
-                uint32_t instanceCount = pair.second.size();
+        secondaryCommandBuffers[task] = cmd;
+        });
 
-                if (instanceCount == 0)
-                {
-                    continue;
-                }
+    renderGraph.Execute(commandBuffer, &gpuProfiler);
 
-                for (const Mesh& mesh : SceneManager::Get().models[pair.first].meshes)
-                {
-                    vkCmdDrawIndexed(commandBuffer, mesh.indexCount, instanceCount, mesh.startIndex, 0, instanceIndex);
-                }
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to record command buffer!");
+    }
+}
 
-                instanceIndex += instanceCount;
-            }
+void URenderer::CreateThreadCommandPools()
+{
+    uint32_t threadCount = JobSystem::Get().GetThreadCount();
+
+    for (FrameData& frame : frames)
+    {
+        frame.threadCommandPools.resize(threadCount);
+
+        for (ThreadCommandPool& threadCommandPool : frame.threadCommandPools)
+        {
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = vkb_device.get_queue_index(vkb::QueueType::graphics).value();
 
-            vkCmdEndRenderPass(commandBuffer);
+            if (vkCreateCommandPool(vkb_device, &poolInfo, nullptr, &threadCommandPool.pool) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create thread command pool!");
+            }
         }
     }
 
+    deletionQueue.push_function([&]() {
+        for (FrameData& frame : frames)
+        {
+            for (ThreadCommandPool& threadCommandPool : frame.threadCommandPools)
+            {
+                vkDestroyCommandPool(vkb_device, threadCommandPool.pool, nullptr);
+            }
+        }
+        });
+}
+
+VkCommandBuffer URenderer::BeginSecondaryCommandBuffer(VkRenderPass renderPass, VkFramebuffer framebuffer)
+{
+    //only the calling thread uses its pool, so no locking is needed
+    ThreadCommandPool& threadCommandPool = frames[currentFrame].threadCommandPools[JobSystem::GetThreadIndex()];
+
+    if (threadCommandPool.usedCount == threadCommandPool.commandBuffers.size())
     {
-        VkRenderPassBeginInfo renderPassInfo{};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
-        renderPassInfo.renderArea.offset = { 0, 0 };
-        renderPassInfo.renderArea.extent = swapChainExtent;
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = threadCommandPool.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
 
-        std::vector<VkClearValue> clearValues(2);
-        clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-        clearValues[1].depthStencil = { 1.0f, 0 };
+        VkCommandBuffer newCommandBuffer;
 
-        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-        renderPassInfo.pClearValues = clearValues.data();
+        if (vkAllocateCommandBuffers(vkb_device, &allocInfo, &newCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate secondary command buffer!");
+        }
+
+        threadCommandPool.commandBuffers.push_back(newCommandBuffer);
+    }
+
+    VkCommandBuffer commandBuffer = threadCommandPool.commandBuffers[threadCommandPool.usedCount++];
 
-        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = framebuffer;
 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    //every pass is recorded inside a profiler scope
+    inheritanceInfo.pipelineStatistics = gpuProfiler.GetPipelineStatisticFlags();
 
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = static_cast<float>(swapChainExtent.width);
-        viewport.height = static_cast<float>(swapChainExtent.height);
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording secondary command buffer!");
+    }
 
-        VkRect2D scissor{};
-        scissor.offset = { 0, 0 };
-        scissor.extent = swapChainExtent;
-        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    return commandBuffer;
+}
 
+void URenderer::RecordShadowPass(VkCommandBuffer commandBuffer, uint32_t viewMask, const std::array<std::vector<DrawCommand>, SKINNING_VARIANT_COUNT>& drawCommands, uint32_t clusterList)
+{
+    UTRACE_FUNCTION();
 
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(shadowResolution);
+    viewport.height = static_cast<float>(shadowResolution);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-        glm::mat4 projection = glm::perspective(glm::radians(camera->Zoom), (float)swapChainExtent.width / (float)swapChainExtent.height, camera->nearPlane, camera->farPlane);
+    VkRect2D scissor{};
+    scissor.offset = { 0, 0 };
+    scissor.extent.height = shadowResolution;
+    scissor.extent.width = shadowResolution;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-        projection[1][1] *= -1;
+    ShadowPushConstants pushConstants{};
+    pushConstants.viewMask = viewMask;
 
-        glm::mat4 view = camera->GetViewMatrix();
+    vkCmdPushConstants(commandBuffer, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ShadowPushConstants), &pushConstants);
 
-        glm::mat4 model = glm::mat4(1.0f);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelineLayout, 0, 1, &shadowDescriptorSets[currentFrame], 0, nullptr);
 
-        SceneData sceneData{};
-        sceneData.projection = projection;
-        sceneData.view = view;
-        sceneData.model = model;
-        sceneData.lightPos = glm::vec4(sunPos, 0.f);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
 
-		CascadeData cascadeData{};
+    //layout, descriptors and push constants are shared, so they survive the pipeline switches
+    for (uint32_t variant = 0; variant < SKINNING_VARIANT_COUNT; variant++)
+    {
+        bool bClustered = variant == 0 && clusterList != CLUSTER_LIST_NONE;
 
-        for (size_t i = 0; i < NUM_CASCADES; i++)
+        if (!bClustered && drawCommands[variant].empty())
         {
-			cascadeData.cascades[i] = cascades[i];
+            continue;
         }
 
-        void* data = sceneDataUniformBuffer.allocation->GetMappedData();
-        memcpy(data, &sceneData, sizeof(SceneData));
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelines[variant]);
 
-		data = cascadeDataBuffer.allocation->GetMappedData();
-		memcpy(data, &cascadeData, sizeof(CascadeData));
+        if (bClustered)
+        {
+            RecordClusterDraws(commandBuffer, clusterList);
+            continue;
+        }
 
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+        for (const DrawCommand& draw : drawCommands[variant])
+        {
+            vkCmdDrawIndexed(commandBuffer, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
+        }
+    }
+}
 
-        vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+void URenderer::RecordMainPassChunk(VkCommandBuffer commandBuffer, VkPipeline pipeline, const std::vector<DrawCommand>& drawCommands, size_t firstDraw, size_t drawCount, uint32_t clusterList)
+{
+    UTRACE_FUNCTION();
 
-        uint32_t instanceIndex = 0;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
-        for (const auto& pair : modelInstanceMap)
-        {
-            uint32_t instanceCount = pair.second.size(); 
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(renderExtent.width);
+    viewport.height = static_cast<float>(renderExtent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-            if (instanceCount == 0)
-            {
-                continue;
-            }
+    VkRect2D scissor{};
+    scissor.offset = { 0, 0 };
+    scissor.extent = renderExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-            for (const Mesh& mesh : SceneManager::Get().models[pair.first].meshes)
-            {  
-                vkCmdDrawIndexed(commandBuffer, mesh.indexCount, instanceCount, mesh.startIndex, 0, instanceIndex);    
-            }
+    std::array<VkDescriptorSet, 2> sets = { descriptorSets[currentFrame], textureHeap.GetSet() };
 
-            instanceIndex += instanceCount;
-        }
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
 
-        if (renderDebugQuad)
-        {
-            //render debug quad
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, debugQuadPipeline);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
 
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, debugQuadPipelineLayout, 0, 1, &debugQuadDescriptorSets[currentFrame], 0, nullptr);
+    if (clusterList != CLUSTER_LIST_NONE)
+    {
+        RecordClusterDraws(commandBuffer, clusterList);
+        return;
+    }
 
-			DebugQuadPushConstants pushConstants{};
+    for (size_t i = firstDraw; i < firstDraw + drawCount; i++)
+    {
+        const DrawCommand& draw = drawCommands[i];
 
-            pushConstants.textureIndex = debugQuadTextureIndex;
+        vkCmdDrawIndexed(commandBuffer, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
+    }
+}
 
-			vkCmdPushConstants(commandBuffer, debugQuadPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(DebugQuadPushConstants), &pushConstants);
+void URenderer::RecordClusterDraws(VkCommandBuffer commandBuffer, uint32_t clusterList)
+{
+    //every list owns clusterListCapacity commands, the culling pass wrote how many are used
+    VkDeviceSize commandOffset = static_cast<VkDeviceSize>(clusterList) * clusterListCapacity * sizeof(VkDrawIndexedIndirectCommand);
 
-            vkCmdDraw(commandBuffer, 4, 1, 0, 0);
-        }
+    VkDeviceSize countOffset = static_cast<VkDeviceSize>(clusterList) * sizeof(uint32_t);
+
+    vkCmdDrawIndexedIndirectCount(commandBuffer, clusterCommandBuffer.buffer, commandOffset, clusterCountBuffer.buffer, countOffset,
+        clusterListCapacity, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void URenderer::RecordDebugQuad(VkCommandBuffer commandBuffer)
+{
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(renderExtent.width);
+    viewport.height = static_cast<float>(renderExtent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.offset = { 0, 0 };
+    scissor.extent = renderExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, debugQuadPipeline);
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, debugQuadPipelineLayout, 0, 1, &debugQuadDescriptorSets[currentFrame], 0, nullptr);
+
+    DebugQuadPushConstants pushConstants{};
+
+    pushConstants.textureIndex = debugQuadTextureIndex;
 
-        vkCmdEndRenderPass(commandBuffer);
+    vkCmdPushConstants(commandBuffer, debugQuadPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(DebugQuadPushConstants), &pushConstants);
 
+    vkCmdDraw(commandBuffer, 4, 1, 0, 0);
+}
+
+void URenderer::UpdateFragmentStatistics()
+{
+    const GpuScopeResult* mainPass = gpuProfiler.FindResult("Main pass");
+
+    if (!pipelineStatistics || !mainPass)
+    {
+        return;
     }
 
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    fragmentInvocations = mainPass->fragmentInvocations;
+
+    if (frameNumber % STATISTICS_LOG_INTERVAL == 0)
     {
-        throw std::runtime_error("Failed to record command buffer!");
+        //with early depth testing and the prepass this approaches 1, the rest is overdraw
+        double pixelCount = static_cast<double>(renderExtent.width) * renderExtent.height;
+
+        std::cout << "Main pass fragment invocations: " << fragmentInvocations << " (" << fragmentInvocations / pixelCount << " per pixel)" << std::endl;
     }
 }
 
@@ -2269,12 +4293,14 @@ VkShaderModule URenderer::CreateShaderModule(const std::vector<uint32_t>& spirvC
 
 void URenderer::UpdateCascades()
 {
+    UTRACE_FUNCTION();
+
     float cascadeSplitLambda = 0.95f;
 
     float cascadeSplits[NUM_CASCADES];
 
     float nearClip = camera->nearPlane;
-    float farClip = camera->farPlane;
+    float farClip = camera->farPlane * drawDistanceScale;
     float clipRange = farClip - nearClip;
 
     float minZ = nearClip;
@@ -2283,8 +4309,9 @@ void URenderer::UpdateCascades()
     float range = maxZ - minZ;
     float ratio = maxZ / minZ;
 
-    for (uint32_t i = 0; i < NUM_CASCADES; i++) {
-        float p = (i + 1) / static_cast<float>(NUM_CASCADES);
+    //the active cascades split the whole range between them
+    for (uint32_t i = 0; i < activeCascades; i++) {
+        float p = (i + 1) / static_cast<float>(activeCascades);
         float log = minZ * std::pow(ratio, p);
         float uniform = minZ + range * p;
         float d = cascadeSplitLambda * (log - uniform) + uniform;
@@ -2293,7 +4320,7 @@ void URenderer::UpdateCascades()
 
     // Calculate orthographic projection matrix for each cascade
     float lastSplitDist = 0.0;
-    for (uint32_t i = 0; i < NUM_CASCADES; i++) {
+    for (uint32_t i = 0; i < activeCascades; i++) {
         float splitDist = cascadeSplits[i];
 
         glm::vec3 frustumCorners[8] = {
@@ -2308,7 +4335,7 @@ void URenderer::UpdateCascades()
         };
 
         // Project frustum corners into world space
-        glm::mat4 invCam = glm::inverse(glm::perspective(glm::radians(camera->Zoom), (float)swapChainExtent.width / (float)swapChainExtent.height, camera->nearPlane, camera->farPlane) * camera->GetViewMatrix());
+        glm::mat4 invCam = glm::inverse(glm::perspective(glm::radians(camera->Zoom), (float)swapChainExtent.width / (float)swapChainExtent.height, camera->nearPlane, farClip) * camera->GetViewMatrix());
 
         for (uint32_t j = 0; j < 8; j++) {
             glm::vec4 invCorner = invCam * glm::vec4(frustumCorners[j], 1.0f);
@@ -2335,17 +4362,35 @@ void URenderer::UpdateCascades()
         }
         radius = std::ceil(radius * 16.0f) / 16.0f;
 
-        glm::vec3 maxExtents = glm::vec3(radius);
-        glm::vec3 minExtents = -maxExtents;
+        //the radius only depends on the projection, so the snap step is a fixed whole number of texels per cascade
+        //the cascade is grown by one step so the snapped center still covers the whole slice
+        float snapStep = 2.0f * radius * SHADOW_CACHE_SNAP_TEXELS / (shadowResolution - 2.0f * SHADOW_CACHE_SNAP_TEXELS);
+        float halfExtent = radius + snapStep;
 
+        //light view without translation, the center is snapped in light space so the matrix stays identical
+        //while the camera moves inside one step
         glm::vec3 lightDir = glm::normalize(-sunPos);
-        glm::mat4 lightViewMatrix = glm::lookAt(frustumCenter - lightDir * -minExtents.z, frustumCenter, glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::mat4 lightOrthoMatrix = glm::ortho(minExtents.x, maxExtents.x, minExtents.y, maxExtents.y, 0.0f, maxExtents.z - minExtents.z);
+        glm::mat4 lightViewMatrix = glm::lookAt(glm::vec3(0.0f), lightDir, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        glm::vec3 lightSpaceCenter = glm::vec3(lightViewMatrix * glm::vec4(frustumCenter, 1.0f));
+        lightSpaceCenter = glm::floor(lightSpaceCenter / snapStep + 0.5f) * snapStep;
+
+        glm::mat4 lightOrthoMatrix = glm::ortho(lightSpaceCenter.x - halfExtent, lightSpaceCenter.x + halfExtent,
+            lightSpaceCenter.y - halfExtent, lightSpaceCenter.y + halfExtent,
+            -lightSpaceCenter.z - halfExtent, -lightSpaceCenter.z + halfExtent);
 
 		lightOrthoMatrix[1][1] *= -1.0f;
         // Store split distance and matrix in cascade
         cascades[i].splitDepth = (camera->nearPlane + splitDist * clipRange) * -1.0f;
 
+        //the last active cascade is never left for the next one
+        if (i + 1 == activeCascades && i + 1 < NUM_CASCADES)
+        {
+            cascades[i].splitDepth = -std::numeric_limits<float>::max();
+        }
+
+        cascades[i].uvScale = static_cast<float>(shadowResolution) / shadowMapResolution;
+
         cascades[i].viewProjMatrix = lightOrthoMatrix * lightViewMatrix;
 
         lastSplitDist = cascadeSplits[i];
@@ -2353,3 +4398,29 @@ void URenderer::UpdateCascades()
 }
 
 
+
+void URenderer::ApplyScalabilitySettings(const ScalabilitySettings& settings)
+{
+    uint32_t newShadowResolution = std::min(settings.shadowResolution, shadowMapResolution);
+
+    uint32_t newActiveCascades = std::clamp(settings.cascadeCount, 1u, static_cast<uint32_t>(NUM_CASCADES));
+
+    //cached layers were drawn at the old size or split, every active cascade is redrawn on the next frame
+    if (newShadowResolution != shadowResolution || newActiveCascades != activeCascades)
+    {
+        for (int i = 0; i < NUM_CASCADES; i++)
+        {
+            staticShadowValid[i] = false;
+        }
+    }
+
+    shadowResolution = newShadowResolution;
+
+    activeCascades = newActiveCascades;
+
+    cascadeIntervalScale = std::max(settings.cascadeIntervalScale, 1u);
+
+    drawDistanceScale = settings.drawDistanceScale;
+
+    SceneManager::Get().animationLODDistanceScale = settings.animationLODDistanceScale;
+}
@@ -13,12 +13,25 @@
 
 #include "CommonTypes.h"
 
+#include "AsyncUploader.h"
+
+#include "GpuProfiler.h"
+
+#include "DynamicResolution.h"
+
+#include "ScalabilityGovernor.h"
+
+#include "RenderGraph.h"
+
+#include "TextureHeap.h"
+
+#include "GeometryArena.h"
+
 #include <glslang/Public/ShaderLang.h>
 #include <glslang/SPIRV/GlslangToSpv.h>
 #include <glslang/Public/ResourceLimits.h>
 
-const int MAX_TEXTURE_COUNT = 256;
-
+//starting capacities of the instance and bone transform buffers, both double whenever the scene outgrows them
 const int MAX_ENTITIES = 1000;
 
 const int MAX_ANIMATED_ENTITIES = 100;
@@ -27,6 +40,58 @@ const int MAX_FRAMES = 2;
 
 const int NUM_CASCADES = 3;
 
+//multiview mask covering every cascade layer of the shadow array
+const uint32_t ALL_CASCADES_MASK = (1u << NUM_CASCADES) - 1;
+
+const VkDeviceSize UPLOAD_STAGING_SIZE = 64 * 1024 * 1024;
+
+//bytes of geometry the arena may move down per frame to close the holes unloaded models leave
+const uint32_t GEOMETRY_DEFRAG_BYTES_PER_FRAME = 4 * 1024 * 1024;
+
+//draws per secondary command buffer in the main pass
+const int MAIN_PASS_DRAWS_PER_CHUNK = 256;
+
+//frames between fragment statistics logs
+const int STATISTICS_LOG_INTERVAL = 300;
+
+//cascade centers move in steps of this many texels, so cached static shadows survive small camera moves
+const int SHADOW_CACHE_SNAP_TEXELS = 64;
+
+//indirect draw lists written by the cluster culling pass, must match clusterCull.comp
+const uint32_t CLUSTER_LIST_OPAQUE = 0;
+
+const uint32_t CLUSTER_LIST_ALPHA_TESTED = 1;
+
+const uint32_t CLUSTER_LIST_SHADOW_STATIC = 2;
+
+const uint32_t CLUSTER_LIST_SHADOW_DYNAMIC = 3;
+
+//clusters hidden by last frame's depth pyramid that pass against this frame's, drawn after the pyramid is rebuilt
+const uint32_t CLUSTER_LIST_OPAQUE_LATE = 4;
+
+const uint32_t CLUSTER_LIST_ALPHA_TESTED_LATE = 5;
+
+const uint32_t CLUSTER_LIST_COUNT = 6;
+
+const uint32_t CLUSTER_LIST_NONE = ~0u;
+
+//commands per cluster list at startup, the lists grow with the clusters handed to the culling pass
+const uint32_t CLUSTER_LIST_INITIAL_CAPACITY = 1 << 16;
+
+//largest list size, frames with more clusters than a list can hold are drawn without cluster culling
+const uint32_t CLUSTER_LIST_MAX_CAPACITY = 1 << 21;
+
+//draws the CPU hands to the cluster culling pass per frame
+const uint32_t MAX_CLUSTER_DRAWS = 16384;
+
+//levels of the depth pyramid, enough for a first level 32768 texels wide
+const uint32_t HI_Z_MAX_MIPS = 16;
+
+//pipeline variants specialized on the bone influences the vertex shaders read, variant 0 draws without skinning
+const uint32_t SKINNING_VARIANT_COUNT = 4;
+
+const uint32_t SKINNING_VARIANT_INFLUENCES[SKINNING_VARIANT_COUNT] = { 0, 1, 2, 4 };
+
 struct SDL_Window;
 
 class URenderer {
@@ -77,12 +142,97 @@ private:
         VmaAllocationInfo info;
     };
 
+    //decoded texture waiting for upload, region buffer offsets are relative to data
+    struct TextureUpload {
+        VkFormat format;
+        uint32_t width;
+        uint32_t height;
+        std::vector<VkBufferImageCopy> regions;
+        std::vector<uint8_t> data;
+        bool bAlphaTested = false;
+    };
+
+    //secondary command buffers recorded by one thread, reset once the frame using them has finished
+    struct ThreadCommandPool
+    {
+        VkCommandPool pool;
+        std::vector<VkCommandBuffer> commandBuffers;
+        uint32_t usedCount = 0;
+    };
+
+    struct DrawCommand
+    {
+        uint32_t indexCount;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        int32_t vertexOffset;
+        uint32_t firstInstance;
+        uint32_t firstMeshlet;
+        uint32_t meshletCount;
+    };
+
+    //mirrors ClusterDraw in clusterCull.comp
+    struct ClusterDraw
+    {
+        uint32_t firstMeshlet;
+        uint32_t meshletCount;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+        uint32_t workOffset;
+        uint32_t mainList;
+        uint32_t shadowList;
+        //arena offsets of the model, meshlet indices count from its first index and vertex
+        uint32_t indexOffset;
+        int32_t vertexOffset;
+        uint32_t padding[3];
+    };
+
+    struct ClusterCullData
+    {
+        //camera planes followed by every cascade's
+        glm::vec4 frustumPlanes[(1 + NUM_CASCADES) * 6];
+        glm::vec4 cameraPosition;
+        //draw count, total invocations, capacity of each list
+        glm::uvec4 counts;
+        //cascades of the static and dynamic shadow lists
+        glm::uvec4 cascadeMasks;
+        //view the depth pyramid was built with last frame, then this frame's view
+        glm::mat4 occlusionViews[2];
+        //P00, P11, P22 and P32 of the matching projections
+        glm::vec4 occlusionProjections[2];
+        //size of the first pyramid level, its mip count, 1 when last frame's pyramid can be tested against
+        glm::uvec4 hiZParams;
+    };
+
     struct FrameData
     {
         VkCommandBuffer commandBuffer;
         VkSemaphore imageAvailableSemaphore;
         VkSemaphore renderFinishedSemaphore;
         VkFence renderFence;
+
+        //written by the CPU while the previous use of this frame is known to be finished
+        AllocatedBuffer entityInstanceStaging;
+        AllocatedBuffer boneTransformStaging;
+
+        size_t entityInstanceStagingSize = 0;
+        size_t boneTransformStagingSize = 0;
+
+        //version of the instance buffers this frame's descriptor sets point at
+        uint32_t instanceBuffersVersion = 0;
+
+        //version of the cluster lists this frame's culling set points at
+        uint32_t clusterListsVersion = 0;
+
+        //buffers replaced while this frame slot was recorded, destroyed once its fence is waited on again
+        std::vector<std::function<void()>> retiredBuffers;
+
+        //cluster culling input, read by the compute pass of this frame
+        AllocatedBuffer clusterDraws;
+        AllocatedBuffer clusterCullUniform;
+
+        //indexed by JobSystem::GetThreadIndex
+        std::vector<ThreadCommandPool> threadCommandPools;
     };
 
     struct GPUPushConstants
@@ -98,12 +248,13 @@ private:
 
 	struct ShadowPushConstants
 	{
-		glm::mat4 lightSpaceMatrix;
+		//bit i set when cascade layer i is drawn in this pass
+		uint32_t viewMask;
 	};
 
     struct ShadowData
     {
-        glm::mat4 model;
+        glm::mat4 lightSpaceMatrices[NUM_CASCADES];
     };
 
     struct SceneData
@@ -118,7 +269,9 @@ private:
     {
         glm::mat4 viewProjMatrix;
         float splitDepth;
-		int padding[3];
+        //fraction of the layer's side the cascade was drawn into
+        float uvScale;
+		int padding[2];
     };
 
     struct CascadeData
@@ -140,6 +293,19 @@ private:
 
     VkQueue presentQueue;
 
+    UAsyncUploader uploader;
+
+    UGpuProfiler gpuProfiler;
+
+    UDynamicResolution resolutionController;
+
+    UScalabilityGovernor governor;
+
+    URenderGraph renderGraph;
+
+    //scene textures take the first slots, streamed textures allocate and free their own
+    UTextureHeap textureHeap;
+
     VkSurfaceKHR surface;
 
     VmaAllocator allocator;
@@ -148,16 +314,29 @@ private:
 
     VkExtent2D swapChainExtent;
 
+    //area of the scene targets drawn this frame, the swapchain extent without dynamic resolution
+    VkExtent2D renderExtent = {};
+
+    //size of the scene targets, the swapchain extent scaled by the maximum scale so scale changes do not reallocate
+    VkExtent2D renderTargetExtent = {};
+
     VkSurfaceFormatKHR swapChainSurfaceFormat;
 
     std::vector<VkImage> swapChainImages;
 
     std::vector<VkImageView> swapChainImageViews;
 
-    std::vector<VkFramebuffer> swapChainFramebuffers;
+    //no surface or swapchain, frames are rendered into MAX_FRAMES offscreen images and never presented
+    bool headless = false;
+
+    //layout the render graph leaves the main color target in, present src needs the swapchain extension
+    VkImageLayout colorFinalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     VkRenderPass renderPass;
 
+    //loads the main pass result so overlays like the debug quad are their own pass, compatible with renderPass
+    VkRenderPass overlayRenderPass;
+
     VkDescriptorSetLayout descriptorSetLayout;
 
     VkDescriptorPool descriptorPool;
@@ -168,9 +347,70 @@ private:
 
     std::vector<VkDescriptorSet> debugQuadDescriptorSets = std::vector<VkDescriptorSet>(MAX_FRAMES);
 
-    VkPipelineLayout pipelineLayout;
+    std::vector<VkDescriptorSet> clusterCullDescriptorSets = std::vector<VkDescriptorSet>(MAX_FRAMES);
+
+    VkDescriptorSetLayout clusterCullDescriptorSetLayout;
+
+    VkPipelineLayout clusterCullPipelineLayout;
+
+    VkPipeline clusterCullPipeline;
+
+    //conservative farthest depth pyramid, built from the depth of the clusters drawn before it
+    VkImage hiZImage = VK_NULL_HANDLE;
+
+    VmaAllocation hiZAllocation;
+
+    //every level, read by the culling pass
+    VkImageView hiZImageView;
+
+    //one view per level, written and read by the build pass
+    std::array<VkImageView, HI_Z_MAX_MIPS> hiZMipViews;
 
-    VkPipeline graphicsPipeline;
+    //half the swapchain extent rounded up, the depth image is reduced once before the first level
+    VkExtent2D hiZExtent;
+
+    uint32_t hiZMipCount = 0;
+
+    VkSampler hiZSampler;
+
+    VkDescriptorSetLayout hiZBuildDescriptorSetLayout;
+
+    VkPipelineLayout hiZBuildPipelineLayout;
+
+    VkPipeline hiZBuildPipeline;
+
+    //a set per level and frame, the first level reads the depth image of its frame
+    std::vector<std::array<VkDescriptorSet, HI_Z_MAX_MIPS>> hiZBuildDescriptorSets = std::vector<std::array<VkDescriptorSet, HI_Z_MAX_MIPS>>(MAX_FRAMES);
+
+    //false until the first build and after the pyramid is recreated
+    bool hiZValid = false;
+
+    //camera the pyramid was built with, the next frame's first culling phase projects into it
+    glm::mat4 hiZView;
+
+    glm::vec4 hiZProjection;
+
+    //clear and store depth so the pyramid and the late clusters can use it, compatible with renderPass
+    VkRenderPass occlusionEarlyRenderPass;
+
+    //loads the early pass color and depth for the late clusters
+    VkRenderPass occlusionLateRenderPass;
+
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+
+    //kept for the skinning variants created after startup
+    VkShaderModule mainVertShaderModule = VK_NULL_HANDLE;
+
+    VkShaderModule mainFragShaderModule = VK_NULL_HANDLE;
+
+    //one pipeline per skinning variant, variants the scene has not needed yet are VK_NULL_HANDLE
+    //opaque materials, compiled without the alpha test discard so early depth testing stays on
+    std::array<VkPipeline, SKINNING_VARIANT_COUNT> graphicsPipelines{};
+
+    std::array<VkPipeline, SKINNING_VARIANT_COUNT> alphaTestPipelines{};
+
+    //depth only version of the opaque pipeline, the opaque pipeline then tests for equal depth
+    std::array<VkPipeline, SKINNING_VARIANT_COUNT> depthPrepassPipelines{};
 
     VkCommandPool commandPool;
 
@@ -178,6 +418,7 @@ private:
 
     uint32_t currentFrame = 0;
 
+    //fixed size buffers the geometry arena sub-allocates between models
     AllocatedBuffer vertexBuffer;
     AllocatedBuffer indexBuffer;
 
@@ -185,29 +426,104 @@ private:
 
     AllocatedBuffer boneTransformBuffer;
 
+    //Meshlets of every loaded model
+    AllocatedBuffer meshletBuffer;
+
+    UGeometryArena geometryArena;
+
+    //copies Defragment asked for this frame, recorded by the geometry moves pass
+    std::vector<GeometryMove> geometryMoves;
+
+    //CLUSTER_LIST_COUNT lists of clusterListCapacity indexed indirect commands and their draw counts
+    AllocatedBuffer clusterCommandBuffer;
+
+    //every cluster appends at most once to the main and once to the shadow lists, a capacity of the work count never drops one
+    uint32_t clusterListCapacity = CLUSTER_LIST_INITIAL_CAPACITY;
+
+    //CLUSTER_LIST_MAX_CAPACITY lowered to the storage buffer range and the late phase's dispatch limit
+    uint32_t clusterListMaxCapacity = CLUSTER_LIST_MAX_CAPACITY;
+
+    //bumped whenever the cluster lists are replaced by larger ones
+    uint32_t clusterListsVersion = 0;
+
+    //work groups per row of the first culling phase, rows are stacked in y past the device limit
+    uint32_t maxComputeWorkGroupsX = 65535;
+
+    bool bClusterListOverflowLogged = false;
+
+    AllocatedBuffer clusterCountBuffer;
+
+    //indirect dispatch arguments and count, followed by the clusters the first phase found occluded
+    AllocatedBuffer clusterLateBuffer;
+
+    //render graph states of resources that live across frames
+    RGResourceState entityInstanceBufferState;
+
+    RGResourceState boneTransformBufferState;
+
+    RGResourceState shadowImageState;
+
+    RGResourceState staticShadowImageState;
+
+    RGResourceState clusterCommandBufferState;
+
+    RGResourceState clusterCountBufferState;
+
+    RGResourceState clusterLateBufferState;
+
+    RGResourceState hiZImageState;
+
+    RGResourceState vertexBufferState;
+
+    RGResourceState indexBufferState;
+
+    RGResourceState meshletBufferState;
+
     VkSampler textureSampler;
 
-    VkImage depthImage;
+    bool textureCompressionBC = false;
 
-    VkImageView depthImageView;
+    //indexed by texture id
+    std::vector<bool> textureAlphaTested;
 
-    VkFormat depthFormat = VK_FORMAT_D32_SFLOAT_S8_UINT;
+    bool pipelineStatistics = false;
 
-    VkFormat shadowDepthFormat = VK_FORMAT_D32_SFLOAT_S8_UINT;
+    //fragment shader invocations of the main pass in the latest profiled frame
+    uint64_t fragmentInvocations = 0;
 
-    VkRenderPass shadowRenderPass;
+    VkDeviceSize textureUploadSize = 0;
+
+    VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
 
-    std::vector<VkImageView> images;
+    VkFormat shadowDepthFormat = VK_FORMAT_D32_SFLOAT;
 
+    VkRenderPass shadowRenderPass;
+
+    //size of the shadow layers, the largest resolution the governor can pick
     uint32_t shadowMapResolution = 4096;
 
+    //side of the part of every layer that is drawn, the cascades carry the fraction it covers
+    uint32_t shadowResolution = 4096;
+
+    //cascades the view range is split into, the later layers are left alone
+    uint32_t activeCascades = NUM_CASCADES;
+
+    //multiplies cascadeUpdateIntervals
+    uint32_t cascadeIntervalScale = 1;
+
+    //fraction of the camera far plane that is drawn
+    float drawDistanceScale = 1.0f;
+
     VkSampler shadowSampler;
 
-    VkFramebuffer shadowFramebuffers[NUM_CASCADES];
+    //multiview framebuffer, every cascade is a layer of shadowImage
+    VkFramebuffer shadowFramebuffer;
 
-    VkPipeline shadowPipeline;
+    std::array<VkPipeline, SKINNING_VARIANT_COUNT> shadowPipelines{};
 
-    VkPipelineLayout shadowPipelineLayout;
+    VkPipelineLayout shadowPipelineLayout = VK_NULL_HANDLE;
+
+    VkShaderModule shadowVertShaderModule = VK_NULL_HANDLE;
 
     VkDescriptorSetLayout shadowDescriptorSetLayout;
 
@@ -217,9 +533,9 @@ private:
 
     VkDescriptorSetLayout debugQuadDescriptorSetLayout;
 
-    VkImage shadowImages[NUM_CASCADES];
+    VkImage shadowImage;
 
-    VkImageView shadowImageViews[NUM_CASCADES];
+    VkImageView shadowImageView;
 
     AllocatedBuffer shadowUniformBuffer;
 
@@ -229,25 +545,95 @@ private:
 
     SDL_Window* _window;
 
-    AllocatedBuffer entityInstanceStaging;
-
-	AllocatedBuffer boneTransformStaging;
-
     size_t entityInstanceBufferSize;
 
     size_t boneTransformBufferSize;
 
+    //instances and animated entities written this frame, only those are copied
+    uint32_t entityInstanceCount = 0;
+
+    uint32_t animatedEntityCount = 0;
+
+    //bumped whenever the instance or bone transform buffer is replaced by a larger one
+    uint32_t instanceBuffersVersion = 0;
+
 	float deltaTime = 0.0f;
 
+    //CPU time of the last frame from after the image was acquired to the submit, for the governor
+    double cpuFrameMilliseconds = 0.0;
+
 	class Camera* defaultCamera;
 
 	class Camera* camera;
 
     glm::vec3 sunPos = glm::vec3(-2.0f, 4.0f, -1.0f);
 
+    uint64_t frameNumber = 0;
+
+    //keeps the depth of every layer, used for the static cache and for dynamic casters drawn over a copy of it
+    VkRenderPass shadowLoadRenderPass;
+
+    //static casters are rendered into these only when the cascade matrix changes
+
+    VkImage staticShadowImage;
+
+    VkImageView staticShadowImageView;
+
+    VkFramebuffer staticShadowFramebuffer;
+
+    glm::mat4 staticShadowMatrices[NUM_CASCADES];
+
+    bool staticShadowValid[NUM_CASCADES] = {};
+
+    //SceneManager::staticBatchVersion the static shadow cache was drawn with
+    uint32_t staticBatchVersion = 0;
+
+    //draw lists rebuilt every frame from the render batches, one per skinning variant
+    std::array<std::vector<DrawCommand>, SKINNING_VARIANT_COUNT> staticDrawCommands;
+
+    std::array<std::vector<DrawCommand>, SKINNING_VARIANT_COUNT> dynamicDrawCommands;
+
+    std::array<std::vector<DrawCommand>, SKINNING_VARIANT_COUNT> allDrawCommands;
+
+    //main pass lists, alpha tested materials are drawn last with the pipeline that keeps the discard
+    std::array<std::vector<DrawCommand>, SKINNING_VARIANT_COUNT> opaqueDrawCommands;
+
+    std::array<std::vector<DrawCommand>, SKINNING_VARIANT_COUNT> alphaTestedDrawCommands;
+
+    //matrices the shadow images were last rendered with, cascades that skip a frame are sampled with these
+    std::array<Cascade, NUM_CASCADES> renderedCascades;
+
 public:
     bool renderDebugQuad = false;
 
+    bool shadowCaching = true;
+
+    //lay down opaque depth first so the lighting shader runs at most once per pixel
+    bool depthPrepass = false;
+
+    //draw meshlets that survive frustum and cone culling in a compute pass instead of whole meshes
+    bool clusterCulling = true;
+
+    //test clusters against a depth pyramid of last frame and re-test the hidden ones against this frame's, needs clusterCulling
+    bool occlusionCulling = true;
+
+    //hide instances behind the scene's occluder models on the CPU before the instance buffer is filled
+    bool softwareOcclusionCulling = true;
+
+    //render the scene at a fraction of the window resolution chosen from GPU frame times and upscale it into the swapchain
+    bool dynamicResolution = false;
+
+    //step shadow quality, draw distance and animation LOD down when the frame time leaves the budget and back up when it allows
+    bool scalabilityGovernor = false;
+
+    //sizes of the geometry arena, raised at Init when the scene alone needs more
+    uint32_t geometryArenaVertexMB = 256;
+
+    uint32_t geometryArenaIndexMB = 64;
+
+    //with shadow caching cascade i is re-rendered every cascadeUpdateIntervals[i] frames
+    uint32_t cascadeUpdateIntervals[NUM_CASCADES] = { 1, 2, 4 };
+
 	int debugQuadTextureIndex = 0;
 
 	int cameraIndex = 0;
@@ -260,6 +646,23 @@ public:
 
     void SetWindow(SDL_Window* window);
 
+    //render offscreen at extent instead of into a window, call before Init
+    void SetHeadless(VkExtent2D extent);
+
+    bool IsHeadless() const { return headless; }
+
+    //per pass GPU timings, configure logging before Init
+    UGpuProfiler& GetGpuProfiler() { return gpuProfiler; }
+
+    //target frame time and scale bounds, configure before Init
+    UDynamicResolution& GetDynamicResolution() { return resolutionController; }
+
+    //budget and temporary boosts of the scalability governor
+    UScalabilityGovernor& GetScalabilityGovernor() { return governor; }
+
+    //ranges of the loaded models in the vertex, index and meshlet buffers
+    const UGeometryArena& GetGeometryArena() const { return geometryArena; }
+
 private:
 
     void InitVulkan();
@@ -268,17 +671,38 @@ private:
 
     void LoadAssets();
 
-    void CreateDepthResources();
+    //decodes and uploads the scene textures not loaded yet, models loaded at runtime append theirs
+    void LoadTextures();
+
+    //grows the instance and bone transform buffers and this frame's staging to fit the scene, old buffers are retired to the frame slot
+    void ReserveInstanceBuffers(FrameData& frame, uint32_t instanceCount, uint32_t animatedCount);
+
+    //points this frame's descriptor sets at the current instance and bone transform buffers
+    void WriteInstanceBufferDescriptors(uint32_t frameIndex);
+
+    void CreateClusterListBuffers();
 
-    void CreateTextureImage(std::string texturePath);
+    //grows the cluster lists to workCount commands each, false when that is past clusterListMaxCapacity
+    bool ReserveClusterLists(FrameData& frame, uint32_t workCount);
+
+    //points this frame's culling set at the current cluster lists
+    void WriteClusterListDescriptors(uint32_t frameIndex);
+
+    //frees unloaded models' ranges, uploads the geometry of newly loaded models and plans this frame's defragmentation moves
+    void StreamModelGeometry();
+
+    void DecodeTexture(const std::string& texturePath, TextureUpload& upload);
+
+    void UploadTextures(const std::vector<TextureUpload>& uploads, uint32_t firstTexture);
 
     void CreateTextureSampler();
 
-    VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
+    void CreateTextureHeap();
 
-    void CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImage& image);
+    //a layerCount above 1 creates a 2D array view
+    VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1, uint32_t layerCount = 1);
 
-    void TransitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout);
+    void CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImage& image, uint32_t mipLevels = 1, uint32_t arrayLayers = 1);
 
     void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
 
@@ -296,15 +720,26 @@ private:
 
     void CreateDebugQuadDescriptorSetLayout();
 
-    void CreateGraphicsPipeline();
+    void CreateClusterCullDescriptorSetLayout();
+
+    void CreateHiZBuildDescriptorSetLayout();
+
+    void CreateGraphicsPipeline(uint32_t variant);
 
     void CreateDebugQuadPipeline();
 
-    void CreateShadowPipeline();
+    void CreateShadowPipeline(uint32_t variant);
 
-    void CreateFrameBuffers();
+    //creates the main and shadow pipelines of a skinning variant unless they exist
+    void CreatePipelineVariant(uint32_t variant);
 
-    void CreateShadowFrameBuffer(VkFramebuffer &shadowFramebuffer, VkImage &shadowImage, VkImageView &shadowImageView);
+    void CreateClusterCullPipeline();
+
+    void CreateHiZBuildPipeline();
+
+    void CreateShadowFrameBuffer();
+
+    void CreateStaticShadowFrameBuffer();
 
 	void CreateShadowSampler();
 
@@ -320,15 +755,49 @@ private:
 
     void CreateDebugQuadDescriptorSets();
 
+    void CreateClusterCullDescriptorSets();
+
+    //sampler, pyramid and build descriptor sets, call after the cluster culling sets
+    void CreateHiZ();
+
+    //sized from the swapchain extent, recreated with it
+    void CreateHiZImage();
+
+    void DestroyHiZImage();
+
+    //points the culling and build sets at the current pyramid views
+    void WriteHiZDescriptors();
+
     void CreateCommandBuffer();
 
     void RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
 
+    void CreateThreadCommandPools();
+
+    VkCommandBuffer BeginSecondaryCommandBuffer(VkRenderPass renderPass, VkFramebuffer framebuffer);
+
+    //draws into every cascade layer set in viewMask with a single set of draws per skinning variant
+    //a cluster list replaces the static variant's draws, the skinned variants are never cluster culled
+    void RecordShadowPass(VkCommandBuffer commandBuffer, uint32_t viewMask, const std::array<std::vector<DrawCommand>, SKINNING_VARIANT_COUNT>& drawCommands, uint32_t clusterList = CLUSTER_LIST_NONE);
+
+    void RecordMainPassChunk(VkCommandBuffer commandBuffer, VkPipeline pipeline, const std::vector<DrawCommand>& drawCommands, size_t firstDraw, size_t drawCount, uint32_t clusterList = CLUSTER_LIST_NONE);
+
+    //draws the clusters the culling pass appended to clusterList
+    void RecordClusterDraws(VkCommandBuffer commandBuffer, uint32_t clusterList);
+
+    void RecordDebugQuad(VkCommandBuffer commandBuffer);
+
     void CreateSyncPrimitives();
 
+    //logs main pass fragment invocations per pixel from the profiler results
+    void UpdateFragmentStatistics();
+
     std::vector<uint32_t> CompileGLSLtoSPV(const std::string& sourceCode, EShLanguage shaderType);
 
     VkShaderModule CreateShaderModule(const std::vector<uint32_t>& spirvCode);
 
     void UpdateCascades();
+
+    //moves the knobs to a governor level, shadow changes redraw every cascade
+    void ApplyScalabilitySettings(const ScalabilitySettings& settings);
 };
@@ -0,0 +1,80 @@
+#include "ScalabilityGovernor.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+bool UScalabilityGovernor::Update(double cpuMilliseconds, double gpuMilliseconds, double deltaSeconds)
+{
+    if (boostSeconds > 0.0)
+    {
+        boostSeconds -= deltaSeconds;
+
+        if (boostSeconds <= 0.0)
+        {
+            boostSeconds = 0.0;
+            boostMilliseconds = 0.0;
+        }
+    }
+
+    if (++framesSinceChange <= settleFrames)
+    {
+        return false;
+    }
+
+    double budget = GetBudgetMilliseconds();
+
+    //the slower side decides, without GPU timings only the CPU is governed
+    double frameMilliseconds = std::max(cpuMilliseconds, gpuMilliseconds);
+
+    framesOver = frameMilliseconds > budget ? framesOver + 1 : 0;
+
+    framesUnder = frameMilliseconds < budget * stepUpFraction ? framesUnder + 1 : 0;
+
+    if (framesOver >= stepDownFrames && level + 1 < SCALABILITY_LEVEL_COUNT)
+    {
+        SetLevel(level + 1, gpuMilliseconds > cpuMilliseconds ? "GPU over budget" : "CPU over budget", cpuMilliseconds, gpuMilliseconds);
+        return true;
+    }
+
+    if (framesUnder >= stepUpFrames && level > 0)
+    {
+        SetLevel(level - 1, "under budget", cpuMilliseconds, gpuMilliseconds);
+        return true;
+    }
+
+    return false;
+}
+
+void UScalabilityGovernor::RequestBudgetBoost(double milliseconds, double seconds)
+{
+    boostMilliseconds = std::max(boostMilliseconds, milliseconds);
+
+    boostSeconds = std::max(boostSeconds, seconds);
+
+    //the boost applies to the frames measured from now on
+    framesOver = 0;
+}
+
+void UScalabilityGovernor::SetLevel(uint32_t newLevel, const char* reason, double cpuMilliseconds, double gpuMilliseconds)
+{
+    const ScalabilitySettings& settings = SCALABILITY_LEVELS[newLevel];
+
+    //formatted locally so the precision does not stick to std::cout
+    std::ostringstream message;
+
+    message << std::fixed << std::setprecision(2)
+        << "Scalability level " << level << " -> " << newLevel << ", " << reason
+        << " (CPU " << cpuMilliseconds << " ms, GPU " << gpuMilliseconds << " ms, budget " << GetBudgetMilliseconds() << " ms): "
+        << "shadows " << settings.shadowResolution << " x " << settings.cascadeCount << " cascades, cascade intervals x" << settings.cascadeIntervalScale
+        << ", draw distance x" << settings.drawDistanceScale << ", animation LOD distances x" << settings.animationLODDistanceScale;
+
+    std::cout << message.str() << std::endl;
+
+    level = newLevel;
+
+    framesOver = 0;
+    framesUnder = 0;
+    framesSinceChange = 0;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+
+//quality knobs of one scalability level
+struct ScalabilitySettings
+{
+    //side of the part of every shadow layer that is drawn, at most the shadow map resolution
+    uint32_t shadowResolution;
+
+    //cascades splitting the view range, the rest are not drawn
+    uint32_t cascadeCount;
+
+    //multiplies the update intervals of the cached cascades
+    uint32_t cascadeIntervalScale;
+
+    //fraction of the camera far plane that is drawn
+    float drawDistanceScale;
+
+    //scales the distances past which skinned meshes evaluate their animation less often
+    float animationLODDistanceScale;
+};
+
+//level 0 is full quality, every later level is cheaper, knobs that cost little to lower come first
+const ScalabilitySettings SCALABILITY_LEVELS[] = {
+    { 4096, 3, 1, 1.0f, 1.0f },
+    { 4096, 3, 2, 1.0f, 0.75f },
+    { 3072, 3, 2, 0.85f, 0.75f },
+    { 2048, 3, 2, 0.75f, 0.5f },
+    { 2048, 2, 2, 0.6f, 0.5f },
+    { 1024, 2, 4, 0.5f, 0.35f },
+};
+
+const uint32_t SCALABILITY_LEVEL_COUNT = sizeof(SCALABILITY_LEVELS) / sizeof(SCALABILITY_LEVELS[0]);
+
+//steps through the scalability levels to keep CPU and GPU frame times inside a budget
+//a step down needs the budget to be exceeded for a while, a step up needs a clear margin for longer, so single spikes and
+//levels right at the budget do not make it oscillate
+class UScalabilityGovernor
+{
+public:
+    //frame time neither the CPU nor the GPU should exceed
+    double budgetMilliseconds = 16.6;
+
+    //frames in a row over the budget before stepping down
+    uint32_t stepDownFrames = 30;
+
+    //frames in a row under stepUpFraction of the budget before stepping up
+    uint32_t stepUpFrames = 180;
+
+    double stepUpFraction = 0.75;
+
+    //frames after a change whose timings are ignored, the GPU time of a frame is only known frames later
+    uint32_t settleFrames = 3;
+
+    //feeds the times of the latest measured frames, a 0 GPU time is ignored, returns true when the level changed
+    bool Update(double cpuMilliseconds, double gpuMilliseconds, double deltaSeconds);
+
+    //raises the budget by milliseconds for the next seconds, for moments gameplay knows a lower frame rate is acceptable
+    //overlapping requests keep the larger boost and the later end
+    void RequestBudgetBoost(double milliseconds, double seconds);
+
+    //budget including an active boost
+    double GetBudgetMilliseconds() const { return budgetMilliseconds + boostMilliseconds; }
+
+    uint32_t GetLevel() const { return level; }
+
+    const ScalabilitySettings& GetSettings() const { return SCALABILITY_LEVELS[level]; }
+
+private:
+    uint32_t level = 0;
+
+    uint32_t framesOver = 0;
+
+    uint32_t framesUnder = 0;
+
+    uint32_t framesSinceChange = 0;
+
+    double boostMilliseconds = 0.0;
+
+    double boostSeconds = 0.0;
+
+    void SetLevel(uint32_t newLevel, const char* reason, double cpuMilliseconds, double gpuMilliseconds);
+};
@@ -2,10 +2,22 @@
 
 #include "AssetImporter.h"
 
+#include "MeshletBuilder.h"
+
+#include "ModelCooker.h"
+
+#include "OcclusionCuller.h"
+
+#include <glm/gtc/packing.hpp>
+
 #include <iostream>
 
 #include <fstream>
 
+#include <algorithm>
+
+#include <iterator>
+
 #include "json.hpp"
 
 #include "InputManager.h"
@@ -14,10 +26,36 @@
 
 #include "FreeCamera.h"
 
+#include "Trace.h"
+
 using json = nlohmann::json;
 
+SceneManager::SceneManager()
+{
+	//render batches follow the components that decide them
+	registry.on_construct<ModelComponent>().connect<&SceneManager::OnRenderBatchComponentChanged<ModelComponent>>(*this);
+	registry.on_update<ModelComponent>().connect<&SceneManager::OnRenderBatchComponentChanged<ModelComponent>>(*this);
+	registry.on_destroy<ModelComponent>().connect<&SceneManager::OnRenderBatchComponentDestroyed<ModelComponent>>(*this);
+
+	registry.on_construct<TransformComponent>().connect<&SceneManager::OnRenderBatchComponentChanged<TransformComponent>>(*this);
+	registry.on_destroy<TransformComponent>().connect<&SceneManager::OnRenderBatchComponentDestroyed<TransformComponent>>(*this);
+
+	registry.on_construct<StaticComponent>().connect<&SceneManager::OnRenderBatchComponentChanged<StaticComponent>>(*this);
+	registry.on_destroy<StaticComponent>().connect<&SceneManager::OnRenderBatchComponentDestroyed<StaticComponent>>(*this);
+
+	registry.on_construct<MeshSocketComponent>().connect<&SceneManager::OnRenderBatchComponentChanged<MeshSocketComponent>>(*this);
+	registry.on_destroy<MeshSocketComponent>().connect<&SceneManager::OnRenderBatchComponentDestroyed<MeshSocketComponent>>(*this);
+
+	registry.on_construct<AnimationComponent>().connect<&SceneManager::OnRenderBatchComponentChanged<AnimationComponent>>(*this);
+	registry.on_destroy<AnimationComponent>().connect<&SceneManager::OnRenderBatchComponentDestroyed<AnimationComponent>>(*this);
+
+	registry.on_destroy<RenderBatchComponent>().connect<&SceneManager::OnRenderBatchDestroyed>(*this);
+}
+
 void SceneManager::LoadScene(const std::string& path)
 {
+	UTRACE_FUNCTION();
+
 	std::ifstream file(path);
 	json scene = json::parse(file);
 
@@ -31,7 +69,9 @@ void SceneManager::LoadScene(const std::string& path)
 			customMaterialTextures = true;
 		}
 
-		SceneManager::Get().LoadModelFromFile(model["file"], model["name"], customMaterialTextures);
+		bool occluder = model.contains("occluder") && model["occluder"].get<bool>();
+
+		SceneManager::Get().LoadModelFromFile(model["file"], model["name"], customMaterialTextures, occluder);
 	}
 	for (auto& animation : scene["assets"]["animations"]) {
 		SceneManager::Get().LoadAnimationToModel(animation["file"], animation["modelName"], animation["name"]);
@@ -126,6 +166,8 @@ void SceneManager::LoadScene(const std::string& path)
 				}
 
 				registry.emplace<RigidBodyComponent>(entity, RigidBodyComponent{ UPhysics::Get().CreatePxRigidStaticActor(t, *geometry) });
+
+				registry.emplace<StaticComponent>(entity);
 			}
 			else if (components.contains("CharacterController"))
 			{
@@ -185,19 +227,147 @@ void SceneManager::LoadScene(const std::string& path)
 	}
 }
 
-void SceneManager::LoadModelFromFile(const std::string& path, const std::string& modelName, bool customMaterialTextures)
+void SceneManager::LoadModelFromFile(const std::string& path, const std::string& modelName, bool customMaterialTextures, bool occluder)
 {
+	UTRACE_FUNCTION();
+
 	Model& model = models[modelName];
 
 	model.name = modelName;
 
+	//references into the map stay valid as it grows, so the table can point at the models
+	if (modelIDs.find(modelName) == modelIDs.end())
+	{
+		modelIDs[modelName] = static_cast<uint32_t>(modelTable.size());
+
+		modelTable.push_back(&model);
+
+		for (std::vector<RenderBatch>& batches : renderBatches)
+		{
+			batches.emplace_back();
+		}
+	}
+
 	model.customMaterialTextures = customMaterialTextures;
 
-	AssetImporter::Get().LoadModelFromFile(path.c_str(), model, vertices, indices, texturePaths);
+	if (model.sceneRoot == nullptr)
+	{
+		ImportModel(path, model);
+	}
+	else
+	{
+		//loaded before, entities and sockets point into the node tree, bones and animations so only the meshes are replaced
+		//the file is expected to keep its skeleton, bone indices of the new vertices refer to the bones of the first load
+		Model imported;
+
+		imported.customMaterialTextures = customMaterialTextures;
+
+		ImportModel(path, imported);
+
+		ReleaseModelGeometry(model);
+
+		model.meshes = std::move(imported.meshes);
+		model.vertices = std::move(imported.vertices);
+		model.indices = std::move(imported.indices);
+		model.meshlets = std::move(imported.meshlets);
+		model.mappedFile = std::move(imported.mappedFile);
+		model.mappedGeometry = imported.mappedGeometry;
+		model.lodCount = imported.lodCount;
+		model.boundsCenter = imported.boundsCenter;
+		model.boundsRadius = imported.boundsRadius;
+		model.boundsMin = imported.boundsMin;
+		model.boundsMax = imported.boundsMax;
+
+		DestroySceneNodes(imported.sceneRoot);
+	}
+
+	if (occluder)
+	{
+		GeometrySource geometry = model.GetPendingGeometry();
+
+		OcclusionCuller::Get().BuildOccluder(model, geometry.vertices, geometry.indices);
+	}
+}
+
+void SceneManager::ImportModel(const std::string& path, Model& model)
+{
+	//the cooked file already holds the optimized LODs and meshlets
+	if (ModelCooker::Get().LoadCookedModel(path, model, texturePaths))
+	{
+		return;
+	}
+
+	AssetImporter::Get().LoadModelFromFile(path.c_str(), model, model.vertices, model.indices, texturePaths);
+
+	for (Mesh& mesh : model.meshes)
+	{
+		for (uint32_t lod = 0; lod < mesh.lodCount; lod++)
+		{
+			MeshletBuilder::Get().Build(mesh.lods[lod], model.vertices, model.indices, model.meshlets);
+		}
+	}
+}
+
+void SceneManager::UnloadModel(const std::string& modelName)
+{
+	auto it = models.find(modelName);
+
+	if (it == models.end())
+	{
+		std::cout << "Model not found: " << modelName << std::endl;
+		return;
+	}
+
+	ReleaseModelGeometry(it->second);
+}
+
+void SceneManager::ReleaseModelGeometry(Model& model)
+{
+	if (model.geometry != INVALID_GEOMETRY_HANDLE)
+	{
+		releasedGeometry.push_back(model.geometry);
+
+		model.geometry = INVALID_GEOMETRY_HANDLE;
+	}
+
+	model.meshes.clear();
+
+	std::vector<Vertex>().swap(model.vertices);
+	std::vector<uint32_t>().swap(model.indices);
+	std::vector<Meshlet>().swap(model.meshlets);
+
+	model.mappedFile.reset();
+	model.mappedGeometry = GeometrySource();
+
+	model.occluderPositions.clear();
+	model.occluderIndices.clear();
+
+	//static shadows cached with the model's meshes are redrawn
+	staticBatchVersion++;
+}
+
+void SceneManager::DestroySceneNodes(SceneNode* node)
+{
+	if (node == nullptr)
+	{
+		return;
+	}
+
+	for (SceneNode* child : node->children)
+	{
+		DestroySceneNodes(child);
+	}
+
+	delete node;
 }
 
 void SceneManager::LoadAnimationToModel(const std::string& path, const std::string& modelName, const std::string& animName)
 {
+	if (ModelCooker::Get().LoadCookedAnimations(path, models[modelName], animName))
+	{
+		return;
+	}
+
 	AssetImporter::Get().LoadAnimatonToModel(path.c_str(), models[modelName], animName);
 }
 
@@ -335,122 +505,397 @@ glm::quat SceneManager::GetAnimationRotation(std::vector<RotationKey>& keys, dou
 
 }
 
-void SceneManager::UpdateEntityInstances(EntityInstance* entityInstanceBuffer, std::map<std::string, std::vector<EntityInstance>>& modelInstanceMap)
+//coarsest LOD whose threshold the projected size is below, moving away from the current LOD needs the hysteresis margin
+static uint32_t SelectLOD(const Model& model, const glm::mat4& modelMatrix, const LODView& lodView, uint32_t currentLOD)
 {
-	entt::basic_view view = registry.view<ModelComponent, TransformComponent>();
+	if (model.lodCount == 1)
+	{
+		return 0;
+	}
 
-	//entities that are attached to a socket
-	std::vector<entt::entity> socketEntities;
+	glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(model.boundsCenter, 1.0f));
 
-	for (entt::entity entity : view) {
-		//check if entity has a socket component
+	float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
 
-		if (registry.all_of<MeshSocketComponent>(entity))
-		{
-			socketEntities.push_back(entity);
-			continue;
-		}
+	float radius = model.boundsRadius * scale;
 
-		ModelComponent& modelComp = view.get<ModelComponent>(entity);
-		const TransformComponent& transformComp = view.get<TransformComponent>(entity);
+	float distance = glm::length(center - lodView.position);
+
+	//the camera is inside the bounds
+	if (distance <= radius)
+	{
+		return 0;
+	}
+
+	float screenSize = radius * lodView.projectionScale / distance;
+
+	uint32_t lod = std::min(currentLOD, model.lodCount - 1);
+
+	while (lod > 0 && screenSize > LOD_SCREEN_SIZES[lod - 1] * (1.0f + LOD_HYSTERESIS))
+	{
+		lod--;
+	}
+
+	while (lod + 1 < model.lodCount && screenSize < LOD_SCREEN_SIZES[lod] * (1.0f - LOD_HYSTERESIS))
+	{
+		lod++;
+	}
 
-		glm::mat4 model = glm::mat4(1.0f);
+	return lod;
+}
 
-		model = glm::translate(model, transformComp.position);
-		model = glm::rotate(model, glm::radians(transformComp.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(transformComp.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(transformComp.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		model = glm::scale(model, transformComp.scale);
+//the shadows of hidden instances past the draw distance fall outside the cascades, which end there too
+static bool BeyondDrawDistance(const Model& model, const glm::mat4& modelMatrix, const LODView& lodView)
+{
+	glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(model.boundsCenter, 1.0f));
 
-		model = glm::translate(model, modelComp.localPosition);
-		model = glm::rotate(model, glm::radians(modelComp.localRotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(modelComp.localRotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(modelComp.localRotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		model = glm::scale(model, modelComp.localScale);
+	float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
 
-		modelComp.modelMatrix = model;
+	return glm::length(center - lodView.position) - model.boundsRadius * scale > lodView.drawDistance;
+}
 
-		EntityInstance data{};
-		data.model = model;
-		data.boneTransformBufferIndex = modelComp.boneTransformBufferIndex;
+//the normal matrix is computed once per instance instead of per vertex
+static EntityInstance MakeEntityInstance(const glm::mat4& model, int boneTransformBufferIndex)
+{
+	EntityInstance instance;
+
+	glm::mat4 rows = glm::transpose(model);
 
-		modelInstanceMap[modelComp.modelName].push_back(data);
+	for (int i = 0; i < 3; i++)
+	{
+		instance.modelRows[i] = rows[i];
 	}
 
-	for (entt::entity entity : socketEntities)
+	//cofactors are the inverse transpose times the determinant, the sign keeps mirrored instances facing out
+	glm::vec3 x = glm::vec3(model[0]);
+	glm::vec3 y = glm::vec3(model[1]);
+	glm::vec3 z = glm::vec3(model[2]);
+
+	glm::mat3 normalMatrix(glm::cross(y, z), glm::cross(z, x), glm::cross(x, y));
+
+	float largest = 0.0f;
+
+	for (int column = 0; column < 3; column++)
 	{
-		const MeshSocketComponent& socketComp = registry.get<MeshSocketComponent>(entity);
+		for (int row = 0; row < 3; row++)
+		{
+			largest = std::max(largest, std::abs(normalMatrix[column][row]));
+		}
+	}
 
-		const TransformComponent& transformComp = registry.get<TransformComponent>(entity);
+	float scale = largest > 0.0f ? (glm::dot(x, glm::cross(y, z)) < 0.0f ? -1.0f : 1.0f) / largest : 0.0f;
 
-		const ModelComponent& modelComp = registry.get<ModelComponent>(entity);
+	float values[10] = {};
 
-		const ModelComponent& parentModelComp = registry.get<ModelComponent>(entityMap[socketComp.parentEntityName]);
+	for (int i = 0; i < 9; i++)
+	{
+		values[i] = normalMatrix[i / 3][i % 3] * scale;
+	}
 
-		Model& parentModel = models[parentModelComp.modelName];
+	for (int i = 0; i < 5; i++)
+	{
+		instance.normalMatrix[i] = glm::packSnorm2x16(glm::vec2(values[i * 2], values[i * 2 + 1]));
+	}
+
+	instance.boneTransformBufferIndex = boneTransformBufferIndex;
+	instance.flags = boneTransformBufferIndex != -1 ? ENTITY_INSTANCE_SKINNED : 0;
+
+	return instance;
+}
+
+void SceneManager::UpdateEntityInstances(EntityInstance* entityInstanceBuffer, uint32_t capacity, const LODView& lodView, const glm::mat4* occlusionViewProjection)
+{
+	UTRACE_FUNCTION();
+
+	if (occlusionViewProjection)
+	{
+		OcclusionCuller::Get().BeginFrame(*occlusionViewProjection);
 
-		SceneNode* node = parentModel.sceneRoot;
+		//occluders are static, so last frame's matrices are this frame's and a new occluder starts hiding a frame late
+		std::vector<RenderBatch>& staticBatches = renderBatches[static_cast<size_t>(RenderBatchCategory::Static)];
 
-		if (parentModel.nodeMap.find(socketComp.nodeName) != parentModel.nodeMap.end())
+		for (uint32_t modelID = 0; modelID < staticBatches.size(); modelID++)
 		{
-			node = parentModel.nodeMap[socketComp.nodeName];
+			if (modelTable[modelID]->occluderIndices.empty())
+			{
+				continue;
+			}
+
+			for (entt::entity entity : staticBatches[modelID].entities)
+			{
+				OcclusionCuller::Get().RenderOccluder(*modelTable[modelID], registry.get<ModelComponent>(entity).modelMatrix);
+			}
 		}
-		else
+	}
+
+	uint32_t instanceIndex = 0;
+
+	for (std::vector<RenderBatch>& batches : renderBatches)
+	{
+		for (uint32_t modelID = 0; modelID < batches.size(); modelID++)
 		{
-			std::cout << "Node not found: " << socketComp.nodeName << std::endl;
-			continue;
-		}
+			RenderBatch& batch = batches[modelID];
+
+			if (instanceIndex + batch.entities.size() > capacity)
+			{
+				throw std::runtime_error("Entity instance buffer is too small!");
+			}
+
+			batch.firstInstance = instanceIndex;
+
+			batchInstances.clear();
+
+			batchRanges.clear();
+
+			for (entt::entity entity : batch.entities)
+			{
+				ModelComponent& modelComp = registry.get<ModelComponent>(entity);
+				const TransformComponent& transformComp = registry.get<TransformComponent>(entity);
+
+				glm::mat4 model = glm::mat4(1.0f);
+
+				MeshSocketComponent* socketComp = registry.try_get<MeshSocketComponent>(entity);
+
+				//socket batches come last, so the parent's matrix is already this frame's
+				if (socketComp)
+				{
+					if (socketComp->parentEntity == entt::null)
+					{
+						auto it = entityMap.find(socketComp->parentEntityName);
+
+						if (it != entityMap.end())
+						{
+							socketComp->parentEntity = it->second;
+						}
+					}
+
+					const ModelComponent* parentModelComp = socketComp->parentEntity != entt::null ? registry.try_get<ModelComponent>(socketComp->parentEntity) : nullptr;
+
+					if (parentModelComp && !socketComp->node && parentModelComp->modelID < modelTable.size())
+					{
+						Model& parentModel = *modelTable[parentModelComp->modelID];
+
+						auto it = parentModel.nodeMap.find(socketComp->nodeName);
+
+						if (it != parentModel.nodeMap.end())
+						{
+							socketComp->node = it->second;
+						}
+						else
+						{
+							std::cout << "Node not found: " << socketComp->nodeName << std::endl;
+						}
+					}
+
+					//unresolved sockets collapse to a point instead of leaving a hole in the batch
+					if (!parentModelComp || !socketComp->node)
+					{
+						batchInstances.push_back(MakeEntityInstance(glm::mat4(0.0f), modelComp.boneTransformBufferIndex));
+						batchRanges.push_back(0);
+						continue;
+					}
+
+					model = parentModelComp->modelMatrix * socketComp->node->globalTransform;
+
+					model = glm::translate(model, socketComp->position);
+					model = glm::rotate(model, glm::radians(socketComp->rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+					model = glm::rotate(model, glm::radians(socketComp->rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+					model = glm::rotate(model, glm::radians(socketComp->rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+					model = glm::scale(model, socketComp->scale);
+				}
+
+				model = glm::translate(model, transformComp.position);
+				model = glm::rotate(model, glm::radians(transformComp.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+				model = glm::rotate(model, glm::radians(transformComp.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+				model = glm::rotate(model, glm::radians(transformComp.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+				model = glm::scale(model, transformComp.scale);
+
+				model = glm::translate(model, modelComp.localPosition);
+				model = glm::rotate(model, glm::radians(modelComp.localRotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+				model = glm::rotate(model, glm::radians(modelComp.localRotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+				model = glm::rotate(model, glm::radians(modelComp.localRotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+				model = glm::scale(model, modelComp.localScale);
+
+				if (socketComp)
+				{
+					//set scale as 1
+					const ModelComponent& parentModelComp = registry.get<ModelComponent>(socketComp->parentEntity);
 
-		glm::mat4 model = parentModelComp.modelMatrix * node->globalTransform;
+					model = glm::scale(model, glm::vec3(1 / parentModelComp.localScale.x, 1 / parentModelComp.localScale.y, 1 / parentModelComp.localScale.z));
+				}
+				else
+				{
+					modelComp.modelMatrix = model;
+				}
 
-		model = glm::translate(model, socketComp.position);
-		model = glm::rotate(model, glm::radians(socketComp.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(socketComp.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(socketComp.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		model = glm::scale(model, socketComp.scale);
+				const Model& modelAsset = *modelTable[modelID];
 
-		model = glm::translate(model, transformComp.position);
-		model = glm::rotate(model, glm::radians(transformComp.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(transformComp.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(transformComp.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		model = glm::scale(model, transformComp.scale);
+				modelComp.lod = SelectLOD(modelAsset, model, lodView, modelComp.lod);
 
-		model = glm::translate(model, modelComp.localPosition);
-		model = glm::rotate(model, glm::radians(modelComp.localRotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(modelComp.localRotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(modelComp.localRotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		model = glm::scale(model, modelComp.localScale);
+				//skinned instances leave the bind pose box, they are never hidden
+				bool bOccluded = occlusionViewProjection && modelComp.boneTransformBufferIndex == -1 &&
+					!OcclusionCuller::Get().IsVisible(modelAsset.boundsMin, modelAsset.boundsMax, model);
 
-		//set scale as 1
+				bOccluded = bOccluded || BeyondDrawDistance(modelAsset, model, lodView);
+
+				batchInstances.push_back(MakeEntityInstance(model, modelComp.boneTransformBufferIndex));
+				batchRanges.push_back(modelComp.lod + (bOccluded ? MAX_MESH_LODS : 0));
+			}
+
+			//counting sort by occlusion then LOD, each LOD of the batch is one contiguous instance range
+			std::array<uint32_t, MAX_MESH_LODS * 2> rangeCounts{};
+
+			for (uint32_t range : batchRanges)
+			{
+				rangeCounts[range]++;
+			}
 
-		model = glm::scale(model, glm::vec3(1 / parentModelComp.localScale.x, 1 / parentModelComp.localScale.y, 1 / parentModelComp.localScale.z));
+			std::copy(rangeCounts.begin(), rangeCounts.begin() + MAX_MESH_LODS, batch.lodInstanceCounts.begin());
+			std::copy(rangeCounts.begin() + MAX_MESH_LODS, rangeCounts.end(), batch.occludedLODInstanceCounts.begin());
 
-		EntityInstance data{};
-		data.model = model;
-		data.boneTransformBufferIndex = modelComp.boneTransformBufferIndex;
+			std::array<uint32_t, MAX_MESH_LODS * 2> rangeOffsets;
 
-		modelInstanceMap[modelComp.modelName].push_back(data);
+			uint32_t offset = batch.firstInstance;
+
+			for (uint32_t range = 0; range < rangeOffsets.size(); range++)
+			{
+				rangeOffsets[range] = offset;
+				offset += rangeCounts[range];
+			}
+
+			for (size_t i = 0; i < batchInstances.size(); i++)
+			{
+				entityInstanceBuffer[rangeOffsets[batchRanges[i]]++] = batchInstances[i];
+			}
+
+			instanceIndex += static_cast<uint32_t>(batchInstances.size());
+		}
 	}
+}
 
-	uint32_t instanceIndex = 0;
+uint32_t SceneManager::GetInstanceCount() const
+{
+	size_t instanceCount = 0;
 
-	for (const auto& pair : modelInstanceMap)
+	for (const std::vector<RenderBatch>& batches : renderBatches)
 	{
-		if (pair.second.size() == 0)
+		for (const RenderBatch& batch : batches)
 		{
-			continue;
+			instanceCount += batch.entities.size();
 		}
+	}
+
+	return static_cast<uint32_t>(instanceCount);
+}
+
+uint32_t SceneManager::GetAnimatedEntityCount()
+{
+	//a multi component view only knows an upper bound of its size
+	entt::basic_view view = registry.view<ModelComponent, AnimationComponent>();
+
+	return static_cast<uint32_t>(std::distance(view.begin(), view.end()));
+}
+
+//destroy signals fire while the component is still attached
+template<typename Component>
+static bool HasRenderBatchComponent(entt::registry& registry, entt::entity entity, entt::id_type removedComponent)
+{
+	return registry.all_of<Component>(entity) && removedComponent != entt::type_hash<Component>::value();
+}
+
+void SceneManager::UpdateRenderBatch(entt::entity entity, entt::id_type removedComponent)
+{
+	bool bBatched = HasRenderBatchComponent<ModelComponent>(registry, entity, removedComponent) && HasRenderBatchComponent<TransformComponent>(registry, entity, removedComponent);
 
-		for (size_t i = 0; i < pair.second.size(); i++)
+	uint32_t modelID = ~0u;
+
+	if (bBatched)
+	{
+		ModelComponent& modelComp = registry.get<ModelComponent>(entity);
+
+		auto it = modelIDs.find(modelComp.modelName);
+
+		if (it != modelIDs.end())
 		{
-			entityInstanceBuffer[instanceIndex] = pair.second[i];
-			instanceIndex++;
+			modelID = it->second;
 		}
+		else
+		{
+			std::cout << "Model not found: " << modelComp.modelName << std::endl;
+			bBatched = false;
+		}
+
+		modelComp.modelID = modelID;
+	}
+
+	RenderBatchCategory category = RenderBatchCategory::Dynamic;
+
+	//sockets take precedence so their parent is transformed first, animated ones still skin in their own socket category
+	if (HasRenderBatchComponent<MeshSocketComponent>(registry, entity, removedComponent))
+	{
+		category = HasRenderBatchComponent<AnimationComponent>(registry, entity, removedComponent) ? RenderBatchCategory::SkinnedSocket : RenderBatchCategory::Socket;
+	}
+	else if (HasRenderBatchComponent<AnimationComponent>(registry, entity, removedComponent))
+	{
+		category = RenderBatchCategory::Skinned;
+	}
+	else if (HasRenderBatchComponent<StaticComponent>(registry, entity, removedComponent))
+	{
+		category = RenderBatchCategory::Static;
+	}
+
+	if (RenderBatchComponent* batchComp = registry.try_get<RenderBatchComponent>(entity))
+	{
+		if (bBatched && batchComp->category == category && batchComp->modelID == modelID)
+		{
+			return;
+		}
+
+		registry.remove<RenderBatchComponent>(entity);
+	}
+
+	if (!bBatched)
+	{
+		return;
+	}
+
+	RenderBatch& batch = renderBatches[static_cast<size_t>(category)][modelID];
+
+	registry.emplace<RenderBatchComponent>(entity, RenderBatchComponent{ category, modelID, static_cast<uint32_t>(batch.entities.size()) });
+
+	batch.entities.push_back(entity);
+
+	if (category == RenderBatchCategory::Static)
+	{
+		staticBatchVersion++;
+	}
+}
+
+void SceneManager::OnRenderBatchDestroyed(entt::registry& registry, entt::entity entity)
+{
+	const RenderBatchComponent& batchComp = registry.get<RenderBatchComponent>(entity);
+
+	std::vector<entt::entity>& entities = renderBatches[static_cast<size_t>(batchComp.category)][batchComp.modelID].entities;
+
+	//swap with the last entity of the batch, instance order inside a batch does not matter
+	entt::entity last = entities.back();
+
+	entities[batchComp.index] = last;
+
+	registry.get<RenderBatchComponent>(last).index = batchComp.index;
+
+	entities.pop_back();
+
+	if (batchComp.category == RenderBatchCategory::Static)
+	{
+		staticBatchVersion++;
 	}
 }
 
 void SceneManager::UpdatePhysicsActors(float deltaTime)
 {
+	UTRACE_FUNCTION();
+
 	entt::basic_view view = registry.view<TransformComponent, RigidBodyComponent>();
 
 	for (entt::entity entity : view)
@@ -574,8 +1019,12 @@ void SceneManager::UpdatePhysicsActors(float deltaTime)
 	}
 }
 
-void SceneManager::UpdateAnimationSystem(BoneTransformData* boneTransforms, float deltaTime)
+void SceneManager::UpdateAnimationSystem(BoneTransformData* boneTransforms, uint32_t capacity, float deltaTime, const glm::vec3& viewPosition)
 {
+	UTRACE_FUNCTION();
+
+	animationFrame++;
+
 	int boneTransformBufferIndex = 0;
 	entt::basic_view view = registry.view<ModelComponent, AnimationComponent>();
 	for (entt::entity entity : view)
@@ -584,12 +1033,45 @@ void SceneManager::UpdateAnimationSystem(BoneTransformData* boneTransforms, floa
 		AnimationComponent& animComp = view.get<AnimationComponent>(entity);
 		Model& model = SceneManager::Get().models[modelComp.modelName];
 
-		// Process animation controller
-		ProcessAnimationController(model, animComp, deltaTime);
+		if (static_cast<uint32_t>(boneTransformBufferIndex) >= capacity)
+		{
+			throw std::runtime_error("Bone transform buffer is too small!");
+		}
 
-		// Update bone transforms
 		modelComp.boneTransformBufferIndex = boneTransformBufferIndex;
-		UpdateAnimationsWithBlending(model, animComp, boneTransforms[boneTransformBufferIndex], deltaTime);
+
+		size_t boneCount = std::min<size_t>(model.boneMap.size(), MAX_BONES);
+
+		animComp.pendingDeltaTime += deltaTime;
+
+		//last frame's matrix, the entity moved at most one frame since
+		float distance = glm::length(glm::vec3(modelComp.modelMatrix[3]) - viewPosition);
+
+		uint32_t interval = 1;
+
+		for (float lodDistance : ANIMATION_LOD_DISTANCES)
+		{
+			if (distance > lodDistance * animationLODDistanceScale)
+			{
+				interval *= 2;
+			}
+		}
+
+		//entities are offset by their index so the reduced rate evaluations do not land on the same frame
+		if (animComp.lastPose.size() != boneCount || (animationFrame + boneTransformBufferIndex) % interval == 0)
+		{
+			// Process animation controller
+			ProcessAnimationController(model, animComp, animComp.pendingDeltaTime);
+
+			// Update bone transforms
+			UpdateAnimationsWithBlending(model, animComp, animationScratch, animComp.pendingDeltaTime);
+
+			animComp.pendingDeltaTime = 0;
+
+			animComp.lastPose.assign(animationScratch.boneTransforms, animationScratch.boneTransforms + boneCount);
+		}
+
+		std::copy(animComp.lastPose.begin(), animComp.lastPose.end(), boneTransforms[boneTransformBufferIndex].boneTransforms);
 
 		boneTransformBufferIndex++;
 	}
@@ -597,6 +1079,8 @@ void SceneManager::UpdateAnimationSystem(BoneTransformData* boneTransforms, floa
 
 void SceneManager::UpdateCameraSystem(float deltaTime, std::vector<Camera*>& cameras)
 {
+	UTRACE_FUNCTION();
+
 	entt::basic_view view = registry.view<CameraComponent>();
 	for (entt::entity entity : view)
 	{
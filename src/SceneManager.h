@@ -6,8 +6,19 @@
 
 #include "Physics.h"
 
+#include <array>
+
 const int MAX_BONES = 200;
 
+//projected bounding sphere radius, as a fraction of half the screen height, below which LOD i + 1 is drawn
+const float LOD_SCREEN_SIZES[MAX_MESH_LODS - 1] = { 0.25f, 0.125f, 0.0625f };
+
+//a LOD is only left once the screen size is this far past its threshold, so instances near one do not flicker
+const float LOD_HYSTERESIS = 0.15f;
+
+//distances past which a skinned mesh evaluates its animation every 2nd, 4th and 8th frame, scaled by animationLODDistanceScale
+const float ANIMATION_LOD_DISTANCES[] = { 25.0f, 50.0f, 100.0f };
+
 struct MeshSocketComponent
 {
 	//name of the entity that owns the node that this socket is attached to
@@ -19,6 +30,10 @@ struct MeshSocketComponent
 	glm::vec3 position;
 	glm::vec3 rotation;
 	glm::vec3 scale;
+
+	//resolved from the names on first use
+	entt::entity parentEntity = entt::null;
+	SceneNode* node = nullptr;
 };
 
 struct TransformComponent
@@ -31,11 +46,16 @@ struct TransformComponent
 struct ModelComponent
 {
 	std::string modelName;
+	//index into SceneManager::modelTable, resolved from modelName whenever the component is added or replaced
+	uint32_t modelID = ~0u;
+	//LOD drawn last frame, the hysteresis is relative to it
+	uint32_t lod = 0;
 	int boneTransformBufferIndex = -1;
 	glm::vec3 localPosition;
 	glm::vec3 localRotation;
 	glm::vec3 localScale;
-	glm::mat4 modelMatrix;
+	//zero until the first UpdateEntityInstances, an occluder with it rasterises nothing
+	glm::mat4 modelMatrix = glm::mat4(0.0f);
 };
 
 struct AnimationInstance
@@ -110,6 +130,12 @@ struct AnimationComponent
 	uint16_t currentAnimationIndex = 0;
 
 	float currentAnimationTime = 0;
+
+	//time of the frames the animation LOD skipped, applied by the next evaluation
+	float pendingDeltaTime = 0;
+
+	//bones of the last evaluation, written again on skipped frames
+	std::vector<glm::mat4> lastPose;
 };
 
 struct RigidBodyComponent
@@ -117,6 +143,11 @@ struct RigidBodyComponent
 	PxRigidActor* actor;
 };
 
+//entities that never move, their shadows are cached
+struct StaticComponent
+{
+};
+
 struct CharacterControllerComponent
 {
 	PxController* controller;
@@ -130,11 +161,65 @@ struct CharacterControllerComponent
 	float terminalVelocity = 20.0f;
 };
 
+//static batches come first in the instance buffer, socket batches last so their parents are transformed before them
+//skinned batches draw with the skinning pipeline variants, the others with the static one
+enum class RenderBatchCategory : uint8_t
+{
+	Static,
+	Dynamic,
+	Skinned,
+	Socket,
+	SkinnedSocket,
+	Count
+};
+
+inline bool IsSkinnedRenderBatch(RenderBatchCategory category)
+{
+	return category == RenderBatchCategory::Skinned || category == RenderBatchCategory::SkinnedSocket;
+}
+
+//entities drawing the same model in the same category, their instances are contiguous in the instance buffer
+struct RenderBatch
+{
+	std::vector<entt::entity> entities;
+	//assigned every frame by UpdateEntityInstances, instances are sorted by LOD within the batch
+	uint32_t firstInstance = 0;
+	std::array<uint32_t, MAX_MESH_LODS> lodInstanceCounts{};
+	//instances the software occlusion test or the draw distance hid follow the visible ones, sorted by LOD the same way, they only cast shadows
+	std::array<uint32_t, MAX_MESH_LODS> occludedLODInstanceCounts{};
+};
+
+//where an entity sits in the render batches, removing it takes the entity out of its batch
+struct RenderBatchComponent
+{
+	RenderBatchCategory category;
+	uint32_t modelID;
+	uint32_t index;
+};
+
+//EntityInstance::flags
+const uint32_t ENTITY_INSTANCE_SKINNED = 1u << 0;
+
+//80 bytes, mirrored by every shader reading the instance buffer
 struct EntityInstance
 {
-	glm::mat4 model;
+	//rows of the affine model matrix, the fourth row is always 0 0 0 1
+	glm::vec4 modelRows[3];
+	//inverse transpose of the model matrix's 3x3 part as column major snorm16 pairs, scaled to fit since shaders renormalise
+	uint32_t normalMatrix[5];
 	int boneTransformBufferIndex = -1;
-	int padding[3];
+	uint32_t flags = 0;
+	uint32_t padding = 0;
+};
+
+//camera the instance LODs are picked for
+struct LODView
+{
+	glm::vec3 position;
+	//cot(fovY / 2), turns radius / distance into a fraction of half the screen height
+	float projectionScale;
+	//instances whose bounds are entirely farther away are hidden like occluded ones
+	float drawDistance;
 };
 
 struct BoneTransformData
@@ -157,13 +242,28 @@ public:
 	entt::registry registry;
 
 
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
 	std::vector<std::string> texturePaths;
 
+	//geometry arena allocations of unloaded models, the renderer frees them once the frames in flight are done
+	std::vector<GeometryHandle> releasedGeometry;
+
 	//map of model name to model
 	std::unordered_map<std::string, Model> models;
 
+	//model handles, ids index this table and the render batches
+	std::vector<Model*> modelTable;
+
+	std::unordered_map<std::string, uint32_t> modelIDs;
+
+	//per category, indexed by model id, kept up to date by registry signals instead of being rebuilt every frame
+	std::array<std::vector<RenderBatch>, static_cast<size_t>(RenderBatchCategory::Count)> renderBatches;
+
+	//bumped whenever an entity joins or leaves a static batch, cached static shadows are redrawn when it changes
+	uint32_t staticBatchVersion = 0;
+
+	//scales ANIMATION_LOD_DISTANCES, lowered by the scalability governor
+	float animationLODDistanceScale = 1.0f;
+
 	//entity name to entity map
 	std::unordered_map<std::string, entt::entity> entityMap;
 
@@ -173,9 +273,17 @@ public:
 		return instance;
 	}
 
+	SceneManager();
+
 	void LoadScene(const std::string& path);
 
-	void LoadModelFromFile(const std::string& path, const std::string& modelName, bool customMaterialTextures);
+	//occluder models also get a simplified mesh for the software occlusion culler
+	//can be called at runtime, the renderer streams the geometry in and draws the model once it arrived
+	//loading a model that is already loaded replaces its meshes
+	void LoadModelFromFile(const std::string& path, const std::string& modelName, bool customMaterialTextures, bool occluder = false);
+
+	//releases the meshes and their GPU geometry, the model id, skeleton and animations stay so entities using it simply draw nothing
+	void UnloadModel(const std::string& modelName);
 
 	void LoadAnimationToModel(const std::string& path, const std::string& modelName, const std::string& animName);
 
@@ -187,11 +295,23 @@ public:
 
 	glm::quat GetAnimationRotation(std::vector<RotationKey>& keys, double currentTime);
 
-	void UpdateEntityInstances(EntityInstance* entityInstanceBuffer, std::map<std::string, std::vector<EntityInstance>>& modelInstanceMap);
+	//walks the render batches in category order, every instance is written once at its batch offset
+	//picks the LOD of every instance from its projected size and groups the batch by LOD
+	//with an occlusionViewProjection, static occluders are rasterised first and instances behind them are moved past the visible ones
+	//throws when more than capacity instances would be written
+	void UpdateEntityInstances(EntityInstance* entityInstanceBuffer, uint32_t capacity, const LODView& lodView, const glm::mat4* occlusionViewProjection = nullptr);
+
+	//instances UpdateEntityInstances writes, one per batched entity
+	uint32_t GetInstanceCount() const;
+
+	//entities UpdateAnimationSystem writes bone transforms for
+	uint32_t GetAnimatedEntityCount();
 
 	void UpdatePhysicsActors(float deltaTime);
 
-	void UpdateAnimationSystem(BoneTransformData* boneTransforms, float deltaTime);
+	//skinned meshes far from viewPosition reuse their last pose on some frames
+	//throws when more than capacity entities are animated
+	void UpdateAnimationSystem(BoneTransformData* boneTransforms, uint32_t capacity, float deltaTime, const glm::vec3& viewPosition);
 
 	void UpdateCameraSystem(float deltaTime, std::vector<class Camera*> &cameras);
 
@@ -204,4 +324,42 @@ public:
 	void SetAnimationParameter(entt::entity entity, const std::string& paramName, float value);
 
 	void PlayAnimationMontage(entt::entity entity, const std::string& montageName);
+
+private:
+	//instances of the batch being written and their instance ranges, the LOD plus MAX_MESH_LODS when occluded or past the draw distance
+	//reused from batch to batch
+	std::vector<EntityInstance> batchInstances;
+
+	std::vector<uint32_t> batchRanges;
+
+	//poses are evaluated here instead of in the mapped staging buffer, which is slow to read back
+	BoneTransformData animationScratch;
+
+	//frames since the start, spreads the reduced rate evaluations of the animation LOD
+	uint32_t animationFrame = 0;
+
+	//moves the entity to the batch its components ask for, removedComponent is being destroyed and no longer counts
+	void UpdateRenderBatch(entt::entity entity, entt::id_type removedComponent);
+
+	template<typename Component>
+	void OnRenderBatchComponentChanged(entt::registry& registry, entt::entity entity)
+	{
+		UpdateRenderBatch(entity, 0);
+	}
+
+	template<typename Component>
+	void OnRenderBatchComponentDestroyed(entt::registry& registry, entt::entity entity)
+	{
+		UpdateRenderBatch(entity, entt::type_hash<Component>::value());
+	}
+
+	void OnRenderBatchDestroyed(entt::registry& registry, entt::entity entity);
+
+	//reads the cooked model when it is up to date, imports the source and builds the meshlets otherwise
+	void ImportModel(const std::string& path, Model& model);
+
+	//hands the geometry arena allocation to the renderer and drops the meshes and their CPU geometry
+	void ReleaseModelGeometry(Model& model);
+
+	static void DestroySceneNodes(SceneNode* node);
 };
@@ -2,9 +2,14 @@
 
 #include "CommonTypes.h"
 
+#include "GeometryArena.h"
+
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <memory>
+
+class MappedFile;
 
 struct PositionKey
 {
@@ -63,6 +68,18 @@ struct Bone
 	glm::mat4 offsetMatrix;
 };
 
+//geometry of a model waiting to be copied into the geometry arena
+struct GeometrySource
+{
+	const Vertex* vertices = nullptr;
+	const uint32_t* indices = nullptr;
+	const Meshlet* meshlets = nullptr;
+
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0;
+	uint32_t meshletCount = 0;
+};
+
 struct Model
 {
 	std::string name;
@@ -78,7 +95,46 @@ struct Model
 	//node name to node map
 	std::unordered_map<std::string, SceneNode*> nodeMap;
 
-	SceneNode* sceneRoot;
+	SceneNode* sceneRoot = nullptr;
+
+	//bind pose bounding sphere in model space
+	glm::vec3 boundsCenter = glm::vec3(0.0f);
+	float boundsRadius = 0.0f;
+
+	//bind pose bounding box in model space, projected by the software occlusion test
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+
+	//position only triangle list rasterised by the software occlusion culler, empty unless the scene marks the model as an occluder
+	std::vector<glm::vec3> occluderPositions;
+	std::vector<uint32_t> occluderIndices;
+
+	//most LODs of any of the meshes
+	uint32_t lodCount = 1;
 
 	bool customMaterialTextures = false;
+
+	//geometry of the model alone, mesh index and meshlet ranges and the indices themselves count from the start of these
+	//kept until the renderer copied it into the geometry arena
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<Meshlet> meshlets;
+
+	//cooked file the geometry is read from in place of the vectors, unmapped once the renderer copied it
+	std::shared_ptr<MappedFile> mappedFile;
+	GeometrySource mappedGeometry;
+
+	//ranges in the geometry arena, INVALID_GEOMETRY_HANDLE until the renderer allocated them
+	GeometryHandle geometry = INVALID_GEOMETRY_HANDLE;
+
+	GeometrySource GetPendingGeometry() const
+	{
+		if (mappedFile)
+		{
+			return mappedGeometry;
+		}
+
+		return { vertices.data(), indices.data(), meshlets.data(),
+			static_cast<uint32_t>(vertices.size()), static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(meshlets.size()) };
+	}
 };
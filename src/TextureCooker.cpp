@@ -0,0 +1,719 @@
+#include "TextureCooker.h"
+
+#include "AssetImporter.h"
+
+#include "SceneTypes.h"
+
+#include "stb_image.h"
+
+#include "json.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cfloat>
+
+using json = nlohmann::json;
+
+namespace
+{
+	const char COOKED_TEXTURE_MAGIC[4] = { 'U', 'T', 'E', 'X' };
+
+	//BC7 4 bit index interpolation weights
+	const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	float SRGBToLinear(float c)
+	{
+		return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float LinearToSRGB(float c)
+	{
+		return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+	}
+
+	uint8_t ToByte(float v)
+	{
+		return static_cast<uint8_t>(std::clamp(std::lround(v), 0l, 255l));
+	}
+
+	//copies a 4x4 block, clamping at the texture edge for sizes that are not a multiple of 4
+	void ExtractBlock(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, uint8_t block[16][4])
+	{
+		for (uint32_t y = 0; y < 4; y++)
+		{
+			for (uint32_t x = 0; x < 4; x++)
+			{
+				uint32_t sx = std::min(blockX * 4 + x, width - 1);
+				uint32_t sy = std::min(blockY * 4 + y, height - 1);
+
+				memcpy(block[y * 4 + x], pixels + (sy * width + sx) * 4, 4);
+			}
+		}
+	}
+
+	//principal axis of the point set, found by power iteration on the covariance matrix
+	template<typename V>
+	V PrincipalAxis(const V* points, int count, const V& mean)
+	{
+		constexpr int N = sizeof(V) / sizeof(float);
+
+		float covariance[N][N] = {};
+
+		for (int i = 0; i < count; i++)
+		{
+			V d = points[i] - mean;
+
+			for (int r = 0; r < N; r++)
+				for (int c = 0; c < N; c++)
+					covariance[r][c] += d[r] * d[c];
+		}
+
+		V axis(1.0f);
+
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			V next(0.0f);
+
+			for (int r = 0; r < N; r++)
+				for (int c = 0; c < N; c++)
+					next[r] += covariance[r][c] * axis[c];
+
+			float length = glm::length(next);
+
+			if (length < 1e-6f)
+			{
+				return V(0.0f);
+			}
+
+			axis = next / length;
+		}
+
+		return axis;
+	}
+
+	//endpoints of the block along its principal axis
+	template<typename V>
+	void FitEndpoints(const V* points, int count, V& minPoint, V& maxPoint)
+	{
+		V mean(0.0f);
+
+		for (int i = 0; i < count; i++)
+			mean += points[i];
+
+		mean /= static_cast<float>(count);
+
+		V axis = PrincipalAxis(points, count, mean);
+
+		float minT = 0.0f;
+		float maxT = 0.0f;
+
+		for (int i = 0; i < count; i++)
+		{
+			float t = glm::dot(points[i] - mean, axis);
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+
+		minPoint = glm::clamp(mean + axis * minT, V(0.0f), V(255.0f));
+		maxPoint = glm::clamp(mean + axis * maxT, V(0.0f), V(255.0f));
+	}
+
+	uint16_t PackRGB565(const glm::vec3& color)
+	{
+		uint16_t r = static_cast<uint16_t>(std::lround(color.r * 31.0f / 255.0f));
+		uint16_t g = static_cast<uint16_t>(std::lround(color.g * 63.0f / 255.0f));
+		uint16_t b = static_cast<uint16_t>(std::lround(color.b * 31.0f / 255.0f));
+
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	glm::vec3 UnpackRGB565(uint16_t value)
+	{
+		uint32_t r = (value >> 11) & 31;
+		uint32_t g = (value >> 5) & 63;
+		uint32_t b = value & 31;
+
+		return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+	}
+
+	//BC1 colour block, always in 4 colour mode so it can also be used as the colour half of BC3
+	void EncodeColorBlock(const uint8_t block[16][4], uint8_t* out)
+	{
+		glm::vec3 colors[16];
+
+		for (int i = 0; i < 16; i++)
+			colors[i] = glm::vec3(block[i][0], block[i][1], block[i][2]);
+
+		glm::vec3 minColor, maxColor;
+		FitEndpoints(colors, 16, minColor, maxColor);
+
+		uint16_t color0 = PackRGB565(maxColor);
+		uint16_t color1 = PackRGB565(minColor);
+
+		if (color0 < color1)
+			std::swap(color0, color1);
+
+		uint32_t indices = 0;
+
+		if (color0 != color1)
+		{
+			glm::vec3 palette[4];
+			palette[0] = UnpackRGB565(color0);
+			palette[1] = UnpackRGB565(color1);
+			palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+			palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+			for (int i = 0; i < 16; i++)
+			{
+				uint32_t best = 0;
+				float bestError = FLT_MAX;
+
+				for (uint32_t p = 0; p < 4; p++)
+				{
+					glm::vec3 d = colors[i] - palette[p];
+					float error = glm::dot(d, d);
+
+					if (error < bestError)
+					{
+						bestError = error;
+						best = p;
+					}
+				}
+
+				indices |= best << (2 * i);
+			}
+		}
+
+		out[0] = color0 & 0xFF;
+		out[1] = color0 >> 8;
+		out[2] = color1 & 0xFF;
+		out[3] = color1 >> 8;
+		memcpy(out + 4, &indices, 4);
+	}
+
+	//BC4 single channel block, used for BC3 alpha and both BC5 channels
+	void EncodeChannelBlock(const uint8_t values[16], uint8_t* out)
+	{
+		uint8_t maxValue = *std::max_element(values, values + 16);
+		uint8_t minValue = *std::min_element(values, values + 16);
+
+		out[0] = maxValue;
+		out[1] = minValue;
+
+		uint64_t indices = 0;
+
+		if (maxValue != minValue)
+		{
+			float palette[8];
+			palette[0] = maxValue;
+			palette[1] = minValue;
+
+			for (int i = 2; i < 8; i++)
+				palette[i] = ((8 - i) * maxValue + (i - 1) * minValue) / 7.0f;
+
+			for (int i = 0; i < 16; i++)
+			{
+				uint64_t best = 0;
+				float bestError = FLT_MAX;
+
+				for (uint64_t p = 0; p < 8; p++)
+				{
+					float error = std::abs(values[i] - palette[p]);
+
+					if (error < bestError)
+					{
+						bestError = error;
+						best = p;
+					}
+				}
+
+				indices |= best << (3 * i);
+			}
+		}
+
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+	}
+
+	struct BitWriter
+	{
+		uint8_t* out;
+		uint32_t bit = 0;
+
+		void Write(uint32_t value, uint32_t count)
+		{
+			for (uint32_t i = 0; i < count; i++, bit++)
+			{
+				if (value & (1u << i))
+					out[bit >> 3] |= static_cast<uint8_t>(1u << (bit & 7));
+			}
+		}
+	};
+
+	//7 bit endpoint with the shared p-bit that reconstructs an 8 bit value as (e << 1) | p
+	void QuantizeBC7Endpoint(const glm::vec4& endpoint, glm::ivec4& quantized, int& pBit)
+	{
+		float bestError = FLT_MAX;
+
+		for (int p = 0; p < 2; p++)
+		{
+			glm::ivec4 q;
+			float error = 0.0f;
+
+			for (int c = 0; c < 4; c++)
+			{
+				q[c] = std::clamp(static_cast<int>(std::lround((endpoint[c] - p) / 2.0f)), 0, 127);
+
+				float d = endpoint[c] - static_cast<float>((q[c] << 1) | p);
+				error += d * d;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				quantized = q;
+				pBit = p;
+			}
+		}
+	}
+
+	//BC7 mode 6: one subset, RGBA endpoints and 4 bit indices
+	void EncodeBC7Block(const uint8_t block[16][4], uint8_t* out)
+	{
+		glm::vec4 texels[16];
+
+		for (int i = 0; i < 16; i++)
+			texels[i] = glm::vec4(block[i][0], block[i][1], block[i][2], block[i][3]);
+
+		glm::vec4 minPoint, maxPoint;
+		FitEndpoints(texels, 16, minPoint, maxPoint);
+
+		glm::ivec4 q[2];
+		int pBits[2];
+		QuantizeBC7Endpoint(minPoint, q[0], pBits[0]);
+		QuantizeBC7Endpoint(maxPoint, q[1], pBits[1]);
+
+		glm::ivec4 endpoints[2];
+		endpoints[0] = (q[0] << 1) | pBits[0];
+		endpoints[1] = (q[1] << 1) | pBits[1];
+
+		uint32_t indices[16];
+
+		for (int i = 0; i < 16; i++)
+		{
+			float bestError = FLT_MAX;
+
+			for (uint32_t w = 0; w < 16; w++)
+			{
+				glm::vec4 color = glm::vec4(((64 - BC7_WEIGHTS[w]) * endpoints[0] + BC7_WEIGHTS[w] * endpoints[1] + 32) >> 6);
+				glm::vec4 d = texels[i] - color;
+				float error = glm::dot(d, d);
+
+				if (error < bestError)
+				{
+					bestError = error;
+					indices[i] = w;
+				}
+			}
+		}
+
+		//the anchor index is stored with its top bit implied to be zero
+		if (indices[0] & 8)
+		{
+			std::swap(q[0], q[1]);
+			std::swap(pBits[0], pBits[1]);
+
+			for (int i = 0; i < 16; i++)
+				indices[i] = 15 - indices[i];
+		}
+
+		memset(out, 0, 16);
+
+		BitWriter writer{ out };
+		writer.Write(1u << 6, 7);
+
+		for (int c = 0; c < 4; c++)
+		{
+			writer.Write(q[0][c], 7);
+			writer.Write(q[1][c], 7);
+		}
+
+		writer.Write(pBits[0], 1);
+		writer.Write(pBits[1], 1);
+
+		writer.Write(indices[0], 3);
+
+		for (int i = 1; i < 16; i++)
+			writer.Write(indices[i], 4);
+	}
+
+	size_t BlockSize(CookedTextureFormat format)
+	{
+		return format == CookedTextureFormat::BC1_SRGB ? 8 : 16;
+	}
+
+	bool IsNormalMap(const std::string& texturePath)
+	{
+		std::string lower = texturePath;
+
+		for (char& c : lower)
+			c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+		return lower.find("normal") != std::string::npos;
+	}
+}
+
+std::string TextureCooker::GetCookedPath(const std::string& texturePath)
+{
+	return "cooked/" + std::filesystem::path(texturePath).replace_extension(".utex").generic_string();
+}
+
+std::vector<std::string> TextureCooker::CollectSceneTextures(const std::string& scenePath)
+{
+	std::vector<std::string> texturePaths;
+
+	std::ifstream file(scenePath);
+	json scene = json::parse(file);
+
+	//run the importer only to resolve the material texture references, geometry is discarded
+	for (auto& modelData : scene["assets"]["models"])
+	{
+		Model model;
+		model.name = modelData["name"];
+		model.customMaterialTextures = modelData.contains("customMaterialTextures");
+
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+
+		std::string path = modelData["file"];
+
+		AssetImporter::Get().LoadModelFromFile(path.c_str(), model, vertices, indices, texturePaths);
+	}
+
+	std::ifstream f("config/CustomMaterialTextures.json");
+	json data = json::parse(f);
+
+	for (auto& entry : data["entries"])
+	{
+		std::string texturePath = entry["texturePath"];
+
+		if (std::find(texturePaths.begin(), texturePaths.end(), texturePath) == texturePaths.end())
+		{
+			texturePaths.push_back(texturePath);
+		}
+	}
+
+	return texturePaths;
+}
+
+void TextureCooker::CookTextures(const std::vector<std::string>& texturePaths)
+{
+	int cooked = 0;
+
+	for (const std::string& texturePath : texturePaths)
+	{
+		if (CookTexture(texturePath))
+		{
+			cooked++;
+		}
+	}
+
+	std::cout << "Cooked " << cooked << "/" << texturePaths.size() << " textures" << std::endl;
+}
+
+bool TextureCooker::CookTexture(const std::string& texturePath)
+{
+	int texWidth, texHeight, texChannels;
+	stbi_uc* pixels = stbi_load(texturePath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+
+	if (!pixels)
+	{
+		std::cout << "Failed to load texture for cooking: " << texturePath << std::endl;
+		return false;
+	}
+
+	size_t pixelCount = static_cast<size_t>(texWidth) * texHeight;
+
+	bool hasAlpha = false;
+	bool alphaTested = false;
+
+	for (size_t i = 0; i < pixelCount && !alphaTested; i++)
+	{
+		hasAlpha |= pixels[i * 4 + 3] < 255;
+		alphaTested = pixels[i * 4 + 3] < ALPHA_TEST_CUTOFF;
+	}
+
+	CookedTextureFormat format = CookedTextureFormat::BC1_SRGB;
+
+	if (IsNormalMap(texturePath))
+	{
+		format = CookedTextureFormat::BC5_UNORM;
+	}
+	else if (hasAlpha)
+	{
+		format = preferBC3 ? CookedTextureFormat::BC3_SRGB : CookedTextureFormat::BC7_SRGB;
+	}
+
+	std::vector<std::vector<uint8_t>> mips(1);
+	mips[0].assign(pixels, pixels + pixelCount * 4);
+
+	stbi_image_free(pixels);
+
+	CookedTexture texture;
+	texture.format = format;
+	texture.width = static_cast<uint32_t>(texWidth);
+	texture.height = static_cast<uint32_t>(texHeight);
+	texture.bAlphaTested = alphaTested;
+	texture.mips.push_back(CookedMipLevel{ texture.width, texture.height, 0, 0 });
+
+	GenerateMipChain(mips, texture.mips, format != CookedTextureFormat::BC5_UNORM);
+
+	for (size_t i = 0; i < mips.size(); i++)
+	{
+		std::vector<uint8_t> blocks;
+
+		EncodeMip(mips[i], texture.mips[i].width, texture.mips[i].height, format, blocks);
+
+		texture.mips[i].offset = texture.data.size();
+		texture.mips[i].size = blocks.size();
+
+		texture.data.insert(texture.data.end(), blocks.begin(), blocks.end());
+	}
+
+	std::string cookedPath = GetCookedPath(texturePath);
+
+	std::filesystem::create_directories(std::filesystem::path(cookedPath).parent_path());
+
+	std::ofstream file(cookedPath, std::ios::out | std::ios::binary);
+
+	if (!file.is_open())
+	{
+		std::cout << "Failed to write cooked texture: " << cookedPath << std::endl;
+		return false;
+	}
+
+	CookedTextureHeader header{};
+	memcpy(header.magic, COOKED_TEXTURE_MAGIC, 4);
+	header.version = COOKED_TEXTURE_VERSION;
+	header.format = static_cast<uint32_t>(texture.format);
+	header.width = texture.width;
+	header.height = texture.height;
+	header.mipCount = static_cast<uint32_t>(texture.mips.size());
+	header.alphaTested = texture.bAlphaTested ? 1 : 0;
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(texture.mips.data()), texture.mips.size() * sizeof(CookedMipLevel));
+	file.write(reinterpret_cast<const char*>(texture.data.data()), texture.data.size());
+
+	std::cout << "Cooked " << texturePath << " -> " << cookedPath << " (" << pixelCount * 4 / 1024 << " KB -> " << texture.data.size() / 1024 << " KB, " << texture.mips.size() << " mips)" << std::endl;
+
+	return true;
+}
+
+bool TextureCooker::LoadCookedTexture(const std::string& texturePath, CookedTexture& texture)
+{
+	std::string cookedPath = GetCookedPath(texturePath);
+
+	std::error_code error;
+
+	if (!std::filesystem::exists(cookedPath, error))
+	{
+		return false;
+	}
+
+	if (std::filesystem::exists(texturePath, error) && std::filesystem::last_write_time(texturePath, error) > std::filesystem::last_write_time(cookedPath, error))
+	{
+		std::cout << "Cooked texture is out of date, loading source: " << texturePath << std::endl;
+		return false;
+	}
+
+	std::ifstream file(cookedPath, std::ios::in | std::ios::binary);
+
+	CookedTextureHeader header{};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+	if (!file || memcmp(header.magic, COOKED_TEXTURE_MAGIC, 4) != 0 || header.version != COOKED_TEXTURE_VERSION)
+	{
+		std::cout << "Invalid cooked texture: " << cookedPath << std::endl;
+		return false;
+	}
+
+	//the mip table becomes buffer to image copies, anything that does not describe the full chain of the header's size is rejected
+	uint32_t maxMipCount = 1;
+
+	while (maxMipCount < 32 && (std::max(header.width, header.height) >> maxMipCount) > 0)
+	{
+		maxMipCount++;
+	}
+
+	if (header.format > static_cast<uint32_t>(CookedTextureFormat::BC7_SRGB) || header.width == 0 || header.height == 0
+		|| header.mipCount == 0 || header.mipCount > maxMipCount)
+	{
+		std::cout << "Invalid cooked texture: " << cookedPath << std::endl;
+		return false;
+	}
+
+	texture.format = static_cast<CookedTextureFormat>(header.format);
+	texture.width = header.width;
+	texture.height = header.height;
+	texture.bAlphaTested = header.alphaTested != 0;
+	texture.mips.resize(header.mipCount);
+
+	file.read(reinterpret_cast<char*>(texture.mips.data()), texture.mips.size() * sizeof(CookedMipLevel));
+
+	uint64_t fileSize = std::filesystem::file_size(cookedPath, error);
+
+	uint64_t tableSize = sizeof(CookedTextureHeader) + texture.mips.size() * sizeof(CookedMipLevel);
+
+	if (!file || error || fileSize < tableSize)
+	{
+		std::cout << "Truncated cooked texture: " << cookedPath << std::endl;
+		return false;
+	}
+
+	uint64_t dataSize = fileSize - tableSize;
+
+	size_t blockSize = BlockSize(texture.format);
+
+	for (uint32_t i = 0; i < texture.mips.size(); i++)
+	{
+		const CookedMipLevel& mip = texture.mips[i];
+
+		uint32_t width = std::max(header.width >> i, 1u);
+		uint32_t height = std::max(header.height >> i, 1u);
+
+		uint64_t size = static_cast<uint64_t>((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+
+		if (mip.width != width || mip.height != height || mip.size != size || mip.offset % blockSize != 0 || mip.offset > dataSize || mip.size > dataSize - mip.offset)
+		{
+			std::cout << "Invalid cooked texture: " << cookedPath << std::endl;
+			return false;
+		}
+	}
+
+	texture.data.resize(dataSize);
+	file.read(reinterpret_cast<char*>(texture.data.data()), dataSize);
+
+	if (!file)
+	{
+		std::cout << "Truncated cooked texture: " << cookedPath << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void TextureCooker::GenerateMipChain(std::vector<std::vector<uint8_t>>& mips, std::vector<CookedMipLevel>& levels, bool srgb)
+{
+	float toLinear[256];
+
+	for (int i = 0; i < 256; i++)
+	{
+		toLinear[i] = srgb ? SRGBToLinear(i / 255.0f) : i / 255.0f;
+	}
+
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		const CookedMipLevel& src = levels.back();
+		const std::vector<uint8_t>& srcPixels = mips.back();
+
+		CookedMipLevel dst{ std::max(src.width / 2, 1u), std::max(src.height / 2, 1u), 0, 0 };
+
+		std::vector<uint8_t> dstPixels(static_cast<size_t>(dst.width) * dst.height * 4);
+
+		//2x2 box filter in linear space, the last row/column is reused for odd sizes
+		for (uint32_t y = 0; y < dst.height; y++)
+		{
+			for (uint32_t x = 0; x < dst.width; x++)
+			{
+				uint32_t x0 = std::min(x * 2, src.width - 1);
+				uint32_t x1 = std::min(x * 2 + 1, src.width - 1);
+				uint32_t y0 = std::min(y * 2, src.height - 1);
+				uint32_t y1 = std::min(y * 2 + 1, src.height - 1);
+
+				const uint8_t* p[4] = {
+					&srcPixels[(y0 * src.width + x0) * 4],
+					&srcPixels[(y0 * src.width + x1) * 4],
+					&srcPixels[(y1 * src.width + x0) * 4],
+					&srcPixels[(y1 * src.width + x1) * 4]
+				};
+
+				uint8_t* out = &dstPixels[(y * dst.width + x) * 4];
+
+				for (int c = 0; c < 3; c++)
+				{
+					float sum = toLinear[p[0][c]] + toLinear[p[1][c]] + toLinear[p[2][c]] + toLinear[p[3][c]];
+					float value = sum * 0.25f;
+
+					out[c] = ToByte((srgb ? LinearToSRGB(value) : value) * 255.0f);
+				}
+
+				out[3] = ToByte((p[0][3] + p[1][3] + p[2][3] + p[3][3]) * 0.25f);
+			}
+		}
+
+		levels.push_back(dst);
+		mips.push_back(std::move(dstPixels));
+	}
+}
+
+void TextureCooker::EncodeMip(const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height, CookedTextureFormat format, std::vector<uint8_t>& blocks)
+{
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blocksY = (height + 3) / 4;
+
+	size_t blockSize = BlockSize(format);
+
+	blocks.resize(blocksX * blocksY * blockSize);
+
+	for (uint32_t by = 0; by < blocksY; by++)
+	{
+		for (uint32_t bx = 0; bx < blocksX; bx++)
+		{
+			uint8_t block[16][4];
+			ExtractBlock(pixels.data(), width, height, bx, by, block);
+
+			uint8_t* out = &blocks[(by * blocksX + bx) * blockSize];
+
+			switch (format)
+			{
+			case CookedTextureFormat::BC1_SRGB:
+				EncodeColorBlock(block, out);
+				break;
+			case CookedTextureFormat::BC3_SRGB:
+			{
+				uint8_t alpha[16];
+
+				for (int i = 0; i < 16; i++)
+					alpha[i] = block[i][3];
+
+				EncodeChannelBlock(alpha, out);
+				EncodeColorBlock(block, out + 8);
+				break;
+			}
+			case CookedTextureFormat::BC5_UNORM:
+			{
+				uint8_t red[16];
+				uint8_t green[16];
+
+				for (int i = 0; i < 16; i++)
+				{
+					red[i] = block[i][0];
+					green[i] = block[i][1];
+				}
+
+				EncodeChannelBlock(red, out);
+				EncodeChannelBlock(green, out + 8);
+				break;
+			}
+			case CookedTextureFormat::BC7_SRGB:
+				EncodeBC7Block(block, out);
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "CommonTypes.h"
+
+const uint32_t COOKED_TEXTURE_VERSION = 2;
+
+enum class CookedTextureFormat : uint32_t
+{
+	BC1_SRGB = 0,
+	BC3_SRGB = 1,
+	BC5_UNORM = 2,
+	BC7_SRGB = 3
+};
+
+struct CookedTextureHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipCount;
+	//any texel below ALPHA_TEST_CUTOFF, the alpha formats are also picked for soft alpha
+	uint32_t alphaTested;
+};
+
+struct CookedMipLevel
+{
+	uint32_t width;
+	uint32_t height;
+	//offset of the mip's blocks from the start of the block data
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct CookedTexture
+{
+	CookedTextureFormat format = CookedTextureFormat::BC1_SRGB;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	bool bAlphaTested = false;
+	std::vector<CookedMipLevel> mips;
+	std::vector<uint8_t> data;
+};
+
+//offline encoder that turns the scene's source textures into block compressed mip chains under cooked/
+class TextureCooker
+{
+public:
+	//use BC3 instead of BC7 for textures with alpha
+	bool preferBC3 = false;
+
+	static TextureCooker& Get()
+	{
+		static TextureCooker instance;
+		return instance;
+	}
+
+	static std::string GetCookedPath(const std::string& texturePath);
+
+	//texture paths referenced by the scene's models and by CustomMaterialTextures.json
+	std::vector<std::string> CollectSceneTextures(const std::string& scenePath);
+
+	void CookTextures(const std::vector<std::string>& texturePaths);
+
+	bool CookTexture(const std::string& texturePath);
+
+	//returns false if there is no up to date cooked file for the source texture
+	bool LoadCookedTexture(const std::string& texturePath, CookedTexture& texture);
+
+private:
+	void GenerateMipChain(std::vector<std::vector<uint8_t>>& mips, std::vector<CookedMipLevel>& levels, bool srgb);
+
+	void EncodeMip(const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height, CookedTextureFormat format, std::vector<uint8_t>& blocks);
+};
@@ -0,0 +1,169 @@
+#include "TextureHeap.h"
+
+#include <stdexcept>
+#include <iostream>
+#include <algorithm>
+
+void UTextureHeap::Init(VkDevice device, VkPhysicalDevice physicalDevice, VkSampler sampler, uint32_t framesInFlight)
+{
+    this->device = device;
+    this->sampler = sampler;
+
+    retired.resize(framesInFlight);
+
+    VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &indexingProperties;
+
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    capacity = std::min({ TEXTURE_HEAP_CAPACITY, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+        indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages, indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers });
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = capacity;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorBindingFlags bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+        VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = 1;
+    bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create texture heap descriptor set layout!");
+    }
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = capacity;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create texture heap descriptor pool!");
+    }
+
+    VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountInfo{};
+    variableCountInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+    variableCountInfo.descriptorSetCount = 1;
+    variableCountInfo.pDescriptorCounts = &capacity;
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = &variableCountInfo;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate texture heap descriptor set!");
+    }
+
+    freeSlots.resize(capacity);
+
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        freeSlots[i] = capacity - 1 - i;
+    }
+
+    std::cout << "Texture heap capacity: " << capacity << " textures" << std::endl;
+}
+
+void UTextureHeap::Cleanup()
+{
+    //the device is idle, nothing retired is still in use
+    for (std::vector<RetiredSlot>& frameRetired : retired)
+    {
+        for (RetiredSlot& retiredSlot : frameRetired)
+        {
+            if (retiredSlot.release)
+                retiredSlot.release();
+        }
+
+        frameRetired.clear();
+    }
+
+    vkDestroyDescriptorPool(device, pool, nullptr);
+
+    vkDestroyDescriptorSetLayout(device, layout, nullptr);
+}
+
+void UTextureHeap::BeginFrame(uint32_t frameIndex)
+{
+    currentFrame = frameIndex;
+
+    for (RetiredSlot& retiredSlot : retired[frameIndex])
+    {
+        if (retiredSlot.release)
+            retiredSlot.release();
+
+        freeSlots.insert(std::lower_bound(freeSlots.begin(), freeSlots.end(), retiredSlot.slot, std::greater<uint32_t>()), retiredSlot.slot);
+
+        usedCount--;
+    }
+
+    retired[frameIndex].clear();
+}
+
+uint32_t UTextureHeap::Allocate(VkImageView view)
+{
+    if (freeSlots.empty())
+    {
+        return TEXTURE_HEAP_INVALID_SLOT;
+    }
+
+    uint32_t slot = freeSlots.back();
+    freeSlots.pop_back();
+
+    usedCount++;
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = view;
+    imageInfo.sampler = sampler;
+
+    //the slot is unused by every pending frame, so it may be written while the set is bound
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = 0;
+    write.dstArrayElement = slot;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.descriptorCount = 1;
+    write.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+    return slot;
+}
+
+void UTextureHeap::Free(uint32_t slot, std::function<void()>&& release)
+{
+    if (slot >= capacity)
+    {
+        throw std::runtime_error("Texture heap slot out of range!");
+    }
+
+    //frames in flight may still sample the slot, it is released when this frame slot comes around again
+    retired[currentFrame].push_back({ slot, std::move(release) });
+}
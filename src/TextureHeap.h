@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+
+#include "vulkan/vulkan.h"
+
+//upper bound on heap slots, the device limits for update after bind samplers may lower it
+const uint32_t TEXTURE_HEAP_CAPACITY = 16384;
+
+const uint32_t TEXTURE_HEAP_INVALID_SLOT = ~0u;
+
+//one global set holding a variable sized, partially bound array of sampled textures
+//slots are written the moment they are allocated, update after bind lets that happen while the set is bound by frames in flight
+//freed slots are only reused once every frame that could still read them has finished
+class UTextureHeap
+{
+public:
+    void Init(VkDevice device, VkPhysicalDevice physicalDevice, VkSampler sampler, uint32_t framesInFlight);
+
+    void Cleanup();
+
+    //returns what this frame slot freed to the free list, its fence must have been waited on
+    void BeginFrame(uint32_t frameIndex);
+
+    //writes view into the lowest free slot, TEXTURE_HEAP_INVALID_SLOT when the heap is full
+    uint32_t Allocate(VkImageView view);
+
+    //the slot must no longer be referenced by draws recorded from now on
+    //release runs once the GPU is done with the slot, streamed textures destroy their image and view there
+    void Free(uint32_t slot, std::function<void()>&& release = nullptr);
+
+    VkDescriptorSetLayout GetLayout() const { return layout; }
+
+    VkDescriptorSet GetSet() const { return set; }
+
+    uint32_t GetCapacity() const { return capacity; }
+
+    uint32_t GetUsedCount() const { return usedCount; }
+
+private:
+    struct RetiredSlot
+    {
+        uint32_t slot;
+        std::function<void()> release;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+
+    VkSampler sampler = VK_NULL_HANDLE;
+
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+
+    VkDescriptorSet set = VK_NULL_HANDLE;
+
+    uint32_t capacity = 0;
+
+    uint32_t usedCount = 0;
+
+    uint32_t currentFrame = 0;
+
+    //sorted descending so the lowest slot is popped from the back
+    std::vector<uint32_t> freeSlots;
+
+    std::vector<std::vector<RetiredSlot>> retired;
+};
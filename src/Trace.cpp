@@ -0,0 +1,134 @@
+#include "Trace.h"
+
+#include "JobSystem.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+namespace
+{
+	const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+	thread_local void* threadBuffer = nullptr;
+
+	void WriteJsonString(std::ofstream& file, const char* text)
+	{
+		file << '"';
+
+		for (const char* c = text; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+				file << '\\';
+
+			file << *c;
+		}
+
+		file << '"';
+	}
+}
+
+uint64_t Trace::Now()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count());
+}
+
+Trace::ThreadBuffer* Trace::GetThreadBuffer()
+{
+	if (threadBuffer)
+		return static_cast<ThreadBuffer*>(threadBuffer);
+
+	//first event of this thread, the only time recording locks
+	std::unique_ptr<ThreadBuffer> buffer = std::make_unique<ThreadBuffer>();
+	buffer->threadIndex = JobSystem::GetThreadIndex();
+	buffer->events.resize(TRACE_RING_SIZE);
+
+	threadBuffer = buffer.get();
+
+	std::lock_guard<std::mutex> lock(buffersMutex);
+	buffers.push_back(std::move(buffer));
+
+	return static_cast<ThreadBuffer*>(threadBuffer);
+}
+
+void Trace::Record(const char* name, uint64_t startNs, uint64_t endNs)
+{
+	ThreadBuffer* buffer = GetThreadBuffer();
+
+	uint64_t index = buffer->writeCount.load(std::memory_order_relaxed);
+
+	buffer->events[index % TRACE_RING_SIZE] = { name, startNs, endNs };
+
+	buffer->writeCount.store(index + 1, std::memory_order_release);
+}
+
+void Trace::EndFrame(bool bDumpRequested)
+{
+	frameCount++;
+
+	if (bDumpRequested || (dumpAfterFrames > 0 && frameCount == dumpAfterFrames))
+	{
+		WriteChromeTrace(outputPath);
+	}
+}
+
+void Trace::WriteChromeTrace(const std::string& path)
+{
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+
+	if (!file.is_open())
+	{
+		//a dump is a debugging aid, failing to write one must not take the frame down
+		std::cout << "Failed to open trace file: " << path << std::endl;
+		return;
+	}
+
+	file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+	bool bFirst = true;
+
+	size_t eventCount = 0;
+
+	std::lock_guard<std::mutex> lock(buffersMutex);
+
+	for (const std::unique_ptr<ThreadBuffer>& buffer : buffers)
+	{
+		if (!bFirst)
+			file << ",";
+
+		bFirst = false;
+
+		//thread name metadata
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadIndex << ",\"args\":{\"name\":\"";
+
+		if (buffer->threadIndex == 0)
+			file << "Main";
+		else
+			file << "Worker " << buffer->threadIndex;
+
+		file << "\"}}";
+
+		uint64_t writeCount = buffer->writeCount.load(std::memory_order_acquire);
+
+		uint64_t first = writeCount > TRACE_RING_SIZE ? writeCount - TRACE_RING_SIZE : 0;
+
+		for (uint64_t i = first; i < writeCount; i++)
+		{
+			const TraceEvent& event = buffer->events[i % TRACE_RING_SIZE];
+
+			//complete events, timestamps in microseconds
+			file << ",{\"name\":";
+			WriteJsonString(file, event.name);
+			file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadIndex
+				<< ",\"ts\":" << event.startNs / 1000 << "." << event.startNs % 1000 / 100
+				<< ",\"dur\":" << (event.endNs - event.startNs) / 1000 << "." << (event.endNs - event.startNs) % 1000 / 100 << "}";
+		}
+
+		eventCount += static_cast<size_t>(writeCount - first);
+	}
+
+	file << "]}" << std::endl;
+
+	std::cout << "Wrote " << eventCount << " trace events to " << path << std::endl;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+//define UTRACE_ENABLED as 0 to compile every marker out
+#ifndef UTRACE_ENABLED
+#define UTRACE_ENABLED 1
+#endif
+
+//events kept per thread, older ones are overwritten
+const uint32_t TRACE_RING_SIZE = 1 << 16;
+
+struct TraceEvent
+{
+	//string literal, only the pointer is stored
+	const char* name;
+	uint64_t startNs;
+	uint64_t endNs;
+};
+
+//CPU zone recorder, every thread writes into its own ring so recording takes no lock
+//the rings are written out as Chrome trace event JSON, which chrome://tracing and Perfetto open
+class Trace
+{
+public:
+	static Trace& Get()
+	{
+		static Trace instance;
+		return instance;
+	}
+
+	Trace(const Trace&) = delete;
+	Trace& operator=(const Trace&) = delete;
+
+	//write the trace once this many frames have ended, 0 disables
+	uint32_t dumpAfterFrames = 0;
+
+	std::string outputPath = "trace.json";
+
+	//nanoseconds since the first call
+	static uint64_t Now();
+
+	void Record(const char* name, uint64_t startNs, uint64_t endNs);
+
+	//called by the main loop between frames while no jobs are running
+	void EndFrame(bool bDumpRequested);
+
+	void WriteChromeTrace(const std::string& path);
+
+private:
+	struct ThreadBuffer
+	{
+		uint32_t threadIndex = 0;
+		std::vector<TraceEvent> events;
+		//total events written, the ring position is writeCount % TRACE_RING_SIZE
+		std::atomic<uint64_t> writeCount{ 0 };
+	};
+
+	Trace() = default;
+
+	ThreadBuffer* GetThreadBuffer();
+
+	std::mutex buffersMutex;
+
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+	uint64_t frameCount = 0;
+};
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name) : name(name), startNs(Trace::Now()) {}
+
+	~TraceScope()
+	{
+		Trace::Get().Record(name, startNs, Trace::Now());
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* name;
+	uint64_t startNs;
+};
+
+#if UTRACE_ENABLED
+#define UTRACE_CONCAT_INNER(a, b) a##b
+#define UTRACE_CONCAT(a, b) UTRACE_CONCAT_INNER(a, b)
+//times the rest of the enclosing block, name must be a string literal
+#define UTRACE_SCOPE(name) TraceScope UTRACE_CONCAT(traceScope, __LINE__)(name)
+#define UTRACE_FUNCTION() UTRACE_SCOPE(__FUNCTION__)
+#define UTRACE_END_FRAME(bDumpRequested) Trace::Get().EndFrame(bDumpRequested)
+#else
+#define UTRACE_SCOPE(name)
+#define UTRACE_FUNCTION()
+#define UTRACE_END_FRAME(bDumpRequested)
+#endif